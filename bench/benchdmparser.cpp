@@ -0,0 +1,400 @@
+/***************************************************************************
+    benchdmparser.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// 解析処理とジオメトリ作成のマイクロベンチマーク
+//
+// 固定の入力に対して各関数を繰り返し呼び出し、1回あたりの時間(ns/op)と
+// ヒープ確保回数(allocs/op)を出力する。繰り返し回数はDM_BENCH_ITERATIONS
+// （既定 100000）で変更できる。
+
+#include "dmalloccounter.h"
+#include "dmbenchutils.h"
+#include "dmgenerator.h"
+
+#include "qgsapplication.h"
+#include "qgsdmboxfilter.h"
+#include "qgsdmfile.h"
+#include "qgsdmprovider.h"
+#include "qgsgeometry.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextCodec>
+#include <QtTest/QtTest>
+
+#include <random>
+
+class BenchDmParser : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+
+    void benchmarkExtractField();
+    void benchmarkExtractInt();
+    void benchmarkExtract2dCoords();
+    void benchmarkExtract3dCoords();
+    void benchmarkMesh();
+    void benchmarkCircleCenterAndRadius();
+    void benchmarkArcAngles();
+    void benchmarkNote_data();
+    void benchmarkNote();
+    void benchmarkCreateGeometry_data();
+    void benchmarkCreateGeometry();
+    void benchmarkFetchAttribute_data();
+    void benchmarkFetchAttribute();
+    void benchmarkBoxFilter_data();
+    void benchmarkBoxFilter();
+
+  private:
+    // 1回分の処理を繰り返して ns/op と allocs/op を出力する
+    template<class Function>
+    void measure( const QString &name, Function function );
+
+    static QByteArray record( const char *recordType, const QList< QPair< int, QByteArray > > &fields );
+    static DmRows rows( const QVector<DmRow> &rowList ) { return DmRows( rowList.constData(), rowList.count() ); }
+
+    int mIterations = 100000;
+    // 最適化で処理が省かれないようにする
+    volatile double mSink = 0;
+
+    QByteArrayList mElement2dRecords;
+    QByteArrayList mElement3dRecords;
+    QByteArrayList mMeshRecords;
+    QByteArrayList mNoteRecords;
+    QVector<DmRow> mElement2dRows;
+    QVector<DmRow> mElement3dRows;
+    QVector<DmRow> mMeshRows;
+    QVector<DmRow> mNoteRows;
+    DmMesh mMesh;
+
+    QVector<Point2d> mPolygonPoints;
+    QVector<Point2d> mArcPoints;
+
+    QTemporaryDir mTempDir;
+    std::unique_ptr<QgsDmFile> mNoteFile;
+
+    // 要素の範囲の配列（BOX_COUNT要素）
+    static const int BOX_COUNT = 4096;
+    QVector<double> mBoxXMin;
+    QVector<double> mBoxYMin;
+    QVector<double> mBoxXMax;
+    QVector<double> mBoxYMax;
+};
+
+QByteArray BenchDmParser::record( const char *recordType, const QList< QPair< int, QByteArray > > &fields )
+{
+  QByteArray line( 84, ' ' );
+  line.replace( 0, 2, recordType );
+  for ( const QPair< int, QByteArray > &field : fields )
+    line.replace( field.first, field.second.size(), field.second );
+  return line;
+}
+
+template<class Function>
+void BenchDmParser::measure( const QString &name, Function function )
+{
+  // 暖機（初回のみの確保を除く）
+  for ( int i = 0; i < qMin( mIterations, 1000 ); i++ )
+    function();
+
+  qint64 allocationsBefore = DmBench::allocationCount();
+  QElapsedTimer timer;
+  timer.start();
+  for ( int i = 0; i < mIterations; i++ )
+    function();
+  qint64 nsecs = timer.nsecsElapsed();
+  qint64 allocations = DmBench::allocationCount() - allocationsBefore;
+
+  double nsPerOp = static_cast<double>( nsecs ) / mIterations;
+  double allocationsPerOp = static_cast<double>( allocations ) / mIterations;
+  qInfo( "%-36s %10.1f ns/op %8.2f allocs/op%s", qPrintable( name ), nsPerOp, allocationsPerOp,
+         DmBench::allocationCountIncludesMalloc() ? "" : " (operator new only)" );
+  QTest::setBenchmarkResult( nsPerOp, QTest::WalltimeNanoseconds );
+}
+
+void BenchDmParser::initTestCase()
+{
+  mIterations = qMax( 1, DmBench::envInt( "DM_BENCH_ITERATIONS", 100000 ) );
+
+  // 線（2次元、16点、3レコード）
+  mElement2dRecords << record( "E2", { { 2, "2101" }, { 18, "01" }, { 20, "2" }, { 24, "00" }, { 26, "0" }, { 27, "  16" }, { 31, "   3" } } );
+  for ( int r = 0; r < 3; r++ )
+  {
+    QList< QPair< int, QByteArray > > fields;
+    for ( int i = 0; i < 6 && r * 6 + i < 16; i++ )
+    {
+      int n = r * 6 + i;
+      fields << qMakePair( i * 14, QByteArray::number( 100000 + n * 1234 ).rightJustified( 7 ) );
+      fields << qMakePair( i * 14 + 7, QByteArray::number( 200000 + n * 987 ).rightJustified( 7 ) );
+    }
+    mElement2dRecords << record( "  ", fields );
+  }
+
+  // 面（3次元、8点、2レコード）
+  mElement3dRecords << record( "E1", { { 2, "3101" }, { 18, "01" }, { 20, "3" }, { 24, "00" }, { 26, "0" }, { 27, "   8" }, { 31, "   2" } } );
+  for ( int r = 0; r < 2; r++ )
+  {
+    QList< QPair< int, QByteArray > > fields;
+    for ( int i = 0; i < 4; i++ )
+    {
+      int n = r * 4 + i;
+      fields << qMakePair( i * 21, QByteArray::number( 100000 + n * 1234 ).rightJustified( 7 ) );
+      fields << qMakePair( i * 21 + 7, QByteArray::number( 200000 + n * 987 ).rightJustified( 7 ) );
+      fields << qMakePair( i * 21 + 14, QByteArray::number( 5000 + n * 10 ).rightJustified( 7 ) );
+    }
+    mElement3dRecords << record( "  ", fields );
+  }
+
+  // 図郭レコード(a)～(e)
+  mMeshRecords << record( "M ", { { 30, "  500" }, { 65, " 0" } } )
+               << record( "  ", { { 0, " -60000" }, { 7, " -20000" }, { 14, " -59700" }, { 21, " -19600" }, { 44, "  1" } } )
+               << record( "  ", {} )
+               << record( "  ", { { 9, "0" } } )
+               << record( "  ", { { 40, "   0" }, { 44, "   0" }, { 48, "   0" }, { 52, "   0" } } );
+
+  // 注記（全角8文字）
+  QTextCodec *codec = QTextCodec::codecForName( "Shift-JIS" );
+  QVERIFY( codec );
+  const QByteArray noteText = codec->fromUnicode( QStringLiteral( u"地図道路河川山田" ) );
+  mNoteRecords << record( "E7", { { 2, "7101" }, { 20, "2" }, { 23, "1" }, { 24, "00" }, { 27, "   8" }, { 31, "   1" }, { 35, " 150000" }, { 42, " 200000" } } )
+               << record( "  ", { { 0, "0" }, { 1, "     45" }, { 8, "   30" }, { 20, noteText } } );
+
+  for ( const QByteArray &line : qAsConst( mElement2dRecords ) )
+    mElement2dRows << DmRow( line );
+  for ( const QByteArray &line : qAsConst( mElement3dRecords ) )
+    mElement3dRows << DmRow( line );
+  for ( const QByteArray &line : qAsConst( mMeshRecords ) )
+    mMeshRows << DmRow( line );
+  for ( const QByteArray &line : qAsConst( mNoteRecords ) )
+    mNoteRows << DmRow( line );
+
+  mMesh = DmMesh( rows( mMeshRows ), 0, QList<int>() << 0 );
+
+  // 面の頂点（16点）
+  for ( int i = 0; i < 16; i++ )
+  {
+    double angle = 2.0 * M_PI * i / 16;
+    mPolygonPoints << Point2d( 100.0 + 10.0 * qCos( angle ), 200.0 + 10.0 * qSin( angle ) );
+  }
+  mArcPoints << Point2d( 110.0, 200.0 ) << Point2d( 100.0, 210.0 ) << Point2d( 90.0, 200.0 );
+
+  // fetchAttribute用のデータ（1図郭の注記）
+  QVERIFY( mTempDir.isValid() );
+  DmGenerator::Options options;
+  options.meshCount = 1;
+  DmGenerator generator( options );
+  QVERIFY( generator.generate( mTempDir.path() ) );
+  QUrl url = QUrl::fromLocalFile( mTempDir.path() );
+  url.setQuery( QStringLiteral( "dataType=dm_tx" ) );
+  mNoteFile.reset( new QgsDmFile( QString::fromLatin1( url.toEncoded() ) ) );
+  QVERIFY( mNoteFile->read() );
+  QVERIFY( mNoteFile->recordCount() > 0 );
+
+  // 要素の範囲（1000x1000の範囲に最大20の大きさ）
+  std::mt19937 random( 1 );
+  for ( int i = 0; i < BOX_COUNT; i++ )
+  {
+    const double x = random() % 1000;
+    const double y = random() % 1000;
+    mBoxXMin << x;
+    mBoxYMin << y;
+    mBoxXMax << x + random() % 20;
+    mBoxYMax << y + random() % 20;
+  }
+}
+
+void BenchDmParser::benchmarkExtractField()
+{
+  const DmRow header = mElement2dRows.at( 0 );
+  measure( QStringLiteral( "extractField" ), [&]
+  {
+    mSink = extractField( header, true, 2, 4 ).size();
+  } );
+}
+
+void BenchDmParser::benchmarkExtractInt()
+{
+  const DmRow header = mElement2dRows.at( 0 );
+  measure( QStringLiteral( "extractInt" ), [&]
+  {
+    mSink = extractInt( header, 2, 4 );
+  } );
+}
+
+void BenchDmParser::benchmarkExtract2dCoords()
+{
+  DmArena arena;
+  const DmRows elementRows = rows( mElement2dRows );
+  measure( QStringLiteral( "DmElement::extract2dCoords (16 pts)" ), [&]
+  {
+    DmElement element;
+    element.extract2dCoords( elementRows, mMesh, arena, 3, 16 );
+    mSink = element.points().count();
+    // アリーナはチャンク単位で確保するので、一定量ごとに解放する
+    if ( arena.bytesAllocated() > DmArena::DEFAULT_CHUNK_SIZE / 2 )
+      arena.clear();
+  } );
+}
+
+void BenchDmParser::benchmarkExtract3dCoords()
+{
+  DmArena arena;
+  const DmRows elementRows = rows( mElement3dRows );
+  measure( QStringLiteral( "DmElement::extract3dCoords (8 pts)" ), [&]
+  {
+    DmElement element;
+    element.extract3dCoords( elementRows, mMesh, arena, 2, 8 );
+    mSink = element.points().count();
+    if ( arena.bytesAllocated() > DmArena::DEFAULT_CHUNK_SIZE / 2 )
+      arena.clear();
+  } );
+}
+
+void BenchDmParser::benchmarkMesh()
+{
+  const DmRows meshRows = rows( mMeshRows );
+  const QList<int> courseCounts = QList<int>() << 0;
+  measure( QStringLiteral( "DmMesh" ), [&]
+  {
+    DmMesh mesh( meshRows, 0, courseCounts );
+    mSink = mesh.originPoint().x();
+  } );
+}
+
+void BenchDmParser::benchmarkCircleCenterAndRadius()
+{
+  const DmCoords points( mArcPoints.constData(), mArcPoints.count() );
+  measure( QStringLiteral( "calculateCircleCenterAndRadius" ), [&]
+  {
+    Point2d center;
+    double radius = 0;
+    calculateCircleCenterAndRadius( points, center, radius );
+    mSink = radius;
+  } );
+}
+
+void BenchDmParser::benchmarkArcAngles()
+{
+  DmArc arc;
+  measure( QStringLiteral( "DmArc::calculateArcAngles (90 deg)" ), [&]
+  {
+    mSink = arc.calculateArcAngles( 0.0, 45.0, 90.0 ).count();
+  } );
+}
+
+void BenchDmParser::benchmarkNote_data()
+{
+  QTest::addColumn<bool>( "pooled" );
+  QTest::newRow( "pooled" ) << true;
+  QTest::newRow( "decode" ) << false;
+}
+
+void BenchDmParser::benchmarkNote()
+{
+  QFETCH( bool, pooled );
+
+  // pooled: 登録済みの注記（繰り返し現れる注記）
+  // decode: 毎回プールを空にしてShift-JISからデコードする
+  DmArena arena;
+  DmTextPool pool;
+  const DmRows noteRows = rows( mNoteRows );
+  measure( QStringLiteral( "DmNote (%1)" ).arg( pooled ? QStringLiteral( "pooled" ) : QStringLiteral( "decode" ) ), [&]
+  {
+    if ( !pooled )
+      pool.clear();
+    DmNote note( noteRows, mMesh, arena, pool );
+    mSink = note.textHandle();
+    if ( arena.bytesAllocated() > DmArena::DEFAULT_CHUNK_SIZE / 2 )
+      arena.clear();
+  } );
+}
+
+void BenchDmParser::benchmarkCreateGeometry_data()
+{
+  QTest::addColumn<int>( "geometryType" );
+  QTest::newRow( "point" ) << static_cast<int>( QgsWkbTypes::PointGeometry );
+  QTest::newRow( "line" ) << static_cast<int>( QgsWkbTypes::LineGeometry );
+  QTest::newRow( "polygon" ) << static_cast<int>( QgsWkbTypes::PolygonGeometry );
+}
+
+void BenchDmParser::benchmarkCreateGeometry()
+{
+  QFETCH( int, geometryType );
+
+  const DmCoords points( mPolygonPoints.constData(), mPolygonPoints.count() );
+  const QgsWkbTypes::GeometryType type = static_cast<QgsWkbTypes::GeometryType>( geometryType );
+  measure( QStringLiteral( "QgsDmProvider::createGeometry (%1)" ).arg( QgsWkbTypes::geometryDisplayString( type ) ), [&]
+  {
+    QgsGeometry geom;
+    QgsDmProvider::createGeometry( type, points, geom );
+    mSink = geom.isNull() ? 0 : 1;
+  } );
+}
+
+void BenchDmParser::benchmarkFetchAttribute_data()
+{
+  QTest::addColumn<QString>( "fieldName" );
+  QTest::newRow( "dmcode" ) << QStringLiteral( "dmcode" );
+  QTest::newRow( "vtext" ) << QStringLiteral( "vtext" );
+}
+
+void BenchDmParser::benchmarkFetchAttribute()
+{
+  QFETCH( QString, fieldName );
+
+  long count = mNoteFile->recordCount();
+  long recordId = 0;
+  measure( QStringLiteral( "QgsDmFile::fetchAttribute (%1)" ).arg( fieldName ), [&]
+  {
+    recordId = recordId % count + 1;
+    mSink = mNoteFile->fetchAttribute( fieldName, recordId ).isValid() ? 1 : 0;
+  } );
+}
+
+void BenchDmParser::benchmarkBoxFilter_data()
+{
+  QTest::addColumn<int>( "kernel" );
+  for ( DmBoxFilter::Kernel kernel : { DmBoxFilter::Scalar, DmBoxFilter::Sse2, DmBoxFilter::Avx } )
+  {
+    if ( DmBoxFilter::isSupported( kernel ) )
+      QTest::newRow( DmBoxFilter::kernelName( kernel ) ) << static_cast<int>( kernel );
+  }
+}
+
+void BenchDmParser::benchmarkBoxFilter()
+{
+  QFETCH( int, kernel );
+
+  // 1%程度の要素を選ぶ矩形
+  const DmRect rect( 400.0, 400.0, 500.0, 500.0 );
+  QVector<int> indexes;
+  indexes.reserve( BOX_COUNT );
+  measure( QStringLiteral( "DmBoxFilter::select (%1, %2 elements)" ).arg( DmBoxFilter::kernelName( static_cast<DmBoxFilter::Kernel>( kernel ) ) ).arg( BOX_COUNT ), [&]
+  {
+    indexes.clear();
+    DmBoxFilter::select( static_cast<DmBoxFilter::Kernel>( kernel ), mBoxXMin.constData(), mBoxYMin.constData(), mBoxXMax.constData(), mBoxYMax.constData(),
+                         0, BOX_COUNT, rect, indexes );
+    mSink = indexes.size();
+  } );
+}
+
+int main( int argc, char *argv[] )
+{
+  QgsApplication app( argc, argv, false );
+  QgsApplication::init();
+  QgsApplication::initQgis();
+
+  BenchDmParser bench;
+  int result = QTest::qExec( &bench, argc, argv );
+
+  QgsApplication::exitQgis();
+  return result;
+}
+
+#include "benchdmparser.moc"
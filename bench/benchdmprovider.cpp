@@ -0,0 +1,411 @@
+/***************************************************************************
+    benchdmprovider.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// DMプロバイダのエンドツーエンドのベンチマーク
+//
+// 生成したDMディレクトリに対して読込速度(MB/s)、scanFileの時間、
+// 全件走査の地物数/秒、空間検索の応答時間の分位点、最大メモリ使用量を計測する。
+// 実行計画のベンチマークは索引の有無ごとに選ばれた計画と応答時間を出力し、見積もりの確認に使う。
+// データ量は環境変数で変更できる（DM_BENCH_MESHES等、initTestCase()を参照）。
+// DM_BENCH_DIRを指定した場合は生成せずにそのディレクトリを使用する。
+
+#include "dmbenchutils.h"
+#include "dmgenerator.h"
+
+#include "qgsapplication.h"
+#include "qgsdmfile.h"
+#include "qgsdmmemory.h"
+#include "qgsdmprovider.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QUrlQuery>
+#include <QtTest/QtTest>
+
+#include <limits>
+#include <random>
+
+class BenchDmProvider : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+    void cleanupTestCase();
+
+    void benchmarkRead_data();
+    void benchmarkRead();
+    void benchmarkScanFile_data();
+    void benchmarkScanFile();
+    void benchmarkIterate_data();
+    void benchmarkIterate();
+    void benchmarkSpatialQuery_data();
+    void benchmarkSpatialQuery();
+    void benchmarkPlanner_data();
+    void benchmarkPlanner();
+    void benchmarkSetSubset_data();
+    void benchmarkSetSubset();
+
+  private:
+    QString uri( const QString &dataType, const QString &extra = QString() ) const;
+    void addDataTypeRows();
+    void reportMemory( const QString &name ) const;
+
+    QTemporaryDir mTempDir;
+    QString mDirPath;
+    int mIterations = 3;
+    int mQueries = 200;
+};
+
+void BenchDmProvider::initTestCase()
+{
+  mIterations = qMax( 1, DmBench::envInt( "DM_BENCH_ITERATIONS", 3 ) );
+  mQueries = qMax( 1, DmBench::envInt( "DM_BENCH_QUERIES", 200 ) );
+
+  mDirPath = qEnvironmentVariable( "DM_BENCH_DIR" );
+  if ( !mDirPath.isEmpty() )
+  {
+    qInfo( "using %s", qPrintable( mDirPath ) );
+    return;
+  }
+
+  DmGenerator::Options options;
+  options.meshCount = DmBench::envInt( "DM_BENCH_MESHES", 16 );
+  options.meshesPerFile = DmBench::envInt( "DM_BENCH_MESHES_PER_FILE", 4 );
+  options.verticesPerElement = DmBench::envInt( "DM_BENCH_VERTICES", options.verticesPerElement );
+  options.noteLength = DmBench::envInt( "DM_BENCH_NOTE_LENGTH", options.noteLength );
+  options.use3d = DmBench::envInt( "DM_BENCH_3D", 0 ) != 0;
+  options.revisionCount = DmBench::envInt( "DM_BENCH_REVISIONS", 0 );
+  options.seed = static_cast<quint32>( DmBench::envInt( "DM_BENCH_SEED", 1 ) );
+  const QString elements = qEnvironmentVariable( "DM_BENCH_ELEMENTS" );
+  if ( !elements.isEmpty() )
+    QVERIFY2( DmGenerator::parseElementCounts( elements, options ), qPrintable( elements ) );
+
+  QVERIFY( mTempDir.isValid() );
+  mDirPath = mTempDir.path();
+
+  DmGenerator generator( options );
+  QString error;
+  QVERIFY2( generator.generate( mDirPath, &error ), qPrintable( error ) );
+  qInfo( "generated %d files, %s, %d meshes", generator.filePaths().count(),
+         qPrintable( DmMemory::mebibytes( generator.bytesWritten() ) ), options.meshCount );
+  reportMemory( QStringLiteral( "initTestCase" ) );
+}
+
+void BenchDmProvider::cleanupTestCase()
+{
+  reportMemory( QStringLiteral( "cleanupTestCase" ) );
+}
+
+QString BenchDmProvider::uri( const QString &dataType, const QString &extra ) const
+{
+  QUrl url = QUrl::fromLocalFile( mDirPath );
+  QUrlQuery query;
+  if ( !dataType.isEmpty() )
+    query.addQueryItem( QStringLiteral( "dataType" ), dataType );
+  query.addQueryItem( QStringLiteral( "quiet" ), QStringLiteral( "yes" ) );
+  if ( !extra.isEmpty() )
+  {
+    const QStringList items = extra.split( '&' );
+    for ( const QString &item : items )
+      query.addQueryItem( item.section( '=', 0, 0 ), item.section( '=', 1 ) );
+  }
+  url.setQuery( query );
+  return QString::fromLatin1( url.toEncoded() );
+}
+
+void BenchDmProvider::addDataTypeRows()
+{
+  QTest::addColumn<QString>( "dataType" );
+  for ( int i = 0; i < DmGenerator::ElementTypeCount; i++ )
+  {
+    const QString dataType = DmGenerator::dataType( static_cast<DmGenerator::ElementType>( i ) );
+    QTest::newRow( qPrintable( dataType ) ) << dataType;
+  }
+}
+
+void BenchDmProvider::reportMemory( const QString &name ) const
+{
+  qInfo( "%s: peak memory %s", qPrintable( name ), qPrintable( DmMemory::mebibytes( DmMemory::peakBytes() ) ) );
+}
+
+void BenchDmProvider::benchmarkRead_data()
+{
+  addDataTypeRows();
+  QTest::newRow( "all" ) << QString();
+}
+
+void BenchDmProvider::benchmarkRead()
+{
+  QFETCH( QString, dataType );
+
+  qint64 bestNsecs = std::numeric_limits<qint64>::max();
+  qint64 bytes = 0;
+  long elements = 0;
+  for ( int i = 0; i < mIterations; i++ )
+  {
+    QgsDmFile file( uri( dataType ) );
+    QElapsedTimer timer;
+    timer.start();
+    QVERIFY( file.read() );
+    bestNsecs = qMin( bestNsecs, timer.nsecsElapsed() );
+    bytes = file.totalBytes();
+    elements = file.elementsDecoded();
+  }
+
+  double seconds = qMax( bestNsecs, qint64( 1 ) ) / 1e9;
+  qInfo( "read %s: %.1f MB/s, %.0f elements/s (%.2f ms)", qPrintable( dataType.isEmpty() ? QStringLiteral( "all" ) : dataType ),
+         bytes / seconds / 1e6, elements / seconds, bestNsecs / 1e6 );
+  QTest::setBenchmarkResult( bytes / seconds, QTest::BytesPerSecond );
+  reportMemory( QStringLiteral( "read" ) );
+}
+
+void BenchDmProvider::benchmarkScanFile_data()
+{
+  addDataTypeRows();
+}
+
+void BenchDmProvider::benchmarkScanFile()
+{
+  QFETCH( QString, dataType );
+
+  // プロバイダの作成時に読込とscanFileが行われる
+  qint64 bestNsecs = std::numeric_limits<qint64>::max();
+  long features = 0;
+  for ( int i = 0; i < mIterations; i++ )
+  {
+    QElapsedTimer timer;
+    timer.start();
+    QgsDmProvider provider( uri( dataType ), QgsDataProvider::ProviderOptions() );
+    bestNsecs = qMin( bestNsecs, timer.nsecsElapsed() );
+    QVERIFY( provider.isValid() );
+    features = provider.featureCount();
+  }
+
+  qInfo( "scanFile %s: %.2f ms, %ld features", qPrintable( dataType ), bestNsecs / 1e6, features );
+  QTest::setBenchmarkResult( bestNsecs / 1e6, QTest::WalltimeMilliseconds );
+  reportMemory( QStringLiteral( "scanFile" ) );
+}
+
+void BenchDmProvider::benchmarkIterate_data()
+{
+  addDataTypeRows();
+}
+
+void BenchDmProvider::benchmarkIterate()
+{
+  QFETCH( QString, dataType );
+
+  QgsDmProvider provider( uri( dataType ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+
+  qint64 bestNsecs = std::numeric_limits<qint64>::max();
+  long count = 0;
+  for ( int i = 0; i < mIterations; i++ )
+  {
+    QElapsedTimer timer;
+    timer.start();
+    QgsFeatureIterator it = provider.getFeatures( QgsFeatureRequest() );
+    QgsFeature feature;
+    count = 0;
+    while ( it.nextFeature( feature ) )
+      count++;
+    bestNsecs = qMin( bestNsecs, timer.nsecsElapsed() );
+  }
+  QCOMPARE( count, provider.featureCount() );
+
+  double seconds = qMax( bestNsecs, qint64( 1 ) ) / 1e9;
+  qInfo( "iterate %s: %.0f features/s (%ld features, %.2f ms)", qPrintable( dataType ), count / seconds, count, bestNsecs / 1e6 );
+  QTest::setBenchmarkResult( count / seconds, QTest::Events );
+  reportMemory( QStringLiteral( "iterate" ) );
+}
+
+void BenchDmProvider::benchmarkSpatialQuery_data()
+{
+  QTest::addColumn<QString>( "dataType" );
+  QTest::addColumn<bool>( "spatialIndex" );
+  for ( int i = 0; i < DmGenerator::ElementTypeCount; i++ )
+  {
+    const QString dataType = DmGenerator::dataType( static_cast<DmGenerator::ElementType>( i ) );
+    QTest::newRow( qPrintable( dataType ) ) << dataType << false;
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " indexed" ) ) ) << dataType << true;
+  }
+}
+
+void BenchDmProvider::benchmarkSpatialQuery()
+{
+  QFETCH( QString, dataType );
+  QFETCH( bool, spatialIndex );
+
+  QgsDmProvider provider( uri( dataType, spatialIndex ? QStringLiteral( "spatialIndex=yes" ) : QString() ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+  const QgsRectangle extent = provider.extent();
+  QVERIFY( !extent.isEmpty() );
+
+  // 範囲の1/20四方の矩形を決まった順序で検索する
+  std::mt19937 random( 1 );
+  double width = extent.width() / 20.0;
+  double height = extent.height() / 20.0;
+  QVector<qint64> samples;
+  samples.reserve( mQueries );
+  long found = 0;
+  for ( int i = 0; i < mQueries; i++ )
+  {
+    double x = extent.xMinimum() + ( random() % 1000 ) / 1000.0 * ( extent.width() - width );
+    double y = extent.yMinimum() + ( random() % 1000 ) / 1000.0 * ( extent.height() - height );
+    QgsRectangle rect( x, y, x + width, y + height );
+
+    QElapsedTimer timer;
+    timer.start();
+    QgsFeatureIterator it = provider.getFeatures( QgsFeatureRequest().setFilterRect( rect ) );
+    QgsFeature feature;
+    while ( it.nextFeature( feature ) )
+      found++;
+    samples.append( timer.nsecsElapsed() );
+  }
+
+  qint64 p50 = DmBench::percentile( samples, 50 );
+  qInfo( "spatial query %s%s: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us (%d queries, %ld features)",
+         qPrintable( dataType ), spatialIndex ? " indexed" : "",
+         p50 / 1e3, DmBench::percentile( samples, 90 ) / 1e3, DmBench::percentile( samples, 99 ) / 1e3,
+         DmBench::percentile( samples, 100 ) / 1e3, mQueries, found );
+  QTest::setBenchmarkResult( p50 / 1e6, QTest::WalltimeMilliseconds );
+  reportMemory( QStringLiteral( "spatialQuery" ) );
+}
+
+void BenchDmProvider::benchmarkPlanner_data()
+{
+  QTest::addColumn<QString>( "dataType" );
+  QTest::addColumn<QString>( "options" );
+  QTest::addColumn<QString>( "subset" );
+  const QStringList dataTypes = { DmGenerator::dataType( DmGenerator::Line ), DmGenerator::dataType( DmGenerator::Polygon ) };
+  for ( const QString &dataType : dataTypes )
+  {
+    // "dmcode" = nは地図分類コードの索引、"dmcode" + 0 = nは選択ビット列で処理される
+    QTest::newRow( qPrintable( dataType ) ) << dataType << QString() << QString();
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " spatialIndex" ) ) ) << dataType << QStringLiteral( "spatialIndex=yes" ) << QString();
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " dmcode" ) ) ) << dataType << QString() << QStringLiteral( "\"dmcode\" = %1" );
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " dmcode selection" ) ) ) << dataType << QString() << QStringLiteral( "\"dmcode\" + 0 = %1" );
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " dmcode spatialIndex" ) ) ) << dataType << QStringLiteral( "spatialIndex=yes" ) << QStringLiteral( "\"dmcode\" = %1" );
+  }
+}
+
+void BenchDmProvider::benchmarkPlanner()
+{
+  QFETCH( QString, dataType );
+  QFETCH( QString, options );
+  QFETCH( QString, subset );
+
+  QgsDmProvider provider( uri( dataType, options ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+  const QgsRectangle extent = provider.extent();
+  QVERIFY( !extent.isEmpty() );
+
+  if ( !subset.isEmpty() )
+  {
+    // 最初の地物の地図分類コードで絞り込む
+    QgsFeature first;
+    QVERIFY( provider.getFeatures( QgsFeatureRequest().setLimit( 1 ) ).nextFeature( first ) );
+    QVERIFY( provider.setSubsetString( subset.arg( first.attribute( QStringLiteral( "dmcode" ) ).toInt() ) ) );
+  }
+
+  // 範囲の1/50・1/10・1/2四方の矩形ごとに計画と応答時間を出力する
+  const double fractions[] = { 0.02, 0.1, 0.5 };
+  for ( double fraction : fractions )
+  {
+    std::mt19937 random( 1 );
+    const double width = extent.width() * fraction;
+    const double height = extent.height() * fraction;
+    QVector<qint64> samples;
+    samples.reserve( mQueries );
+    long found = 0;
+    for ( int i = 0; i < mQueries; i++ )
+    {
+      double x = extent.xMinimum() + ( random() % 1000 ) / 1000.0 * ( extent.width() - width );
+      double y = extent.yMinimum() + ( random() % 1000 ) / 1000.0 * ( extent.height() - height );
+      QgsRectangle rect( x, y, x + width, y + height );
+
+      QElapsedTimer timer;
+      timer.start();
+      QgsFeatureIterator it = provider.getFeatures( QgsFeatureRequest().setFilterRect( rect ) );
+      QgsFeature feature;
+      while ( it.nextFeature( feature ) )
+        found++;
+      samples.append( timer.nsecsElapsed() );
+    }
+    // 最後の検索の計画（反復子を閉じたときに記録される）
+    const QList< QgsDmQueryPlan > plans = provider.recentPlans();
+    const QString plan = plans.isEmpty() ? QString() : plans.last().reason;
+    qInfo( "planner %s%s%s%s%s %.2f: p50 %.1f us, p90 %.1f us (%ld features) - %s",
+           qPrintable( dataType ), options.isEmpty() ? "" : " ", qPrintable( options ),
+           subset.isEmpty() ? "" : " ", qPrintable( provider.subsetString() ), fraction,
+           DmBench::percentile( samples, 50 ) / 1e3, DmBench::percentile( samples, 90 ) / 1e3, found, qPrintable( plan ) );
+  }
+  reportMemory( QStringLiteral( "planner" ) );
+}
+
+void BenchDmProvider::benchmarkSetSubset_data()
+{
+  QTest::addColumn<QString>( "dataType" );
+  QTest::addColumn<bool>( "spatialIndex" );
+  const QStringList dataTypes = { DmGenerator::dataType( DmGenerator::Line ), DmGenerator::dataType( DmGenerator::Polygon ) };
+  for ( const QString &dataType : dataTypes )
+  {
+    QTest::newRow( qPrintable( dataType ) ) << dataType << false;
+    QTest::newRow( qPrintable( dataType + QStringLiteral( " indexed" ) ) ) << dataType << true;
+  }
+}
+
+void BenchDmProvider::benchmarkSetSubset()
+{
+  QFETCH( QString, dataType );
+  QFETCH( bool, spatialIndex );
+
+  QgsDmProvider provider( uri( dataType, spatialIndex ? QStringLiteral( "spatialIndex=yes" ) : QString() ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+  const long featureCount = provider.featureCount();
+
+  // 索引で処理できる式・できない式・解除を繰り返し、地物数と範囲の更新までの時間を計測する
+  const QStringList subsets = { QStringLiteral( "\"dmcode\" = %1" ), QStringLiteral( "\"dmcode\" + 0 = %1" ), QString() };
+  QgsFeature first;
+  QVERIFY( provider.getFeatures( QgsFeatureRequest().setLimit( 1 ) ).nextFeature( first ) );
+  const int dmcode = first.attribute( QStringLiteral( "dmcode" ) ).toInt();
+  for ( const QString &subset : subsets )
+  {
+    const QString subsetString = subset.isEmpty() ? QString() : subset.arg( dmcode );
+    qint64 bestNsecs = std::numeric_limits<qint64>::max();
+    for ( int i = 0; i < mIterations; i++ )
+    {
+      // 同じ文字列では何もしないので一度解除する
+      provider.setSubsetString( QStringLiteral( "FALSE" ) );
+      QElapsedTimer timer;
+      timer.start();
+      QVERIFY( provider.setSubsetString( subsetString ) );
+      bestNsecs = qMin( bestNsecs, timer.nsecsElapsed() );
+    }
+    qInfo( "set subset %s%s '%s': %.2f ms (%ld of %ld features)", qPrintable( dataType ), spatialIndex ? " indexed" : "",
+           qPrintable( subsetString ), bestNsecs / 1e6, provider.featureCount(), featureCount );
+  }
+  reportMemory( QStringLiteral( "setSubset" ) );
+}
+
+int main( int argc, char *argv[] )
+{
+  QgsApplication app( argc, argv, false );
+  QgsApplication::init();
+  QgsApplication::initQgis();
+
+  BenchDmProvider bench;
+  int result = QTest::qExec( &bench, argc, argv );
+
+  QgsApplication::exitQgis();
+  return result;
+}
+
+#include "benchdmprovider.moc"
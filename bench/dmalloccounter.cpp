@@ -0,0 +1,117 @@
+/***************************************************************************
+    dmalloccounter.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// ヒープ確保の回数を数える（マイクロベンチマーク専用）
+//
+// glibcではmalloc系の関数を置き換えて、Qtのコンテナによる確保も数える。
+// それ以外の環境ではoperator newのみを数える。
+
+#include "dmalloccounter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+  std::atomic<qint64> sAllocations( 0 );
+
+  inline void countAllocation()
+  {
+    sAllocations.fetch_add( 1, std::memory_order_relaxed );
+  }
+}
+
+qint64 DmBench::allocationCount()
+{
+  return sAllocations.load( std::memory_order_relaxed );
+}
+
+#if defined(__GLIBC__)
+
+extern "C"
+{
+  void *__libc_malloc( size_t size );
+  void *__libc_calloc( size_t count, size_t size );
+  void *__libc_realloc( void *ptr, size_t size );
+
+  void *malloc( size_t size )
+  {
+    countAllocation();
+    return __libc_malloc( size );
+  }
+
+  void *calloc( size_t count, size_t size )
+  {
+    countAllocation();
+    return __libc_calloc( count, size );
+  }
+
+  void *realloc( void *ptr, size_t size )
+  {
+    countAllocation();
+    return __libc_realloc( ptr, size );
+  }
+}
+
+bool DmBench::allocationCountIncludesMalloc()
+{
+  return true;
+}
+
+#else
+
+void *operator new( std::size_t size )
+{
+  countAllocation();
+  if ( void *ptr = std::malloc( size ? size : 1 ) )
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new[]( std::size_t size )
+{
+  return operator new( size );
+}
+
+void *operator new( std::size_t size, const std::nothrow_t & ) noexcept
+{
+  countAllocation();
+  return std::malloc( size ? size : 1 );
+}
+
+void *operator new[]( std::size_t size, const std::nothrow_t &tag ) noexcept
+{
+  return operator new( size, tag );
+}
+
+void operator delete( void *ptr ) noexcept
+{
+  std::free( ptr );
+}
+
+void operator delete[]( void *ptr ) noexcept
+{
+  std::free( ptr );
+}
+
+void operator delete( void *ptr, std::size_t ) noexcept
+{
+  std::free( ptr );
+}
+
+void operator delete[]( void *ptr, std::size_t ) noexcept
+{
+  std::free( ptr );
+}
+
+bool DmBench::allocationCountIncludesMalloc()
+{
+  return false;
+}
+
+#endif
@@ -0,0 +1,24 @@
+/***************************************************************************
+    dmalloccounter.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef DMALLOCCOUNTER_H
+#define DMALLOCCOUNTER_H
+
+#include <QtGlobal>
+
+namespace DmBench
+{
+  //! Returns the number of heap allocations made by the process so far.
+  qint64 allocationCount();
+
+  /**
+   * Returns true if allocationCount() includes malloc() calls (and so the
+   * allocations made by Qt containers), false if only operator new is counted.
+   */
+  bool allocationCountIncludesMalloc();
+}
+
+#endif // DMALLOCCOUNTER_H
@@ -0,0 +1,37 @@
+/***************************************************************************
+    dmbenchutils.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef DMBENCHUTILS_H
+#define DMBENCHUTILS_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#include <algorithm>
+#include <cmath>
+
+namespace DmBench
+{
+  //! Returns the \a percentile (0-100) of \a samples by the nearest-rank method.
+  inline qint64 percentile( QVector<qint64> samples, double percentile )
+  {
+    if ( samples.isEmpty() )
+      return 0;
+    std::sort( samples.begin(), samples.end() );
+    int rank = qBound( 1, static_cast<int>( std::ceil( percentile / 100.0 * samples.count() ) ), samples.count() );
+    return samples.at( rank - 1 );
+  }
+
+  //! Returns the integer environment variable \a name, or \a defaultValue if unset.
+  inline int envInt( const char *name, int defaultValue )
+  {
+    bool ok = false;
+    int value = qEnvironmentVariableIntValue( name, &ok );
+    return ok ? value : defaultValue;
+  }
+}
+
+#endif // DMBENCHUTILS_H
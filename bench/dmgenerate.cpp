@@ -0,0 +1,87 @@
+/***************************************************************************
+    dmgenerate.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// ベンチマーク用のDMディレクトリを作成するコマンド
+//
+//   dmgenerate [options] <directory>
+
+#include "dmgenerator.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+int main( int argc, char *argv[] )
+{
+  QCoreApplication app( argc, argv );
+  QCoreApplication::setApplicationName( QStringLiteral( "dmgenerate" ) );
+
+  DmGenerator::Options options;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription( QStringLiteral( "Writes a synthetic DM directory for benchmarking." ) );
+  parser.addHelpOption();
+  parser.addPositionalArgument( QStringLiteral( "directory" ), QStringLiteral( "Output directory." ) );
+
+  QCommandLineOption meshesOption( QStringLiteral( "meshes" ), QStringLiteral( "Number of meshes." ), QStringLiteral( "count" ), QString::number( options.meshCount ) );
+  QCommandLineOption meshesPerFileOption( QStringLiteral( "meshes-per-file" ), QStringLiteral( "Number of meshes per .dm file." ), QStringLiteral( "count" ), QString::number( options.meshesPerFile ) );
+  QCommandLineOption elementsOption( QStringLiteral( "elements" ), QStringLiteral( "Elements per mesh, e.g. pg=200,pl=200,cir=20,arc=20,pt=200,dir=20,tx=100." ), QStringLiteral( "mix" ) );
+  QCommandLineOption verticesOption( QStringLiteral( "vertices" ), QStringLiteral( "Vertices per polygon or line." ), QStringLiteral( "count" ), QString::number( options.verticesPerElement ) );
+  QCommandLineOption noteLengthOption( QStringLiteral( "note-length" ), QStringLiteral( "Characters per note." ), QStringLiteral( "count" ), QString::number( options.noteLength ) );
+  QCommandLineOption noteVocabularyOption( QStringLiteral( "note-vocabulary" ), QStringLiteral( "Number of distinct note texts." ), QStringLiteral( "count" ), QString::number( options.noteVocabulary ) );
+  QCommandLineOption halfWidthOption( QStringLiteral( "half-width-notes" ), QStringLiteral( "Write half-width (ASCII) notes instead of full-width ones." ) );
+  QCommandLineOption use3dOption( QStringLiteral( "3d" ), QStringLiteral( "Write polygons and lines as 3D data." ) );
+  QCommandLineOption revisionsOption( QStringLiteral( "revisions" ), QStringLiteral( "Number of mesh revisions." ), QStringLiteral( "count" ), QString::number( options.revisionCount ) );
+  QCommandLineOption levelOption( QStringLiteral( "level" ), QStringLiteral( "Map information level." ), QStringLiteral( "level" ), QString::number( options.level ) );
+  QCommandLineOption seedOption( QStringLiteral( "seed" ), QStringLiteral( "Random seed." ), QStringLiteral( "seed" ), QString::number( options.seed ) );
+  parser.addOptions( QList<QCommandLineOption>()
+                     << meshesOption << meshesPerFileOption << elementsOption << verticesOption
+                     << noteLengthOption << noteVocabularyOption << halfWidthOption << use3dOption
+                     << revisionsOption << levelOption << seedOption );
+  parser.process( app );
+
+  QTextStream err( stderr );
+  const QStringList args = parser.positionalArguments();
+  if ( args.count() != 1 )
+  {
+    parser.showHelp( 1 );
+  }
+
+  options.meshCount = parser.value( meshesOption ).toInt();
+  options.meshesPerFile = parser.value( meshesPerFileOption ).toInt();
+  options.verticesPerElement = parser.value( verticesOption ).toInt();
+  options.noteLength = parser.value( noteLengthOption ).toInt();
+  options.noteVocabulary = parser.value( noteVocabularyOption ).toInt();
+  options.fullWidthNotes = !parser.isSet( halfWidthOption );
+  options.use3d = parser.isSet( use3dOption );
+  options.revisionCount = parser.value( revisionsOption ).toInt();
+  options.level = parser.value( levelOption ).toInt();
+  options.seed = parser.value( seedOption ).toUInt();
+  if ( parser.isSet( elementsOption ) && !DmGenerator::parseElementCounts( parser.value( elementsOption ), options ) )
+  {
+    err << "Invalid element mix: " << parser.value( elementsOption ) << endl;
+    return 1;
+  }
+
+  DmGenerator generator( options );
+  QString error;
+  if ( !generator.generate( args.at( 0 ), &error ) )
+  {
+    err << error << endl;
+    return 1;
+  }
+
+  QTextStream out( stdout );
+  out << generator.filePaths().count() << " files, " << generator.bytesWritten() << " bytes" << endl;
+  for ( int i = 0; i < DmGenerator::ElementTypeCount; i++ )
+  {
+    DmGenerator::ElementType type = static_cast<DmGenerator::ElementType>( i );
+    out << DmGenerator::dataType( type ) << ": " << generator.elementCount( type ) << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,404 @@
+/***************************************************************************
+    dmgenerator.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "dmgenerator.h"
+
+#include <QDir>
+#include <QFile>
+#include <QObject>
+#include <QTextCodec>
+#include <QtMath>
+
+namespace
+{
+  // レコード長
+  const int RECORD_LENGTH = 84;
+
+  // 図郭の原点の基準（m）
+  const int ORIGIN_BASE_X = -20000;
+  const int ORIGIN_BASE_Y = -60000;
+
+  // 固定長レコードを組み立てる
+  class DmRecord
+  {
+    public:
+      explicit DmRecord( const char *recordType = "  " )
+        : mLine( RECORD_LENGTH, ' ' )
+      {
+        mLine.replace( 0, 2, recordType );
+      }
+
+      // 右詰めで数値を設定する
+      DmRecord &setInt( int start, int width, qint64 value )
+      {
+        const QByteArray text = QByteArray::number( value );
+        Q_ASSERT( text.size() <= width );
+        mLine.replace( start + width - text.size(), text.size(), text );
+        return *this;
+      }
+
+      // 左詰めで文字列を設定する
+      DmRecord &setText( int start, const QByteArray &text )
+      {
+        Q_ASSERT( start + text.size() <= mLine.size() );
+        mLine.replace( start, text.size(), text );
+        return *this;
+      }
+
+      QByteArray line() const { return mLine + "\r\n"; }
+
+    private:
+      QByteArray mLine;
+  };
+
+  const char *const ELEMENT_RECORD_TYPES[DmGenerator::ElementTypeCount] = { "E1", "E2", "E3", "E4", "E5", "E6", "E7" };
+  const char *const ELEMENT_KEYS[DmGenerator::ElementTypeCount] = { "pg", "pl", "cir", "arc", "pt", "dir", "tx" };
+}
+
+DmGenerator::DmGenerator( const Options &options )
+  : mOptions( options )
+  , mRandom( options.seed )
+{
+  // 地図情報レベル500の図郭は400m×300m
+  double scale = mOptions.level / 500.0;
+  mMeshWidth = qRound( 400000 * scale );
+  mMeshHeight = qRound( 300000 * scale );
+
+  for ( int i = 0; i < ElementTypeCount; i++ )
+    mElementCounts[i] = 0;
+}
+
+QString DmGenerator::dataType( ElementType type )
+{
+  return QStringLiteral( "dm_%1" ).arg( QLatin1String( ELEMENT_KEYS[type] ) );
+}
+
+bool DmGenerator::parseElementCounts( const QString &text, Options &options )
+{
+  const QStringList items = text.split( ',', QString::SkipEmptyParts );
+  for ( const QString &item : items )
+  {
+    const QStringList keyValue = item.split( '=' );
+    if ( keyValue.count() != 2 )
+      return false;
+
+    bool ok = false;
+    int count = keyValue.at( 1 ).trimmed().toInt( &ok );
+    if ( !ok || count < 0 )
+      return false;
+
+    bool found = false;
+    for ( int i = 0; i < ElementTypeCount; i++ )
+    {
+      if ( keyValue.at( 0 ).trimmed() == QLatin1String( ELEMENT_KEYS[i] ) )
+      {
+        options.elementCounts[i] = count;
+        found = true;
+      }
+    }
+    if ( !found )
+      return false;
+  }
+  return true;
+}
+
+bool DmGenerator::generate( const QString &dirPath, QString *error )
+{
+  // 同じオプションからは同じファイルを作成する
+  mRandom.seed( mOptions.seed );
+  mBytesWritten = 0;
+  mFilePaths.clear();
+  for ( int i = 0; i < ElementTypeCount; i++ )
+    mElementCounts[i] = 0;
+  createNoteTexts();
+
+  QDir dir( dirPath );
+  if ( !dir.mkpath( QStringLiteral( "." ) ) )
+  {
+    if ( error )
+      *error = QObject::tr( "Could not create %1" ).arg( dirPath );
+    return false;
+  }
+
+  int meshesPerFile = qMax( 1, mOptions.meshesPerFile );
+  for ( int firstMesh = 0; firstMesh < mOptions.meshCount; firstMesh += meshesPerFile )
+  {
+    const QString filePath = dir.filePath( QStringLiteral( "%1.dm" ).arg( firstMesh / meshesPerFile, 4, 10, QChar( '0' ) ) );
+    QFile file( filePath );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+      if ( error )
+        *error = QObject::tr( "Could not write %1" ).arg( filePath );
+      return false;
+    }
+
+    int lastMesh = qMin( firstMesh + meshesPerFile, mOptions.meshCount );
+
+    // インデックスレコード
+    QByteArray data;
+    data.append( DmRecord( "I " ).setInt( 37, 2, qMin( lastMesh - firstMesh, 99 ) ).line() );
+    for ( int meshIndex = firstMesh; meshIndex < lastMesh && meshIndex - firstMesh < 99; meshIndex++ )
+      data.append( DmRecord().setInt( 0, 8, meshIndex ).line() );
+
+    for ( int meshIndex = firstMesh; meshIndex < lastMesh; meshIndex++ )
+      data.append( meshRecords( meshIndex ) );
+
+    if ( file.write( data ) != data.size() )
+    {
+      if ( error )
+        *error = QObject::tr( "Could not write %1" ).arg( filePath );
+      return false;
+    }
+    file.close();
+
+    mBytesWritten += data.size();
+    mFilePaths.append( filePath );
+  }
+
+  return true;
+}
+
+void DmGenerator::createNoteTexts()
+{
+  static const QString FULL_WIDTH_CHARS = QStringLiteral( u"地図道路河川山田町村橋駅公園学校神社寺港島谷沢森林原野" );
+  static const QString HALF_WIDTH_CHARS = QStringLiteral( "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789" );
+
+  QTextCodec *codec = QTextCodec::codecForName( "Shift-JIS" );
+  const QString &chars = mOptions.fullWidthNotes ? FULL_WIDTH_CHARS : HALF_WIDTH_CHARS;
+
+  mNoteTexts.clear();
+  int vocabulary = qMax( 1, mOptions.noteVocabulary );
+  for ( int i = 0; i < vocabulary; i++ )
+  {
+    QString text;
+    for ( int c = 0; c < qMax( 1, mOptions.noteLength ); c++ )
+      text.append( chars.at( random( 0, chars.length() - 1 ) ) );
+    mNoteTexts.append( codec ? codec->fromUnicode( text ) : text.toLatin1() );
+  }
+}
+
+QByteArray DmGenerator::meshRecords( int meshIndex )
+{
+  int columns = qMax( 1, qCeil( qSqrt( mOptions.meshCount ) ) );
+  int originX = ORIGIN_BASE_X + ( meshIndex % columns ) * ( mMeshWidth / 1000 );
+  int originY = ORIGIN_BASE_Y + ( meshIndex / columns ) * ( mMeshHeight / 1000 );
+
+  QByteArray data;
+
+  // 図郭レコード(a)
+  data.append( DmRecord( "M " )
+               .setInt( 2, 8, meshIndex )
+               .setInt( 30, 5, mOptions.level )
+               .setInt( 65, 2, mOptions.revisionCount ).line() );
+  // 図郭レコード(b)：左下・右上の座標(m)と座標値の単位(1:mm)
+  data.append( DmRecord()
+               .setInt( 0, 7, originY )
+               .setInt( 7, 7, originX )
+               .setInt( 14, 7, originY + mMeshHeight / 1000 )
+               .setInt( 21, 7, originX + mMeshWidth / 1000 )
+               .setInt( 44, 3, 1 ).line() );
+  // 図郭レコード(c)
+  data.append( DmRecord().line() );
+  // 図郭レコード(d)(e)を新規+修正回数分作成する（撮影コースレコードはなし）
+  for ( int revision = 0; revision <= mOptions.revisionCount; revision++ )
+  {
+    data.append( DmRecord().setInt( 0, 2, revision ).setInt( 9, 1, 0 ).line() );
+    data.append( DmRecord()
+                 .setInt( 40, 4, 0 )
+                 .setInt( 44, 4, 0 )
+                 .setInt( 48, 4, 0 )
+                 .setInt( 52, 4, 0 ).line() );
+  }
+
+  // グループヘッダレコード
+  int total = 0;
+  for ( int i = 0; i < ElementTypeCount; i++ )
+    total += mOptions.elementCounts[i];
+
+  DmRecord header( "H " );
+  header.setInt( 16, 2, 0 ).setInt( 18, 5, qMin( total, 99999 ) ).setInt( 23, 5, 0 );
+  for ( int i = 0; i < ElementTypeCount; i++ )
+    header.setInt( 28 + i * 5, 5, qMin( mOptions.elementCounts[i], 99999 ) );
+  header.setInt( 63, 5, 0 ).setInt( 68, 5, 0 );
+  data.append( header.line() );
+
+  // 要素レコード
+  for ( int i = 0; i < ElementTypeCount; i++ )
+  {
+    for ( int n = 0; n < mOptions.elementCounts[i]; n++ )
+    {
+      data.append( elementRecords( static_cast<ElementType>( i ) ) );
+      mElementCounts[i]++;
+    }
+  }
+
+  return data;
+}
+
+QByteArray DmGenerator::elementRecords( ElementType type )
+{
+  QList<QPoint> points;
+  QList<int> heights;
+  bool use3d = mOptions.use3d && ( type == Polygon || type == Line );
+
+  switch ( type )
+  {
+    case Polygon:
+    {
+      // 中心の周りに頂点を配置する（自己交差しない）
+      QPoint center = randomCenter( 30000 );
+      int radius = random( 2000, 20000 );
+      int count = qMax( 3, mOptions.verticesPerElement );
+      for ( int i = 0; i < count; i++ )
+      {
+        double angle = 2.0 * M_PI * i / count;
+        double r = radius * random( 70, 100 ) / 100.0;
+        points.append( QPoint( center.x() + qRound( r * qCos( angle ) ), center.y() + qRound( r * qSin( angle ) ) ) );
+      }
+      break;
+    }
+    case Line:
+    {
+      QPoint point = randomCenter( 30000 );
+      int count = qMax( 2, mOptions.verticesPerElement );
+      for ( int i = 0; i < count; i++ )
+      {
+        points.append( point );
+        point.setX( qBound( 0, point.x() + random( -5000, 5000 ), mMeshWidth ) );
+        point.setY( qBound( 0, point.y() + random( -5000, 5000 ), mMeshHeight ) );
+      }
+      break;
+    }
+    case Circle:
+    case Arc:
+    {
+      // 円周上の3点
+      QPoint center = randomCenter( 30000 );
+      int radius = random( 1000, 10000 );
+      int degree = random( 0, 359 );
+      for ( int i = 0; i < 3; i++ )
+      {
+        double angle = qDegreesToRadians( static_cast<double>( degree ) );
+        points.append( QPoint( center.x() + qRound( radius * qCos( angle ) ), center.y() + qRound( radius * qSin( angle ) ) ) );
+        degree += random( 30, 150 );
+      }
+      break;
+    }
+    case Direction:
+    {
+      QPoint point = randomCenter( 30000 );
+      points.append( point );
+      int dx = random( 1000, 3000 );
+      int dy = random( -3000, 3000 );
+      points.append( point + QPoint( dx, dy ) );
+      break;
+    }
+    case Point:
+    case Note:
+    case ElementTypeCount:
+      break;
+  }
+
+  if ( use3d )
+  {
+    for ( int i = 0; i < points.count(); i++ )
+      heights.append( random( 0, 50000 ) );
+  }
+
+  // 乱数の順序がコンパイラに依存しないよう、引数の中では1回だけ呼ぶ
+  int dmcode = 1000 * ( type + 1 ) + random( 0, 19 );
+  int kandan = random( 0, 1 );
+  DmRecord header( ELEMENT_RECORD_TYPES[type] );
+  header.setInt( 2, 4, dmcode )
+  .setInt( 18, 2, 1 )
+  .setInt( 24, 2, 0 )
+  .setInt( 26, 1, kandan );
+
+  QByteArray data;
+  if ( type == Point )
+  {
+    // 記号は要素レコードに座標を持つ
+    QPoint point = randomCenter( 1000 );
+    header.setInt( 20, 1, 2 ).setInt( 27, 4, 0 ).setInt( 31, 4, 0 )
+    .setInt( 35, 7, point.y() ).setInt( 42, 7, point.x() );
+    data.append( header.line() );
+  }
+  else if ( type == Note )
+  {
+    const QByteArray text = mNoteTexts.at( random( 0, mNoteTexts.count() - 1 ) );
+    int angle = random( 0, 359 );
+    int bytesPerChar = mOptions.fullWidthNotes ? 2 : 1;
+    int recordCount = qMax( 1, ( text.size() + 63 ) / 64 );
+
+    QPoint point = randomCenter( 1000 );
+    header.setInt( 20, 1, 2 )
+    .setInt( 23, 1, mOptions.fullWidthNotes ? 1 : 2 )
+    .setInt( 27, 4, text.size() / bytesPerChar )
+    .setInt( 31, 4, recordCount )
+    .setInt( 35, 7, point.y() ).setInt( 42, 7, point.x() );
+    data.append( header.line() );
+
+    // 文字列は64バイトずつ各レコードの21桁目以降に格納する
+    for ( int i = 0; i < recordCount; i++ )
+    {
+      DmRecord record;
+      if ( i == 0 )
+        record.setInt( 0, 1, 0 ).setInt( 1, 7, angle ).setInt( 8, 5, 30 );
+      record.setText( 20, text.mid( i * 64, 64 ) );
+      data.append( record.line() );
+    }
+  }
+  else
+  {
+    int pointsPerRecord = use3d ? 4 : 6;
+    int recordCount = ( points.count() + pointsPerRecord - 1 ) / pointsPerRecord;
+    header.setInt( 20, 1, use3d ? 3 : 2 ).setInt( 27, 4, points.count() ).setInt( 31, 4, recordCount );
+    data.append( header.line() );
+    data.append( coordRecords( points, heights ) );
+  }
+
+  return data;
+}
+
+QByteArray DmGenerator::coordRecords( const QList<QPoint> &points, const QList<int> &heights )
+{
+  // 2次元は1レコード6点(14桁)、3次元は1レコード4点(21桁)
+  bool use3d = !heights.isEmpty();
+  int pointsPerRecord = use3d ? 4 : 6;
+  int width = use3d ? 21 : 14;
+
+  QByteArray data;
+  DmRecord record;
+  for ( int i = 0; i < points.count(); i++ )
+  {
+    int start = ( i % pointsPerRecord ) * width;
+    record.setInt( start, 7, points.at( i ).y() ).setInt( start + 7, 7, points.at( i ).x() );
+    if ( use3d )
+      record.setInt( start + 14, 7, heights.at( i ) );
+
+    if ( i % pointsPerRecord == pointsPerRecord - 1 || i == points.count() - 1 )
+    {
+      data.append( record.line() );
+      record = DmRecord();
+    }
+  }
+  return data;
+}
+
+QPoint DmGenerator::randomCenter( int margin )
+{
+  int x = random( margin, mMeshWidth - margin );
+  int y = random( margin, mMeshHeight - margin );
+  return QPoint( x, y );
+}
+
+int DmGenerator::random( int lo, int hi )
+{
+  // 分布クラスは実装依存なので剰余で範囲を決める
+  if ( hi <= lo )
+    return lo;
+  return lo + static_cast<int>( mRandom() % static_cast<quint32>( hi - lo + 1 ) );
+}
@@ -0,0 +1,115 @@
+/***************************************************************************
+    dmgenerator.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef DMGENERATOR_H
+#define DMGENERATOR_H
+
+#include <QString>
+#include <QByteArray>
+#include <QStringList>
+#include <QList>
+#include <QPoint>
+
+#include <random>
+
+/**
+ * \class DmGenerator
+ * \brief Writes synthetic DM directories for benchmarking.
+ *
+ * The output only depends on the options (including the seed), so the same
+ * options always produce byte-identical files.  The records follow the column
+ * layout read by QgsDmFile.
+ */
+class DmGenerator
+{
+  public:
+
+    //! 要素の種類（E1～E7）
+    enum ElementType
+    {
+      Polygon = 0,
+      Line,
+      Circle,
+      Arc,
+      Point,
+      Direction,
+      Note,
+      ElementTypeCount
+    };
+
+    struct Options
+    {
+      //! 図郭数
+      int meshCount = 4;
+      //! 1ファイルあたりの図郭数
+      int meshesPerFile = 1;
+      //! 図郭あたりの要素数（E1～E7）
+      int elementCounts[ElementTypeCount] = { 200, 200, 20, 20, 200, 20, 100 };
+      //! 面・線の頂点数
+      int verticesPerElement = 16;
+      //! 注記の文字数
+      int noteLength = 8;
+      //! 注記を全角で作成する
+      bool fullWidthNotes = true;
+      //! 注記の文字列の種類数（同じ注記が繰り返し現れる）
+      int noteVocabulary = 100;
+      //! 面・線を3次元データで作成する
+      bool use3d = false;
+      //! 図郭の修正回数
+      int revisionCount = 0;
+      //! 地図情報レベル
+      int level = 500;
+      //! 乱数の種
+      quint32 seed = 1;
+    };
+
+    explicit DmGenerator( const Options &options );
+
+    /**
+     * Writes the DM files into \a dirPath, creating the directory if needed.
+     * \returns false and sets \a error if a file could not be written
+     */
+    bool generate( const QString &dirPath, QString *error = nullptr );
+
+    //! Returns the number of bytes written by the last generate() call.
+    qint64 bytesWritten() const { return mBytesWritten; }
+
+    //! Returns the number of elements of \a type written by the last generate() call.
+    int elementCount( ElementType type ) const { return mElementCounts[type]; }
+
+    //! Returns the file paths written by the last generate() call.
+    QStringList filePaths() const { return mFilePaths; }
+
+    //! Returns the data type key ("dm_pg" etc.) of \a type.
+    static QString dataType( ElementType type );
+
+    //! Parses "pg=100,pl=50,..." into the element counts of \a options.
+    static bool parseElementCounts( const QString &text, Options &options );
+
+  private:
+
+    void createNoteTexts();
+    QByteArray meshRecords( int meshIndex );
+    QByteArray elementRecords( ElementType type );
+    QByteArray coordRecords( const QList<QPoint> &points, const QList<int> &heights );
+    QPoint randomCenter( int margin );
+
+    int random( int lo, int hi );
+
+    Options mOptions;
+    std::mt19937 mRandom;
+    QList<QByteArray> mNoteTexts;
+
+    // 図郭の大きさ（mm）
+    int mMeshWidth = 0;
+    int mMeshHeight = 0;
+
+    qint64 mBytesWritten = 0;
+    int mElementCounts[ElementTypeCount];
+    QStringList mFilePaths;
+};
+
+#endif // DMGENERATOR_H
@@ -0,0 +1,86 @@
+/***************************************************************************
+    dmparsememory.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// 読込と再読込の最大メモリ使用量とヒープ確保回数を計測するコマンド
+//
+//   dmparsememory [--reloads n] <データソースURI>
+//
+// QgsDmFileのコンストラクタとread()のみを使うので、解析処理を変更する前の
+// リビジョンでも同じソースをビルドして、同じディレクトリで比較できる。
+// 最大メモリ使用量はプロセス全体の値なので、比較する計測は別のプロセスで行う。
+
+#include "dmalloccounter.h"
+
+#include "qgsapplication.h"
+#include "qgsdmfile.h"
+#include "qgsdmmemory.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+namespace
+{
+  // 1回分の読込を計測して出力する
+  bool measureRead( QgsDmFile &file, const QString &name, QTextStream &out )
+  {
+    const qint64 allocationsBefore = DmBench::allocationCount();
+    QElapsedTimer timer;
+    timer.start();
+    const bool success = file.read();
+    const qint64 msecs = timer.elapsed();
+    const qint64 allocations = DmBench::allocationCount() - allocationsBefore;
+
+    out << name.leftJustified( 10 ) << " time " << msecs << " ms, allocations " << allocations
+        << ( DmBench::allocationCountIncludesMalloc() ? "" : " (operator new only)" )
+        << ", peak RSS " << DmMemory::mebibytes( DmMemory::peakBytes() ) << endl;
+    return success;
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  QgsApplication app( argc, argv, false );
+  QgsApplication::init();
+  QgsApplication::initQgis();
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription( QStringLiteral( "Measures peak RSS and heap allocations while reading and reloading a DM data source." ) );
+  parser.addHelpOption();
+  parser.addPositionalArgument( QStringLiteral( "uri" ), QStringLiteral( "Data source URI, e.g. file:///data/dm?dataType=dm_pg." ) );
+  QCommandLineOption reloadsOption( QStringLiteral( "reloads" ), QStringLiteral( "Number of reloads after the first read." ), QStringLiteral( "count" ), QStringLiteral( "3" ) );
+  parser.addOption( reloadsOption );
+  parser.process( app );
+
+  const QStringList args = parser.positionalArguments();
+  if ( args.count() != 1 )
+  {
+    parser.showHelp( 1 );
+  }
+
+  QTextStream out( stdout );
+  out << "start      peak RSS " << DmMemory::mebibytes( DmMemory::peakBytes() ) << endl;
+
+  int result = 0;
+  {
+    QgsDmFile file( args.at( 0 ) );
+    if ( !measureRead( file, QStringLiteral( "read" ), out ) )
+      result = 1;
+
+    // 再読込（前回のデータを破棄してから読み込む）
+    const int reloads = parser.value( reloadsOption ).toInt();
+    for ( int i = 0; i < reloads && result == 0; i++ )
+    {
+      if ( !measureRead( file, QStringLiteral( "reload %1" ).arg( i + 1 ), out ) )
+        result = 1;
+    }
+    out << "records    " << file.recordCount() << endl;
+  }
+
+  QgsApplication::exitQgis();
+  return result;
+}
@@ -0,0 +1,241 @@
+/***************************************************************************
+    dmstat.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// DMファイルの統計を表示するコマンド（QGIS不要）
+//
+//   dmstat [options] <directory|file>...
+//
+// ファイルごとのレコード種別別のレコード数と解析速度、
+// データ種別ごとの要素数と属性レコードの列、図郭の範囲、メモリ使用量を表示する。
+
+#include "qgsdmmemory.h"
+#include "qgsdmparser.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QTextStream>
+
+namespace
+{
+  // 0件でないレコード種別を「M 4, H 20, E1 800」の形式で返す
+  QString formatRecordCounts( const DmRecordCounts &counts )
+  {
+    QStringList items;
+    for ( int i = 0; i < DmRecordCounts::RecordTypeCount; i++ )
+    {
+      DmRecordCounts::RecordType type = static_cast<DmRecordCounts::RecordType>( i );
+      if ( counts.count( type ) > 0 )
+        items << QStringLiteral( "%1 %2" ).arg( DmRecordCounts::recordTypeName( type ) ).arg( counts.count( type ) );
+    }
+    return items.join( QStringLiteral( ", " ) );
+  }
+
+  // 属性レコード(E8)の列を「0001 integer 120, 0002 text 8」（属性コード 型 値の数）の形式で返す
+  QString formatAttributeColumns( const DmAttributeTable &table )
+  {
+    QStringList items;
+    for ( int i = 0; i < table.columnCount(); i++ )
+    {
+      const DmAttributeColumn &column = table.column( i );
+      QString type;
+      switch ( column.type() )
+      {
+        case DmAttributeColumn::Integer:
+          type = QStringLiteral( "integer" );
+          break;
+        case DmAttributeColumn::Double:
+          type = QStringLiteral( "double" );
+          break;
+        case DmAttributeColumn::String:
+          type = QStringLiteral( "text" );
+          break;
+      }
+      int values = 0;
+      for ( int j = 0; j < column.count(); j++ )
+      {
+        if ( !column.isNull( j ) )
+          values++;
+      }
+      items << QStringLiteral( "%1 %2 %3" ).arg( column.code(), 4, 10, QChar( '0' ) ).arg( type ).arg( values );
+    }
+    return items.join( QStringLiteral( ", " ) );
+  }
+}
+
+int main( int argc, char *argv[] )
+{
+  QCoreApplication app( argc, argv );
+  QCoreApplication::setApplicationName( QStringLiteral( "dmstat" ) );
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription( QStringLiteral( "Prints record counts, parse throughput, element counts, mesh extents and memory use of DM files." ) );
+  parser.addHelpOption();
+  parser.addPositionalArgument( QStringLiteral( "paths" ), QStringLiteral( "DM directories or .dm files." ), QStringLiteral( "<directory|file>..." ) );
+
+  QCommandLineOption dataTypeOption( QStringLiteral( "data-type" ), QStringLiteral( "Decode only this data type (dm_pg, dm_pl, dm_cir, dm_arc, dm_pt, dm_dir, dm_tx, dm_grid or dm_tin)." ), QStringLiteral( "type" ) );
+  QCommandLineOption overwritingTimesOption( QStringLiteral( "overwriting-times" ), QStringLiteral( "Override the mesh modification count." ), QStringLiteral( "count" ), QStringLiteral( "-1" ) );
+  QCommandLineOption extentOption( QStringLiteral( "extent" ), QStringLiteral( "Read only the files with meshes intersecting this area, using the I and M records." ), QStringLiteral( "xmin,ymin,xmax,ymax" ) );
+  QCommandLineOption recursiveOption( QStringList() << QStringLiteral( "r" ) << QStringLiteral( "recursive" ), QStringLiteral( "Include the .dm files of all subdirectories of the directories." ) );
+  QCommandLineOption lodOption( QStringLiteral( "lod" ), QStringLiteral( "Build the simplified levels of detail of the line and polygon elements and show their vertex counts." ) );
+  parser.addOptions( QList<QCommandLineOption>() << dataTypeOption << overwritingTimesOption << extentOption << recursiveOption << lodOption );
+  parser.process( app );
+
+  QTextStream out( stdout );
+  QTextStream err( stderr );
+
+  const QStringList args = parser.positionalArguments();
+  if ( args.isEmpty() )
+  {
+    parser.showHelp( 1 );
+  }
+
+  QStringList filePaths;
+  for ( const QString &arg : args )
+  {
+    if ( QFileInfo( arg ).isDir() && parser.isSet( recursiveOption ) )
+    {
+      const QStringList directories = DmReader::dmDirectories( arg );
+      for ( const QString &directory : directories )
+        filePaths << DmReader::dmFilePaths( directory );
+    }
+    else if ( QFileInfo( arg ).isDir() )
+      filePaths << DmReader::dmFilePaths( arg );
+    else
+      filePaths << arg;
+  }
+  if ( filePaths.isEmpty() )
+  {
+    err << "No .dm files found" << endl;
+    return 1;
+  }
+
+  DmReader reader;
+  reader.setDataType( parser.value( dataTypeOption ).toLower() );
+  reader.setOverwritingTimes( parser.value( overwritingTimesOption ).toInt() );
+
+  // 範囲を指定した場合はカタログで範囲と交差するファイルに絞り込む
+  if ( parser.isSet( extentOption ) )
+  {
+    const QStringList values = parser.value( extentOption ).split( ',' );
+    if ( values.count() != 4 )
+    {
+      err << "Invalid extent: " << parser.value( extentOption ) << endl;
+      return 1;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    DmCatalog catalog;
+    for ( const QString &filePath : qAsConst( filePaths ) )
+      reader.catalogFile( filePath, catalog );
+    const DmRect area( values.at( 0 ).toDouble(), values.at( 1 ).toDouble(), values.at( 2 ).toDouble(), values.at( 3 ).toDouble() );
+    filePaths = catalog.filePaths( area );
+    out << "catalog: " << catalog.fileCount() << " files, " << catalog.meshCount() << " meshes, "
+        << filePaths.count() << " files intersect the extent, " << QString::number( timer.nsecsElapsed() / 1e6, 'f', 2 ) << " ms" << endl << endl;
+    if ( filePaths.isEmpty() )
+      return 0;
+  }
+
+  reader.setBytesTotal( DmReader::totalBytes( filePaths ) );
+
+  DmRecordCounts totalCounts;
+  qint64 totalNsecs = 0;
+  int result = 0;
+  for ( const QString &filePath : qAsConst( filePaths ) )
+  {
+    DmRecordCounts counts;
+    QElapsedTimer timer;
+    timer.start();
+    if ( !reader.readFile( filePath, nullptr, &counts ) )
+    {
+      err << filePath << ": cannot read" << endl;
+      result = 1;
+      continue;
+    }
+    qint64 nsecs = timer.nsecsElapsed();
+    totalNsecs += nsecs;
+    totalCounts.add( counts );
+
+    double seconds = qMax( nsecs, qint64( 1 ) ) / 1e9;
+    out << filePath << ": " << counts.byteCount() << " bytes, " << counts.lineCount() << " lines, "
+        << QString::number( nsecs / 1e6, 'f', 2 ) << " ms, " << QString::number( counts.byteCount() / seconds / 1e6, 'f', 1 ) << " MB/s" << endl;
+    out << "  " << formatRecordCounts( counts ) << endl;
+  }
+
+  double seconds = qMax( totalNsecs, qint64( 1 ) ) / 1e9;
+  out << endl;
+  out << "total: " << filePaths.count() << " files, " << totalCounts.byteCount() << " bytes, " << totalCounts.lineCount() << " lines, "
+      << QString::number( totalNsecs / 1e6, 'f', 2 ) << " ms, " << QString::number( totalCounts.byteCount() / seconds / 1e6, 'f', 1 ) << " MB/s" << endl;
+  out << "  " << formatRecordCounts( totalCounts ) << endl;
+
+  out << "elements:" << endl;
+  out << "  dm_pg: " << reader.polygons().count() << endl;
+  out << "  dm_pl: " << reader.lines().count() << endl;
+  out << "  dm_cir: " << reader.circles().count() << endl;
+  out << "  dm_arc: " << reader.arcs().count() << endl;
+  out << "  dm_pt: " << reader.points().count() << endl;
+  out << "  dm_dir: " << reader.directions().count() << endl;
+  out << "  dm_tx: " << reader.notes().count() << " (" << reader.textPool().count() << " distinct texts)" << endl;
+  qint64 gridCells = 0;
+  for ( const DmGrid &grid : reader.grids() )
+    gridCells += grid.values().count();
+  out << "  dm_grid: " << reader.grids().count() << " (" << gridCells << " cells)" << endl;
+  out << "  dm_tin: " << reader.tin().surfaceCount() << " (" << reader.tin().vertexCount() << " vertices, "
+      << reader.tin().triangleCount() << " triangles)" << endl;
+
+  // 詳細度ごとの頂点数（許容誤差は座標の単位）
+  if ( parser.isSet( lodOption ) )
+  {
+    QElapsedTimer timer;
+    timer.start();
+    reader.buildLevelsOfDetail();
+    out << "levels of detail: " << QString::number( timer.nsecsElapsed() / 1e6, 'f', 2 ) << " ms" << endl;
+    const char *const lineTypes[] = { "dm_pg", "dm_pl", "dm_cir", "dm_arc" };
+    for ( const char *dataType : lineTypes )
+    {
+      const DmLevelsOfDetail &levels = reader.levelsOfDetail( QLatin1String( dataType ) );
+      if ( levels.count() == 0 )
+        continue;
+      QStringList vertexCounts;
+      for ( int level = 0; level < DmLevelsOfDetail::LevelCount; level++ )
+        vertexCounts << QStringLiteral( "%1 (%2)" ).arg( levels.vertexCount( level ) ).arg( DmLevelsOfDetail::tolerance( level ) );
+      out << "  " << dataType << ": " << vertexCounts.join( QStringLiteral( ", " ) ) << endl;
+    }
+  }
+
+  const char *const dataTypes[] = { "dm_pg", "dm_pl", "dm_cir", "dm_arc", "dm_pt", "dm_dir", "dm_tx" };
+  bool hasAttributes = false;
+  for ( const char *dataType : dataTypes )
+  {
+    const DmAttributeTable &table = reader.attributes( QLatin1String( dataType ) );
+    if ( table.columnCount() == 0 )
+      continue;
+    if ( !hasAttributes )
+      out << "attributes:" << endl;
+    hasAttributes = true;
+    out << "  " << dataType << ": " << formatAttributeColumns( table ) << endl;
+  }
+
+  DmRect extent;
+  for ( const DmMesh &mesh : reader.meshes() )
+    extent.combine( mesh.extent() );
+  out << "meshes: " << reader.meshes().count();
+  if ( !extent.isNull() )
+  {
+    out << ", extent " << QString::number( extent.xMinimum(), 'f', 3 ) << ',' << QString::number( extent.yMinimum(), 'f', 3 )
+        << " : " << QString::number( extent.xMaximum(), 'f', 3 ) << ',' << QString::number( extent.yMaximum(), 'f', 3 );
+  }
+  out << endl;
+
+  out << "memory: arena " << DmMemory::mebibytes( static_cast<qint64>( reader.arena().bytesAllocated() ) )
+      << " used / " << DmMemory::mebibytes( static_cast<qint64>( reader.arena().bytesReserved() ) ) << " reserved in "
+      << reader.arena().chunkCount() << " chunks, peak " << DmMemory::mebibytes( DmMemory::peakBytes() ) << endl;
+
+  return result;
+}
@@ -0,0 +1,103 @@
+/***************************************************************************
+      qgsdmarena.h  -  Monotonic arena for parsed DM data
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMARENA_H
+#define QGSDMARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * 単調増加アリーナ
+ * 要素の座標列と簡略化した座標列（詳細度）をチャンク単位でまとめて確保し、個別には解放しない。
+ * 要素・図郭はDmReaderのQVectorに、注記の文字列は文字列プールに格納するので、アリーナには含まない。
+ * clear()またはデストラクタで全チャンクを一度に解放する。
+ * 確保した領域は移動しないので、確保済みの領域を他スレッドから参照できる
+ * （確保は1スレッドのみで行うこと）。
+ */
+class DmArena
+{
+public:
+	explicit DmArena(std::size_t chunkSize = DEFAULT_CHUNK_SIZE)
+		: mChunkSize(chunkSize)
+	{}
+
+	DmArena(const DmArena&) = delete;
+	DmArena& operator=(const DmArena&) = delete;
+
+	// 領域を確保する
+	void* allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+	{
+		std::size_t offset = (mUsed + alignment - 1) & ~(alignment - 1);
+		if (mChunks.empty() || offset + size > mChunks.back().size) {
+			addChunk(size + alignment);
+			offset = (mUsed + alignment - 1) & ~(alignment - 1);
+		}
+		mUsed = offset + size;
+		mBytesAllocated += size;
+		return mChunks.back().data.get() + offset;
+	}
+
+	// 要素数countの配列を確保する（解放時にデストラクタは呼ばれない）
+	template<class T>
+	T* allocateArray(int count)
+	{
+		if (count <= 0)
+			return nullptr;
+		T* items = static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+		for (int i = 0; i < count; i++)
+			new (items + i) T();
+		return items;
+	}
+
+	// 全チャンクを一度に解放する
+	void clear()
+	{
+		mChunks.clear();
+		mUsed = 0;
+		mBytesAllocated = 0;
+		mBytesReserved = 0;
+	}
+
+	// 確保済みのバイト数
+	std::size_t bytesAllocated() const { return mBytesAllocated; }
+	// チャンクとして予約済みのバイト数
+	std::size_t bytesReserved() const { return mBytesReserved; }
+	// チャンク数
+	int chunkCount() const { return static_cast<int>(mChunks.size()); }
+
+	static const std::size_t DEFAULT_CHUNK_SIZE = 1 << 20;
+
+private:
+	struct Chunk
+	{
+		std::unique_ptr<char[]> data;
+		std::size_t size;
+	};
+
+	void addChunk(std::size_t minimumSize)
+	{
+		// チャンクより大きな要求は専用のチャンクとする
+		std::size_t size = minimumSize > mChunkSize ? minimumSize : mChunkSize;
+		Chunk chunk;
+		chunk.data.reset(new char[size]);
+		chunk.size = size;
+		mChunks.push_back(std::move(chunk));
+		mUsed = 0;
+		mBytesReserved += size;
+	}
+
+	std::size_t mChunkSize;
+	std::vector<Chunk> mChunks;
+	std::size_t mUsed = 0;
+	std::size_t mBytesAllocated = 0;
+	std::size_t mBytesReserved = 0;
+};
+
+#endif // QGSDMARENA_H
@@ -0,0 +1,178 @@
+/***************************************************************************
+  qgsdmboxfilter.cpp -  Rectangle filter over element extent arrays
+  -------------------
+          begin                : March 2021
+          copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#include "qgsdmboxfilter.h"
+
+#include <QtAlgorithms>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DM_BOXFILTER_SSE2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC/ClangではAVXの関数のみAVXでコンパイルする（MSVCは指定なしで使える）
+#if defined(DM_BOXFILTER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define DM_BOXFILTER_AVX_TARGET __attribute__((target("avx")))
+#else
+#define DM_BOXFILTER_AVX_TARGET
+#endif
+
+namespace
+{
+	// 分岐なしで判定し、該当する添字の追加のみ分岐する
+	void selectScalar(const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+		int begin, int end, const DmRect& rect, QVector<int>& indexes)
+	{
+		const double rectXMin = rect.xMinimum();
+		const double rectYMin = rect.yMinimum();
+		const double rectXMax = rect.xMaximum();
+		const double rectYMax = rect.yMaximum();
+
+		const int BLOCK_SIZE = 256;
+		unsigned char hit[BLOCK_SIZE];
+		for (int blockBegin = begin; blockBegin < end; blockBegin += BLOCK_SIZE) {
+			const int n = qMin(BLOCK_SIZE, end - blockBegin);
+			for (int i = 0; i < n; i++) {
+				const int j = blockBegin + i;
+				hit[i] = static_cast<unsigned char>((xMin[j] <= rectXMax) & (xMax[j] >= rectXMin) & (yMin[j] <= rectYMax) & (yMax[j] >= rectYMin));
+			}
+			for (int i = 0; i < n; i++) {
+				if (hit[i])
+					indexes.append(blockBegin + i);
+			}
+		}
+	}
+
+#ifdef DM_BOXFILTER_SSE2
+	void selectSse2(const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+		int begin, int end, const DmRect& rect, QVector<int>& indexes)
+	{
+		const __m128d rectXMin = _mm_set1_pd(rect.xMinimum());
+		const __m128d rectYMin = _mm_set1_pd(rect.yMinimum());
+		const __m128d rectXMax = _mm_set1_pd(rect.xMaximum());
+		const __m128d rectYMax = _mm_set1_pd(rect.yMaximum());
+
+		int i = begin;
+		for (; i + 2 <= end; i += 2) {
+			// 比較はNaNで偽になる
+			const __m128d x = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(xMin + i), rectXMax), _mm_cmpge_pd(_mm_loadu_pd(xMax + i), rectXMin));
+			const __m128d y = _mm_and_pd(_mm_cmple_pd(_mm_loadu_pd(yMin + i), rectYMax), _mm_cmpge_pd(_mm_loadu_pd(yMax + i), rectYMin));
+			const int mask = _mm_movemask_pd(_mm_and_pd(x, y));
+			if (mask & 1)
+				indexes.append(i);
+			if (mask & 2)
+				indexes.append(i + 1);
+		}
+		selectScalar(xMin, yMin, xMax, yMax, i, end, rect, indexes);
+	}
+
+	DM_BOXFILTER_AVX_TARGET
+	void selectAvx(const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+		int begin, int end, const DmRect& rect, QVector<int>& indexes)
+	{
+		const __m256d rectXMin = _mm256_set1_pd(rect.xMinimum());
+		const __m256d rectYMin = _mm256_set1_pd(rect.yMinimum());
+		const __m256d rectXMax = _mm256_set1_pd(rect.xMaximum());
+		const __m256d rectYMax = _mm256_set1_pd(rect.yMaximum());
+
+		int i = begin;
+		for (; i + 4 <= end; i += 4) {
+			const __m256d x = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(xMin + i), rectXMax, _CMP_LE_OQ), _mm256_cmp_pd(_mm256_loadu_pd(xMax + i), rectXMin, _CMP_GE_OQ));
+			const __m256d y = _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(yMin + i), rectYMax, _CMP_LE_OQ), _mm256_cmp_pd(_mm256_loadu_pd(yMax + i), rectYMin, _CMP_GE_OQ));
+			unsigned int mask = static_cast<unsigned int>(_mm256_movemask_pd(_mm256_and_pd(x, y)));
+			while (mask) {
+				indexes.append(i + static_cast<int>(qCountTrailingZeroBits(mask)));
+				mask &= mask - 1;
+			}
+		}
+		selectScalar(xMin, yMin, xMax, yMax, i, end, rect, indexes);
+	}
+
+	bool cpuSupportsAvx()
+	{
+#if defined(_MSC_VER) && !defined(__clang__)
+		// CPUID.1:ECXのOSXSAVEとAVX、OSがYMMレジスタを保存するか
+		int info[4];
+		__cpuid(info, 1);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		return osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#else
+		return __builtin_cpu_supports("avx");
+#endif
+	}
+#endif
+}
+
+DmBoxFilter::Kernel DmBoxFilter::bestKernel()
+{
+	static const Kernel sKernel = isSupported(Avx) ? Avx : isSupported(Sse2) ? Sse2 : Scalar;
+	return sKernel;
+}
+
+bool DmBoxFilter::isSupported(Kernel kernel)
+{
+	switch (kernel) {
+	case Scalar:
+		return true;
+#ifdef DM_BOXFILTER_SSE2
+	case Sse2:
+		return true;
+	case Avx:
+	{
+		static const bool sAvx = cpuSupportsAvx();
+		return sAvx;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+const char* DmBoxFilter::kernelName(Kernel kernel)
+{
+	switch (kernel) {
+	case Sse2:
+		return "sse2";
+	case Avx:
+		return "avx";
+	default:
+		return "scalar";
+	}
+}
+
+void DmBoxFilter::select(const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+	int begin, int end, const DmRect& rect, QVector<int>& indexes)
+{
+	select(bestKernel(), xMin, yMin, xMax, yMax, begin, end, rect, indexes);
+}
+
+void DmBoxFilter::select(Kernel kernel, const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+	int begin, int end, const DmRect& rect, QVector<int>& indexes)
+{
+	if (rect.isNull() || begin >= end)
+		return;
+
+	if (!isSupported(kernel))
+		kernel = Scalar;
+	switch (kernel) {
+#ifdef DM_BOXFILTER_SSE2
+	case Avx:
+		selectAvx(xMin, yMin, xMax, yMax, begin, end, rect, indexes);
+		break;
+	case Sse2:
+		selectSse2(xMin, yMin, xMax, yMax, begin, end, rect, indexes);
+		break;
+#endif
+	default:
+		selectScalar(xMin, yMin, xMax, yMax, begin, end, rect, indexes);
+		break;
+	}
+}
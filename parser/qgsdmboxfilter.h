@@ -0,0 +1,45 @@
+/***************************************************************************
+      qgsdmboxfilter.h  -  Rectangle filter over element extent arrays
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMBOXFILTER_H
+#define QGSDMBOXFILTER_H
+
+#include <QVector>
+
+#include "qgsdmparser.h"
+
+/**
+ * 要素の範囲の配列から矩形と交差する要素を選ぶ
+ * 範囲は最小X、最小Y、最大X、最大Yの4つの配列（要素の添字ごと）で渡す。点は最小と最大に同じ配列を渡す。
+ * NaNの範囲（座標のない要素）は選ばない。
+ * x86ではSSE2、AVXのベクトル命令で4要素（SSE2は2要素）ずつ判定する。AVXは実行時のCPUが対応している場合のみ使う
+ */
+class DmBoxFilter {
+public:
+	enum Kernel {
+		Scalar,
+		Sse2,
+		Avx,
+	};
+
+	// 実行中のCPUで使用できる最も速い実装
+	static Kernel bestKernel();
+	// 実装を実行中のCPUで使用できるか
+	static bool isSupported(Kernel kernel);
+	static const char* kernelName(Kernel kernel);
+
+	/**
+	 * 添字の範囲 [begin, end) のうち範囲が矩形と交差する（境界を含む）要素の添字を昇順でindexesに追加する
+	 */
+	static void select(const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+		int begin, int end, const DmRect& rect, QVector<int>& indexes);
+	// 実装を指定する（ベンチマーク用。使用できない実装はScalarで処理する）
+	static void select(Kernel kernel, const double* xMin, const double* yMin, const double* xMax, const double* yMax,
+		int begin, int end, const DmRect& rect, QVector<int>& indexes);
+};
+
+#endif // QGSDMBOXFILTER_H
@@ -0,0 +1,43 @@
+/***************************************************************************
+  qgsdmmemory.cpp -  Process memory usage
+  -------------------
+          begin                : March 2021
+          copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#include "qgsdmmemory.h"
+
+#ifdef Q_OS_WIN
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+qint64 DmMemory::peakBytes()
+{
+#ifdef Q_OS_WIN
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return static_cast<qint64>(counters.PeakWorkingSetSize);
+	return -1;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return -1;
+#ifdef Q_OS_MACOS
+	// macOSはバイト単位
+	return static_cast<qint64>(usage.ru_maxrss);
+#else
+	return static_cast<qint64>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+QString DmMemory::mebibytes(qint64 bytes)
+{
+	return bytes < 0 ? QStringLiteral("n/a") : QString::number(bytes / (1024.0 * 1024.0), 'f', 1) + QStringLiteral(" MiB");
+}
@@ -0,0 +1,24 @@
+/***************************************************************************
+      qgsdmmemory.h  -  Process memory usage
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMMEMORY_H
+#define QGSDMMEMORY_H
+
+#include <QString>
+
+/**
+ * プロセスのメモリ使用量（dmstatとベンチマークで使用する）
+ */
+class DmMemory {
+public:
+	// 最大常駐メモリ（バイト、不明の場合は-1）
+	static qint64 peakBytes();
+	// バイト数をMiBの表示にする（負の値は"n/a"）
+	static QString mebibytes(qint64 bytes);
+};
+
+#endif // QGSDMMEMORY_H
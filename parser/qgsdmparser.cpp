@@ -0,0 +1,2377 @@
+/***************************************************************************
+  qgsdmparser.cpp -  DM file parsing core
+  -------------------
+          begin                : March 2021
+          copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#include "qgsdmparser.h"
+#include "qgsdmboxfilter.h"
+
+#include <QtGlobal>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QTextCodec>
+#include <QThreadPool>
+#include <QVarLengthArray>
+#include <QtMath>
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// 3点を通る円の中心と半径を取得
+void calculateCircleCenterAndRadius(const DmCoords& points, Point2d& center, double& radius) {
+	double x1 = points.at(0).x();
+	double y1 = points.at(0).y();
+	double x2 = points.at(1).x();
+	double y2 = points.at(1).y();
+	double x3 = points.at(2).x();
+	double y3 = points.at(2).y();
+
+	double	d = 2.0 * ((y1 - y3) * (x1 - x2) - (y1 - y2) * (x1 - x3));
+	double	x = ((y1 - y3) * (qPow(y1, 2.0) - qPow(y2, 2.0) + qPow(x1, 2.0) - qPow(x2, 2.0)) - (y1 - y2) * (qPow(y1, 2.0) - qPow(y3, 2.0) + qPow(x1, 2.0) - qPow(x3, 2.0))) / d;
+	double	y = ((x1 - x3) * (qPow(x1, 2.0) - qPow(x2, 2.0) + qPow(y1, 2.0) - qPow(y2, 2.0)) - (x1 - x2) * (qPow(x1, 2.0) - qPow(x3, 2.0) + qPow(y1, 2.0) - qPow(y3, 2.0))) / -d;
+	center.setCoord(x, y);
+
+	radius = qSqrt(qPow((x - x1), 2.0) + qPow((y - y1), 2.0));
+}
+
+QString extractField(const DmRow & row, bool trim, int start, int count)
+{
+	DmRow field = row.mid(start, count);
+	if (field.isEmpty())
+		return QString();
+
+	QString result = QString::fromLatin1(field.data(), field.size());
+	if (trim)
+		return result.trimmed();
+	else
+		return result;
+}
+
+namespace
+{
+	inline bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+	}
+
+	// 前後の空白を除いた項目を取得する
+	DmRow trimmedField(const DmRow & row, int start, int count)
+	{
+		DmRow field = row.mid(start, count);
+		const char* begin = field.data();
+		const char* end = begin + field.size();
+		while (begin < end && isBlank(*begin))
+			begin++;
+		while (end > begin && isBlank(*(end - 1)))
+			end--;
+		return DmRow(begin, static_cast<int>(end - begin));
+	}
+
+	// 読込バッファを行に分割する
+	// 行末の改行（CR/LF）は含めない。返した行はバッファが有効な間参照できる
+	class DmBufferLineReader
+	{
+	public:
+		DmBufferLineReader(const char* data, qint64 size)
+			: mBegin(data)
+			, mCurrent(data)
+			, mEnd(data + size)
+		{}
+
+		bool atEnd() const { return mCurrent >= mEnd; }
+		qint64 pos() const { return mCurrent - mBegin; }
+		long lineCount() const { return mLineCount; }
+
+		DmRow readLine()
+		{
+			const char* lineBegin = mCurrent;
+			mLineCount++;
+			const char* lineEnd = static_cast<const char*>(memchr(mCurrent, '\n', mEnd - mCurrent));
+			if (lineEnd) {
+				mCurrent = lineEnd + 1;
+			}
+			else {
+				lineEnd = mEnd;
+				mCurrent = mEnd;
+			}
+			if (lineEnd > lineBegin && *(lineEnd - 1) == '\r')
+				lineEnd--;
+			return DmRow(lineBegin, static_cast<int>(lineEnd - lineBegin));
+		}
+
+	private:
+		const char* mBegin;
+		const char* mCurrent;
+		const char* mEnd;
+		long mLineCount = 0;
+	};
+
+	// QFileから行を読み込む（図郭レコードの調査用）
+	// 返した行はこのオブジェクトが有効な間参照できる
+	class DmFileLineReader
+	{
+	public:
+		explicit DmFileLineReader(QFile& file)
+			: mFile(file)
+		{}
+
+		bool atEnd() const { return mFile.atEnd(); }
+
+		DmRow readLine()
+		{
+			mLines.append(mFile.readLine());
+			return DmRow(mLines.last());
+		}
+
+	private:
+		QFile& mFile;
+		QByteArrayList mLines;
+	};
+}
+
+int extractInt(const DmRow & row, int start, int count, bool* ok)
+{
+	// QString::toInt()と同じく空文字列や数字以外を含む場合は失敗とする
+	DmRow field = trimmedField(row, start, count);
+	const char* p = field.data();
+	const char* end = p + field.size();
+
+	bool negative = false;
+	if (p < end && (*p == '+' || *p == '-')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	if (p == end) {
+		if (ok) *ok = false;
+		return 0;
+	}
+
+	int value = 0;
+	for (; p < end; p++) {
+		if (*p < '0' || *p > '9') {
+			if (ok) *ok = false;
+			return 0;
+		}
+		value = value * 10 + (*p - '0');
+	}
+
+	if (ok) *ok = true;
+	return negative ? -value : value;
+}
+
+double extractDouble(const DmRow & row, int start, int count, bool* ok)
+{
+	// 符号・整数部・小数部のみで15桁以内の数値は直接変換する
+	// （仮数が正確に表せるので10のべき乗で割った結果はtoDouble()と一致する）
+	static const double POWERS_OF_TEN[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15 };
+
+	DmRow field = trimmedField(row, start, count);
+	const char* p = field.data();
+	const char* end = p + field.size();
+
+	bool negative = false;
+	if (p < end && (*p == '+' || *p == '-')) {
+		negative = (*p == '-');
+		p++;
+	}
+
+	qint64 mantissa = 0;
+	int digits = 0;
+	int fractionDigits = 0;
+	bool hasPoint = false;
+	for (; p < end; p++) {
+		if (*p >= '0' && *p <= '9') {
+			mantissa = mantissa * 10 + (*p - '0');
+			digits++;
+			if (hasPoint)
+				fractionDigits++;
+		}
+		else if (*p == '.' && !hasPoint) {
+			hasPoint = true;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (p != end || digits > 15) {
+		// 指数表記などはQByteArrayで変換する
+		return field.toByteArray().toDouble(ok);
+	}
+
+	if (ok) *ok = digits > 0;
+	if (digits == 0)
+		return 0.0;
+	double value = static_cast<double>(mantissa) / POWERS_OF_TEN[fractionDigits];
+	return negative ? -value : value;
+}
+
+namespace
+{
+	// 属性レコード(E8)の属性コードと値を取得する
+	// 値は注記と同じく各データレコードの21桁目から64バイトずつ、ヘッダのデータ数のバイト数とする
+	// （データ数が0の場合はデータレコードの全て）。前後の空白を除き、空の場合はInvalidHandleを返す
+	DmTextPool::Handle extractAttributeValue(const DmRows & rows, DmTextPool & textPool, int & code)
+	{
+		const DmRow& header = rows[0];
+		bool ok = false;
+		code = extractInt(header, 2, 4, &ok);
+		if (!ok)
+			return DmTextPool::InvalidHandle;
+
+		int remaining = extractInt(header, 27, 4, &ok);
+		if (!ok || remaining <= 0)
+			remaining = (rows.count() - 1) * 64;
+
+		QVarLengthArray<char, 256> value;
+		for (int i = 1; i < rows.count() && remaining > 0; i++) {
+			DmRow part = rows[i].mid(20, qMin(64, remaining));
+			value.append(part.data(), part.size());
+			remaining -= 64;
+		}
+
+		const char* begin = value.constData();
+		const char* end = begin + value.size();
+		while (begin < end && isBlank(*begin))
+			begin++;
+		while (end > begin && isBlank(*(end - 1)))
+			end--;
+		if (begin == end)
+			return DmTextPool::InvalidHandle;
+
+		DmRow trimmed(begin, static_cast<int>(end - begin));
+		return textPool.intern(&trimmed, 1);
+	}
+}
+
+void DmRecordCounts::add(const DmRecordCounts & other)
+{
+	for (int i = 0; i < RecordTypeCount; i++)
+		mCounts[i] += other.mCounts[i];
+	mLineCount += other.mLineCount;
+	mByteCount += other.mByteCount;
+}
+
+void DmRecordCounts::clear()
+{
+	for (int i = 0; i < RecordTypeCount; i++)
+		mCounts[i] = 0;
+	mLineCount = 0;
+	mByteCount = 0;
+}
+
+DmRecordCounts::RecordType DmRecordCounts::recordType(char c0, char c1)
+{
+	if (c0 == 'E') {
+		if (c1 >= '1' && c1 <= '8')
+			return static_cast<RecordType>(Element1 + (c1 - '1'));
+		return Other;
+	}
+	if (c1 != ' ')
+		return Other;
+
+	switch (c0) {
+	case 'I':
+		return Index;
+	case 'M':
+		return Mesh;
+	case 'H':
+		return Header;
+	case 'G':
+		return Grid;
+	case 'T':
+		return Tin;
+	default:
+		return Other;
+	}
+}
+
+QString DmRecordCounts::recordTypeName(RecordType type)
+{
+	switch (type) {
+	case Index:
+		return QStringLiteral("I");
+	case Mesh:
+		return QStringLiteral("M");
+	case Header:
+		return QStringLiteral("H");
+	case Grid:
+		return QStringLiteral("G");
+	case Tin:
+		return QStringLiteral("T");
+	case Other:
+	case RecordTypeCount:
+		break;
+	default:
+		return QStringLiteral("E%1").arg(type - Element1 + 1);
+	}
+	return QStringLiteral("?");
+}
+
+DmReader::DmReader()
+	: mArena(std::make_shared<DmArena>())
+{
+}
+
+QStringList DmReader::dmFilePaths(const QString & dirPath)
+{
+	QStringList paths;
+	if (dirPath.isEmpty()) {
+		return paths;
+	}
+
+	QDir dmDir(dirPath);
+	const QStringList dmFiles = dmDir.entryList(QStringList() << "*.dm", QDir::Files);
+	for (const QString& dmFile : dmFiles) {
+		paths.append(dmDir.filePath(dmFile));
+	}
+	return paths;
+}
+
+QStringList DmReader::dmDirectories(const QString & rootPath)
+{
+	QStringList directories;
+	if (rootPath.isEmpty() || !QDir(rootPath).exists()) {
+		return directories;
+	}
+
+	if (!dmFilePaths(rootPath).isEmpty())
+		directories.append(QDir(rootPath).path());
+
+	QStringList subDirectories;
+	QDirIterator it(rootPath, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+	while (it.hasNext()) {
+		const QString dirPath = it.next();
+		if (!QDir(dirPath).entryList(QStringList() << "*.dm", QDir::Files).isEmpty())
+			subDirectories.append(dirPath);
+	}
+	// 走査の順はファイルシステムに依存するので並べ替える
+	subDirectories.sort();
+	directories.append(subDirectories);
+	return directories;
+}
+
+qint64 DmReader::totalBytes(const QStringList & filePaths)
+{
+	qint64 total = 0;
+	for (const QString& filePath : filePaths) {
+		total += QFileInfo(filePath).size();
+	}
+	return total;
+}
+
+void DmReader::clear()
+{
+	//mIndexes.clear();
+	mMeshes.clear();
+	//mHeaders.clear();
+	mPolygons.clear();
+	mLines.clear();
+	mCircles.clear();
+	mArcs.clear();
+	mPoints.clear();
+	mDirections.clear();
+	mNotes.clear();
+	mTextPool.clear();
+	for (DmAttributeTable& table : mAttributes)
+		table.clear();
+	for (DmElementGroups& groups : mGroups)
+		groups.clear();
+	for (DmElementCodes& codes : mCodes)
+		codes.clear();
+	for (DmLevelsOfDetail& levels : mLevelsOfDetail)
+		levels.clear();
+	for (DmPointCoords& coords : mPointCoords)
+		coords.clear();
+	for (DmElementExtents& extents : mExtents)
+		extents.clear();
+	// 他のDmReaderと共有している場合は座標列が参照されているので新しいアリーナにする
+	if (mArena.use_count() == 1)
+		mArena->clear();
+	else
+		mArena = std::make_shared<DmArena>();
+	mGrids.clear();
+	mTin.clear();
+
+	mBytesTotal = 0;
+	mBytesRead = 0;
+	mElementsDecoded = 0;
+}
+
+namespace
+{
+	// データ種別に対応する要素レコードの番号-1（要素でない場合は-1）
+	int elementTypeIndex(const QString & dataType)
+	{
+		static const char* const DATA_TYPES[] = { "dm_pg", "dm_pl", "dm_cir", "dm_arc", "dm_pt", "dm_dir", "dm_tx" };
+		for (int i = 0; i < 7; i++) {
+			if (dataType == QLatin1String(DATA_TYPES[i]))
+				return i;
+		}
+		return -1;
+	}
+}
+
+const DmAttributeTable & DmReader::attributes(const QString & dataType) const
+{
+	static const DmAttributeTable sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 ? sEmpty : mAttributes[index];
+}
+
+const DmElementGroups & DmReader::groups(const QString & dataType) const
+{
+	static const DmElementGroups sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 ? sEmpty : mGroups[index];
+}
+
+const DmElementCodes & DmReader::codes(const QString & dataType) const
+{
+	static const DmElementCodes sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 ? sEmpty : mCodes[index];
+}
+
+void DmReader::buildLevelsOfDetail()
+{
+	// 前回までに作成した要素は処理しない
+	DmArena& arena = *mArena;
+	for (int i = mLevelsOfDetail[0].count(); i < mPolygons.count(); i++)
+		mLevelsOfDetail[0].append(mPolygons.at(i).points(), true, arena);
+	for (int i = mLevelsOfDetail[1].count(); i < mLines.count(); i++)
+		mLevelsOfDetail[1].append(mLines.at(i).points(), false, arena);
+	for (int i = mLevelsOfDetail[2].count(); i < mCircles.count(); i++)
+		mLevelsOfDetail[2].append(mCircles.at(i).points(), false, arena);
+	for (int i = mLevelsOfDetail[3].count(); i < mArcs.count(); i++)
+		mLevelsOfDetail[3].append(mArcs.at(i).points(), false, arena);
+}
+
+const DmLevelsOfDetail & DmReader::levelsOfDetail(const QString & dataType) const
+{
+	static const DmLevelsOfDetail sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 || index >= 4 ? sEmpty : mLevelsOfDetail[index];
+}
+
+const DmPointCoords & DmReader::pointCoords(const QString & dataType) const
+{
+	static const DmPointCoords sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 4 ? sEmpty : mPointCoords[index - 4];
+}
+
+const DmElementExtents & DmReader::extents(const QString & dataType) const
+{
+	static const DmElementExtents sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 || index >= 4 ? sEmpty : mExtents[index];
+}
+
+template<class LineReader>
+DmMesh DmReader::readMesh(LineReader & reader, const DmRow & line, int overwritingTimes)
+{
+	QVarLengthArray<DmRow, 16> rows;
+	rows.append(line);
+
+	// 図郭の修正回数を決定する
+	// 新規の場合0
+	int recModCount = extractInt(line, 65, 2);
+	int modCount = overwritingTimes < 0 ? recModCount : qMin(recModCount, overwritingTimes);
+	// 図郭レコード(b)を読み込む
+	if (!reader.atEnd()) rows.append(reader.readLine());
+	// 図郭レコード(c)を読み込む
+	if (!reader.atEnd()) rows.append(reader.readLine());
+
+	// 図郭レコード(d)(e)(f)を新規+修正回数分読み込む
+	int modIndex = 0;
+	QList<int> fcountList;
+	while (!reader.atEnd() && (modIndex < (recModCount + 1)))
+	{
+		// 図郭レコード(d)を読み込む
+		DmRow temp_row = reader.readLine();
+		rows.append(temp_row);
+		// 撮影コースレコード(図郭レコード(f))数を算出する
+		int courseRecordCount = extractInt(temp_row, 9, 1);
+		if (reader.atEnd())
+			break;
+		fcountList.append(courseRecordCount);
+		// 図郭レコード(e)を読み込む
+		rows.append(reader.readLine());
+		// 図郭レコード(f)を読み込む
+		int courseRecordIndex = 0;
+		while (!reader.atEnd() && (courseRecordIndex < courseRecordCount)) {
+			rows.append(reader.readLine());
+			courseRecordIndex++;
+		}
+
+		modIndex++;
+	}
+	return DmMesh(DmRows(rows.constData(), rows.count()), modCount, fcountList);
+}
+
+bool DmReader::readFile(const QString & filePath, DmParseFeedback* feedback, DmRecordCounts* recordCounts)
+{
+	// 改行は行分割時に除去するのでテキストモードでは開かない
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	// ファイル全体をマップして行単位にコピーせずに解析する
+	// マップできない場合は一括で読み込む
+	QByteArray buffer;
+	qint64 size = file.size();
+	const char* data = reinterpret_cast<const char*>(size > 0 ? file.map(0, size) : nullptr);
+	if (!data) {
+		buffer = file.readAll();
+		data = buffer.constData();
+		size = buffer.size();
+	}
+	DmBufferLineReader reader(data, size);
+
+	// 読込前のバイト数（進捗通知用）
+	qint64 bytesBefore = mBytesRead;
+	long elementsBefore = mElementsDecoded;
+
+	// レコードの作業領域（要素ごとに再利用する）
+	QVector<DmRow> rows;
+	rows.reserve(64);
+
+	// 属性レコードを付加する直前の要素（要素レコードの番号1～7、0は対象なし）
+	int attributeTarget = 0;
+	int attributeIndex = -1;
+	// 直前のグループヘッダレコードのレイヤコードと要素グループコード
+	quint32 groupCode = 0;
+
+	while (!reader.atEnd()) {
+		DmRow line = reader.readLine();
+
+		// レコードタイプを確認
+		char recordType[2] = { line.size() > 0 ? line.at(0) : '\0', line.size() > 1 ? line.at(1) : '\0' };
+
+		if (recordCounts)
+			recordCounts->mCounts[DmRecordCounts::recordType(recordType[0], recordType[1])]++;
+
+		rows.resize(0);
+		rows.append(line);
+
+		if (recordType[0] == 'I' && recordType[1] == ' ') {
+			// インデックス
+			// 図郭識別番号レコード数
+			int recordCount = extractInt(line, 37, 2);
+			int index = 0;
+			while (!reader.atEnd() && index < recordCount)
+			{
+				rows.append(reader.readLine());
+				index++;
+			}
+			//mIndexes.append(rows);
+
+		}
+		else if (recordType[0] == 'M' && recordType[1] == ' ') {
+			// 図郭
+			// キャンセルと進捗は図郭単位で確認する
+			mBytesRead = bytesBefore + reader.pos();
+			if (feedback) {
+				if (feedback->isCanceled()) {
+					file.close();
+					return false;
+				}
+				if (mBytesTotal > 0)
+					feedback->setProgress(100.0 * mBytesRead / mBytesTotal);
+				if (!mMeshes.isEmpty())
+					feedback->meshCompleted();
+			}
+
+			mMeshes.append(readMesh(reader, line, mOverwritingTimes));
+			attributeTarget = 0;
+			groupCode = 0;
+		}
+		else if (recordType[0] == 'H' && recordType[1] == ' ') {
+			// グループヘッダレコード（レイヤヘッダレコード及び要素グループヘッダレコード）
+			// レイヤコードは3～6桁目、グループコードは7～8桁目（地物数の各欄と同じく桁の区切りに合わせる）
+			groupCode = DmElementGroups::pack(extractInt(line, 2, 4), extractInt(line, 6, 2));
+		}
+		else if (recordType[0] == 'E' && recordType[1] >= '0' && recordType[1] <= '9') {
+			// 要素レコード
+
+			int recordCount = extractInt(line, 31, 4);
+			for (int i = 0; (i < recordCount && !reader.atEnd()); i++)
+			{
+				rows.append(reader.readLine());
+			}
+			const DmRows elementRows(rows.constData(), rows.count());
+			DmArena& arena = *mArena;
+
+			// 収集しない要素の後の属性レコードは読み飛ばす
+			if (recordType[1] != '8')
+				attributeTarget = 0;
+
+			switch (recordType[1]) {
+			case '1':
+				// 面
+				if (mDataType.isEmpty() || mDataType == "dm_pg") {
+					mPolygons.append(DmPolygon(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 1;
+					attributeIndex = mPolygons.count() - 1;
+					mGroups[0].append(groupCode);
+					mCodes[0].append(mPolygons.last().dmcode());
+					mExtents[0].append(mPolygons.last().points());
+				}
+				break;
+			case '2':
+				// 線
+				if (mDataType.isEmpty() || mDataType == "dm_pl") {
+					mLines.append(DmLine(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 2;
+					attributeIndex = mLines.count() - 1;
+					mGroups[1].append(groupCode);
+					mCodes[1].append(mLines.last().dmcode());
+					mExtents[1].append(mLines.last().points());
+				}
+				break;
+			case '3':
+				// 円
+				if (mDataType.isEmpty() || mDataType == "dm_cir") {
+					mCircles.append(DmCircle(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 3;
+					attributeIndex = mCircles.count() - 1;
+					mGroups[2].append(groupCode);
+					mCodes[2].append(mCircles.last().dmcode());
+					mExtents[2].append(mCircles.last().points());
+				}
+				break;
+			case '4':
+				// 円弧
+				if (mDataType.isEmpty() || mDataType == "dm_arc") {
+					mArcs.append(DmArc(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 4;
+					attributeIndex = mArcs.count() - 1;
+					mGroups[3].append(groupCode);
+					mCodes[3].append(mArcs.last().dmcode());
+					mExtents[3].append(mArcs.last().points());
+				}
+				break;
+			case '5':
+				// 点
+				if (mDataType.isEmpty() || mDataType == "dm_pt") {
+					mPoints.append(DmPoint(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 5;
+					attributeIndex = mPoints.count() - 1;
+					mGroups[4].append(groupCode);
+					mCodes[4].append(mPoints.last().dmcode());
+					mPointCoords[0].append(mPoints.last().points());
+				}
+				break;
+			case '6':
+				// 方向
+				if(mDataType.isEmpty() || mDataType == "dm_dir") {
+					mDirections.append(DmDirection(elementRows, mMeshes.last(), arena));
+					mElementsDecoded++;
+					attributeTarget = 6;
+					attributeIndex = mDirections.count() - 1;
+					mGroups[5].append(groupCode);
+					mCodes[5].append(mDirections.last().dmcode());
+					mPointCoords[1].append(mDirections.last().points());
+				}
+				break;
+			case '7':
+				// 注記
+				if(mDataType.isEmpty() || mDataType == "dm_tx") {
+					mNotes.append(DmNote(elementRows, mMeshes.last(), arena, mTextPool));
+					mElementsDecoded++;
+					attributeTarget = 7;
+					attributeIndex = mNotes.count() - 1;
+					mGroups[6].append(groupCode);
+					mCodes[6].append(mNotes.last().dmcode());
+					mPointCoords[2].append(mNotes.last().points());
+				}
+				break;
+			case '8':
+				// 属性
+				if (attributeTarget > 0) {
+					int code = 0;
+					DmTextPool::Handle handle = extractAttributeValue(elementRows, mTextPool, code);
+					if (handle != DmTextPool::InvalidHandle)
+						mAttributes[attributeTarget - 1].setValue(attributeIndex, code, handle, mTextPool.text(handle));
+				}
+				break;
+			}
+		}
+		else if (recordType[0] == 'G' && recordType[1] == ' ') {
+			// グリッド
+			int recordCount = extractInt(line, 26, 4);
+			for (int i = 0; i < recordCount; i++)
+			{
+				if (reader.atEnd()) break;
+				rows.append(reader.readLine());
+			}
+			if ((mDataType.isEmpty() || mDataType == "dm_grid") && !mMeshes.isEmpty()) {
+				DmGrid grid(DmRows(rows.constData(), rows.count()), mMeshes.last());
+				if (grid.isValid()) {
+					mGrids.append(grid);
+					mElementsDecoded++;
+				}
+			}
+		}
+		else if (recordType[0] == 'T' && recordType[1] == ' ') {
+			// 不整三角網
+			int recordCount = extractInt(line, 26, 6);
+			bool collect = (mDataType.isEmpty() || mDataType == "dm_tin") && !mMeshes.isEmpty();
+			if (collect)
+				rows.reserve(recordCount + 1);
+			for (int i = 0; i < recordCount; i++)
+			{
+				if (reader.atEnd()) break;
+				rows.append(reader.readLine());
+			}
+			if (collect) {
+				mTin.append(DmRows(rows.constData(), rows.count()), mMeshes.last());
+				mElementsDecoded++;
+			}
+		}
+	}
+	file.close();
+
+	if (recordCounts) {
+		recordCounts->mLineCount += reader.lineCount();
+		recordCounts->mByteCount += size;
+	}
+
+	mBytesRead = bytesBefore + file.size();
+	if (feedback && mBytesTotal > 0)
+		feedback->setProgress(100.0 * mBytesRead / mBytesTotal);
+	DmDebugMsgLevel(QStringLiteral("%1: %2 bytes, %3 elements decoded").arg(filePath).arg(file.size()).arg(mElementsDecoded - elementsBefore), 2);
+
+	return true;
+}
+
+namespace
+{
+	// DMファイルのレコードを読み飛ばす
+	// レコードが固定長の場合は読み込まずにシークする
+	class DmRecordSkipper
+	{
+	public:
+		explicit DmRecordSkipper(QFile& file)
+			: mFile(file)
+		{}
+
+		QByteArray readLine()
+		{
+			QByteArray line = mFile.readLine();
+			if (mRecordLength < 0) {
+				mRecordLength = line.size();
+			}
+			else if (mRecordLength != line.size() && !mFile.atEnd()) {
+				// 可変長なのでシークしない
+				mRecordLength = 0;
+			}
+			return line;
+		}
+
+		void skip(int count)
+		{
+			if (count <= 0)
+				return;
+
+			if (mRecordLength > 0) {
+				qint64 pos = mFile.pos();
+				qint64 target = pos + mRecordLength * count;
+				if (target >= mFile.size()) {
+					mFile.seek(mFile.size());
+					return;
+				}
+				// 直前の文字が改行で、既知のレコードタイプで始まればレコードの先頭に位置している
+				char c = 0;
+				if (mFile.seek(target - 1) && mFile.getChar(&c) && c == '\n') {
+					const QByteArray recordType = mFile.peek(2);
+					if (recordType.size() == 2 && DmRecordCounts::recordType(recordType.at(0), recordType.at(1)) != DmRecordCounts::Other) {
+						return;
+					}
+				}
+				mRecordLength = 0;
+				mFile.seek(pos);
+			}
+
+			for (int i = 0; i < count && !mFile.atEnd(); i++) {
+				mFile.readLine();
+			}
+		}
+
+	private:
+		QFile& mFile;
+		// -1:未確定 0:可変長
+		qint64 mRecordLength = -1;
+	};
+}
+
+bool DmReader::surveyFile(const QString & filePath, DmSurvey & survey) const
+{
+	// シークするためテキストモードでは開かない
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	DmRecordSkipper skipper(file);
+	// グリッドの位置の基準とする直前の図郭
+	DmMesh mesh;
+	bool hasMesh = false;
+	// 属性レコードを付加する直前の要素（要素レコードの番号1～7、0は対象なし）
+	int attributeTarget = 0;
+	// 属性値の型の判定に使用する（ファイルごと）
+	DmTextPool textPool;
+	QVector<QByteArray> lines;
+	QVector<DmRow> rows;
+
+	while (!file.atEnd()) {
+		QByteArray line = skipper.readLine();
+		QByteArray recordType = line.left(2);
+
+		if (recordType == "I ") {
+			// インデックス
+			skipper.skip(extractInt(line, 37, 2));
+		}
+		else if (recordType == "M ") {
+			// 図郭
+			DmFileLineReader meshReader(file);
+			mesh = readMesh(meshReader, line, mOverwritingTimes);
+			hasMesh = true;
+			survey.mExtent.combine(mesh.extent());
+			survey.mMeshCount++;
+			attributeTarget = 0;
+		}
+		else if (recordType == "H ") {
+			// グループヘッダレコード
+			survey.mFeatureCounts["dm_pg"] += extractInt(line, 28, 5);
+			survey.mFeatureCounts["dm_pl"] += extractInt(line, 33, 5);
+			survey.mFeatureCounts["dm_cir"] += extractInt(line, 38, 5);
+			survey.mFeatureCounts["dm_arc"] += extractInt(line, 43, 5);
+			survey.mFeatureCounts["dm_pt"] += extractInt(line, 48, 5);
+			survey.mFeatureCounts["dm_dir"] += extractInt(line, 53, 5);
+			survey.mFeatureCounts["dm_tx"] += extractInt(line, 58, 5);
+		}
+		else if (recordType.size() == 2 && recordType.at(0) == 'E' && isdigit(static_cast<unsigned char>(recordType.at(1)))) {
+			// 要素レコード
+			int recordCount = extractInt(line, 31, 4);
+			const char elementType = recordType.at(1);
+			if (elementType != '8') {
+				attributeTarget = (elementType >= '1' && elementType <= '7') ? elementType - '0' : 0;
+				skipper.skip(recordCount);
+			}
+			else if (attributeTarget > 0) {
+				// 属性レコードは値を読み込んで列の型を決める（DmReader::readFile()と同じ列・型とする）
+				lines.resize(0);
+				lines.append(line);
+				for (int i = 0; i < recordCount && !file.atEnd(); i++)
+					lines.append(skipper.readLine());
+				rows.resize(0);
+				for (const QByteArray& record : qAsConst(lines))
+					rows.append(DmRow(record));
+
+				int code = 0;
+				DmTextPool::Handle handle = extractAttributeValue(DmRows(rows.constData(), rows.count()), textPool, code);
+				if (handle != DmTextPool::InvalidHandle)
+					survey.addAttributeValue(attributeTarget - 1, code, textPool.text(handle));
+			}
+			else {
+				skipper.skip(recordCount);
+			}
+		}
+		else if (recordType == "G ") {
+			// グリッド
+			if (hasMesh) {
+				DmGrid grid(DmRow(line.constData(), line.size()), mesh);
+				if (grid.isValid())
+					survey.mGrids.append(grid);
+			}
+			skipper.skip(extractInt(line, 26, 4));
+		}
+		else if (recordType == "T ") {
+			// 不整三角網
+			skipper.skip(extractInt(line, 26, 6));
+		}
+	}
+	file.close();
+
+	survey.mFileCount++;
+
+	return true;
+}
+
+bool DmReader::catalogFile(const QString & filePath, DmCatalog & catalog) const
+{
+	// シークするためテキストモードでは開かない
+	QFile file(filePath);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	const QFileInfo info(filePath);
+	DmCatalog::File entry;
+	entry.path = filePath;
+	entry.directory = info.path();
+	entry.size = info.size();
+	entry.modified = info.lastModified().toMSecsSinceEpoch();
+
+	DmRecordSkipper skipper(file);
+	while (!file.atEnd()) {
+		QByteArray line = skipper.readLine();
+		if (line.size() < 2)
+			continue;
+
+		const char c0 = line.at(0);
+		const char c1 = line.at(1);
+		if (c0 == 'I' && c1 == ' ') {
+			// インデックス
+			// 図郭識別番号レコードは8桁の図郭識別番号を並べたものとする
+			int recordCount = extractInt(line, 37, 2);
+			for (int i = 0; i < recordCount && !file.atEnd(); i++) {
+				QByteArray record = skipper.readLine();
+				for (int start = 0; start + 8 <= record.size(); start += 8) {
+					QString id = extractField(DmRow(record), true, start, 8);
+					if (!id.isEmpty())
+						entry.indexedMeshIds.append(id);
+				}
+			}
+		}
+		else if (c0 == 'M' && c1 == ' ') {
+			// 図郭
+			DmCatalog::Mesh mesh;
+			mesh.id = extractField(DmRow(line), true, 2, 8);
+			DmFileLineReader meshReader(file);
+			mesh.extent = readMesh(meshReader, line, mOverwritingTimes).extent();
+			entry.extent.combine(mesh.extent);
+			entry.meshes.append(mesh);
+		}
+		else if (c0 == 'H' && c1 == ' ') {
+			// グループヘッダレコード（DmReader::surveyFile()と同じ桁）
+			entry.featureCounts["dm_pg"] += extractInt(line, 28, 5);
+			entry.featureCounts["dm_pl"] += extractInt(line, 33, 5);
+			entry.featureCounts["dm_cir"] += extractInt(line, 38, 5);
+			entry.featureCounts["dm_arc"] += extractInt(line, 43, 5);
+			entry.featureCounts["dm_pt"] += extractInt(line, 48, 5);
+			entry.featureCounts["dm_dir"] += extractInt(line, 53, 5);
+			entry.featureCounts["dm_tx"] += extractInt(line, 58, 5);
+		}
+		else if (c0 == 'E' && c1 >= '0' && c1 <= '9') {
+			skipper.skip(extractInt(line, 31, 4));
+		}
+		else if (c0 == 'G' && c1 == ' ') {
+			skipper.skip(extractInt(line, 26, 4));
+		}
+		else if (c0 == 'T' && c1 == ' ') {
+			skipper.skip(extractInt(line, 26, 6));
+		}
+	}
+	file.close();
+
+	catalog.append(entry);
+	return true;
+}
+
+namespace
+{
+	// 1つのディレクトリのカタログを作成する（DmReader::catalogDirectories()で使用）
+	class DmCatalogTask : public QRunnable
+	{
+	public:
+		DmCatalogTask(const DmReader& reader, const QString& dirPath, const DmCatalog& manifest, DmCatalog& catalog, QAtomicInt& filesRead)
+			: mReader(reader)
+			, mDirPath(dirPath)
+			, mManifest(manifest)
+			, mCatalog(catalog)
+			, mFilesRead(filesRead)
+		{
+			setAutoDelete(true);
+		}
+
+		void run() override
+		{
+			const QStringList filePaths = DmReader::dmFilePaths(mDirPath);
+			for (const QString& filePath : filePaths) {
+				// 変更されていないファイルはマニフェストの内容を使う
+				const DmCatalog::File* cached = mManifest.file(filePath);
+				if (cached) {
+					const QFileInfo info(filePath);
+					if (cached->size == info.size() && cached->modified == info.lastModified().toMSecsSinceEpoch()) {
+						mCatalog.append(*cached);
+						continue;
+					}
+				}
+				if (mReader.catalogFile(filePath, mCatalog))
+					mFilesRead.ref();
+				else
+					DmDebugMsg(QStringLiteral("DM file %1 could not be cataloged").arg(filePath));
+			}
+		}
+
+	private:
+		const DmReader& mReader;
+		QString mDirPath;
+		const DmCatalog& mManifest;
+		DmCatalog& mCatalog;
+		QAtomicInt& mFilesRead;
+	};
+}
+
+int DmReader::catalogDirectories(const QStringList & dirPaths, DmCatalog & catalog, const DmCatalog & manifest) const
+{
+	// ディレクトリごとに別のカタログに作成し、最後にディレクトリの順に結合する
+	QVector<DmCatalog> catalogs(dirPaths.count());
+	QAtomicInt filesRead(0);
+	QThreadPool pool;
+	for (int i = 0; i < dirPaths.count(); i++)
+		pool.start(new DmCatalogTask(*this, dirPaths.at(i), manifest, catalogs[i], filesRead));
+	pool.waitForDone();
+
+	for (const DmCatalog& directoryCatalog : qAsConst(catalogs)) {
+		for (const DmCatalog::File& file : directoryCatalog.files())
+			catalog.append(file);
+	}
+	return filesRead.load();
+}
+
+int DmCatalog::meshCount() const
+{
+	int count = 0;
+	for (const File& file : mFiles)
+		count += file.meshes.count();
+	return count;
+}
+
+QStringList DmCatalog::filePaths() const
+{
+	QStringList paths;
+	for (const File& file : mFiles)
+		paths.append(file.path);
+	return paths;
+}
+
+QStringList DmCatalog::filePaths(const DmRect & area) const
+{
+	QStringList paths;
+	for (const File& file : mFiles) {
+		if (!file.extent.intersects(area))
+			continue;
+		for (const Mesh& mesh : file.meshes) {
+			if (mesh.extent.intersects(area)) {
+				paths.append(file.path);
+				break;
+			}
+		}
+	}
+	return paths;
+}
+
+const DmCatalog::File * DmCatalog::file(const QString & path) const
+{
+	auto it = mFileIndex.constFind(path);
+	if (it == mFileIndex.constEnd())
+		return nullptr;
+	return &mFiles.at(it.value());
+}
+
+QList<int> DmCatalog::directories(const DmRect & area) const
+{
+	QList<int> directories;
+	for (int i = 0; i < mFiles.count(); i++) {
+		const File& file = mFiles.at(i);
+		int directory = mFileDirectories.at(i);
+		if (!directories.isEmpty() && directories.last() == directory)
+			continue;
+		if (!file.extent.intersects(area))
+			continue;
+		for (const Mesh& mesh : file.meshes) {
+			if (mesh.extent.intersects(area)) {
+				if (!directories.contains(directory))
+					directories.append(directory);
+				break;
+			}
+		}
+	}
+	return directories;
+}
+
+QStringList DmCatalog::filePaths(int directory) const
+{
+	QStringList paths;
+	for (int i = 0; i < mFiles.count(); i++) {
+		if (mFileDirectories.at(i) == directory)
+			paths.append(mFiles.at(i).path);
+	}
+	return paths;
+}
+
+long DmCatalog::featureCount(const QString & dataType) const
+{
+	long count = 0;
+	for (const File& file : mFiles)
+		count += file.featureCounts.value(dataType, 0);
+	return count;
+}
+
+void DmCatalog::append(const File & file)
+{
+	int directory = mDirectoryIndex.value(file.directory, -1);
+	if (directory < 0) {
+		directory = mDirectories.count();
+		mDirectories.append(file.directory);
+		mDirectoryIndex.insert(file.directory, directory);
+	}
+
+	mFileIndex.insert(file.path, mFiles.count());
+	mFileDirectories.append(directory);
+	mFiles.append(file);
+	mExtent.combine(file.extent);
+}
+
+void DmCatalog::clear()
+{
+	mFiles.clear();
+	mExtent = DmRect();
+	mFileIndex.clear();
+	mDirectories.clear();
+	mDirectoryIndex.clear();
+	mFileDirectories.clear();
+}
+
+namespace
+{
+	// マニフェストの識別子と形式の版
+	const quint32 MANIFEST_MAGIC = 0x444D4354; // "DMCT"
+	const quint32 MANIFEST_VERSION = 1;
+
+	QDataStream& operator<<(QDataStream& out, const DmRect& rect)
+	{
+		out << rect.isNull() << rect.xMinimum() << rect.yMinimum() << rect.xMaximum() << rect.yMaximum();
+		return out;
+	}
+
+	QDataStream& operator>>(QDataStream& in, DmRect& rect)
+	{
+		bool isNull = true;
+		double xMin = 0, yMin = 0, xMax = 0, yMax = 0;
+		in >> isNull >> xMin >> yMin >> xMax >> yMax;
+		rect = isNull ? DmRect() : DmRect(xMin, yMin, xMax, yMax);
+		return in;
+	}
+}
+
+bool DmCatalog::save(const QString & path, int overwritingTimes) const
+{
+	// 書込の途中で失敗しても前回のマニフェストを壊さない
+	QSaveFile file(path);
+	if (!file.open(QIODevice::WriteOnly))
+		return false;
+
+	QDataStream out(&file);
+	out.setVersion(QDataStream::Qt_5_9);
+	out << MANIFEST_MAGIC << MANIFEST_VERSION << static_cast<qint32>(overwritingTimes) << static_cast<qint32>(mFiles.count());
+	for (const File& entry : mFiles) {
+		out << entry.path << entry.size << entry.modified << entry.indexedMeshIds;
+		out << static_cast<qint32>(entry.meshes.count());
+		for (const Mesh& mesh : entry.meshes)
+			out << mesh.id << mesh.extent;
+		out << entry.extent;
+		out << static_cast<qint32>(entry.featureCounts.count());
+		for (auto it = entry.featureCounts.constBegin(); it != entry.featureCounts.constEnd(); ++it)
+			out << it.key() << static_cast<qint64>(it.value());
+	}
+	if (out.status() != QDataStream::Ok) {
+		file.cancelWriting();
+		return false;
+	}
+	return file.commit();
+}
+
+bool DmCatalog::load(const QString & path, int overwritingTimes)
+{
+	clear();
+
+	QFile file(path);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	QDataStream in(&file);
+	in.setVersion(QDataStream::Qt_5_9);
+	quint32 magic = 0, version = 0;
+	qint32 savedOverwritingTimes = 0, fileCount = 0;
+	in >> magic >> version >> savedOverwritingTimes >> fileCount;
+	if (magic != MANIFEST_MAGIC || version != MANIFEST_VERSION || savedOverwritingTimes != overwritingTimes || fileCount < 0)
+		return false;
+
+	for (qint32 i = 0; i < fileCount && in.status() == QDataStream::Ok; i++) {
+		File entry;
+		in >> entry.path >> entry.size >> entry.modified >> entry.indexedMeshIds;
+		entry.directory = QFileInfo(entry.path).path();
+		qint32 meshCount = 0;
+		in >> meshCount;
+		for (qint32 m = 0; m < meshCount && in.status() == QDataStream::Ok; m++) {
+			Mesh mesh;
+			in >> mesh.id >> mesh.extent;
+			entry.meshes.append(mesh);
+		}
+		in >> entry.extent;
+		qint32 countCount = 0;
+		in >> countCount;
+		for (qint32 n = 0; n < countCount && in.status() == QDataStream::Ok; n++) {
+			QString dataType;
+			qint64 count = 0;
+			in >> dataType >> count;
+			entry.featureCounts.insert(dataType, static_cast<long>(count));
+		}
+		append(entry);
+	}
+
+	if (in.status() != QDataStream::Ok) {
+		// 壊れたマニフェストは使わない
+		clear();
+		return false;
+	}
+	return true;
+}
+
+const QVector<DmSurvey::AttributeColumn>& DmSurvey::attributeColumns(const QString & dataType) const
+{
+	static const QVector<AttributeColumn> sEmpty;
+	int index = elementTypeIndex(dataType);
+	return index < 0 ? sEmpty : mAttributeColumns[index];
+}
+
+void DmSurvey::addAttributeValue(int elementType, int code, const QString & text)
+{
+	// DmAttributeTableと同じく属性コードの出現順の列とし、型は値に合わせて広げる
+	const DmAttributeColumn::Type type = DmAttributeColumn::valueType(text);
+	int index = mAttributeColumnIndexes[elementType].value(code, -1);
+	if (index < 0) {
+		mAttributeColumnIndexes[elementType].insert(code, mAttributeColumns[elementType].count());
+		mAttributeColumns[elementType].append(AttributeColumn{ code, type });
+	}
+	else if (type > mAttributeColumns[elementType].at(index).type) {
+		mAttributeColumns[elementType][index].type = type;
+	}
+}
+
+void DmSurvey::clear()
+{
+	mFeatureCounts.clear();
+	mGrids.clear();
+	for (int i = 0; i < 7; i++) {
+		mAttributeColumns[i].clear();
+		mAttributeColumnIndexes[i].clear();
+	}
+	mExtent = DmRect();
+	mMeshCount = 0;
+	mFileCount = 0;
+}
+
+
+DmMesh::DmMesh(const DmRows & rows, int modifiedCount, const QList<int>& fCountList)
+{
+	// 地図情報レベル
+	mLevel = extractInt(rows.at(0), 30, 5);
+	// 座標値の単位
+	setTani(extractInt(rows.at(1), 44, 3));
+	
+	// 端数単位
+	double fractionUnit = (mLevel < 2500) ? 0.001 : 0.01;
+	
+	// 図郭レコード(d)(e)(f)は新規+修正回数分繰り返しているので最終修正回の図郭レコード(e)レコードから抽出する
+	int lastEIndex = 4;
+	for (int modifiedIndex = 0; modifiedIndex < modifiedCount; modifiedIndex++)
+	{
+		lastEIndex += (2 + fCountList.at(modifiedIndex));
+	}
+
+	// 左下図郭の端数座標
+	double fractionX = extractDouble(rows.at(lastEIndex), 40, 4) * fractionUnit;
+	double fractionY = extractDouble(rows.at(lastEIndex), 44, 4) * fractionUnit;
+	// 左下図郭の座標を完成する
+	double x = extractDouble(rows.at(1), 7, 7) + fractionY;
+	double y = extractDouble(rows.at(1), 0, 7) + fractionX;
+	// 原点を算出
+	mOriginPoint.setCoord(x, y);
+
+	// 右上図郭の端数座標
+	double fractionTopX = extractDouble(rows.at(lastEIndex), 48, 4) * fractionUnit;
+	double fractionTopY = extractDouble(rows.at(lastEIndex), 52, 4) * fractionUnit;
+	// 右上図郭の座標
+	double topX = extractDouble(rows.at(1), 21, 7) + fractionTopY;
+	double topY = extractDouble(rows.at(1), 14, 7) + fractionTopX;
+	if (topX > x && topY > y) {
+		mExtent = DmRect(x, y, topX, topY);
+	}
+	else {
+		// 右上図郭の座標がない場合は原点のみ
+		mExtent = DmRect(x, y, x, y);
+	}
+}
+
+double DmMesh::xCoord(double coordValue) const
+{
+	return mOriginPoint.x() + coordValue * mTani;
+}
+
+double DmMesh::yCoord(double coordValue) const
+{
+	return mOriginPoint.y() + coordValue * mTani;
+
+}
+
+void DmMesh::setTani(int value)
+{
+	if (value == 1) {
+		mTani = 0.001;	// mm単位
+	}
+	else if (value == 10) {
+		mTani = 0.01;		// cm単位
+	}
+	else {
+		// 本来は999のみ
+		mTani = 1;			// m単位
+	}
+}
+
+
+DmElement::DmElement()
+{
+}
+
+DmElement::~DmElement()
+{
+}
+
+QVariant DmElement::fieldValue(const QString & fieldName) const
+{
+	if (fieldName.compare("dmcode", Qt::CaseInsensitive) == 0)
+		return mDmcode;
+	if (fieldName.compare("zukei", Qt::CaseInsensitive) == 0)
+		return mZukeiKubun;
+	if (fieldName.compare("kandan", Qt::CaseInsensitive) == 0)
+		return mKandan;
+	if (fieldName.compare("teni", Qt::CaseInsensitive) == 0)
+		return mTeni; 
+	return QVariant();
+}
+
+bool DmElement::extractCommonProperty(const DmRow & header)
+{
+	bool ok = false;
+	do
+	{
+		mDmcode = extractInt(header, 2, 4, &ok);
+		if (!ok) break;
+
+		mZukeiKubun = extractInt(header, 18, 2, &ok);
+		if (!ok) break;
+
+		mKandan = extractInt(header, 26, 1, &ok);
+		if (!ok) break;
+
+		mTeni = extractInt(header, 24, 2, &ok);
+		if (!ok) break;
+
+		mDataKubun = extractInt(header, 20, 1, &ok);
+		if (!ok) break;
+
+		return true;
+
+	} while (false);
+
+	return false;
+}
+
+int DmElement::coordDataCount(const DmRow & header)
+{
+	return extractInt(header, 27, 4);
+}
+
+int DmElement::coordRecordCount(const DmRow & header)
+{
+	return extractInt(header, 31, 4);
+}
+
+bool DmElement::read(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int limitData)
+{
+	if (extractCommonProperty(rows[0]) == false) {
+		DmDebugMsg(QStringLiteral(u"ヘッダー取込エラー"));
+		return false;
+	}
+	
+	int recordCount = coordRecordCount(rows[0]);
+	int dataCount = coordDataCount(rows[0]);
+
+	if (dataCount == 0) {
+		DmDebugMsg(QStringLiteral(u"データ数 0"));
+		return false;
+	}
+
+	if (limitData > 0 && dataCount != limitData) {
+		DmDebugMsg(QString("想定データ数(%1) != 実データ数(%2)").arg(limitData).arg(dataCount));
+		return false;
+	}
+
+	// 座標データ取込
+	return extractCoords(rows, mesh, arena, recordCount, dataCount);
+}
+
+bool DmElement::extractCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount)
+{
+	bool success = false;
+	if (is2D()) {
+		success = extract2dCoords(rows, mesh, arena, recordCount, dataCount);
+		if (!success) {
+			DmDebugMsg(QStringLiteral(u"2D座標データの取込に失敗"));
+		}
+	}
+	else if (is3D()) {
+		success = extract3dCoords(rows, mesh, arena, recordCount, dataCount);
+		if (!success) {
+			DmDebugMsg(QStringLiteral(u"3D座標データの取込に失敗"));
+		}
+	}
+	else {
+		DmDebugMsg(QString("想定外のデータ区分を検出 : %1").arg(mDataKubun));
+	}
+
+	return success;
+}
+
+bool DmElement::extract2dCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount)
+{
+	Point2d* points = allocatePoints(arena, dataCount);
+	int recordIndex = 0;
+	int xPos = 0, yPos = 0;
+	double x = 0.0, y = 0.0;
+
+	for (int dataIndex = 0; dataIndex < dataCount; dataIndex++)
+	{
+		if (dataIndex % 6 == 0) {
+			recordIndex++;
+			if (recordIndex > recordCount)
+				break;
+		}
+
+		xPos = 0 + ((dataIndex % 6) * 14);
+		yPos = 7 + ((dataIndex % 6) * 14);
+
+		x = extractDouble(rows[recordIndex], yPos, 7) * mesh.tani();
+		y = extractDouble(rows[recordIndex], xPos, 7) * mesh.tani();
+		points[mPointCount++].setCoord(mesh.originPoint().x() + x, mesh.originPoint().y() + y);
+	}
+
+	return mPointCount > 0;
+}
+
+bool DmElement::extract3dCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount)
+{
+	Point2d* points = allocatePoints(arena, dataCount);
+	int recordIndex = 0;
+	int xPos = 0, yPos = 0, zPos = 0;
+	double x = 0.0, y = 0.0;
+	int z = 0;
+
+	// 3次元の座標は1レコードに4点（2次元は6点）
+	for (int dataIndex = 0; dataIndex < dataCount; dataIndex++)
+	{
+		if (dataIndex % 4 == 0) {
+			recordIndex++;
+			if (recordIndex > recordCount)
+				break;
+		}
+
+		xPos = 0 + ((dataIndex % 4) * 21);
+		yPos = 7 + ((dataIndex % 4) * 21);
+		zPos = 14 + ((dataIndex % 4) * 21);
+
+		x = extractDouble(rows[recordIndex], yPos, 7) * mesh.tani();
+		y = extractDouble(rows[recordIndex], xPos, 7) * mesh.tani();
+		z = extractInt(rows[recordIndex], zPos, 7);
+
+		// 座標列は2次元で保持する
+		points[mPointCount++].setCoord(mesh.originPoint().x() + x, mesh.originPoint().y() + y);
+	}
+
+	return mPointCount > 0;
+
+}
+
+Point2d* DmElement::allocatePoints(DmArena & arena, int count)
+{
+	Point2d* points = arena.allocateArray<Point2d>(count);
+	mPoints = points;
+	mPointCount = 0;
+	return points;
+}
+
+bool DmElement::is2D()
+{
+	return mDataKubun == 2;
+}
+
+bool DmElement::is3D()
+{
+	return (mDataKubun == 3 || mDataKubun == 6);
+}
+
+DmPolygon::DmPolygon(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+	: DmElement()
+{
+	if (read(rows, mesh, arena)) {
+		//DmDebugMsg(QStringLiteral(u"DmPolygon取込成功"));
+	}
+	else {
+		//DmDebugMsg(QStringLiteral(u"DmPolygon取込失敗"));
+	}
+}
+
+DmLine::DmLine(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+	: DmElement()
+{
+	if (read(rows, mesh, arena)) {
+		//DmDebugMsg(QStringLiteral(u"DmLine取込成功"));
+	}
+	else {
+		//DmDebugMsg(QStringLiteral(u"DmLine取込失敗"));
+	}
+}
+
+DmCircle::DmCircle(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+	: DmElement()
+{
+	if (read(rows, mesh, arena, 3)) {
+
+		// 取得した3点から中心座標と半径を算出する
+		Point2d center;
+		double radius = 0.0;
+		calculateCircleCenterAndRadius(points(), center, radius);
+
+		// 円周上の10度刻みのポイントを作成する(37点目は始点と同一点)
+		// 3点の領域はアリーナ上に残るが、アリーナの解放時にまとめて解放される
+		Point2d* circlePoints = allocatePoints(arena, 37);
+		for (double deg = 0.0; deg < 361.0; deg=deg+10.0)
+		{
+			double x = center.x() + radius * qCos(qDegreesToRadians(deg));
+			double y = center.y() + radius * qSin(qDegreesToRadians(deg));
+			circlePoints[mPointCount++].setCoord(x, y);
+		}
+
+		//DmDebugMsg(QStringLiteral(u"DmCircle取込成功"));
+	}
+	else {
+		//DmDebugMsg(QStringLiteral(u"DmCircle取込失敗"));
+	}
+}
+
+DmArc::DmArc(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+	: DmElement()
+{
+	if (read(rows, mesh, arena, 3)) {
+
+		// 取得した3点から中心座標と半径を算出する
+		Point2d center;
+		double radius = 0.0;
+		DmCoords vertexes = points();
+		calculateCircleCenterAndRadius(vertexes, center, radius);
+
+		// 中心点からの各点角度を算出
+		double deg1 = qRadiansToDegrees(qAtan2(vertexes[0].y() - center.y(), vertexes[0].x() - center.x()));
+		double deg2 = qRadiansToDegrees(qAtan2(vertexes[1].y() - center.y(), vertexes[1].x() - center.x()));
+		double deg3 = qRadiansToDegrees(qAtan2(vertexes[2].y() - center.y(), vertexes[2].x() - center.x()));
+
+		QList<double> angles = calculateArcAngles(deg1, deg2, deg3);
+
+		// 3点の領域はアリーナ上に残るが、アリーナの解放時にまとめて解放される
+		Point2d* arcPoints = allocatePoints(arena, angles.count());
+		for (double deg : angles) {
+			double x = radius * qCos(qDegreesToRadians(deg)) + center.x();
+			double y = radius * qSin(qDegreesToRadians(deg)) + center.y();
+			arcPoints[mPointCount++].setCoord(x, y);
+		}
+
+		//DmDebugMsg(QStringLiteral(u"DmArc取込成功"));
+	}
+	else {
+		//DmDebugMsg(QStringLiteral(u"DmArc取込失敗"));
+	}
+}
+
+QList<double> DmArc::calculateArcAngles(double deg1, double deg2, double deg3)
+{
+	// deg1 始点角度
+	// deg2 経由角度
+	// deg3 終点角度
+
+	// deg1を0度に設定
+	double t_deg2 = deg2 - deg1;
+	double t_deg3 = deg3 - deg1;
+
+	// 0-360表記に整形
+	if (t_deg2 < 0)
+		t_deg2 += 360;
+	else if (t_deg2 > 360)
+		t_deg2 -= 360;
+
+
+	if (t_deg3 < 0)
+		t_deg3 += 360;
+	else if (t_deg3 > 360)
+		t_deg3 -= 360;
+
+	double angle = 0.0;
+	int step = 0;
+	if (t_deg3 > t_deg2) {
+		// clock wise
+		angle = t_deg3;
+		step = 1;
+	}
+	else {
+		// reverse clock wise
+		angle = 360 - t_deg3;
+		step = -1;
+	}
+
+	QList<double> angles;
+	int maxAngle = qCeil(angle);
+	for (int i = 0; i < maxAngle; i++)
+	{
+		// 1度づつ移動
+		angles.append(deg1 + double(i * step));
+	}
+	angles.append(deg3);
+
+	return angles;
+}
+
+DmPoint::DmPoint(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+{
+	do
+	{
+		if (extractCommonProperty(rows[0]) == false) {
+			DmDebugMsg(QStringLiteral(u"ヘッダー取込エラー"));
+			break;
+		}
+
+		int dataCount = coordDataCount(rows[0]);
+		if (dataCount == 0) {
+			// 記号
+			double x = mesh.xCoord(extractDouble(rows[0], 42, 7));
+			double y = mesh.yCoord(extractDouble(rows[0], 35, 7));
+			allocatePoints(arena, 1)[mPointCount++].setCoord(x, y);
+		}
+		else if (dataCount > 0) {
+			DmDebugMsg(QStringLiteral(u"ポイントデータのデータ数に0以外が設定されている : 標高点群は対象外"));
+			break;
+		}
+
+		//DmDebugMsg(QStringLiteral(u"DmPoint取込成功"));
+		return;
+
+	} while (false);
+
+	//DmDebugMsg(QStringLiteral(u"DmPoint取込失敗"));
+}
+
+DmDirection::DmDirection(const DmRows & rows, const DmMesh & mesh, DmArena & arena)
+	: DmElement()
+{
+	if (read(rows, mesh, arena)) {
+		mAngle = qRadiansToDegrees(qAtan2(mPoints[1].y() - mPoints[0].y(), mPoints[1].x() - mPoints[0].x()));
+		// 方向はPointとするので始点のみにする
+		mPointCount = 1;
+		//DmDebugMsg(QStringLiteral(u"DmDirection取込成功"));
+	}
+	else {
+		//DmDebugMsg(QStringLiteral(u"DmDirection取込失敗"));
+	}
+}
+
+QVariant DmDirection::fieldValue(const QString & fieldName) const
+{
+	if (fieldName.compare("vangle", Qt::CaseInsensitive) == 0)
+		return mAngle;
+
+	return DmElement::fieldValue(fieldName);
+}
+
+bool DmDirection::is2D()
+{
+	return (mDataKubun == 0 || mDataKubun == 2);
+}
+
+const DmTextPool::Handle DmTextPool::InvalidHandle;
+
+DmTextPool::DmTextPool()
+	: mCodec(QTextCodec::codecForName("Shift-JIS"))
+{
+	// resize(0)で領域を解放しないように予約しておく
+	mScratch.reserve(256);
+}
+
+DmTextPool::Handle DmTextPool::intern(const QByteArray & encoded)
+{
+	// 同じバイト列は変換済みなのでデコードせずにハンドルを返す
+	QHash<QByteArray, Handle>::const_iterator itr = mEncodedHandles.constFind(encoded);
+	if (itr != mEncodedHandles.constEnd())
+		return itr.value();
+
+	Handle handle = intern(mCodec ? mCodec->toUnicode(encoded) : QString::fromLatin1(encoded));
+	mEncodedHandles.insert(encoded, handle);
+	return handle;
+}
+
+DmTextPool::Handle DmTextPool::intern(const DmRow * parts, int count)
+{
+	mScratch.resize(0);
+	for (int i = 0; i < count; i++)
+		mScratch.append(parts[i].data(), parts[i].size());
+
+	QHash<QByteArray, Handle>::const_iterator itr = mEncodedHandles.constFind(mScratch);
+	if (itr != mEncodedHandles.constEnd())
+		return itr.value();
+
+	// 作業領域を共有しないように複製して登録する
+	return intern(QByteArray(mScratch.constData(), mScratch.size()));
+}
+
+DmTextPool::Handle DmTextPool::intern(const QString & text)
+{
+	QHash<QString, Handle>::const_iterator itr = mHandles.constFind(text);
+	if (itr != mHandles.constEnd())
+		return itr.value();
+
+	Handle handle = static_cast<Handle>(mTexts.count());
+	mTexts.append(text);
+	mHandles.insert(text, handle);
+	return handle;
+}
+
+DmTextPool::Handle DmTextPool::find(const QString & text) const
+{
+	return mHandles.value(text, InvalidHandle);
+}
+
+const QString & DmTextPool::text(Handle handle) const
+{
+	static const QString sEmpty;
+	if (handle >= static_cast<Handle>(mTexts.count()))
+		return sEmpty;
+	return mTexts.at(static_cast<int>(handle));
+}
+
+void DmTextPool::clear()
+{
+	mTexts.clear();
+	mHandles.clear();
+	mEncodedHandles.clear();
+}
+
+const float DmGrid::NoData = -9999.0f;
+
+DmGrid::DmGrid(const DmRow & header, const DmMesh & mesh)
+{
+	readHeader(header, mesh);
+}
+
+DmGrid::DmGrid(const DmRows & rows, const DmMesh & mesh)
+{
+	readHeader(rows[0], mesh);
+	if (!isValid())
+		return;
+
+	// 値なしで初期化し、データレコードの値を順に設定する
+	const int count = mColumnCount * mRowCount;
+	mValues.fill(NoData, count);
+	float* values = mValues.data();
+	int index = 0;
+	for (int i = 1; i < rows.count() && index < count; i++) {
+		const DmRow& row = rows[i];
+		for (int start = 0; start < 80 && index < count; start += 8, index++) {
+			bool ok = false;
+			int value = extractInt(row, start, 8, &ok);
+			if (ok && value > -999999)
+				values[index] = static_cast<float>(value * 0.01);
+		}
+	}
+}
+
+void DmGrid::readHeader(const DmRow & header, const DmMesh & mesh)
+{
+	bool ok = false;
+	mCode = extractInt(header, 2, 4);
+	mColumnCount = extractInt(header, 6, 5);
+	mRowCount = extractInt(header, 11, 5);
+	mSpacing = extractDouble(header, 16, 5) * mesh.tani();
+
+	// 原点からの座標値がない場合は図郭の原点とする
+	double x = extractDouble(header, 30, 7, &ok);
+	if (!ok) x = 0.0;
+	double y = extractDouble(header, 37, 7, &ok);
+	if (!ok) y = 0.0;
+	mOrigin.setCoord(mesh.xCoord(x), mesh.yCoord(y));
+}
+
+DmRect DmGrid::extent() const
+{
+	double half = mSpacing / 2;
+	return DmRect(mOrigin.x() - half, mOrigin.y() - half,
+		mOrigin.x() + (mColumnCount - 1) * mSpacing + half, mOrigin.y() + (mRowCount - 1) * mSpacing + half);
+}
+
+int DmTin::append(const DmRows & rows, const DmMesh & mesh)
+{
+	const DmRow& header = rows[0];
+	int vertexCount = qMax(extractInt(header, 6, 6), 0);
+	int triangleCount = qMax(extractInt(header, 12, 6), 0);
+	vertexCount = qMin(vertexCount, rows.count() - 1);
+	triangleCount = qMin(triangleCount, rows.count() - 1 - vertexCount);
+
+	// 頂点の添字は全ての不整三角網を通した番号とする
+	const int firstVertex = this->vertexCount();
+	mVertices.reserve(mVertices.count() + vertexCount * 3);
+	for (int i = 0; i < vertexCount; i++) {
+		const DmRow& row = rows[1 + i];
+		double x = mesh.xCoord(extractDouble(row, 0, 7));
+		double y = mesh.yCoord(extractDouble(row, 7, 7));
+		bool ok = false;
+		double z = extractInt(row, 14, 8, &ok) * 0.01;
+		mVertices.append(x);
+		mVertices.append(y);
+		mVertices.append(ok ? z : 0.0);
+		mExtent.combine(DmRect(x, y, x, y));
+	}
+
+	int added = 0;
+	mTriangles.reserve(mTriangles.count() + triangleCount * 3);
+	for (int i = 0; i < triangleCount; i++) {
+		const DmRow& row = rows[1 + vertexCount + i];
+		int a = extractInt(row, 0, 6);
+		int b = extractInt(row, 6, 6);
+		int c = extractInt(row, 12, 6);
+		if (a < 1 || b < 1 || c < 1 || a > vertexCount || b > vertexCount || c > vertexCount)
+			continue;
+		mTriangles.append(firstVertex + a - 1);
+		mTriangles.append(firstVertex + b - 1);
+		mTriangles.append(firstVertex + c - 1);
+		added++;
+	}
+
+	mSurfaceCount++;
+	return added;
+}
+
+void DmTin::clear()
+{
+	mVertices.clear();
+	mTriangles.clear();
+	mSurfaceCount = 0;
+	mExtent = DmRect();
+}
+
+QVariant DmAttributeColumn::value(int index, const DmTextPool & textPool) const
+{
+	if (isNull(index))
+		return QVariant();
+
+	switch (mType) {
+	case Integer:
+		return QVariant(static_cast<qlonglong>(mIntegers.at(index)));
+	case Double:
+		return QVariant(mDoubles.at(index));
+	case String:
+		break;
+	}
+	return textPool.text(mHandles.at(index));
+}
+
+void DmAttributeColumn::setValue(int index, DmTextPool::Handle handle, const QString & text)
+{
+	if (index < 0)
+		return;
+
+	if (index >= mHandles.count()) {
+		int count = index + 1;
+		mHandles.reserve(count);
+		while (mHandles.count() < count)
+			mHandles.append(DmTextPool::InvalidHandle);
+		if (mType == Integer)
+			mIntegers.resize(count);
+		else if (mType == Double)
+			mDoubles.resize(count);
+	}
+	mHandles[index] = handle;
+
+	bool ok = false;
+	if (mType == Integer) {
+		qint64 value = text.toLongLong(&ok);
+		if (ok) {
+			mIntegers[index] = value;
+			return;
+		}
+		// 実数の列にする
+		mDoubles.resize(mIntegers.count());
+		for (int i = 0; i < mIntegers.count(); i++)
+			mDoubles[i] = static_cast<double>(mIntegers.at(i));
+		mIntegers = QVector<qint64>();
+		mType = Double;
+	}
+
+	if (mType == Double) {
+		double value = text.toDouble(&ok);
+		if (ok) {
+			mDoubles[index] = value;
+			return;
+		}
+		// 文字列の列にする（値はハンドルで保持している）
+		mDoubles = QVector<double>();
+		mType = String;
+	}
+}
+
+DmAttributeColumn::Type DmAttributeColumn::valueType(const QString & text)
+{
+	bool ok = false;
+	text.toLongLong(&ok);
+	if (ok)
+		return Integer;
+	text.toDouble(&ok);
+	return ok ? Double : String;
+}
+
+QVector<DmElementGroups::Range> DmElementGroups::layerRanges(const QSet<int>& layers) const
+{
+	QVector<Range> ranges;
+	for (const Range& range : mRanges) {
+		if (layers.contains(layerOf(range.code)))
+			ranges.append(range);
+	}
+	return ranges;
+}
+
+void DmElementGroups::append(quint32 code)
+{
+	int index = mCodes.count();
+	mCodes.append(code);
+	if (!mRanges.isEmpty() && mRanges.last().code == code && mRanges.last().end == index)
+		mRanges.last().end = index + 1;
+	else
+		mRanges.append(Range{ code, index, index + 1 });
+}
+
+void DmElementGroups::clear()
+{
+	mCodes.clear();
+	mRanges.clear();
+}
+
+int DmElementCodes::frequency(const QSet<int>& dmcodes) const
+{
+	int frequency = 0;
+	for (int dmcode : dmcodes)
+		frequency += this->frequency(dmcode);
+	return frequency;
+}
+
+QVector<int> DmElementCodes::indexes(const QSet<int>& dmcodes) const
+{
+	QVector<int> indexes;
+	indexes.reserve(frequency(dmcodes));
+	for (int dmcode : dmcodes)
+		indexes += mIndexes.value(dmcode);
+	// 複数のコードの一覧は連結してから並べ替える
+	if (dmcodes.count() > 1)
+		std::sort(indexes.begin(), indexes.end());
+	return indexes;
+}
+
+void DmElementCodes::append(int dmcode)
+{
+	mIndexes[dmcode].append(mCount++);
+}
+
+void DmElementCodes::clear()
+{
+	mIndexes.clear();
+	mCount = 0;
+}
+
+void DmPointCoords::select(const DmRect& rect, int begin, int end, QVector<int>& indexes) const
+{
+	// 点は最小と最大が同じ範囲
+	begin = qMax(begin, 0);
+	end = qMin(end, count());
+	DmBoxFilter::select(mX.constData(), mY.constData(), mX.constData(), mY.constData(), begin, end, rect, indexes);
+}
+
+void DmPointCoords::append(const DmCoords& points)
+{
+	if (points.isEmpty()) {
+		mX.append(std::numeric_limits<double>::quiet_NaN());
+		mY.append(std::numeric_limits<double>::quiet_NaN());
+		return;
+	}
+	mX.append(points.first().x());
+	mY.append(points.first().y());
+}
+
+void DmPointCoords::clear()
+{
+	mX.clear();
+	mY.clear();
+}
+
+DmRect DmElementExtents::extent(int index) const
+{
+	if (index < 0 || index >= count() || std::isnan(mXMin.at(index)))
+		return DmRect();
+	return DmRect(mXMin.at(index), mYMin.at(index), mXMax.at(index), mYMax.at(index));
+}
+
+void DmElementExtents::select(const DmRect& rect, int begin, int end, QVector<int>& indexes) const
+{
+	begin = qMax(begin, 0);
+	end = qMin(end, count());
+	DmBoxFilter::select(mXMin.constData(), mYMin.constData(), mXMax.constData(), mYMax.constData(), begin, end, rect, indexes);
+}
+
+void DmElementExtents::append(const DmCoords& points)
+{
+	if (points.isEmpty()) {
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		mXMin.append(nan);
+		mYMin.append(nan);
+		mXMax.append(nan);
+		mYMax.append(nan);
+		return;
+	}
+	double xMin = points.first().x();
+	double yMin = points.first().y();
+	double xMax = xMin;
+	double yMax = yMin;
+	for (const Point2d& point : points) {
+		xMin = qMin(xMin, point.x());
+		yMin = qMin(yMin, point.y());
+		xMax = qMax(xMax, point.x());
+		yMax = qMax(yMax, point.y());
+	}
+	mXMin.append(xMin);
+	mYMin.append(yMin);
+	mXMax.append(xMax);
+	mYMax.append(yMax);
+}
+
+void DmElementExtents::clear()
+{
+	mXMin.clear();
+	mYMin.clear();
+	mXMax.clear();
+	mYMax.clear();
+}
+
+namespace
+{
+	// 詳細度ごとの許容誤差
+	const double LEVEL_OF_DETAIL_TOLERANCES[DmLevelsOfDetail::LevelCount] = { 0.0, 0.5, 2.0, 8.0, 32.0 };
+
+	// 点pと線分abの距離
+	double segmentDistance(const Point2d& p, const Point2d& a, const Point2d& b)
+	{
+		double dx = b.x() - a.x();
+		double dy = b.y() - a.y();
+		double px = p.x() - a.x();
+		double py = p.y() - a.y();
+		double length2 = dx * dx + dy * dy;
+		if (length2 > 0.0) {
+			double t = (px * dx + py * dy) / length2;
+			if (t >= 1.0) {
+				px = p.x() - b.x();
+				py = p.y() - b.y();
+			}
+			else if (t > 0.0) {
+				px -= t * dx;
+				py -= t * dy;
+			}
+		}
+		return std::sqrt(px * px + py * py);
+	}
+
+	/**
+	 * 頂点firstとlastの間の頂点の重要度をダグラス・ポイカー法で求める
+	 * lastがcountの場合は先頭の頂点とする（面の境界）。再帰せずにスタックで分割する
+	 */
+	void calculateSignificance(const Point2d* points, int count, int first, int last, double* significance)
+	{
+		struct Span {
+			int first;
+			int last;
+			double limit;
+		};
+		QVarLengthArray<Span, 64> stack;
+		stack.append(Span{ first, last, std::numeric_limits<double>::infinity() });
+		while (!stack.isEmpty()) {
+			Span span = stack.last();
+			stack.removeLast();
+			if (span.last - span.first < 2)
+				continue;
+
+			const Point2d& a = points[span.first];
+			const Point2d& b = points[span.last % count];
+			int farthest = span.first + 1;
+			double distance = -1.0;
+			for (int i = span.first + 1; i < span.last; i++) {
+				double d = segmentDistance(points[i], a, b);
+				if (d > distance) {
+					distance = d;
+					farthest = i;
+				}
+			}
+			// 分割した頂点より重要にはしない（詳細度が入れ子になる）
+			double value = qMin(distance, span.limit);
+			significance[farthest] = value;
+			stack.append(Span{ span.first, farthest, value });
+			stack.append(Span{ farthest, span.last, value });
+		}
+	}
+}
+
+double DmLevelsOfDetail::tolerance(int level)
+{
+	return LEVEL_OF_DETAIL_TOLERANCES[qBound(0, level, LevelCount - 1)];
+}
+
+int DmLevelsOfDetail::levelForTolerance(double tolerance)
+{
+	for (int level = LevelCount - 1; level > 0; level--) {
+		if (LEVEL_OF_DETAIL_TOLERANCES[level] <= tolerance)
+			return level;
+	}
+	return 0;
+}
+
+DmCoords DmLevelsOfDetail::points(const DmElement& element, int index, int level) const
+{
+	if (level <= 0 || index < 0 || index >= count())
+		return element.points();
+	return mCoords[qMin(level, LevelCount - 1) - 1].at(index);
+}
+
+void DmLevelsOfDetail::append(const DmCoords& points, bool ring, DmArena& arena)
+{
+	const int count = points.count();
+	mVertexCounts[0] += count;
+
+	// 終点が始点と同じ線（円等）は面の境界として終点を除いて簡略化し、終点は戻す
+	const bool closed = count > 3 && points.first().x() == points.last().x() && points.first().y() == points.last().y();
+	const bool asRing = ring || closed;
+	const int n = closed ? count - 1 : count;
+	if (n <= (asRing ? 3 : 2)) {
+		for (int level = 1; level < LevelCount; level++) {
+			mCoords[level - 1].append(points);
+			mVertexCounts[level] += count;
+		}
+		return;
+	}
+
+	const Point2d* data = points.begin();
+	const double infinity = std::numeric_limits<double>::infinity();
+	QVarLengthArray<double, 256> significance(n);
+	for (int i = 0; i < n; i++)
+		significance[i] = 0.0;
+
+	if (!asRing) {
+		// 端点は常に残す
+		significance[0] = infinity;
+		significance[n - 1] = infinity;
+		calculateSignificance(data, n, 0, n - 1, significance.data());
+	}
+	else {
+		// 始点と始点から最も遠い頂点で2つに分け、残りで最も重要な頂点も残して3頂点以上とする
+		int farthest = 1;
+		double distance = -1.0;
+		for (int i = 1; i < n; i++) {
+			double dx = data[i].x() - data[0].x();
+			double dy = data[i].y() - data[0].y();
+			if (dx * dx + dy * dy > distance) {
+				distance = dx * dx + dy * dy;
+				farthest = i;
+			}
+		}
+		significance[0] = infinity;
+		significance[farthest] = infinity;
+		calculateSignificance(data, n, 0, farthest, significance.data());
+		calculateSignificance(data, n, farthest, n, significance.data());
+
+		int third = -1;
+		for (int i = 1; i < n; i++) {
+			if (i != farthest && (third < 0 || significance[i] > significance[third]))
+				third = i;
+		}
+		significance[third] = infinity;
+	}
+
+	const Point2d* previous = data;
+	int previousCount = count;
+	for (int level = 1; level < LevelCount; level++) {
+		const double levelTolerance = LEVEL_OF_DETAIL_TOLERANCES[level];
+		int kept = closed ? 1 : 0;
+		for (int i = 0; i < n; i++) {
+			if (significance[i] > levelTolerance)
+				kept++;
+		}
+
+		if (kept < previousCount) {
+			Point2d* simplified = arena.allocateArray<Point2d>(kept);
+			int j = 0;
+			for (int i = 0; i < n; i++) {
+				if (significance[i] > levelTolerance)
+					simplified[j++] = data[i];
+			}
+			if (closed)
+				simplified[j++] = points.last();
+			previous = simplified;
+			previousCount = kept;
+		}
+		mCoords[level - 1].append(DmCoords(previous, previousCount));
+		mVertexCounts[level] += previousCount;
+	}
+}
+
+void DmLevelsOfDetail::clear()
+{
+	for (QVector<DmCoords>& coords : mCoords)
+		coords.clear();
+	for (qint64& count : mVertexCounts)
+		count = 0;
+}
+
+void DmAttributeTable::setValue(int elementIndex, int code, DmTextPool::Handle handle, const QString & text)
+{
+	int index = mColumnIndexes.value(code, -1);
+	if (index < 0) {
+		index = mColumns.count();
+		mColumns.append(DmAttributeColumn(code));
+		mColumnIndexes.insert(code, index);
+	}
+	mColumns[index].setValue(elementIndex, handle, text);
+}
+
+void DmAttributeTable::clear()
+{
+	mColumns.clear();
+	mColumnIndexes.clear();
+}
+
+DmNote::DmNote(const DmRows & rows, const DmMesh & mesh, DmArena & arena, DmTextPool & textPool)
+	: DmElement()
+{
+	do
+	{
+		bool ok = false;
+		const DmRow& header = rows[0];
+		mDmcode = extractInt(header, 2, 4, &ok);
+		if (!ok) break;
+	
+		mTeni = extractInt(header, 24, 2, &ok);
+		if (!ok) break;
+		
+		// 注記区分(漢字か英数字かの区分)
+		int noteKubun = extractInt(header, 23, 1, &ok);
+		if (!ok) break;
+
+		// 文字数
+		int dataCount = coordDataCount(header);
+
+		// 座標
+		double x = mesh.xCoord(extractDouble(header, 42, 7));
+		double y = mesh.yCoord(extractDouble(header, 35, 7));
+		allocatePoints(arena, 1)[mPointCount++].setCoord(x, y);
+
+		// 縦横区分(0:横書き／1:縦書き)
+		mTateyoko = extractInt(rows[1], 0, 1, &ok);
+		if (!ok) break;
+		// 傾き
+		mAngle = extractInt(rows[1], 1, 7, &ok);
+		if (!ok) break;
+		// 字の大きさ(0.1mm)
+		mSize = extractInt(rows[1], 8, 5, &ok);
+		if (!ok) break;
+
+		int all = 0;
+		int mod = 0;
+		// 注記区分からレコード数と最終レコードからの文字数を算出する
+		switch (noteKubun)
+		{
+			case 1:	// 全角
+				dataCount *= 2;
+			case 2:	// 半角
+				all = dataCount / 64;
+				mod = dataCount % 64;
+				break;
+		default:
+			// 区分しない
+			DmDebugMsg(QString("注記区分に1,2以外が設定されている : %1").arg(noteKubun));
+			break;
+		}
+
+		// 注記データ
+		// バイト列のまま連結して文字列プールに登録する（デコードは初出の文字列のみ）
+		QVarLengthArray<DmRow, 8> note;
+		if (dataCount < 64) {
+			note.append(rows[all + 1].mid(20, dataCount));
+		}
+		else {
+			for (int i = 0; i < all; i++)
+			{
+				note.append(rows[i + 1].mid(20, 64));
+			}
+
+			if (mod > 0) {
+				note.append(rows[all + 1].mid(20, mod));
+			}
+		}
+
+		mTextHandle = textPool.intern(note.constData(), note.count());
+
+		//DmDebugMsg(QStringLiteral(u"DmNote取込成功"));
+
+		return;
+
+	} while (false);
+
+	//DmDebugMsg(QStringLiteral(u"DmDirection取込失敗"));
+
+}
+
+QVariant DmNote::fieldValue(const QString & fieldName) const 
+{
+	if (fieldName.compare("dmcode", Qt::CaseInsensitive) == 0)
+		return mDmcode;
+	if (fieldName.compare("teni", Qt::CaseInsensitive) == 0)
+		return mTeni;
+	if (fieldName.compare("vangle", Qt::CaseInsensitive) == 0)
+		return mAngle;
+	if (fieldName.compare("tateyoko", Qt::CaseInsensitive) == 0)
+		return mTateyoko;
+	if (fieldName.compare("size", Qt::CaseInsensitive) == 0)
+		return mSize;
+	// vtextは注記文字列プールを持つQgsDmFile::fetchAttribute()で取得する
+
+	return QVariant();
+}
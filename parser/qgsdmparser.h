@@ -0,0 +1,1042 @@
+/***************************************************************************
+      qgsdmparser.h  -  DM file parsing core
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMPARSER_H
+#define QGSDMPARSER_H
+
+// DMファイルの解析処理
+// QGISに依存せずQtCoreのみで使用できる（dmstat等のツールと共用する）
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMap>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVariant>
+#include <QVector>
+#include <QDebug>
+#include <memory>
+
+#include "qgsdmarena.h"
+
+class QTextCodec;
+
+// デバッグ出力（QGISDEBUG定義時のみ）
+#ifdef QGISDEBUG
+#define DmDebugMsg(str) qDebug().noquote() << (str)
+#define DmDebugMsgLevel(str, level) do { if ((level) <= 1) { DmDebugMsg(str); } } while (false)
+#else
+#define DmDebugMsg(str)
+#define DmDebugMsgLevel(str, level)
+#endif
+
+class Point2d {
+public:
+	Point2d() {}
+	Point2d(double x, double y)
+	{
+		mX = x;
+		mY = y;
+	}
+	Point2d(const Point2d& other) {
+		mX = other.mX;
+		mY = other.mY;
+	}
+	const double x() const { return mX; }
+	const double y() const { return mY; }
+
+	void setCoord(double x, double y)
+	{
+		mX = x;
+		mY = y;
+	}
+
+protected:
+	double mX = 0.0;
+	double mY = 0.0;
+};
+
+class Point3d : public Point2d {
+public:
+	Point3d() {}
+	Point3d(double x, double y, double z)
+		: Point2d(x, y)
+	{
+		mZ = z;
+	}
+	double z() const {
+		return mZ;	
+	}
+
+	void setCoord(double x, double y, double z)
+	{
+		Point2d::setCoord(x, y);
+		mZ = z;
+	}
+
+private:
+	double mZ = 0;
+};
+
+
+// DMレコード（1行）への参照
+// 読込バッファ上の行を指すだけで、データは保持しない
+class DmRow {
+public:
+	DmRow() {}
+	DmRow(const char* data, int size)
+		: mData(data)
+		, mSize(size)
+	{}
+	DmRow(const QByteArray& line)
+		: mData(line.constData())
+		, mSize(line.size())
+	{}
+
+	const char* data() const { return mData; }
+	int size() const { return mSize; }
+	bool isEmpty() const { return mSize == 0; }
+	char at(int i) const { return mData[i]; }
+
+	// 部分参照（範囲外は切り詰める）
+	DmRow mid(int start, int count) const
+	{
+		if (start >= mSize || count == 0)
+			return DmRow();
+		int end = (count < 0 || start + count > mSize) ? mSize : start + count;
+		return DmRow(mData + start, end - start);
+	}
+
+	QByteArray toByteArray() const { return QByteArray(mData, mSize); }
+
+private:
+	const char* mData = nullptr;
+	int mSize = 0;
+};
+
+// 複数行からなるレコード（要素ヘッダと座標レコード等）への参照
+class DmRows {
+public:
+	DmRows(const DmRow* rows, int count)
+		: mRows(rows)
+		, mCount(count)
+	{}
+
+	int count() const { return mCount; }
+	const DmRow& at(int i) const { return mRows[i]; }
+	const DmRow& operator[](int i) const { return mRows[i]; }
+
+private:
+	const DmRow* mRows = nullptr;
+	int mCount = 0;
+};
+
+// 座標列（アリーナ上の連続領域への参照）
+class DmCoords {
+public:
+	DmCoords() {}
+	DmCoords(const Point2d* data, int count)
+		: mData(data)
+		, mCount(count)
+	{}
+
+	const Point2d* begin() const { return mData; }
+	const Point2d* end() const { return mData + mCount; }
+	int count() const { return mCount; }
+	bool isEmpty() const { return mCount == 0; }
+	const Point2d& at(int i) const { return mData[i]; }
+	const Point2d& operator[](int i) const { return mData[i]; }
+	const Point2d& first() const { return mData[0]; }
+	const Point2d& last() const { return mData[mCount - 1]; }
+
+private:
+	const Point2d* mData = nullptr;
+	int mCount = 0;
+};
+
+// 固定長項目を文字列として取得する
+QString extractField(const DmRow& row, bool trim, int start, int count);
+// 固定長項目を整数として取得する（前後の空白は無視する。QStringを作成しない）
+int extractInt(const DmRow& row, int start, int count, bool* ok = nullptr);
+// 固定長項目を実数として取得する（前後の空白は無視する。QStringを作成しない）
+double extractDouble(const DmRow& row, int start, int count, bool* ok = nullptr);
+// 3点を通る円の中心と半径を取得する
+void calculateCircleCenterAndRadius(const DmCoords& points, Point2d& center, double& radius);
+
+// 矩形範囲
+class DmRect {
+public:
+	DmRect() {}
+	DmRect(double xMin, double yMin, double xMax, double yMax)
+	{
+		mXMin = qMin(xMin, xMax);
+		mYMin = qMin(yMin, yMax);
+		mXMax = qMax(xMin, xMax);
+		mYMax = qMax(yMin, yMax);
+		mNull = false;
+	}
+
+	bool isNull() const { return mNull; }
+	double xMinimum() const { return mXMin; }
+	double yMinimum() const { return mYMin; }
+	double xMaximum() const { return mXMax; }
+	double yMaximum() const { return mYMax; }
+
+	// 範囲を結合する
+	void combine(const DmRect& other)
+	{
+		if (other.mNull)
+			return;
+		if (mNull) {
+			*this = other;
+			return;
+		}
+		mXMin = qMin(mXMin, other.mXMin);
+		mYMin = qMin(mYMin, other.mYMin);
+		mXMax = qMax(mXMax, other.mXMax);
+		mYMax = qMax(mYMax, other.mYMax);
+	}
+
+	bool intersects(const DmRect& other) const
+	{
+		if (mNull || other.mNull)
+			return false;
+		return mXMin <= other.mXMax && other.mXMin <= mXMax && mYMin <= other.mYMax && other.mYMin <= mYMax;
+	}
+
+private:
+	double mXMin = 0.0;
+	double mYMin = 0.0;
+	double mXMax = 0.0;
+	double mYMax = 0.0;
+	bool mNull = true;
+};
+
+class DmMesh {
+public:
+	DmMesh() {};
+	DmMesh(const DmRows& rows, int modifiedCount, const QList<int>& fCountList);
+	const Point2d &originPoint() const { return mOriginPoint;	}
+	// 図郭の範囲
+	const DmRect &extent() const { return mExtent; }
+	double tani() const { return mTani; }
+	double xCoord(double coordValue) const;
+	double yCoord(double coordValue) const;
+
+private:
+	void setTani(int value);
+
+	// メッシュの原点
+	Point2d mOriginPoint;
+	// 図郭の範囲
+	DmRect mExtent;
+	// 地図情報レベル
+	int mLevel = 0;
+	// 座標値の単位
+	double mTani = 0.0;
+};
+
+class DmElement {
+public:
+	DmElement();
+	virtual ~DmElement();
+
+	// 地図分類コード
+	virtual int dmcode() const { return mDmcode; }
+	// 図形区分
+	virtual int zukeiKubun() const { return mZukeiKubun; }
+	// 間断区分
+	virtual int kandan() const { return mKandan; }
+	// 転移区分
+	virtual int teni() const { return mTeni; }
+	// データ区分
+	virtual int dataKubun() const { return mDataKubun; }
+
+	// 座標列（DmReaderのアリーナ上にある）
+	virtual DmCoords points() const { return DmCoords(mPoints, mPointCount); }
+
+	virtual QVariant fieldValue(const QString& fieldName) const;
+
+protected:
+	bool extractCommonProperty(const DmRow &header);
+	int coordDataCount(const DmRow &header);
+	int coordRecordCount(const DmRow &header);
+	bool read( const DmRows & rows, const DmMesh & mesh, DmArena & arena, int limitData = 0);
+	bool extractCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount);
+	bool extract2dCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount);
+	bool extract3dCoords(const DmRows & rows, const DmMesh & mesh, DmArena & arena, int recordCount, int dataCount);
+	virtual bool is2D();
+	virtual bool is3D();
+
+	// 座標列をアリーナに確保する
+	Point2d* allocatePoints(DmArena & arena, int count);
+
+	// 地図分類コード
+	int mDmcode = 0;
+	// 図形区分
+	int mZukeiKubun = 0;
+	// 間断区分
+	int mKandan = 0;
+	// 転移区分
+	int mTeni = 0;
+	// データ区分
+	int mDataKubun = 0;
+
+	// 座標列（アリーナ上の領域。解放はアリーナがまとめて行う）
+	const Point2d* mPoints = nullptr;
+	int mPointCount = 0;
+
+	// マイクロベンチマーク
+	friend class BenchDmParser;
+};
+
+class DmPolygon: public DmElement {
+public:
+	DmPolygon() {}
+	DmPolygon(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+};
+
+class DmLine : public DmElement {
+public:
+	DmLine() {}
+	DmLine(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+};
+
+class DmCircle : public DmElement {
+public:
+	DmCircle() {}
+	DmCircle(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+};
+
+class DmArc : public DmElement {
+public:
+	DmArc() {}
+	DmArc(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+
+private:
+	QList<double> calculateArcAngles(double deg1, double deg2, double deg3);
+
+	// マイクロベンチマーク
+	friend class BenchDmParser;
+};
+
+class DmPoint : public DmElement {
+public:
+	DmPoint() {}
+	DmPoint(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+};
+
+class DmDirection : public DmElement {
+public:
+	DmDirection() {}
+	DmDirection(const DmRows& rows, const DmMesh& mesh, DmArena& arena);
+
+	int angle() const { return mAngle; }
+
+	virtual QVariant fieldValue(const QString& fieldName) const;
+
+protected:
+	bool is2D() override;
+
+private:
+	// 傾き
+	double mAngle = 0.0;
+};
+
+/**
+ * 注記文字列プール
+ * 同じ注記文字列を1つにまとめ、32bitのハンドルで参照する
+ * 地名や建物種別など同一文字列が大量に繰り返されるため、注記ごとにQStringを持たない
+ */
+class DmTextPool {
+public:
+	typedef quint32 Handle;
+	static const Handle InvalidHandle = 0xFFFFFFFF;
+
+	DmTextPool();
+
+	// Shift-JISの注記データを登録してハンドルを返す（同じ文字列は同じハンドル）
+	Handle intern(const QByteArray& encoded);
+	// 複数レコードに分割されたShift-JISの注記データを登録してハンドルを返す
+	// 連結は作業領域で行い、登録済みの場合はメモリを確保しない
+	Handle intern(const DmRow* parts, int count);
+	// 文字列を登録してハンドルを返す
+	Handle intern(const QString& text);
+	// 登録済み文字列のハンドルを返す（未登録の場合はInvalidHandle）
+	Handle find(const QString& text) const;
+	// ハンドルに対応する文字列を返す
+	const QString& text(Handle handle) const;
+
+	int count() const { return mTexts.count(); }
+	void clear();
+
+private:
+	QTextCodec* mCodec = nullptr;
+	QVector<QString> mTexts;
+	QHash<QString, Handle> mHandles;
+	QHash<QByteArray, Handle> mEncodedHandles;
+	// 分割された注記データの連結用
+	QByteArray mScratch;
+};
+
+class DmNote: public DmElement {
+public:
+	DmNote() {}
+	DmNote(const DmRows& rows, const DmMesh& mesh, DmArena& arena, DmTextPool& textPool);
+
+	virtual int vangle() const { return mAngle; }
+	virtual int tateyoko() const { return mTateyoko; }
+	virtual int size() const { return mSize; }
+	// 注記文字列プールのハンドル
+	DmTextPool::Handle textHandle() const { return mTextHandle; }
+
+	virtual QVariant fieldValue(const QString& fieldName) const;
+
+private:
+	// 図形区分
+	virtual int zukeiKubun() const { return mZukeiKubun; }
+	// 間断区分
+	virtual int kandan() const { return mKandan; }
+
+private:
+	// 傾き
+	double mAngle = 0.0;
+	// 縦横区分(0:横書き／1:縦書き)
+	int mTateyoko = 0;
+	// 字の大きさ(0.1mm)
+	int	mSize = 0;
+	// 注記データ（注記文字列プールのハンドル）
+	DmTextPool::Handle mTextHandle = DmTextPool::InvalidHandle;
+};
+
+/**
+ * 要素のグループヘッダレコード(H)のレイヤコードと要素グループコード
+ * グループヘッダレコードの2～5桁目（0から）をレイヤコード、6～7桁目を要素グループコードとする。
+ * 要素の添字ごとに (レイヤコード << 16) | 要素グループコード を保持する。
+ * 要素はファイル順に追加されるので同じグループの要素は連続し、その範囲も保持する
+ */
+class DmElementGroups {
+public:
+	// 同じコードの要素の範囲 [begin, end)
+	struct Range {
+		quint32 code;
+		int begin;
+		int end;
+	};
+
+	static quint32 pack(int layer, int group) { return (static_cast<quint32>(layer & 0xFFFF) << 16) | static_cast<quint32>(group & 0xFFFF); }
+	static int layerOf(quint32 code) { return static_cast<int>(code >> 16); }
+	static int groupOf(quint32 code) { return static_cast<int>(code & 0xFFFF); }
+
+	int count() const { return mCodes.count(); }
+	int layer(int index) const { return layerOf(mCodes.at(index)); }
+	int group(int index) const { return groupOf(mCodes.at(index)); }
+	const QVector<quint32>& codes() const { return mCodes; }
+	const QVector<Range>& ranges() const { return mRanges; }
+
+	// レイヤコードが含まれる要素の範囲（添字順）
+	QVector<Range> layerRanges(const QSet<int>& layers) const;
+
+	void append(quint32 code);
+	void clear();
+
+private:
+	QVector<quint32> mCodes;
+	QVector<Range> mRanges;
+};
+
+/**
+ * 要素の地図分類コードの索引
+ * 地図分類コードごとに要素の添字の一覧（昇順）を保持する。一覧の長さは地図分類コードの頻度になる
+ */
+class DmElementCodes {
+public:
+	int count() const { return mCount; }
+	// 地図分類コードの要素数
+	int frequency(int dmcode) const { return mIndexes.value(dmcode).count(); }
+	// 地図分類コードのいずれかの要素数
+	int frequency(const QSet<int>& dmcodes) const;
+	// 地図分類コードのいずれかの要素の添字（昇順）
+	QVector<int> indexes(const QSet<int>& dmcodes) const;
+	QList<int> dmcodes() const { return mIndexes.keys(); }
+
+	void append(int dmcode);
+	void clear();
+
+private:
+	QHash<int, QVector<int>> mIndexes;
+	int mCount = 0;
+};
+
+/**
+ * 点要素（点、方向、注記）の座標
+ * 要素の添字ごとに座標列の最初の点のX座標、Y座標をそれぞれ連続した配列に保持し、
+ * 範囲の判定をジオメトリを作成せずに配列の比較のみで行う。座標のない要素はNaNとする
+ */
+class DmPointCoords {
+public:
+	int count() const { return mX.count(); }
+	double x(int index) const { return mX.at(index); }
+	double y(int index) const { return mY.at(index); }
+	const QVector<double>& xs() const { return mX; }
+	const QVector<double>& ys() const { return mY; }
+
+	/**
+	 * 添字の範囲 [begin, end) のうち座標が矩形内（境界を含む）の要素の添字をindexesに追加する（DmBoxFilter）
+	 */
+	void select(const DmRect& rect, int begin, int end, QVector<int>& indexes) const;
+
+	void append(const DmCoords& points);
+	void clear();
+
+private:
+	QVector<double> mX;
+	QVector<double> mY;
+};
+
+/**
+ * 線・面要素の範囲
+ * 要素の添字ごとに座標列の最小X、最小Y、最大X、最大Y座標をそれぞれ連続した配列に保持し、
+ * 矩形と交差する要素をジオメトリを作成せずに選ぶ。座標のない要素はNaNとする
+ */
+class DmElementExtents {
+public:
+	int count() const { return mXMin.count(); }
+	// 要素の範囲（座標のない要素はNull）
+	DmRect extent(int index) const;
+
+	/**
+	 * 添字の範囲 [begin, end) のうち範囲が矩形と交差する（境界を含む）要素の添字をindexesに追加する（DmBoxFilter）
+	 */
+	void select(const DmRect& rect, int begin, int end, QVector<int>& indexes) const;
+
+	void append(const DmCoords& points);
+	void clear();
+
+private:
+	QVector<double> mXMin;
+	QVector<double> mYMin;
+	QVector<double> mXMax;
+	QVector<double> mYMax;
+};
+
+/**
+ * 線・面要素の簡略化した座標列（詳細度）
+ * 詳細度0は元の座標列、1～(LevelCount-1)はtolerance(level)以内の頂点を省いた座標列とする。
+ * 頂点の重要度をダグラス・ポイカー法で要素ごとに1回だけ求め、各詳細度は重要度が許容誤差を
+ * 超える頂点とする（重要度は親の分割以下に抑えるので、粗い詳細度の頂点は細かい詳細度に含まれる）。
+ * 線の端点は常に残して要素間の接続を保ち、面（閉じた線を含む）は3頂点以上を残して潰さない。
+ * 頂点の減らない詳細度は1つ細かい詳細度の座標列を参照し、アリーナに複製しない。
+ */
+class DmLevelsOfDetail {
+public:
+	static const int LevelCount = 5;
+
+	// 詳細度の許容誤差（座標の単位。詳細度0は0）
+	static double tolerance(int level);
+	// 許容誤差がtolerance以下の最も粗い詳細度
+	static int levelForTolerance(double tolerance);
+
+	// 作成済みの要素数
+	int count() const { return mCoords[0].count(); }
+	// 要素の添字indexの詳細度levelの座標列（詳細度0または未作成の場合はelementの座標列）
+	DmCoords points(const DmElement& element, int index, int level) const;
+	// 詳細度の頂点数の合計
+	qint64 vertexCount(int level) const { return mVertexCounts[level]; }
+
+	/**
+	 * 要素を1つ追加する（要素の添字の順に呼び出す）
+	 * \param ring  面の境界（終点から始点に閉じる）として簡略化する
+	 */
+	void append(const DmCoords& points, bool ring, DmArena& arena);
+	void clear();
+
+private:
+	// 詳細度1～の座標列
+	QVector<DmCoords> mCoords[LevelCount - 1];
+	qint64 mVertexCounts[LevelCount] = {};
+};
+
+/**
+ * 属性レコード(E8)の1列
+ * 属性コード（属性レコードの分類コード）ごとに1列とし、要素の添字で値を参照する。
+ * 値が全て整数であれば整数、全て数値であれば実数、それ以外は文字列の列とする。
+ * 文字列は注記文字列プールのハンドルで保持する
+ */
+class DmAttributeColumn {
+public:
+	enum Type {
+		Integer,
+		Double,
+		String
+	};
+
+	DmAttributeColumn() {}
+	explicit DmAttributeColumn(int code) : mCode(code) {}
+
+	int code() const { return mCode; }
+	Type type() const { return mType; }
+	// 要素数（最後に値を持つ要素まで）
+	int count() const { return mHandles.count(); }
+
+	bool isNull(int index) const { return index < 0 || index >= mHandles.count() || mHandles.at(index) == DmTextPool::InvalidHandle; }
+	// 要素の値（値がない場合は無効なQVariant）
+	QVariant value(int index, const DmTextPool& textPool) const;
+
+	// 要素の値を設定する（型は必要に応じて整数→実数→文字列に広げる）
+	void setValue(int index, DmTextPool::Handle handle, const QString& text);
+
+	// 値を保持できる最も狭い型（列の型は値の型のうち最も広い型となる）
+	static Type valueType(const QString& text);
+
+private:
+	int mCode = 0;
+	Type mType = Integer;
+	QVector<DmTextPool::Handle> mHandles;
+	QVector<qint64> mIntegers;
+	QVector<double> mDoubles;
+};
+
+/**
+ * データ種別ごとの属性レコード(E8)の表
+ * 属性レコードは直前の要素の属性とする
+ */
+class DmAttributeTable {
+public:
+	int columnCount() const { return mColumns.count(); }
+	const DmAttributeColumn& column(int index) const { return mColumns.at(index); }
+	// 属性コードの列番号（ない場合は-1）
+	int columnIndex(int code) const { return mColumnIndexes.value(code, -1); }
+
+	void setValue(int elementIndex, int code, DmTextPool::Handle handle, const QString& text);
+	void clear();
+
+private:
+	QVector<DmAttributeColumn> mColumns;
+	QHash<int, int> mColumnIndexes;
+};
+
+/**
+ * グリッドレコード(G)
+ * 格子点の標高値を北の行から、行内は西から東の順に保持する。
+ * ヘッダレコードの項目（桁は0から）は次のとおりとする
+ *   2～5   分類コード
+ *   6～10  列数（東西方向の格子点数）
+ *   11～15 行数（南北方向の格子点数）
+ *   16～20 格子間隔（図郭の座標値の単位）
+ *   26～29 データレコード数
+ *   30～36 南西の格子点の図郭原点からのX座標値（図郭の座標値の単位）
+ *   37～43 南西の格子点の図郭原点からのY座標値（図郭の座標値の単位）
+ * データレコードは8桁の標高値(cm単位)を10個ずつ持ち、空白または-999999以下は値なしとする
+ */
+class DmGrid {
+public:
+	// 値なし
+	static const float NoData;
+
+	DmGrid() {}
+	// ヘッダレコードのみ（値は読み込まない）
+	DmGrid(const DmRow& header, const DmMesh& mesh);
+	// ヘッダレコードとデータレコード
+	DmGrid(const DmRows& rows, const DmMesh& mesh);
+
+	bool isValid() const { return mColumnCount > 0 && mRowCount > 0 && mSpacing > 0; }
+	int code() const { return mCode; }
+	int columnCount() const { return mColumnCount; }
+	int rowCount() const { return mRowCount; }
+	// 格子間隔
+	double spacing() const { return mSpacing; }
+	// 南西の格子点
+	const Point2d& origin() const { return mOrigin; }
+	// 格子点を中心とするセルの範囲
+	DmRect extent() const;
+
+	// 値（行は北から、値なしはNoData）。ヘッダのみの場合は空
+	const QVector<float>& values() const { return mValues; }
+	float value(int column, int row) const { return mValues.at(row * mColumnCount + column); }
+
+private:
+	void readHeader(const DmRow& header, const DmMesh& mesh);
+
+	int mCode = 0;
+	int mColumnCount = 0;
+	int mRowCount = 0;
+	double mSpacing = 0.0;
+	Point2d mOrigin;
+	QVector<float> mValues;
+};
+/**
+ * 不整三角網レコード(T)
+ * 全ての不整三角網の頂点と三角形を連続した配列に保持する（三角形ごとのオブジェクトは作らない）。
+ * ヘッダレコードの項目（桁は0から）は次のとおりとする
+ *   2～5   分類コード
+ *   6～11  頂点数
+ *   12～17 三角形数
+ *   26～31 データレコード数
+ * データレコードは頂点数分の頂点レコードと三角形数分の三角形レコードの順とする
+ *   頂点レコード   0～6 X座標値、7～13 Y座標値（図郭の座標値の単位）、14～21 標高値(cm単位)
+ *   三角形レコード 0～5、6～11、12～17 頂点番号（レコード内の1からの番号）
+ */
+class DmTin {
+public:
+	int vertexCount() const { return mVertices.count() / 3; }
+	int triangleCount() const { return mTriangles.count() / 3; }
+	// 頂点のX,Y,Zの並び
+	const QVector<double>& vertices() const { return mVertices; }
+	// 三角形の頂点の添字(0から)の並び
+	const QVector<qint32>& triangles() const { return mTriangles; }
+	// 読み込んだ不整三角網レコードの数
+	int surfaceCount() const { return mSurfaceCount; }
+	// 頂点の範囲
+	const DmRect& extent() const { return mExtent; }
+
+	/**
+	 * 不整三角網レコードを1つ追加する
+	 * 範囲外の頂点番号を持つ三角形は追加しない。追加した三角形の数を返す
+	 */
+	int append(const DmRows& rows, const DmMesh& mesh);
+	void clear();
+
+private:
+	QVector<double> mVertices;
+	QVector<qint32> mTriangles;
+	int mSurfaceCount = 0;
+	DmRect mExtent;
+};
+
+/**
+ * ヘッダレコードのみから収集したDMディレクトリの概要
+ * DmReader::surveyFile()で作成する。
+ * 属性レコード(E8)は列の型を決めるために値も読み込む
+ */
+class DmSurvey {
+public:
+	// データ種別(dm_pg等)ごとの地物数（グループヘッダレコードの値の合計）
+	long featureCount(const QString& dataType) const { return mFeatureCounts.value(dataType, 0); }
+	const QMap<QString, long>& featureCounts() const { return mFeatureCounts; }
+	// 全図郭の範囲
+	const DmRect& extent() const { return mExtent; }
+	// 図郭数
+	int meshCount() const { return mMeshCount; }
+	// ファイル数
+	int fileCount() const { return mFileCount; }
+	// グリッド（ヘッダのみ）
+	const QVector<DmGrid>& grids() const { return mGrids; }
+
+	// 属性レコード(E8)の列（属性コードと型）
+	struct AttributeColumn {
+		int code;
+		DmAttributeColumn::Type type;
+	};
+	// データ種別(dm_pg等)の要素の属性レコードの列（DmReader::attributes()と同じ順序・型）
+	const QVector<AttributeColumn>& attributeColumns(const QString& dataType) const;
+
+	void clear();
+
+private:
+	// 要素レコードの番号-1の要素の属性値を加える
+	void addAttributeValue(int elementType, int code, const QString& text);
+
+	QMap<QString, long> mFeatureCounts;
+	QVector<DmGrid> mGrids;
+	QVector<AttributeColumn> mAttributeColumns[7];
+	QHash<int, int> mAttributeColumnIndexes[7];
+	DmRect mExtent;
+	int mMeshCount = 0;
+	int mFileCount = 0;
+
+	friend class DmReader;
+};
+
+/**
+ * インデックスレコード(I)と図郭レコード(M)のみから作成したDMディレクトリのカタログ
+ * ファイルごとに含まれる図郭とその範囲を保持し、範囲と交差するファイルのみを読み込むために使用する。
+ * DmReader::catalogFile()、DmReader::catalogDirectories()で作成する
+ *
+ * 複数のディレクトリ（ディレクトリツリー）のカタログはsave()でマニフェストとして保存でき、
+ * 次回はサイズと更新日時の変わっていないファイルを読み込まずにload()した内容を使う。
+ */
+class DmCatalog {
+public:
+	struct Mesh {
+		// 図郭識別番号
+		QString id;
+		DmRect extent;
+	};
+
+	struct File {
+		QString path;
+		// ファイルのあるディレクトリ
+		QString directory;
+		// 作成時のサイズと更新日時（エポックからのミリ秒）
+		qint64 size = 0;
+		qint64 modified = 0;
+		// インデックスレコードの図郭識別番号
+		QStringList indexedMeshIds;
+		// 図郭レコードの図郭
+		QVector<Mesh> meshes;
+		// 図郭の範囲の結合
+		DmRect extent;
+		// データ種別(dm_pg等)ごとの地物数（グループヘッダレコードの値の合計）
+		QMap<QString, long> featureCounts;
+	};
+
+	const QVector<File>& files() const { return mFiles; }
+	int fileCount() const { return mFiles.count(); }
+	int meshCount() const;
+	// 全図郭の範囲
+	const DmRect& extent() const { return mExtent; }
+	// パスのファイル（ない場合はnullptr）
+	const File* file(const QString& path) const;
+
+	// 全てのファイルのパス
+	QStringList filePaths() const;
+	// 範囲と交差する図郭を含むファイルのパス（図郭のないファイルは含まない）
+	QStringList filePaths(const DmRect& area) const;
+
+	// ファイルのあるディレクトリ（追加した順）
+	const QStringList& directories() const { return mDirectories; }
+	// 範囲と交差する図郭を含むファイルのあるディレクトリの番号（directories()の添字）
+	QList<int> directories(const DmRect& area) const;
+	// ディレクトリのファイルのパス
+	QStringList filePaths(int directory) const;
+
+	// データ種別の地物数（グループヘッダレコードの値の合計）
+	long featureCount(const QString& dataType) const;
+
+	// ファイルを追加する
+	void append(const File& file);
+	void clear();
+
+	/**
+	 * マニフェストとして保存する
+	 * 修正回数強制上書きで図郭の範囲が変わるため、作成時の値も保存する
+	 */
+	bool save(const QString& path, int overwritingTimes) const;
+	// マニフェストを読み込む（修正回数強制上書きの値が異なる場合はfalse）
+	bool load(const QString& path, int overwritingTimes);
+
+private:
+	QVector<File> mFiles;
+	DmRect mExtent;
+	// パスからmFilesの添字
+	QHash<QString, int> mFileIndex;
+	QStringList mDirectories;
+	QHash<QString, int> mDirectoryIndex;
+	// ファイルごとのディレクトリの番号
+	QVector<int> mFileDirectories;
+
+	friend class DmReader;
+};
+
+/**
+ * 読込の進捗通知とキャンセルの確認
+ * QgsFeedback等に接続する場合は派生クラスで実装する
+ */
+class DmParseFeedback {
+public:
+	virtual ~DmParseFeedback() {}
+
+	virtual bool isCanceled() const { return false; }
+	// 進捗（0～100）
+	virtual void setProgress(double progress) { Q_UNUSED(progress) }
+	// 図郭の区切り（直前までの図郭の要素はすべて読込済み）
+	virtual void meshCompleted() {}
+};
+
+/**
+ * レコード種別ごとのレコード数（ヘッダの数、後続レコードは含まない）
+ */
+class DmRecordCounts {
+public:
+	enum RecordType {
+		Index,
+		Mesh,
+		Header,
+		Element1,
+		Element2,
+		Element3,
+		Element4,
+		Element5,
+		Element6,
+		Element7,
+		Element8,
+		Grid,
+		Tin,
+		Other,
+		RecordTypeCount
+	};
+
+	DmRecordCounts() { clear(); }
+
+	long count(RecordType type) const { return mCounts[type]; }
+	// 行数
+	long lineCount() const { return mLineCount; }
+	// バイト数
+	qint64 byteCount() const { return mByteCount; }
+
+	void add(const DmRecordCounts& other);
+	void clear();
+
+	// レコードタイプ（先頭2文字）から種別を判定する
+	static RecordType recordType(char c0, char c1);
+	// 種別の表示名（I, M, H, E1～E8, G, T）
+	static QString recordTypeName(RecordType type);
+
+private:
+	long mCounts[RecordTypeCount];
+	long mLineCount;
+	qint64 mByteCount;
+
+	friend class DmReader;
+};
+
+/**
+ * DMファイルの読込
+ * 図郭・要素を収集し、座標列はアリーナに、注記文字列は文字列プールに格納する。
+ * 複製した場合はアリーナを共有する
+ */
+class DmReader {
+public:
+	DmReader();
+
+	// 収集するデータ種別(dm_pg等、グリッドはdm_grid、不整三角網はdm_tin、空の場合は全て)
+	void setDataType(const QString& dataType) { mDataType = dataType; }
+	const QString& dataType() const { return mDataType; }
+
+	// 修正回数強制上書き（負の場合は図郭レコードの値）
+	void setOverwritingTimes(int value) { mOverwritingTimes = value; }
+	int overwritingTimes() const { return mOverwritingTimes; }
+
+	// ディレクトリ内のDMファイルのパス一覧
+	static QStringList dmFilePaths(const QString& dirPath);
+	// rootPath以下（rootPathを含む）のDMファイルのあるディレクトリを再帰的に探す
+	static QStringList dmDirectories(const QString& rootPath);
+	// ファイルの合計バイト数
+	static qint64 totalBytes(const QStringList& filePaths);
+
+	/**
+	 * DMファイルを1つ読み込み、収集済みのデータに追加する
+	 * \param feedback      進捗（読込済みバイト数の割合）の通知とキャンセルの確認
+	 * \param recordCounts  指定した場合はレコード種別ごとのレコード数を加算する
+	 * キャンセルされた場合は図郭の途中までのデータを残してfalseを返す
+	 */
+	bool readFile(const QString& filePath, DmParseFeedback* feedback = nullptr, DmRecordCounts* recordCounts = nullptr);
+
+	/**
+	 * DMファイルのヘッダレコードのみを読み込んで概要を加算する
+	 * 要素・グリッド等の本体はヘッダのレコード数を元に読み飛ばし、デコードしない
+	 * （属性レコード(E8)は列の型を決めるために値を読み込む）
+	 */
+	bool surveyFile(const QString& filePath, DmSurvey& survey) const;
+
+	/**
+	 * DMファイルのインデックスレコードと図郭レコードのみを読み込んでカタログに追加する
+	 * その他のレコードはヘッダのレコード数を元に読み飛ばす
+	 */
+	bool catalogFile(const QString& filePath, DmCatalog& catalog) const;
+
+	/**
+	 * 複数のディレクトリのDMファイルのカタログを作成する
+	 * ディレクトリごとにスレッドプールで並列に読み込み、dirPathsの順にカタログに追加する。
+	 * manifestにサイズと更新日時が同じファイルがある場合は読み込まずにその内容を使う
+	 * \returns 読み込んだ（manifestを使わなかった）ファイルの数
+	 */
+	int catalogDirectories(const QStringList& dirPaths, DmCatalog& catalog, const DmCatalog& manifest = DmCatalog()) const;
+
+	// 収集済みのデータをクリアする
+	void clear();
+
+	// 進捗の基準となる合計バイト数
+	void setBytesTotal(qint64 bytes) { mBytesTotal = bytes; }
+	qint64 bytesTotal() const { return mBytesTotal; }
+	// 読込済みのバイト数
+	qint64 bytesRead() const { return mBytesRead; }
+	// デコード済みの要素数
+	long elementsDecoded() const { return mElementsDecoded; }
+
+	const QVector<DmMesh>& meshes() const { return mMeshes; }
+	const QVector<DmPolygon>& polygons() const { return mPolygons; }
+	const QVector<DmLine>& lines() const { return mLines; }
+	const QVector<DmCircle>& circles() const { return mCircles; }
+	const QVector<DmArc>& arcs() const { return mArcs; }
+	const QVector<DmPoint>& points() const { return mPoints; }
+	const QVector<DmDirection>& directions() const { return mDirections; }
+	const QVector<DmNote>& notes() const { return mNotes; }
+	const DmTextPool& textPool() const { return mTextPool; }
+	const QVector<DmGrid>& grids() const { return mGrids; }
+	const DmTin& tin() const { return mTin; }
+	// データ種別(dm_pg等)の要素の属性レコード(E8)
+	const DmAttributeTable& attributes(const QString& dataType) const;
+	// データ種別(dm_pg等)の要素のレイヤコードと要素グループコード
+	const DmElementGroups& groups(const QString& dataType) const;
+	// データ種別(dm_pg等)の要素の地図分類コードの索引
+	const DmElementCodes& codes(const QString& dataType) const;
+
+	/**
+	 * 線・面要素(dm_pg, dm_pl, dm_cir, dm_arc)の簡略化した座標列を作成する
+	 * 作成済みの要素は処理しないので、ファイルを読み込むごとに呼び出してもよい
+	 */
+	void buildLevelsOfDetail();
+	// データ種別(dm_pg等)の要素の簡略化した座標列（点と注記は常に空）
+	const DmLevelsOfDetail& levelsOfDetail(const QString& dataType) const;
+	// データ種別(dm_pt, dm_dir, dm_tx)の要素の座標の配列（線・面は常に空）
+	const DmPointCoords& pointCoords(const QString& dataType) const;
+	// データ種別(dm_pg, dm_pl, dm_cir, dm_arc)の要素の範囲の配列（点と注記は常に空）
+	const DmElementExtents& extents(const QString& dataType) const;
+
+	// 座標列を保持するアリーナ
+	const DmArena& arena() const { return *mArena; }
+
+private:
+	/**
+	 * 図郭レコード(a)～(f)を読み込む
+	*/
+	template<class LineReader>
+	static DmMesh readMesh(LineReader& reader, const DmRow& line, int overwritingTimes);
+
+	QString mDataType;
+	int mOverwritingTimes = -1;
+
+	//QByteArrayList mIndexes;
+	QVector<DmMesh> mMeshes;
+	//QByteArrayList mHeaders;
+	// 要素は連続領域に、座標列はアリーナに格納する
+	QVector<DmPolygon> mPolygons;
+	QVector<DmLine> mLines;
+	QVector<DmCircle> mCircles;
+	QVector<DmArc> mArcs;
+	QVector<DmPoint> mPoints;
+	QVector<DmDirection> mDirections;
+	QVector<DmNote> mNotes;
+	DmTextPool mTextPool;
+	// 座標列のアリーナ（複製したDmReaderと共有する）
+	std::shared_ptr<DmArena> mArena;
+	// 要素レコード(E1～E7)ごとの属性
+	DmAttributeTable mAttributes[7];
+	// 要素レコード(E1～E7)ごとのグループヘッダレコードのコード
+	DmElementGroups mGroups[7];
+	// 要素レコード(E1～E7)ごとの地図分類コードの索引
+	DmElementCodes mCodes[7];
+	// 線・面要素(E1～E4)ごとの簡略化した座標列
+	DmLevelsOfDetail mLevelsOfDetail[4];
+	// 点要素(E5～E7)ごとの座標の配列
+	DmPointCoords mPointCoords[3];
+	// 線・面要素(E1～E4)ごとの範囲の配列
+	DmElementExtents mExtents[4];
+	QVector<DmGrid> mGrids;
+	DmTin mTin;
+
+	// 進捗通知用
+	qint64 mBytesTotal = 0;
+	qint64 mBytesRead = 0;
+	long mElementsDecoded = 0;
+};
+
+#endif // QGSDMPARSER_H
@@ -0,0 +1,256 @@
+/***************************************************************************
+    qgsdmcounters.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmcounters.h"
+#include "qgis.h"
+#include "qgsruntimeprofiler.h"
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QThread>
+
+#include <algorithm>
+
+QgsDmCounters::QgsDmCounters()
+{
+  reset();
+}
+
+void QgsDmCounters::merge( const QgsDmCounters &other )
+{
+  for ( int i = 0; i < CounterCount; i++ )
+    mValues[i] += other.mValues[i];
+}
+
+void QgsDmCounters::reset()
+{
+  for ( int i = 0; i < CounterCount; i++ )
+    mValues[i] = 0;
+}
+
+QString QgsDmCounters::key( Counter counter )
+{
+  switch ( counter )
+  {
+    case BytesRead:
+      return QStringLiteral( "bytesRead" );
+    case RecordsDecoded:
+      return QStringLiteral( "recordsDecoded" );
+    case GeometriesBuilt:
+      return QStringLiteral( "geometriesBuilt" );
+    case VerticesBuilt:
+      return QStringLiteral( "verticesBuilt" );
+    case VerticesTransformed:
+      return QStringLiteral( "verticesTransformed" );
+    case InvalidGeometries:
+      return QStringLiteral( "invalidGeometries" );
+    case RejectedByBoundingBox:
+      return QStringLiteral( "rejectedByBoundingBox" );
+    case RejectedByExactIntersect:
+      return QStringLiteral( "rejectedByExactIntersect" );
+    case ExactIntersectGeosTests:
+      return QStringLiteral( "exactIntersectGeosTests" );
+    case RejectedBySubset:
+      return QStringLiteral( "rejectedBySubset" );
+    case FeaturesReturned:
+      return QStringLiteral( "featuresReturned" );
+    case ReadTime:
+      return QStringLiteral( "readNsecs" );
+    case ScanTime:
+      return QStringLiteral( "scanNsecs" );
+    case GeometryBuildTime:
+      return QStringLiteral( "geometryBuildNsecs" );
+    case GeometryValidationTime:
+      return QStringLiteral( "geometryValidationNsecs" );
+    case SpatialIndexTime:
+      return QStringLiteral( "spatialIndexNsecs" );
+    case SubsetScanTime:
+      return QStringLiteral( "subsetScanNsecs" );
+    case SubsetEvaluationTime:
+      return QStringLiteral( "subsetEvaluationNsecs" );
+    case CounterCount:
+      break;
+  }
+  return QString();
+}
+
+QString QgsDmCounters::name( Counter counter )
+{
+  switch ( counter )
+  {
+    case BytesRead:
+      return QObject::tr( "Bytes read" );
+    case RecordsDecoded:
+      return QObject::tr( "Records decoded" );
+    case GeometriesBuilt:
+      return QObject::tr( "Geometries built" );
+    case VerticesBuilt:
+      return QObject::tr( "Vertices built" );
+    case VerticesTransformed:
+      return QObject::tr( "Vertices transformed" );
+    case InvalidGeometries:
+      return QObject::tr( "Invalid geometries" );
+    case RejectedByBoundingBox:
+      return QObject::tr( "Features rejected by bounding box" );
+    case RejectedByExactIntersect:
+      return QObject::tr( "Features rejected by exact intersection" );
+    case ExactIntersectGeosTests:
+      return QObject::tr( "Exact intersections tested with GEOS" );
+    case RejectedBySubset:
+      return QObject::tr( "Features rejected by subset" );
+    case FeaturesReturned:
+      return QObject::tr( "Features returned" );
+    case ReadTime:
+      return QObject::tr( "Read and decode" );
+    case ScanTime:
+      return QObject::tr( "Scan features" );
+    case GeometryBuildTime:
+      return QObject::tr( "Build geometries" );
+    case GeometryValidationTime:
+      return QObject::tr( "Validate geometries" );
+    case SpatialIndexTime:
+      return QObject::tr( "Build spatial index" );
+    case SubsetScanTime:
+      return QObject::tr( "Select subset" );
+    case SubsetEvaluationTime:
+      return QObject::tr( "Evaluate subset" );
+    case CounterCount:
+      break;
+  }
+  return QString();
+}
+
+QString QgsDmCounters::formattedValue( Counter counter ) const
+{
+  if ( isTime( counter ) )
+    return QObject::tr( "%1 ms" ).arg( mValues[counter] / 1e6, 0, 'f', 1 );
+  return QString::number( mValues[counter] );
+}
+
+void QgsDmCounterStore::merge( const QgsDmCounters &counters )
+{
+  QMutexLocker locker( &mMutex );
+  mCounters.merge( counters );
+}
+
+QString QgsDmQueryPlan::modeName( Mode mode )
+{
+  switch ( mode )
+  {
+    case FileScan:
+      return QStringLiteral( "FileScan" );
+    case SubsetIndex:
+      return QStringLiteral( "SubsetIndex" );
+    case FeatureIds:
+      return QStringLiteral( "FeatureIds" );
+    case LayerIndex:
+      return QStringLiteral( "LayerIndex" );
+  }
+  return QString();
+}
+
+QString QgsDmQueryPlan::toString() const
+{
+  QStringList tests;
+  if ( testGeometry )
+    tests << ( testGeometryExact ? QStringLiteral( "exact" ) : QStringLiteral( "bbox" ) );
+  if ( testSubset )
+    tests << QStringLiteral( "subset" );
+
+  QString text = QStringLiteral( "%1 (%2)" ).arg( modeName( mode ), reason );
+  if ( !filterRect.isNull() )
+    text += QStringLiteral( " rect %1" ).arg( filterRect.toString( 3 ) );
+  if ( candidateCount >= 0 )
+    text += QStringLiteral( ", candidates %1" ).arg( candidateCount );
+  text += QStringLiteral( ", tests [%1]" ).arg( tests.join( ',' ) );
+  if ( !loadGeometry )
+    text += QStringLiteral( ", no geometry" );
+  if ( levelOfDetail > 0 )
+    text += QStringLiteral( ", level of detail %1" ).arg( levelOfDetail );
+  if ( simplifyTolerance > 0.0 )
+    text += QStringLiteral( ", simplified %1" ).arg( simplifyTolerance, 0, 'g', 4 );
+  text += QStringLiteral( ", built %1 (%2 vertices), invalid %3, rejected bbox %4 exact %5 subset %6, returned %7, setup %8 ms, fetch %9 ms" )
+          .arg( counters.value( QgsDmCounters::GeometriesBuilt ) )
+          .arg( counters.value( QgsDmCounters::VerticesBuilt ) )
+          .arg( counters.value( QgsDmCounters::InvalidGeometries ) )
+          .arg( counters.value( QgsDmCounters::RejectedByBoundingBox ) )
+          .arg( counters.value( QgsDmCounters::RejectedByExactIntersect ) )
+          .arg( counters.value( QgsDmCounters::RejectedBySubset ) )
+          .arg( counters.value( QgsDmCounters::FeaturesReturned ) )
+          .arg( setupNsecs / 1e6, 0, 'f', 2 )
+          .arg( fetchNsecs / 1e6, 0, 'f', 2 );
+  if ( counters.value( QgsDmCounters::ExactIntersectGeosTests ) > 0 )
+    text += QStringLiteral( ", GEOS tests %1" ).arg( counters.value( QgsDmCounters::ExactIntersectGeosTests ) );
+  return text;
+}
+
+QgsDmCounters QgsDmCounterStore::snapshot() const
+{
+  QMutexLocker locker( &mMutex );
+  return mCounters;
+}
+
+void QgsDmCounterStore::addPlan( const QgsDmQueryPlan &plan )
+{
+  QMutexLocker locker( &mMutex );
+  mCounters.merge( plan.counters );
+  if ( mPlanHistorySize <= 0 )
+    return;
+  while ( mPlans.size() >= mPlanHistorySize )
+    mPlans.removeFirst();
+  mPlans.append( plan );
+}
+
+QList< QgsDmQueryPlan > QgsDmCounterStore::plans() const
+{
+  QMutexLocker locker( &mMutex );
+  return mPlans;
+}
+
+void QgsDmCounterStore::setPlanHistorySize( int size )
+{
+  QMutexLocker locker( &mMutex );
+  mPlanHistorySize = std::max( size, 0 );
+  while ( mPlans.size() > mPlanHistorySize )
+    mPlans.removeFirst();
+}
+
+int QgsDmCounterStore::planHistorySize() const
+{
+  QMutexLocker locker( &mMutex );
+  return mPlanHistorySize;
+}
+
+QgsDmCounters QgsDmCounterStore::createCounters() const
+{
+  QgsDmCounters counters;
+  counters.setTiming( mTimingEnabled );
+  return counters;
+}
+
+void QgsDmCounterStore::reset()
+{
+  QMutexLocker locker( &mMutex );
+  mCounters.reset();
+}
+
+QgsDmScopedStage::QgsDmScopedStage( QgsDmCounterStore &store, QgsDmCounters::Counter timeCounter, const QString &name )
+  : mStore( store )
+  , mCounters( store.createCounters() )
+  , mTimeCounter( timeCounter )
+{
+  // QgsRuntimeProfilerはメインスレッドでのみ使用する
+  if ( QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread() )
+    mProfile = qgis::make_unique< QgsScopedRuntimeProfile >( name, QStringLiteral( "projectload" ) );
+  mTimer.start();
+}
+
+QgsDmScopedStage::~QgsDmScopedStage()
+{
+  mCounters.add( mTimeCounter, mTimer.nsecsElapsed() );
+  mStore.merge( mCounters );
+}
@@ -0,0 +1,202 @@
+/***************************************************************************
+    qgsdmcounters.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMCOUNTERS_H
+#define QGSDMCOUNTERS_H
+
+#include <QElapsedTimer>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <memory>
+
+#include "qgsrectangle.h"
+
+class QgsScopedRuntimeProfile;
+
+/**
+ * \class QgsDmCounters
+ * \brief Cumulative counters of the work done by a DM layer.
+ *
+ * Counts the bytes read, records decoded, geometries built and features
+ * rejected at each filter stage, and the time spent in each stage.  A
+ * QgsDmCounters is not thread safe; iterators count into their own instance
+ * and merge it into the provider's QgsDmCounterStore when they are closed.
+ */
+class QgsDmCounters
+{
+  public:
+
+    enum Counter
+    {
+      BytesRead,
+      RecordsDecoded,
+      GeometriesBuilt,
+      VerticesBuilt,
+      VerticesTransformed,
+      InvalidGeometries,
+      RejectedByBoundingBox,
+      RejectedByExactIntersect,
+      ExactIntersectGeosTests,
+      RejectedBySubset,
+      FeaturesReturned,
+      // 以下は時間(ns)
+      ReadTime,
+      ScanTime,
+      GeometryBuildTime,
+      GeometryValidationTime,
+      SpatialIndexTime,
+      SubsetScanTime,
+      SubsetEvaluationTime,
+      CounterCount
+    };
+
+    QgsDmCounters();
+
+    void add( Counter counter, qint64 value = 1 ) { mValues[counter] += value; }
+    qint64 value( Counter counter ) const { return mValues[counter]; }
+
+    //! Merges the values of \a other (the timing flag is not changed).
+    void merge( const QgsDmCounters &other );
+    void reset();
+
+    //! Returns true if per-feature stage times should be measured.
+    bool timing() const { return mTiming; }
+    void setTiming( bool timing ) { mTiming = timing; }
+
+    //! Returns true if \a counter is a time in nanoseconds.
+    static bool isTime( Counter counter ) { return counter >= ReadTime; }
+    //! Returns a stable key for \a counter, e.g. "bytesRead".
+    static QString key( Counter counter );
+    //! Returns a translated, human readable name for \a counter.
+    static QString name( Counter counter );
+    //! Returns \a counter's value formatted for display (times in ms).
+    QString formattedValue( Counter counter ) const;
+
+  private:
+    qint64 mValues[CounterCount];
+    bool mTiming = false;
+};
+
+/**
+ * \class QgsDmQueryPlan
+ * \brief How one feature iterator answered its request.
+ *
+ * Records the mode chosen by QgsDmFeatureIterator and why, the number of
+ * candidates taken from an index, the features rejected at each stage and
+ * the time spent.
+ */
+class QgsDmQueryPlan
+{
+  public:
+
+    enum Mode
+    {
+      FileScan,
+      SubsetIndex,
+      FeatureIds,
+      LayerIndex
+    };
+
+    //! Returns the name of \a mode, e.g. "FileScan".
+    static QString modeName( Mode mode );
+
+    //! Returns a one line description of the plan and its statistics.
+    QString toString() const;
+
+    Mode mode = FileScan;
+    //! Why the mode was chosen, e.g. "spatial index".
+    QString reason;
+    //! Filter rectangle in the source CRS (null if none).
+    QgsRectangle filterRect;
+    bool testGeometry = false;
+    bool testGeometryExact = false;
+    bool testSubset = false;
+    bool loadGeometry = false;
+    //! Number of candidate ids from the spatial/subset index or the request, -1 for a file scan.
+    long candidateCount = -1;
+    //! Level of detail of the line and polygon geometries (0 for the original coordinates).
+    int levelOfDetail = 0;
+    //! Tolerance of the simplification done while building geometries, in layer units (0 if none).
+    double simplifyTolerance = 0.0;
+    //! Features examined, geometries built, rejections and features returned.
+    QgsDmCounters counters;
+    //! Time spent setting up the iterator (including the spatial index query), ns.
+    qint64 setupNsecs = 0;
+    //! Time spent inside fetchFeature(), ns (0 unless counters.timing() is set).
+    qint64 fetchNsecs = 0;
+};
+
+/**
+ * \class QgsDmCounterStore
+ * \brief Thread safe accumulation of the counters of one DM layer.
+ *
+ * Shared between the provider and the feature sources created from it.
+ */
+class QgsDmCounterStore
+{
+  public:
+
+    void merge( const QgsDmCounters &counters );
+    QgsDmCounters snapshot() const;
+    //! Returns empty counters whose timing flag follows timingEnabled().
+    QgsDmCounters createCounters() const;
+    void reset();
+
+    /**
+     * Sets whether per-feature stage times (geometry building, validation,
+     * index insertion, subset evaluation) are measured.  Counts are always kept.
+     */
+    void setTimingEnabled( bool enabled ) { mTimingEnabled = enabled; }
+    bool timingEnabled() const { return mTimingEnabled; }
+
+    /**
+     * Adds the plan of a closed iterator to the history and merges its counters.
+     * Only the last planHistorySize() plans are kept.
+     */
+    void addPlan( const QgsDmQueryPlan &plan );
+    //! Returns the kept plans, oldest first.
+    QList< QgsDmQueryPlan > plans() const;
+
+    //! Sets the number of plans kept (0 keeps none).
+    void setPlanHistorySize( int size );
+    int planHistorySize() const;
+
+  private:
+    mutable QMutex mMutex;
+    QgsDmCounters mCounters;
+    bool mTimingEnabled = false;
+    QList< QgsDmQueryPlan > mPlans;
+    int mPlanHistorySize = 16;
+};
+
+/**
+ * \class QgsDmScopedStage
+ * \brief Times a load stage into a counter and into QgsRuntimeProfiler.
+ *
+ * The stage appears in the "projectload" group of the runtime profiler, nested
+ * under the layer being loaded.  The profiler is only used from the main
+ * thread; from other threads only the counter is updated.  Work counted into
+ * counters() is merged into the store together with the stage time when the
+ * stage ends, including when it ends early because of cancellation.
+ */
+class QgsDmScopedStage
+{
+  public:
+    QgsDmScopedStage( QgsDmCounterStore &store, QgsDmCounters::Counter timeCounter, const QString &name );
+    ~QgsDmScopedStage();
+
+    QgsDmCounters &counters() { return mCounters; }
+
+  private:
+    QgsDmCounterStore &mStore;
+    QgsDmCounters mCounters;
+    QgsDmCounters::Counter mTimeCounter;
+    QElapsedTimer mTimer;
+    std::unique_ptr< QgsScopedRuntimeProfile > mProfile;
+};
+
+#endif // QGSDMCOUNTERS_H
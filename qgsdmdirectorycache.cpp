@@ -0,0 +1,123 @@
+/***************************************************************************
+    qgsdmdirectorycache.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmdirectorycache.h"
+#include "qgsdmfile.h"
+#include "qgslogger.h"
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include <algorithm>
+
+QgsDmDirectoryCache::QgsDmDirectoryCache( const QgsDmFile &definition, const DmCatalog &catalog, const QgsRectangle &filterExtent, int maxDirectories )
+  : mDataType( definition.dataType() )
+  , mOverwritingTimes( definition.overwritingTimes() )
+  , mBuildLevelsOfDetail( definition.buildsLevelsOfDetail() )
+  , mCatalog( catalog )
+  , mMaxDirectories( std::max( 1, maxDirectories ) )
+{
+  if ( filterExtent.isNull() )
+  {
+    for ( int i = 0; i < mCatalog.directories().count(); i++ )
+      mDirectories.append( i );
+  }
+  else
+  {
+    mDirectories = mCatalog.directories( DmRect( filterExtent.xMinimum(), filterExtent.yMinimum(), filterExtent.xMaximum(), filterExtent.yMaximum() ) );
+  }
+
+  mUsedDirectories.resize( mCatalog.directories().count() );
+  for ( int directory : qAsConst( mDirectories ) )
+    mUsedDirectories.setBit( directory );
+}
+
+QList<int> QgsDmDirectoryCache::directories( const QgsRectangle &rect ) const
+{
+  if ( rect.isNull() )
+    return mDirectories;
+
+  // 図郭と交差するディレクトリのうち使用するもの
+  const QList<int> intersecting = mCatalog.directories( DmRect( rect.xMinimum(), rect.yMinimum(), rect.xMaximum(), rect.yMaximum() ) );
+  QList<int> directories;
+  for ( int directory : intersecting )
+  {
+    if ( mUsedDirectories.testBit( directory ) )
+      directories.append( directory );
+  }
+  return directories;
+}
+
+std::shared_ptr< const QgsDmFile > QgsDmDirectoryCache::directory( int directory, qint64 *bytesRead, long *elementsDecoded )
+{
+  if ( bytesRead )
+    *bytesRead = 0;
+  if ( elementsDecoded )
+    *elementsDecoded = 0;
+
+  {
+    QMutexLocker locker( &mMutex );
+    auto it = mLoaded.constFind( directory );
+    if ( it != mLoaded.constEnd() )
+    {
+      mRecent.removeOne( directory );
+      mRecent.prepend( directory );
+      return it.value();
+    }
+  }
+
+  // 読込中は他のディレクトリを使う反復子を止めないようにロックしない
+  QElapsedTimer timer;
+  timer.start();
+  std::shared_ptr< QgsDmFile > file = std::make_shared< QgsDmFile >();
+  file->setDataType( mDataType );
+  file->setOverwritingTimes( mOverwritingTimes );
+  file->setBuildLevelsOfDetail( mBuildLevelsOfDetail );
+  file->setDirectoryIndex( directory );
+  const QStringList filePaths = mCatalog.filePaths( directory );
+  for ( const QString &filePath : filePaths )
+  {
+    if ( !file->readFile( filePath ) )
+      QgsDebugMsg( QStringLiteral( "DM file %1 cannot be read" ).arg( filePath ) );
+  }
+  if ( bytesRead )
+    *bytesRead = file->bytesRead();
+  if ( elementsDecoded )
+    *elementsDecoded = file->elementsDecoded();
+  QgsDebugMsgLevel( QStringLiteral( "DM directory %1 loaded: %2 elements, %3 ms" )
+                    .arg( mCatalog.directories().value( directory ) ).arg( file->recordCount() ).arg( timer.elapsed() ), 2 );
+
+  QMutexLocker locker( &mMutex );
+  // 同時に読み込まれた場合は先に登録されたものを使う
+  auto it = mLoaded.constFind( directory );
+  if ( it != mLoaded.constEnd() )
+    return it.value();
+
+  mLoaded.insert( directory, file );
+  mRecent.removeOne( directory );
+  mRecent.prepend( directory );
+  // 最近使用していないディレクトリから破棄する
+  while ( mRecent.count() > mMaxDirectories )
+  {
+    int evicted = mRecent.takeLast();
+    mLoaded.remove( evicted );
+    QgsDebugMsgLevel( QStringLiteral( "DM directory %1 evicted" ).arg( mCatalog.directories().value( evicted ) ), 2 );
+  }
+  return file;
+}
+
+int QgsDmDirectoryCache::loadedCount() const
+{
+  QMutexLocker locker( &mMutex );
+  return mLoaded.count();
+}
+
+void QgsDmDirectoryCache::clear()
+{
+  QMutexLocker locker( &mMutex );
+  mLoaded.clear();
+  mRecent.clear();
+}
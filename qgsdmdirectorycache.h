@@ -0,0 +1,85 @@
+/***************************************************************************
+    qgsdmdirectorycache.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMDIRECTORYCACHE_H
+#define QGSDMDIRECTORYCACHE_H
+
+#include <QBitArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <memory>
+
+#include "qgsrectangle.h"
+#include "qgsdmparser.h"
+
+class QgsDmFile;
+
+/**
+ * \class QgsDmDirectoryCache
+ * \brief Loads the directories of a recursive DM catalog on demand and evicts the least recently used ones.
+ *
+ * In recursive mode a layer covers a whole directory tree.  Instead of reading
+ * every file up front, each feature iterator asks the cache for the catalog
+ * directories intersecting its filter rectangle.  A directory is read into its
+ * own QgsDmFile the first time it is needed, and once more than maxDirectories
+ * are loaded the least recently used one is dropped.  Iterators hold a
+ * shared pointer, so a directory evicted while it is being iterated stays
+ * valid until the iterator moves on.
+ *
+ * The cache is shared by the provider and its feature sources and is thread safe.
+ */
+class QgsDmDirectoryCache
+{
+  public:
+
+    static const int DEFAULT_MAX_DIRECTORIES = 16;
+
+    /**
+     * Creates a cache for the directories of \a catalog, read with the data type,
+     * overwriting times and level of detail setting of \a definition.  Only the directories with meshes
+     * intersecting \a filterExtent are used, if it is not null.
+     */
+    QgsDmDirectoryCache( const QgsDmFile &definition, const DmCatalog &catalog, const QgsRectangle &filterExtent, int maxDirectories );
+
+    //! Returns the number of directories of the catalog.
+    int directoryCount() const { return mCatalog.directories().count(); }
+
+    //! Returns the directories which may have features within \a rect, or all directories for a null \a rect.
+    QList<int> directories( const QgsRectangle &rect = QgsRectangle() ) const;
+
+    /**
+     * Returns the elements of \a directory, reading the directory if it is not loaded.
+     * \a bytesRead and \a elementsDecoded are set to the work done, 0 if the directory was already loaded.
+     */
+    std::shared_ptr< const QgsDmFile > directory( int directory, qint64 *bytesRead = nullptr, long *elementsDecoded = nullptr );
+
+    //! Returns the number of directories currently loaded.
+    int loadedCount() const;
+
+    //! Drops all loaded directories.
+    void clear();
+
+  private:
+
+    QString mDataType;
+    int mOverwritingTimes = -1;
+    bool mBuildLevelsOfDetail = true;
+    DmCatalog mCatalog;
+    // 使用するディレクトリ（読み込む範囲で絞り込んだもの）
+    QList<int> mDirectories;
+    // ディレクトリの番号ごとに使用するかどうか（mDirectoriesと同じ内容）
+    QBitArray mUsedDirectories;
+    int mMaxDirectories = DEFAULT_MAX_DIRECTORIES;
+
+    mutable QMutex mMutex;
+    QHash< int, std::shared_ptr< const QgsDmFile > > mLoaded;
+    // 最近使用した順（先頭が最新）
+    QList<int> mRecent;
+};
+
+#endif // QGSDMDIRECTORYCACHE_H
@@ -7,9 +7,13 @@
 #include "qgsdmfeatureiterator.h"
 #include "qgsdmprovider.h"
 #include "qgsdmfile.h"
+#include "qgsdmboxfilter.h"
 
 #include "qgsexpression.h"
+#include "qgsexpressionnodeimpl.h"
+#include "qgsdmdirectorycache.h"
 #include "qgsgeometry.h"
+#include "qgspoint.h"
 #include "qgslogger.h"
 #include "qgsmessagelog.h"
 #include "qgsproject.h"
@@ -18,14 +22,217 @@
 #include "qgsexpressioncontextutils.h"
 
 #include <QtAlgorithms>
+#include <QElapsedTimer>
 #include <QTextStream>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+  bool isColumn( const QgsExpressionNode *node, const QString &name )
+  {
+    return node && node->nodeType() == QgsExpressionNode::ntColumnRef
+           && static_cast<const QgsExpressionNodeColumnRef *>( node )->name().compare( name, Qt::CaseInsensitive ) == 0;
+  }
+
+  // 整数のリテラル（小数部のない実数を含む）のみ値を返す
+  // 文字列や小数部のある実数は式の評価と結果が異なるので扱わない（"layer" = 31.5 は31・32のどちらとも一致しない）
+  bool literalInt( const QgsExpressionNode *node, int &value )
+  {
+    if ( !node || node->nodeType() != QgsExpressionNode::ntLiteral )
+      return false;
+    const QVariant literal = static_cast<const QgsExpressionNodeLiteral *>( node )->value();
+    bool ok = false;
+    switch ( literal.type() )
+    {
+      case QVariant::Int:
+      case QVariant::UInt:
+      case QVariant::LongLong:
+      case QVariant::ULongLong:
+      {
+        const qlonglong integer = literal.toLongLong( &ok );
+        if ( !ok || integer < std::numeric_limits<int>::min() || integer > std::numeric_limits<int>::max() )
+          return false;
+        value = static_cast<int>( integer );
+        return true;
+      }
+      case QVariant::Double:
+      {
+        const double number = literal.toDouble( &ok );
+        if ( !ok || std::floor( number ) != number || number < std::numeric_limits<int>::min() || number > std::numeric_limits<int>::max() )
+          return false;
+        value = static_cast<int>( number );
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  // "列" = '文字列'、'文字列' = "列" のみの式であれば文字列を返す
+  bool columnText( const QgsExpression *expression, const QString &name, QString &text )
+  {
+    if ( !expression || !expression->rootNode() || expression->rootNode()->nodeType() != QgsExpressionNode::ntBinaryOperator )
+      return false;
+
+    const QgsExpressionNodeBinaryOperator *op = static_cast<const QgsExpressionNodeBinaryOperator *>( expression->rootNode() );
+    if ( op->op() != QgsExpressionNodeBinaryOperator::boEQ )
+      return false;
+    const QgsExpressionNode *column = op->opLeft();
+    const QgsExpressionNode *literal = op->opRight();
+    if ( !isColumn( column, name ) )
+      std::swap( column, literal );
+    if ( !isColumn( column, name ) || !literal || literal->nodeType() != QgsExpressionNode::ntLiteral )
+      return false;
+    const QVariant value = static_cast<const QgsExpressionNodeLiteral *>( literal )->value();
+    if ( value.type() != QVariant::String )
+      return false;
+    text = value.toString();
+    return true;
+  }
+
+  // "列" = n、n = "列"、"列" IN (n, ...) のみの式であれば値を返す（列はlayer・dmcode）
+  bool columnRestriction( const QgsExpression *expression, const QString &name, QSet<int> &values )
+  {
+    if ( !expression || !expression->rootNode() )
+      return false;
+
+    const QgsExpressionNode *root = expression->rootNode();
+    if ( root->nodeType() == QgsExpressionNode::ntBinaryOperator )
+    {
+      const QgsExpressionNodeBinaryOperator *op = static_cast<const QgsExpressionNodeBinaryOperator *>( root );
+      if ( op->op() != QgsExpressionNodeBinaryOperator::boEQ )
+        return false;
+      const QgsExpressionNode *column = op->opLeft();
+      const QgsExpressionNode *literal = op->opRight();
+      if ( !isColumn( column, name ) )
+        std::swap( column, literal );
+      int value = 0;
+      if ( !isColumn( column, name ) || !literalInt( literal, value ) )
+        return false;
+      values.insert( value );
+      return true;
+    }
+
+    if ( root->nodeType() == QgsExpressionNode::ntInOperator )
+    {
+      const QgsExpressionNodeInOperator *in = static_cast<const QgsExpressionNodeInOperator *>( root );
+      if ( in->isNotIn() || !isColumn( in->node(), name ) || !in->list() )
+        return false;
+      const QList<QgsExpressionNode *> nodes = in->list()->list();
+      QSet<int> list;
+      for ( const QgsExpressionNode *node : nodes )
+      {
+        int value = 0;
+        if ( !literalInt( node, value ) )
+          return false;
+        list.insert( value );
+      }
+      values = list;
+      return true;
+    }
+
+    return false;
+  }
+
+  // 要素の範囲が矩形と交差するか（座標のない要素は交差しない）
+  bool extentIntersects( const DmRect &extent, const QgsRectangle &rect )
+  {
+    return !extent.isNull() && extent.xMinimum() <= rect.xMaximum() && rect.xMinimum() <= extent.xMaximum()
+           && extent.yMinimum() <= rect.yMaximum() && rect.yMinimum() <= extent.yMaximum();
+  }
+
+  // 線分が矩形と交差するか（境界を含む。Liang-Barsky法）
+  bool segmentIntersects( const Point2d &a, const Point2d &b, const QgsRectangle &rect )
+  {
+    const double dx = b.x() - a.x();
+    const double dy = b.y() - a.y();
+    const double p[4] = { -dx, dx, -dy, dy };
+    const double q[4] = { a.x() - rect.xMinimum(), rect.xMaximum() - a.x(), a.y() - rect.yMinimum(), rect.yMaximum() - a.y() };
+    double t0 = 0.0;
+    double t1 = 1.0;
+    for ( int i = 0; i < 4; i++ )
+    {
+      if ( p[i] == 0.0 )
+      {
+        // 境界と平行で外側
+        if ( q[i] < 0.0 )
+          return false;
+        continue;
+      }
+      const double t = q[i] / p[i];
+      if ( p[i] < 0.0 )
+      {
+        if ( t > t1 )
+          return false;
+        t0 = std::max( t0, t );
+      }
+      else
+      {
+        if ( t < t0 )
+          return false;
+        t1 = std::min( t1, t );
+      }
+    }
+    return true;
+  }
+
+  enum class RectRelation
+  {
+    Disjoint,
+    Intersects,
+    // 面が矩形を含む場合がある（座標列の判定では決まらない）
+    MayContain
+  };
+
+  // 座標列と矩形の関係を座標の比較のみで判定する（面は閉じた環とする）
+  RectRelation rectRelation( const DmCoords &points, const DmRect &extent, bool polygon, const QgsRectangle &rect )
+  {
+    if ( extent.isNull() )
+      return RectRelation::Disjoint;
+
+    // 範囲が矩形に含まれる
+    if ( rect.xMinimum() <= extent.xMinimum() && extent.xMaximum() <= rect.xMaximum()
+         && rect.yMinimum() <= extent.yMinimum() && extent.yMaximum() <= rect.yMaximum() )
+      return RectRelation::Intersects;
+
+    // 矩形内の頂点がある
+    for ( const Point2d &point : points )
+    {
+      if ( rect.xMinimum() <= point.x() && point.x() <= rect.xMaximum() && rect.yMinimum() <= point.y() && point.y() <= rect.yMaximum() )
+        return RectRelation::Intersects;
+    }
+
+    // 矩形と交差する辺がある
+    const int count = points.count();
+    for ( int i = 1; i < count; i++ )
+    {
+      if ( segmentIntersects( points.at( i - 1 ), points.at( i ), rect ) )
+        return RectRelation::Intersects;
+    }
+    if ( polygon && count > 2 && segmentIntersects( points.at( count - 1 ), points.at( 0 ), rect ) )
+      return RectRelation::Intersects;
+
+    // 頂点も辺も矩形と交わらないので、交差するのは面が矩形を含む場合のみ（範囲が矩形を含まなければ交差しない）
+    if ( polygon && extent.xMinimum() <= rect.xMinimum() && rect.xMaximum() <= extent.xMaximum()
+         && extent.yMinimum() <= rect.yMinimum() && rect.yMaximum() <= extent.yMaximum() )
+      return RectRelation::MayContain;
+    return RectRelation::Disjoint;
+  }
+}
+
 QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool ownSource, const QgsFeatureRequest &request )
   : QgsAbstractFeatureIteratorFromSource<QgsDmFeatureSource>( source, ownSource, request )
   , mTestSubset( mSource->mSubsetExpression )
 {
   // requet引数に基づきフィルターモードを決定する
   QgsDebugMsg( QStringLiteral( "Setting up QgsDmIterator" ) );
+  QElapsedTimer setupTimer;
+  setupTimer.start();
+  mPlan.counters = mSource->mCounterStore->createCounters();
+  mPlan.reason = QStringLiteral( "no filter" );
 
   if ( mRequest.destinationCrs().isValid() && mRequest.destinationCrs() != mSource->mCrs )
   {
@@ -40,6 +247,8 @@ QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool own
   catch ( QgsCsException & )
   {
     // 投影変換失敗
+    mPlan.reason = QStringLiteral( "filter rectangle transform failed" );
+    mPlan.setupNsecs = setupTimer.nsecsElapsed();
     close();
     return;
   }
@@ -55,6 +264,7 @@ QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool own
     {
             // サブセットの指定がなく、範囲がレイヤーの範囲に交差しない場合は地物IDリストモードに設定
       QgsDebugMsg( QStringLiteral( "Rectangle outside layer extents - no features to return" ) );
+      mPlan.reason = QStringLiteral( "rectangle outside layer extent" );
       mMode = FeatureIds;
     }
     else if ( mFilterRect.contains( mSource->mExtent ) && !mTestSubset )
@@ -62,48 +272,36 @@ QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool own
             // 要求範囲にレイヤー全体の範囲が含まれる場合はファイルスキャンモードのままとする
             // ジオメトリのテストも不要
       QgsDebugMsg( QStringLiteral( "Rectangle contains layer extents - bypass spatial filter" ) );
+      mPlan.reason = QStringLiteral( "rectangle contains layer extent" );
       mTestGeometry = false;
-    }
-
-        // 空間インデックスがある場合は、それを使用します。 
-        // 空間インデックスはすでにサブセットを説明しています。 
-        // また、正確な交差を行わない限り、ジオメトリをテストする必要がないことも意味します
-    else if ( mSource->mUseSpatialIndex )
-    {
-      mFeatureIds = mSource->mSpatialIndex->intersects( mFilterRect );
-      // 効率的に順次検索するためにソート
-      std::sort( mFeatureIds.begin(), mFeatureIds.end() );
-      QgsDebugMsg( QStringLiteral( "Layer has spatial index - selected %1 features from index" ).arg( mFeatureIds.size() ) );
-      mMode = FeatureIds;
-      mTestSubset = false;
-      mTestGeometry = mTestGeometryExact;
     }
   }
 
   if ( request.filterType() == QgsFeatureRequest::FilterFid )
   {
     QgsDebugMsg( QStringLiteral( "Configuring for returning single id" ) );
-    if ( mFilterRect.isNull() || mFeatureIds.contains( request.filterFid() ) )
+    // 範囲がレイヤーの範囲外であれば空のまま、それ以外は範囲を地物ごとに判定する
+    if ( mMode != FeatureIds )
     {
       mFeatureIds = QList<QgsFeatureId>() << request.filterFid();
     }
+    mPlan.reason = QStringLiteral( "feature id" );
     mMode = FeatureIds;
     mTestSubset = false;
   }
+  else if ( mMode == FileScan )
+  {
+        // サブセット・フィルタ式・範囲を処理する索引の組み合わせを見積もりで選ぶ
+    planAccess( request );
+  }
 
-  else
-        // ジオメトリとテストジオメトリがある場合は、オプションを評価する。
-        // ジオメトリがない場合、すべてのレコードがジオメトリフィルタを通過する。
-        // CC：2013-05-09ジオメトリのフィルタリングとジオメトリの要求なしの意図された関係についてよくわかりませんか？ 
-        // ジオメトリを要求しない場合、空間フィルタを無視するという現在のロジックを保持しています。
-
-    if ( mMode == FileScan && mSource->mUseSubsetIndex )
-    {
-            // サブセットインデックスがあれば利用します
-      QgsDebugMsg( QStringLiteral( "Layer has subset index - use %1 items from subset index" ).arg( mSource->mSubsetIndex.size() ) );
-      mTestSubset = false;
-      mMode = SubsetIndex;
-    }
+  // 再帰モードでは要求範囲と交差する図郭のあるディレクトリのみを読み込んで走査する
+  if ( mMode == FileScan && mSource->mDirectoryCache )
+  {
+    mDirectories = mSource->mDirectoryCache->directories( mTestGeometry ? mFilterRect : QgsRectangle() );
+    QgsDebugMsg( QStringLiteral( "Recursive catalog - scan %1 of %2 directories" ).arg( mDirectories.size() ).arg( mSource->mDirectoryCache->directoryCount() ) );
+    mPlan.reason += QStringLiteral( ", %1 of %2 directories" ).arg( mDirectories.size() ).arg( mSource->mDirectoryCache->directoryCount() );
+  }
 
   if ( mMode == FileScan )
   {
@@ -127,6 +325,50 @@ QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool own
     mLoadGeometry = false;
   }
 
+  // 描画用の簡略化が要求された場合は、許容誤差（レイヤのCRSの単位）以内の頂点を省いた詳細度の座標列を使う
+  // 許容誤差は地図の縮尺から求めた1ピクセル程度の大きさなので、省いた頂点は描画結果に影響しない
+  if ( mLoadGeometry && mSource->mGeometryType != QgsWkbTypes::PointGeometry && mSource->mFile->buildsLevelsOfDetail()
+       && mRequest.simplifyMethod().methodType() == QgsSimplifyMethod::OptimizeForRendering )
+  {
+    mLevelOfDetail = DmLevelsOfDetail::levelForTolerance( mRequest.simplifyMethod().tolerance() );
+    QgsDebugMsgLevel( QStringLiteral( "Simplify tolerance %1 - level of detail %2" ).arg( mRequest.simplifyMethod().tolerance() ).arg( mLevelOfDetail ), 3 );
+  }
+  // ローカルでの簡略化を強制されていなければ、地物の作成時に許容誤差未満の頂点を省く（capabilities()のSimplifyGeometries）
+  if ( mLoadGeometry && mSource->mGeometryType != QgsWkbTypes::PointGeometry
+       && mRequest.simplifyMethod().methodType() == QgsSimplifyMethod::OptimizeForRendering
+       && !mRequest.simplifyMethod().forceLocalOptimization() )
+  {
+    mSimplifyTolerance = mRequest.simplifyMethod().tolerance();
+  }
+
+  // 線・面はジオメトリを作成してから地物ごとに変換せず、座標列をまとめて変換してから作成する
+  // 正確な交差判定はレイヤのCRSのジオメトリで行うので従来どおりとする
+  if ( mTransform.isValid() && mLoadGeometry && mSource->mGeometryType != QgsWkbTypes::PointGeometry
+       && !( mTestGeometry && mTestGeometryExact ) )
+  {
+    mBatchTransform = true;
+    if ( mSimplifyTolerance > 0.0 )
+    {
+      // 許容誤差を変換先のCRSの単位にする（範囲の対角線の比）
+      try
+      {
+        const QgsRectangle sourceRect = mFilterRect.isNull() ? mSource->mExtent : mFilterRect;
+        const QgsRectangle destinationRect = mTransform.transformBoundingBox( sourceRect );
+        const double sourceDiagonal = std::sqrt( sourceRect.width() * sourceRect.width() + sourceRect.height() * sourceRect.height() );
+        const double destinationDiagonal = std::sqrt( destinationRect.width() * destinationRect.width() + destinationRect.height() * destinationRect.height() );
+        if ( sourceDiagonal > 0.0 )
+          mSimplifyTolerance *= destinationDiagonal / sourceDiagonal;
+      }
+      catch ( QgsCsException & )
+      {
+        mBatchTransform = false;
+      }
+    }
+    // 再帰モードでは要素の番号がディレクトリごとなので変換キャッシュは使わない
+    if ( mBatchTransform && mSource->mTransformCache && !mSource->mDirectoryCache )
+      mTransformEntry = mSource->mTransformCache->entry( mTransform, mLevelOfDetail, mSource->mFile->recordCount() );
+  }
+
   // 式フィルターに必要なすべての属性がフェッチされていることを確認する
   if ( mRequest.flags() & QgsFeatureRequest::SubsetOfAttributes && request.filterType() == QgsFeatureRequest::FilterExpression )
   {
@@ -148,12 +390,60 @@ QgsDmFeatureIterator::QgsDmFeatureIterator( QgsDmFeatureSource *source, bool own
     }
     mRequest.setSubsetOfAttributes( attrs );
   }
+  // サブセット式を評価する場合は式の属性も必要（要求された属性と式の属性のみ取得する）
+  if ( mTestSubset && mRequest.flags() & QgsFeatureRequest::SubsetOfAttributes )
+  {
+    if ( mSource->mSubsetExpression->referencedColumns().contains( QgsFeatureRequest::ALL_ATTRIBUTES ) )
+    {
+      mRequest.setSubsetOfAttributes( mSource->mFields.allAttributesList() );
+    }
+    else
+    {
+      QSet<int> attributeIndexes = mSource->mSubsetExpression->referencedAttributeIndexes( mSource->mFields );
+      attributeIndexes += mRequest.subsetOfAttributes().toSet();
+      mRequest.setSubsetOfAttributes( attributeIndexes.toList() );
+    }
+  }
 
   QgsDebugMsg( QStringLiteral( "Iterator is scanning file: " ) + ( mMode == FileScan ? "Yes" : "No" ) );
   QgsDebugMsg( QStringLiteral( "Iterator is loading geometries: " ) + ( mLoadGeometry ? "Yes" : "No" ) );
   QgsDebugMsg( QStringLiteral( "Iterator is testing geometries: " ) + ( mTestGeometry ? "Yes" : "No" ) );
   QgsDebugMsg( QStringLiteral( "Iterator is testing subset: " ) + ( mTestSubset ? "Yes" : "No" ) );
 
+  // 実行計画を記録する
+  switch ( mMode )
+  {
+    case FileScan:
+      mPlan.mode = QgsDmQueryPlan::FileScan;
+      mPlan.candidateCount = -1;
+      break;
+    case SubsetIndex:
+      mPlan.mode = QgsDmQueryPlan::SubsetIndex;
+      mPlan.candidateCount = mSource->mSubsetCount;
+      break;
+    case FeatureIds:
+      mPlan.mode = QgsDmQueryPlan::FeatureIds;
+      mPlan.candidateCount = mFeatureIds.size();
+      break;
+    case LayerRanges:
+    {
+      mPlan.mode = QgsDmQueryPlan::LayerIndex;
+      long candidates = 0;
+      for ( const DmElementGroups::Range &range : qAsConst( mRanges ) )
+        candidates += range.end - range.begin;
+      mPlan.candidateCount = candidates;
+      break;
+    }
+  }
+  mPlan.filterRect = mFilterRect;
+  mPlan.testGeometry = mTestGeometry;
+  mPlan.testGeometryExact = mTestGeometryExact;
+  mPlan.testSubset = mTestSubset;
+  mPlan.loadGeometry = mLoadGeometry;
+  mPlan.levelOfDetail = mLevelOfDetail;
+  mPlan.simplifyTolerance = mSimplifyTolerance;
+  mPlan.setupNsecs = setupTimer.nsecsElapsed();
+
   rewind();
 }
 
@@ -162,6 +452,242 @@ QgsDmFeatureIterator::~QgsDmFeatureIterator()
   close();
 }
 
+void QgsDmFeatureIterator::planAccess( const QgsFeatureRequest &request )
+{
+  const QgsDmFile *file = mSource->mFile.get();
+  // 再帰モードでは要素の番号・範囲がディレクトリごとなので索引と範囲の配列は使わない
+  const bool recursive = static_cast<bool>( mSource->mDirectoryCache );
+  const bool hasFilterExpression = request.filterType() == QgsFeatureRequest::FilterExpression;
+
+  QgsDmQueryPlanner::Request plannerRequest;
+  if ( mTestGeometry )
+    plannerRequest.rect = mFilterRect;
+  plannerRequest.hasSubset = mTestSubset;
+  plannerRequest.hasFilterExpression = hasFilterExpression;
+  plannerRequest.spatialIndex = mTestGeometry && mSource->mUseSpatialIndex;
+  plannerRequest.extentFilter = mTestGeometry && !recursive;
+  plannerRequest.combineIndexes = !recursive;
+  plannerRequest.subsetSelection = mTestSubset && mSource->mUseSubsetIndex;
+
+  // 注記の文字列のみの条件（フィルタ式）は、文字列を比較せずに文字列プールのハンドルで判定する
+  QString text;
+  if ( !recursive && hasFilterExpression && file->dataType() == QLatin1String( "dm_tx" )
+       && columnText( request.filterExpression(), QStringLiteral( "vtext" ), text ) )
+  {
+    mTextHandle = file->textPool().find( text );
+    if ( mTextHandle == DmTextPool::InvalidHandle )
+    {
+      // 未登録の文字列と一致する注記はない
+      // 取込に失敗した注記もInvalidHandleを持つので、ハンドルの比較はしない
+      mPlan.reason = QStringLiteral( "text not in pool" );
+      mFeatureIds.clear();
+      mMode = FeatureIds;
+      return;
+    }
+    mTestTextHandle = true;
+    mFilterExpressionHandled = true;
+  }
+
+  if ( plannerRequest.subsetSelection )
+  {
+    QgsDmQueryPlanner::Restriction restriction;
+    restriction.path = QgsDmQueryPlanner::SubsetIndex;
+    restriction.candidates = mSource->mSubsetCount;
+    restriction.coversSubset = true;
+    plannerRequest.restrictions << restriction;
+  }
+
+  // レイヤコード・地図分類コードのみの条件（サブセット・フィルタ式）は索引の要素のみを走査する
+  QSet<int> layers;
+  QSet<int> dmcodes;
+  if ( !recursive )
+  {
+    const QgsDmQueryPlanner::AttributePath paths[] = { QgsDmQueryPlanner::LayerIndex, QgsDmQueryPlanner::DmcodeIndex };
+    for ( QgsDmQueryPlanner::AttributePath path : paths )
+    {
+      const QString column = path == QgsDmQueryPlanner::LayerIndex ? QStringLiteral( "layer" ) : QStringLiteral( "dmcode" );
+      QSet<int> subsetValues;
+      QSet<int> filterValues;
+      const bool fromSubset = mTestSubset && columnRestriction( mSource->mSubsetExpression.get(), column, subsetValues );
+      const bool fromFilter = hasFilterExpression && columnRestriction( request.filterExpression(), column, filterValues );
+      if ( !fromSubset && !fromFilter )
+        continue;
+
+      QSet<int> &values = path == QgsDmQueryPlanner::LayerIndex ? layers : dmcodes;
+      values = fromSubset ? subsetValues : filterValues;
+      if ( fromSubset && fromFilter )
+        values.intersect( filterValues );
+
+      QgsDmQueryPlanner::Restriction restriction;
+      restriction.path = path;
+      if ( path == QgsDmQueryPlanner::LayerIndex )
+      {
+        const QVector<DmElementGroups::Range> ranges = file->groups().layerRanges( values );
+        for ( const DmElementGroups::Range &range : ranges )
+          restriction.candidates += range.end - range.begin;
+      }
+      else
+      {
+        restriction.candidates = file->codes().frequency( values );
+      }
+      restriction.coversSubset = fromSubset;
+      restriction.coversFilter = fromFilter;
+      plannerRequest.restrictions << restriction;
+    }
+  }
+
+  const QgsDmQueryPlanner::Plan plan = QgsDmQueryPlanner( *mSource->mStatistics ).plan( plannerRequest );
+  QgsDebugMsg( QStringLiteral( "Query plan: %1" ).arg( plan.description() ) );
+  mPlan.reason = plan.description();
+  if ( plan.restriction.coversSubset )
+  {
+    mTestSubset = false;
+  }
+  else if ( plannerRequest.subsetSelection )
+  {
+    // 式を評価せず、要素ごとに選択ビット列を判定する
+    mTestSubset = false;
+    mTestSubsetSelection = true;
+  }
+  if ( plan.restriction.coversFilter )
+    mFilterExpressionHandled = true;
+
+  // 要素ごとに範囲を判定する場合は索引の要素を順に走査する
+  if ( plan.rectPath == QgsDmQueryPlanner::RectTest )
+  {
+    switch ( plan.restriction.path )
+    {
+      case QgsDmQueryPlanner::Scan:
+        return;
+      case QgsDmQueryPlanner::SubsetIndex:
+        mMode = SubsetIndex;
+        return;
+      case QgsDmQueryPlanner::LayerIndex:
+        mRanges = file->groups().layerRanges( layers );
+        mMode = LayerRanges;
+        return;
+      case QgsDmQueryPlanner::DmcodeIndex:
+        break;
+    }
+  }
+
+  // 索引の候補（要素の番号の昇順）。範囲の配列・空間インデックスのみの場合は候補を列挙しない
+  const bool point = mSource->mGeometryType == QgsWkbTypes::PointGeometry;
+  const int count = point ? file->pointCoords().count() : file->extents().count();
+  QVector<int> candidates;
+  switch ( plan.restriction.path )
+  {
+    case QgsDmQueryPlanner::Scan:
+      break;
+    case QgsDmQueryPlanner::SubsetIndex:
+    {
+      const QBitArray &selection = mSource->mSubsetSelection;
+      candidates.reserve( mSource->mSubsetCount );
+      for ( int index = 0; index < selection.size(); index++ )
+      {
+        if ( selection.testBit( index ) )
+          candidates.append( index );
+      }
+      break;
+    }
+    case QgsDmQueryPlanner::LayerIndex:
+    {
+      const QVector<DmElementGroups::Range> ranges = file->groups().layerRanges( layers );
+      for ( const DmElementGroups::Range &range : ranges )
+      {
+        for ( int index = range.begin; index < range.end; index++ )
+          candidates.append( index );
+      }
+      break;
+    }
+    case QgsDmQueryPlanner::DmcodeIndex:
+      candidates = file->codes().indexes( dmcodes );
+      break;
+  }
+  const bool scan = plan.restriction.path == QgsDmQueryPlanner::Scan;
+
+  QVector<int> indexes;
+  switch ( plan.rectPath )
+  {
+    case QgsDmQueryPlanner::RectTest:
+      // 地図分類コードの索引のみ（範囲は要素ごとに判定する）
+      indexes = candidates;
+      break;
+
+    case QgsDmQueryPlanner::ExtentFilter:
+    {
+      // 点の座標・線と面の範囲の配列で矩形と交差する要素を選び、要素ごとのジオメトリの判定を省く
+      // 点は正確な交差判定も範囲内かどうかと同じになる。線・面の正確な交差判定は選んだ要素のみ行う
+      const DmRect rect( mFilterRect.xMinimum(), mFilterRect.yMinimum(), mFilterRect.xMaximum(), mFilterRect.yMaximum() );
+      auto select = [&]( int begin, int end )
+      {
+        if ( point )
+          file->pointCoords().select( rect, begin, end, indexes );
+        else
+          file->extents().select( rect, begin, end, indexes );
+      };
+      if ( scan )
+      {
+        select( 0, count );
+      }
+      else
+      {
+        // 連続する候補はまとめて判定する
+        int begin = 0;
+        while ( begin < candidates.size() )
+        {
+          int end = begin + 1;
+          while ( end < candidates.size() && candidates.at( end ) == candidates.at( end - 1 ) + 1 )
+            end++;
+          select( std::min( candidates.at( begin ), count ), std::min( candidates.at( end - 1 ) + 1, count ) );
+          begin = end;
+        }
+      }
+      mPlan.counters.add( QgsDmCounters::RejectedByBoundingBox, ( scan ? count : candidates.size() ) - indexes.size() );
+      QgsDebugMsg( QStringLiteral( "Element extents - selected %1 features (%2)" ).arg( indexes.size() ).arg( DmBoxFilter::kernelName( DmBoxFilter::bestKernel() ) ) );
+      mTestGeometry = !point && mTestGeometryExact;
+      break;
+    }
+
+    case QgsDmQueryPlanner::SpatialIndex:
+    {
+      // 空間インデックスは全ての要素を持つので、サブセットは索引・選択ビット列・式のいずれかで判定する
+      // 正確な交差を行わない限り、ジオメトリをテストする必要はない
+      QList<QgsFeatureId> ids = mSource->mSpatialIndex->intersects( mFilterRect );
+      std::sort( ids.begin(), ids.end() );
+      QgsDebugMsg( QStringLiteral( "Layer has spatial index - selected %1 features from index" ).arg( ids.size() ) );
+      if ( scan )
+      {
+        mFeatureIds = ids;
+      }
+      else
+      {
+        // 索引の候補との共通部分（どちらも昇順）
+        int position = 0;
+        for ( QgsFeatureId id : qAsConst( ids ) )
+        {
+          const long index = file->indexOfRecordId( id );
+          while ( position < candidates.size() && candidates.at( position ) < index )
+            position++;
+          if ( position < candidates.size() && candidates.at( position ) == index )
+            indexes.append( index );
+        }
+      }
+      mTestGeometry = mTestGeometryExact;
+      break;
+    }
+  }
+
+  if ( !( scan && plan.rectPath == QgsDmQueryPlanner::SpatialIndex ) )
+  {
+    mFeatureIds.clear();
+    mFeatureIds.reserve( indexes.size() );
+    for ( int index : qAsConst( indexes ) )
+      mFeatureIds.append( file->recordIdOfIndex( index ) );
+  }
+  mMode = FeatureIds;
+}
+
 bool QgsDmFeatureIterator::fetchFeature( QgsFeature &feature )
 {
   // before we do anything else, assume that there's something wrong with
@@ -171,8 +697,26 @@ bool QgsDmFeatureIterator::fetchFeature( QgsFeature &feature )
   if ( mClosed )
     return false;
 
+  // 地物ごとの時間は計測する設定の場合のみ測る
+  QElapsedTimer fetchTimer;
+  if ( mPlan.counters.timing() )
+    fetchTimer.start();
+
   bool gotFeature = false;
-  if ( mMode == FileScan )
+  if ( mMode == FileScan && mSource->mDirectoryCache )
+  {
+    // ディレクトリの終わりで次のディレクトリに進む
+    while ( !gotFeature )
+    {
+      if ( mDirectoryPosition >= 0 )
+        gotFeature = nextFeatureInternal( feature );
+      if ( gotFeature || mDirectoryPosition + 1 >= mDirectories.size() )
+        break;
+      mDirectoryPosition++;
+      openDirectory( mDirectories.at( mDirectoryPosition ) );
+    }
+  }
+  else if ( mMode == FileScan )
   {
     gotFeature = nextFeatureInternal( feature );
   }
@@ -188,9 +732,26 @@ bool QgsDmFeatureIterator::fetchFeature( QgsFeature &feature )
           fid = mFeatureIds.at( mNextId );
         }
       }
-      else if ( mNextId < mSource->mSubsetIndex.size() )
+      else if ( mMode == LayerRanges )
+      {
+        // mNextIdは範囲内の要素の添字（地物IDは添字+1）
+        while ( mRangeIndex < mRanges.size() && mNextId >= mRanges.at( mRangeIndex ).end )
+        {
+          mRangeIndex++;
+          if ( mRangeIndex < mRanges.size() )
+            mNextId = mRanges.at( mRangeIndex ).begin;
+        }
+        if ( mRangeIndex < mRanges.size() )
+          fid = mNextId + 1;
+      }
+      else
       {
-        fid = mSource->mSubsetIndex.at( mNextId );
+        // mNextIdは選択ビット列の添字（次に選択されている要素まで進める）
+        const QBitArray &selection = mSource->mSubsetSelection;
+        while ( mNextId < selection.size() && !selection.testBit( mNextId ) )
+          mNextId++;
+        if ( mNextId < selection.size() )
+          fid = mSource->mFile->recordIdOfIndex( mNextId );
       }
       if ( fid < 0 ) break;
       mNextId++;
@@ -205,8 +766,12 @@ bool QgsDmFeatureIterator::fetchFeature( QgsFeature &feature )
 
   if ( ! gotFeature ) close();
 
-  geometryToDestinationCrs( feature, mTransform );
+  // 座標列をまとめて変換した地物は変換済み
+  if ( !mGeometryTransformed )
+    geometryToDestinationCrs( feature, mTransform );
 
+  if ( mPlan.counters.timing() )
+    mPlan.fetchNsecs += fetchTimer.nsecsElapsed();
   return gotFeature;
 }
 
@@ -216,10 +781,20 @@ bool QgsDmFeatureIterator::rewind()
     return false;
 
   // Skip to first data record
-  if ( mMode == FileScan )
+  if ( mMode == FileScan && mSource->mDirectoryCache )
+  {
+    // 最初のディレクトリは最初の地物の要求時に読み込む
+    mDirectoryPosition = -1;
+  }
+  else if ( mMode == FileScan )
   {
     mSource->mFile->reset();
   }
+  else if ( mMode == LayerRanges )
+  {
+    mRangeIndex = 0;
+    mNextId = mRanges.isEmpty() ? 0 : mRanges.first().begin;
+  }
   else
   {
     mNextId = 0;
@@ -227,11 +802,23 @@ bool QgsDmFeatureIterator::rewind()
   return true;
 }
 
+bool QgsDmFeatureIterator::nextFeatureFilterExpression( QgsFeature &feature )
+{
+  // レイヤの範囲のみを走査している場合は式を評価しない
+  if ( mFilterExpressionHandled )
+    return fetchFeature( feature );
+  return QgsAbstractFeatureIteratorFromSource<QgsDmFeatureSource>::nextFeatureFilterExpression( feature );
+}
+
 bool QgsDmFeatureIterator::close()
 {
   if ( mClosed )
     return false;
 
+  // ソースを所有している場合はiteratorClosed()で削除されるので先に記録する
+  QgsDebugMsgLevel( QStringLiteral( "Iterator plan: " ) + mPlan.toString(), 2 );
+  mSource->mCounterStore->addPlan( mPlan );
+
   iteratorClosed();
 
   mFeatureIds = QList<QgsFeatureId>();
@@ -277,29 +864,111 @@ bool QgsDmFeatureIterator::nextFeatureInternal( QgsFeature &feature )
 
     // before we do anything else, assume that there's something wrong with
     feature.setValid( false );
+    mGeometryTransformed = false;
 
     DmElement element;
     if(file->nextElement(element) == false) break;
 
     QgsFeatureId fid = file->recordId();
 
+    if ( mTestSubsetSelection && !mSource->mSubsetSelection.testBit( file->currentIndex() ) )
+    {
+      mPlan.counters.add( QgsDmCounters::RejectedBySubset );
+      continue;
+    }
+
+    if ( mTestTextHandle && file->notes().at( file->currentIndex() ).textHandle() != mTextHandle )
+      continue;
+
     QgsGeometry geom;
 
-    if (mSource->createGeometryFromSrouce(element.points(), geom) == false) {
+    bool transformed = false;
+    if ( mSource->mGeometryType == QgsWkbTypes::PointGeometry )
+    {
+      // 点は座標の配列で範囲を判定し、範囲内の場合のみジオメトリを作成する（点は常に有効なので検証しない）
+      const DmPointCoords &coords = file->pointCoords();
+      const long index = file->currentIndex();
+      const double x = coords.x( index );
+      const double y = coords.y( index );
+      if ( std::isnan( x ) || std::isnan( y ) )
+        continue;
+      if ( mTestGeometry && !( x >= mFilterRect.xMinimum() && x <= mFilterRect.xMaximum() && y >= mFilterRect.yMinimum() && y <= mFilterRect.yMaximum() ) )
+      {
+        mPlan.counters.add( QgsDmCounters::RejectedByBoundingBox );
+        continue;
+      }
+      if ( mLoadGeometry )
+      {
+        geom = QgsGeometry( new QgsPoint( x, y ) );
+        mPlan.counters.add( QgsDmCounters::GeometriesBuilt );
+        mPlan.counters.add( QgsDmCounters::VerticesBuilt );
+      }
+    }
+    else if ( !mLoadGeometry && file->currentIndex() < mSource->mValidGeometries.size() )
+    {
+      // ジオメトリが不要な場合は、読込時に無効だった要素のみを除き、ジオメトリを作成しない
+      if ( !mSource->mValidGeometries.testBit( file->currentIndex() ) )
         continue;
     }
+    else
+    {
+      // 範囲は読込時に求めた要素の範囲で判定し、範囲外の要素はジオメトリを作成しない
+      const DmRect extent = mTestGeometry ? file->extents().extent( file->currentIndex() ) : DmRect();
+      if ( mTestGeometry && !extentIntersects( extent, mFilterRect ) )
+      {
+        mPlan.counters.add( QgsDmCounters::RejectedByBoundingBox );
+        continue;
+      }
+
+      // 正確な交差判定は元の座標列で行い、矩形を含む可能性がある面のみジオメトリ(GEOS)で判定する
+      bool testWithGeos = false;
+      if ( mTestGeometry && mTestGeometryExact )
+      {
+        const RectRelation relation = rectRelation( element.points(), extent, mSource->mGeometryType == QgsWkbTypes::PolygonGeometry, mFilterRect );
+        if ( relation == RectRelation::Disjoint )
+        {
+          mPlan.counters.add( QgsDmCounters::RejectedByExactIntersect );
+          continue;
+        }
+        testWithGeos = relation == RectRelation::MayContain;
+      }
 
-		if (mTestGeometry) {
+      DmCoords points = mLevelOfDetail > 0 ? file->levelsOfDetail().points( element, file->currentIndex(), mLevelOfDetail ) : element.points();
+      const bool simplified = points.begin() != element.points().begin() || mSimplifyTolerance > 0.0;
 
-			if (mTestGeometryExact) {
-				if (!geom.intersects(mFilterRect))
-					continue;
-			}
-			else {
-				if (!geom.boundingBox().intersects(mFilterRect))
-					continue;
-			}
-		}
+      if ( mBatchTransform )
+      {
+        // ジオメトリは変換した座標列から作成する
+        // 変換に失敗した場合はレイヤのCRSで作成し、fetchFeature()で変換する（エラーの通知もそちらで行う）
+        const DmCoords destinationPoints = transformPoints( points, file->currentIndex() );
+        if ( !destinationPoints.isEmpty() )
+        {
+          points = destinationPoints;
+          transformed = true;
+        }
+      }
+
+      if (mSource->createGeometryFromSrouce(points, geom, &mPlan.counters, mSimplifyTolerance) == false) {
+          // 簡略化して自己交差した場合は元の座標列で作成する
+          if ( !simplified )
+            continue;
+          DmCoords original = element.points();
+          if ( transformed )
+            original = transformPoints( original, -1 );
+          if ( original.isEmpty() || !mSource->createGeometryFromSrouce( original, geom, &mPlan.counters ) )
+            continue;
+      }
+
+      if ( testWithGeos )
+      {
+        mPlan.counters.add( QgsDmCounters::ExactIntersectGeosTests );
+        if ( !geom.intersects( mFilterRect ) )
+        {
+          mPlan.counters.add( QgsDmCounters::RejectedByExactIntersect );
+          continue;
+        }
+      }
+    }
 
     // At this point the current feature values are valid
 
@@ -309,34 +978,44 @@ bool QgsDmFeatureIterator::nextFeatureInternal( QgsFeature &feature )
     feature.initAttributes( mSource->mFields.count() );
     feature.setGeometry( geom );
 
-    // サブセット式をテストする場合は、万が一に備えてすべての属性が必要です。
+    // サブセット式をテストする場合は、式の属性もmRequestの属性に含めている
 
-    if ( ! mTestSubset && ( mRequest.flags() & QgsFeatureRequest::SubsetOfAttributes ) )
+    if ( mRequest.flags() & QgsFeatureRequest::SubsetOfAttributes )
     {
       QgsAttributeList attrs = mRequest.subsetOfAttributes();
       for ( QgsAttributeList::const_iterator i = attrs.constBegin(); i != attrs.constEnd(); ++i )
       {
         int fieldIdx = *i;
-        feature.setAttribute(fieldIdx, file->fetchAttribute(mSource->mFields.at(fieldIdx).name(), fid));
+        feature.setAttribute(fieldIdx, file->fetchAttribute(fieldIdx, fid));
       }
     }
     else
     {
       for ( int idx = 0; idx < mSource->mFields.count(); ++idx )
-        feature.setAttribute(idx, file->fetchAttribute(mSource->mFields.at(idx).name(), fid));
+        feature.setAttribute(idx, file->fetchAttribute(idx, fid));
     }
 
     // If the iterator hasn't already filtered out the subset, then do it now
 
     if ( mTestSubset )
     {
+      QElapsedTimer timer;
+      if ( mPlan.counters.timing() )
+        timer.start();
       mSource->mExpressionContext.setFeature( feature );
       QVariant isOk = mSource->mSubsetExpression->evaluate( &mSource->mExpressionContext );
-      if ( mSource->mSubsetExpression->hasEvalError() ) continue;
-      if ( ! isOk.toBool() ) continue;
+      if ( mPlan.counters.timing() )
+        mPlan.counters.add( QgsDmCounters::SubsetEvaluationTime, timer.nsecsElapsed() );
+      if ( mSource->mSubsetExpression->hasEvalError() || ! isOk.toBool() )
+      {
+        mPlan.counters.add( QgsDmCounters::RejectedBySubset );
+        continue;
+      }
     }
 
     // We have a good record, so return
+    mGeometryTransformed = transformed;
+    mPlan.counters.add( QgsDmCounters::FeaturesReturned );
     return true;
 
   }
@@ -346,7 +1025,67 @@ bool QgsDmFeatureIterator::nextFeatureInternal( QgsFeature &feature )
 
 bool QgsDmFeatureIterator::setNextFeatureId( qint64 fid )
 {
-  return mSource->mFile->setNextRecordId( ( long ) fid );
+  // 再帰モードでは地物IDの上位32ビットのディレクトリを読み込む
+  if ( mSource->mDirectoryCache && QgsDmFile::directoryIndexOf( fid ) != mCurrentDirectory )
+  {
+    if ( !openDirectory( QgsDmFile::directoryIndexOf( fid ) ) )
+      return false;
+  }
+  return mSource->mFile->setNextRecordId( fid );
+}
+
+bool QgsDmFeatureIterator::openDirectory( int directory )
+{
+  if ( directory < 0 || directory >= mSource->mDirectoryCache->directoryCount() )
+    return false;
+
+  qint64 bytesRead = 0;
+  long elementsDecoded = 0;
+  std::shared_ptr< const QgsDmFile > file = mSource->mDirectoryCache->directory( directory, &bytesRead, &elementsDecoded );
+  mPlan.counters.add( QgsDmCounters::BytesRead, bytesRead );
+  mPlan.counters.add( QgsDmCounters::RecordsDecoded, elementsDecoded );
+
+  // 要素はキャッシュと共有するので、破棄されても走査中は有効
+  mSource->mFile.reset( new QgsDmFile( file.get() ) );
+  mCurrentDirectory = directory;
+  return true;
+}
+
+DmCoords QgsDmFeatureIterator::transformPoints( const DmCoords &points, long index )
+{
+  if ( mTransformEntry && index >= 0 )
+  {
+    const DmCoords cached = mTransformEntry->coords( index );
+    if ( !cached.isEmpty() )
+      return cached;
+  }
+
+  const int count = points.count();
+  mTransformX.resize( count );
+  mTransformY.resize( count );
+  mTransformZ.fill( 0.0, count );
+  for ( int i = 0; i < count; i++ )
+  {
+    mTransformX[i] = points.at( i ).x();
+    mTransformY[i] = points.at( i ).y();
+  }
+  try
+  {
+    mTransform.transformCoords( count, mTransformX.data(), mTransformY.data(), mTransformZ.data() );
+  }
+  catch ( QgsCsException & )
+  {
+    return DmCoords();
+  }
+  mPlan.counters.add( QgsDmCounters::VerticesTransformed, count );
+
+  mTransformed.resize( count );
+  for ( int i = 0; i < count; i++ )
+    mTransformed[i].setCoord( mTransformX.at( i ), mTransformY.at( i ) );
+
+  if ( mTransformEntry && index >= 0 )
+    return mTransformEntry->insert( index, mTransformed.constData(), count );
+  return DmCoords( mTransformed.constData(), count );
 }
 
 // ------------
@@ -357,12 +1096,18 @@ QgsDmFeatureSource::QgsDmFeatureSource( const QgsDmProvider *p )
   , mUseSpatialIndex( p->mUseSpatialIndex )
   , mSpatialIndex( p->mSpatialIndex ? new QgsSpatialIndex( *p->mSpatialIndex ) : nullptr )
   , mUseSubsetIndex( p->mUseSubsetIndex )
-  , mSubsetIndex( p->mSubsetIndex )
+  , mSubsetSelection( p->mSubsetSelection )
+  , mSubsetCount( p->mNumberFeatures )
+  , mValidGeometries( p->mValidGeometries )
   , mFile( nullptr )
   , mFields( p->attributeFields )
   , mFieldCount( p->attributeFields.count())
   , mGeometryType( p->mGeometryType )
   , mCrs( p->mSrid )
+  , mCounterStore( p->mCounters )
+  , mDirectoryCache( p->mDirectoryCache )
+  , mTransformCache( p->mTransformCache )
+  , mStatistics( p->mStatistics )
 {
   mFile.reset(new QgsDmFile(p->mFile.get()));
 
@@ -376,7 +1121,7 @@ QgsFeatureIterator QgsDmFeatureSource::getFeatures( const QgsFeatureRequest &req
   return QgsFeatureIterator( new QgsDmFeatureIterator( this, false, request ) );
 }
 
-bool QgsDmFeatureSource::createGeometryFromSrouce(const QList<Point2d>& points, QgsGeometry & geom)
+bool QgsDmFeatureSource::createGeometryFromSrouce(const DmCoords& points, QgsGeometry & geom, QgsDmCounters* counters, double tolerance)
 {
-    return QgsDmProvider::createGeometry(mGeometryType, points, geom);
+    return QgsDmProvider::createGeometry(mGeometryType, points, geom, counters, tolerance);
 }
@@ -7,12 +7,15 @@
 #ifndef QGSDMFEATUREITERATOR_H
 #define QGSDMFEATUREITERATOR_H
 
+#include <QBitArray>
 #include <QList>
 #include "qgsfeatureiterator.h"
 #include "qgsfeature.h"
 #include "qgsexpressioncontext.h"
 
 #include "qgsdmprovider.h"
+#include "qgsdmtransformcache.h"
+#include "qgsdmqueryplanner.h"
 
 class QgsDmFeatureSource : public QgsAbstractFeatureSource
 {
@@ -23,7 +26,7 @@ class QgsDmFeatureSource : public QgsAbstractFeatureSource
 
   private:
 
-		bool createGeometryFromSrouce(const QList<Point2d>& points, QgsGeometry& geom);
+		bool createGeometryFromSrouce(const DmCoords& points, QgsGeometry& geom, QgsDmCounters* counters = nullptr, double tolerance = 0.0);
 
     std::unique_ptr< QgsExpression > mSubsetExpression;
     QgsExpressionContext mExpressionContext;
@@ -31,13 +34,25 @@ class QgsDmFeatureSource : public QgsAbstractFeatureSource
     bool mUseSpatialIndex;
     std::unique_ptr< QgsSpatialIndex > mSpatialIndex;
     bool mUseSubsetIndex;
-    QList<quintptr> mSubsetIndex;
+    // サブセットの地物の選択ビット列と選択されている地物数
+    QBitArray mSubsetSelection;
+    long mSubsetCount = 0;
+    // 要素のジオメトリが有効かどうか（ジオメトリを作成しない場合に使う）
+    QBitArray mValidGeometries;
     std::unique_ptr< QgsDmFile > mFile;
     QgsFields mFields;
     int mFieldCount;  // Note: this includes field count for wkt field
     QgsWkbTypes::GeometryType mGeometryType;
     QList<int> attributeColumns;
     QgsCoordinateReferenceSystem mCrs;
+    // プロバイダの処理量の累計
+    std::shared_ptr< QgsDmCounterStore > mCounterStore;
+    // 再帰モードの読込済みディレクトリ（再帰モードでない場合はnullptr）
+    std::shared_ptr< QgsDmDirectoryCache > mDirectoryCache;
+    // 変換先CRSごとの変換済み座標列（使用しない場合はnullptr）
+    std::shared_ptr< QgsDmTransformCache > mTransformCache;
+    // 実行計画の見積もりに使う要素の統計
+    std::shared_ptr< const QgsDmLayerStatistics > mStatistics;
 		
     friend class QgsDmFeatureIterator;
 };
@@ -49,7 +64,8 @@ class QgsDmFeatureIterator : public QgsAbstractFeatureIteratorFromSource<QgsDmFe
     {
       FileScan,
       SubsetIndex,
-      FeatureIds
+      FeatureIds,
+      LayerRanges
     };
   public:
     QgsDmFeatureIterator( QgsDmFeatureSource *source, bool ownSource, const QgsFeatureRequest &request );
@@ -65,6 +81,7 @@ class QgsDmFeatureIterator : public QgsAbstractFeatureIteratorFromSource<QgsDmFe
 
   protected:
     bool fetchFeature( QgsFeature &feature ) override;
+    bool nextFeatureFilterExpression( QgsFeature &feature ) override;
 
   private:
 
@@ -72,15 +89,59 @@ class QgsDmFeatureIterator : public QgsAbstractFeatureIteratorFromSource<QgsDmFe
 
     bool nextFeatureInternal( QgsFeature &feature );
 
+    // 索引・範囲の判定の組み合わせを見積もりで選び、走査する要素を決める
+    void planAccess( const QgsFeatureRequest &request );
+
+    // 再帰モード：カタログのディレクトリを読み込み（読込済みであれば取得し）走査対象とする
+    bool openDirectory( int directory );
+
+    /**
+     * 座標列をまとめて変換先のCRSに変換する（変換に失敗した場合は空）
+     * indexが0以上で変換キャッシュがある場合は、キャッシュの座標列を使うか変換した座標列を登録する
+     */
+    DmCoords transformPoints( const DmCoords &points, long index );
+
     QList<QgsFeatureId> mFeatureIds;
+    // LayerRangesで走査する要素の範囲
+    QVector<DmElementGroups::Range> mRanges;
+    int mRangeIndex = 0;
+    // 再帰モードで走査するディレクトリと走査中の位置
+    QList<int> mDirectories;
+    int mDirectoryPosition = -1;
+    // mSource->mFileに読み込んでいるディレクトリ
+    int mCurrentDirectory = -1;
     IteratorMode mMode = FileScan;
     long mNextId = 0;
+    // リクエストのフィルタ式をレイヤの範囲で処理済み
+    bool mFilterExpressionHandled = false;
     bool mTestSubset = false;
+    // サブセットを選択ビット列で判定する
+    bool mTestSubsetSelection = false;
+    // フィルタ式の注記の文字列を文字列プールのハンドルで判定する
+    bool mTestTextHandle = false;
+    DmTextPool::Handle mTextHandle = DmTextPool::InvalidHandle;
     bool mTestGeometry = false;
     bool mTestGeometryExact = false;
     bool mLoadGeometry = false;
+    // 線・面の座標列の詳細度（0は元の座標列）
+    int mLevelOfDetail = 0;
+    // プロバイダで簡略化する場合の許容誤差（ジオメトリを作成する座標のCRSの単位、0は簡略化しない）
+    double mSimplifyTolerance = 0.0;
+    // 線・面はジオメトリの作成前に座標列ごとに変換する
+    bool mBatchTransform = false;
+    // 最後に返した地物のジオメトリは変換先のCRS
+    bool mGeometryTransformed = false;
+    // 変換先CRSと詳細度の変換済み座標列
+    std::shared_ptr< QgsDmTransformCache::Entry > mTransformEntry;
+    // 変換用の作業領域
+    QVector<double> mTransformX;
+    QVector<double> mTransformY;
+    QVector<double> mTransformZ;
+    QVector<Point2d> mTransformed;
     QgsRectangle mFilterRect;
     QgsCoordinateTransform mTransform;
+    // このイテレーターの実行計画と処理量（close()でプロバイダに記録する）
+    QgsDmQueryPlan mPlan;
 };
 
 
@@ -13,196 +13,17 @@
 #include <QRegularExpression>
 #include <QUrl>
 #include <QObject>
+#include <QHash>
+#include <QVector>
+#include <QMap>
+#include <QMutex>
+#include <functional>
 #include <qgsfields.h>
+#include <qgsrectangle.h>
 
-class QFile;
-
-class Point2d {
-public:
-	Point2d() {}
-	Point2d(double x, double y)
-	{
-		mX = x;
-		mY = y;
-	}
-	Point2d(const Point2d& other) {
-		mX = other.mX;
-		mY = other.mY;
-	}
-	const double x() const { return mX; }
-	const double y() const { return mY; }
-
-	void setCoord(double x, double y)
-	{
-		mX = x;
-		mY = y;
-	}
-
-protected:
-	double mX = 0.0;
-	double mY = 0.0;
-};
-
-class Point3d : public Point2d {
-public:
-	Point3d() {}
-	Point3d(double x, double y, double z)
-		: Point2d(x, y)
-	{
-		mZ = z;
-	}
-	double z() const {
-		return mZ;	
-	}
-
-	void setCoord(double x, double y, double z)
-	{
-		Point2d::setCoord(x, y);
-		mZ = z;
-	}
-
-private:
-	double mZ = 0;
-};
-
-
-class DmMesh {
-public:
-	DmMesh() {};
-	DmMesh(const QByteArrayList& rows, int modifiedCount, const QList<int>& fCountList);
-	const Point2d &originPoint() const { return mOriginPoint;	}
-	double tani() const { return mTani; }
-	double xCoord(const QString& coordText) const;
-	double yCoord(const QString& coordText) const;
-
-private:
-	void setTani(int value);
-
-	// メッシュの原点
-	Point2d mOriginPoint;
-	// 地図情報レベル
-	int mLevel = 0;
-	// 座標値の単位
-	double mTani = 0.0;
-};
-
-class DmElement {
-public:
-	DmElement();
-	virtual ~DmElement();
-
-	// 地図分類コード
-	virtual int dmcode() const { return mDmcode; }
-	// 図形区分
-	virtual int zukeiKubun() const { return mZukeiKubun; }
-	// 間断区分
-	virtual int kandan() const { return mKandan; }
-	// 転移区分
-	virtual int teni() const { return mTeni; }
-	// データ区分
-	virtual int dataKubun() const { return mDataKubun; }
-
-	virtual const QList<Point2d>& points() const { return mPoints; }
-
-	virtual QVariant fieldValue(const QString& fieldName) const;
-
-protected:
-	bool extractCommonProperty(const QByteArray &header);
-	int coordDataCount(const QByteArray &header);
-	int coordRecordCount(const QByteArray &header);
-	bool read( const QByteArrayList & rows, const DmMesh & mesh, int limitData = 0);
-	bool extractCoords(const QByteArrayList & rows, const DmMesh & mesh, int recordCount, int dataCount);
-	bool extract2dCoords(const QByteArrayList & rows, const DmMesh & mesh, int recordCount, int dataCount);
-	bool extract3dCoords(const QByteArrayList & rows, const DmMesh & mesh, int recordCount, int dataCount);
-	virtual bool is2D();
-	virtual bool is3D();
-
-	// 地図分類コード
-	int mDmcode = 0;
-	// 図形区分
-	int mZukeiKubun = 0;
-	// 間断区分
-	int mKandan = 0;
-	// 転移区分
-	int mTeni = 0;
-	// データ区分
-	int mDataKubun = 0;
-
-	QList<Point2d> mPoints;
-};
-
-class DmPolygon: public DmElement {
-public:
-	DmPolygon(const QByteArrayList& rows, const DmMesh& mesh);
-};
-
-class DmLine : public DmElement {
-public:
-	DmLine(const QByteArrayList& rows, const DmMesh& mesh);
-};
-
-class DmCircle : public DmElement {
-public:
-	DmCircle(const QByteArrayList& rows, const DmMesh& mesh);
-};
-
-class DmArc : public DmElement {
-public:
-	DmArc(const QByteArrayList& rows, const DmMesh& mesh);
-
-private:
-	QList<double> calculateArcAngles(double deg1, double deg2, double deg3);
-};
-
-class DmPoint : public DmElement {
-public:
-	DmPoint(const QByteArrayList& rows, const DmMesh& mesh);
-};
-
-class DmDirection : public DmElement {
-public:
-	DmDirection(const QByteArrayList& rows, const DmMesh& mesh);
-
-	int angle() const { return mAngle; }
-
-	virtual QVariant fieldValue(const QString& fieldName) const;
-
-protected:
-	bool is2D() override;
-
-private:
-	// 傾き
-	double mAngle = 0.0;
-};
-
-class DmNote: public DmElement {
-public:
-	DmNote(const QByteArrayList& rows, const DmMesh& mesh);
-
-	virtual int vangle() const { return mAngle; }
-	virtual int tateyoko() const { return mTateyoko; }
-	virtual int size() const { return mSize; }
-	virtual const QString& vtext() const { return mText; }
-
-	virtual QVariant fieldValue(const QString& fieldName) const;
-
-private:
-	// 図形区分
-	virtual int zukeiKubun() const { return mZukeiKubun; }
-	// 間断区分
-	virtual int kandan() const { return mKandan; }
-
-private:
-	// 傾き
-	double mAngle = 0.0;
-	// 縦横区分(0:横書き／1:縦書き)
-	int mTateyoko = 0;
-	// 字の大きさ(0.1mm)
-	int	mSize = 0;
-	// 注記データ
-	QString mText;
-};
+#include "qgsdmparser.h"
 
+class QgsFeedback;
 
 /**
 \class QgsDmFile
@@ -278,6 +99,44 @@ class QgsDmFile : public QObject
 
 		void setOverwritingTimes(int value) { mOverwritingTimes = value; }
 
+		/**
+		 * 読み込む範囲（ヌルの場合は全て）
+		 * 範囲を指定した場合はカタログから範囲と交差する図郭を含むファイルのみを読み込む
+		 */
+		const QgsRectangle& filterExtent() const { return mFilterExtent; }
+		void setFilterExtent(const QgsRectangle& extent) { mFilterExtent = extent; }
+
+		/**
+		 * 再帰モード（ディレクトリツリー全体を1つのデータソースとする）
+		 * カタログはサブディレクトリを含めて作成し、マニフェストに保存する
+		 */
+		bool isRecursive() const { return mRecursive; }
+		void setRecursive(bool recursive);
+
+		/**
+		 * カタログのマニフェストのパス（再帰モード）
+		 * 指定がない場合はキャッシュのディレクトリ（QStandardPaths::CacheLocation）の
+		 * dmcatalog/<ディレクトリのパスのハッシュ>.manifest（キャッシュのディレクトリがない場合は空で、保存しない）
+		 */
+		QString manifestPath() const;
+		void setManifestPath(const QString& path) { mManifestPath = path; }
+
+		/**
+		 * カタログのディレクトリの番号（再帰モードで1つのディレクトリを読み込む場合）
+		 * レコードID（地物ID）の上位32ビットとし、ディレクトリをまたいで一意にする
+		 */
+		int directoryIndex() const { return mDirectoryIndex; }
+		void setDirectoryIndex(int index) { mDirectoryIndex = index; }
+		// レコードIDのディレクトリの番号
+		static int directoryIndexOf(qint64 recordId) { return static_cast<int>(recordId >> 32); }
+
+		/**
+		 * 線・面要素の簡略化した座標列（詳細度）を読込時に作成するか（既定は作成しない）
+		 * 要素ごとに4回の間引きを行うので、URLの lod=yes を指定した場合のみ作成する
+		 */
+		bool buildsLevelsOfDetail() const { return mBuildLevelsOfDetail; }
+		void setBuildLevelsOfDetail(bool build) { mBuildLevelsOfDetail = build; }
+
     /**
      * Decode the parser settings from a url as a string
      *  \param url  The url from which the delimiter and delimiterType items are read
@@ -325,23 +184,82 @@ class QgsDmFile : public QObject
 
 		/**
 		 * テスト
+		 * survey()の結果からデータ種別ごとに地物があるかを返す
 		 */
 		bool test(QMap<QString, bool>& hasMap);
 
+		/**
+		 * ヘッダレコードのみを読み込んでディレクトリの概要を収集する
+		 * 要素・グリッド等の本体はヘッダのレコード数を元に読み飛ばし、デコードしない
+		 * （属性レコード(E8)は列の型を決めるために値を読み込む）
+		 */
+		bool survey(DmSurvey& survey);
+
 		/**
 		 * データ収集
+		 * \param feedback  進捗（読込済みバイト数の割合）の通知とキャンセルの確認に使用する。
+		 *                  キャンセルされた場合は収集済みのデータをクリアしてfalseを返す
 		 */
-		bool read();
+		bool read(QgsFeedback* feedback = nullptr);
 
-		const QList<DmPolygon>& polygons() const { return mPolygons; }
-		const QList<DmLine>& lines() const { return mLines; }
-		const QList<DmCircle>& circles() const { return mCircles; }
-		const QList<DmArc>& arcs() const { return mArcs; }
-		const QList<DmPoint>& points() const { return mPoints; }
-		const QList<DmDirection>& directions() const { return mDirections; }
-		const QList<DmNote>& notes() const { return mNotes; }
+		/**
+		 * 読み込むDMファイルのパス一覧
+		 * 読み込む範囲を指定した場合は範囲と交差する図郭を含むファイルのみ
+		 */
+		QStringList dmFilePaths() const;
+
+		/**
+		 * ディレクトリのカタログ（ファイルごとの図郭と範囲）
+		 * 最初の呼び出し時にインデックスレコードと図郭レコードのみを読み込んで作成する
+		 * 再帰モードではサブディレクトリを並列に読み込み、変更のないファイルはマニフェストの内容を使う
+		 */
+		const DmCatalog& catalog() const;
+
+		/**
+		 * DMファイルを1つ読み込み、収集済みのデータに追加する
+		 * （バックグラウンド読込で使用）
+		 * キャンセルされた場合は図郭の途中までのデータを残してfalseを返す
+		 * meshCompletedは図郭の区切りごとに読込中のスレッドで呼び出す（feedbackの指定が必要）
+		 */
+		bool readFile(const QString& filePath, QgsFeedback* feedback = nullptr, const std::function<void()>& meshCompleted = std::function<void()>());
+
+		// ディレクトリ内のDMファイルの合計バイト数
+		qint64 totalBytes() const;
+		// 読込済みのバイト数
+		qint64 bytesRead() const { return mReader.bytesRead(); }
+		// デコード済みの要素数
+		long elementsDecoded() const { return mReader.elementsDecoded(); }
+
+		/**
+		 * 他のQgsDmFileが収集したデータで置き換える
+		 */
+		void setElements(const QgsDmFile& other);
+
+		const QVector<DmPolygon>& polygons() const { return mReader.polygons(); }
+		const QVector<DmLine>& lines() const { return mReader.lines(); }
+		const QVector<DmCircle>& circles() const { return mReader.circles(); }
+		const QVector<DmArc>& arcs() const { return mReader.arcs(); }
+		const QVector<DmPoint>& points() const { return mReader.points(); }
+		const QVector<DmDirection>& directions() const { return mReader.directions(); }
+		const QVector<DmNote>& notes() const { return mReader.notes(); }
+		const DmTextPool& textPool() const { return mReader.textPool(); }
+		// データ種別の要素のレイヤコードと要素グループコード
+		const DmElementGroups& groups() const { return mReader.groups(mDataType); }
+		// データ種別の要素の地図分類コードの索引
+		const DmElementCodes& codes() const { return mReader.codes(mDataType); }
+		// データ種別の要素の簡略化した座標列（作成しない場合は空）
+		const DmLevelsOfDetail& levelsOfDetail() const { return mReader.levelsOfDetail(mDataType); }
+		// データ種別の点要素の座標の配列（線・面は空）
+		const DmPointCoords& pointCoords() const { return mReader.pointCoords(mDataType); }
+		// データ種別の線・面要素の範囲の配列（点と注記は空）
+		const DmElementExtents& extents() const { return mReader.extents(mDataType); }
+
+		// 座標列を保持するアリーナ
+		const DmArena& arena() const { return mReader.arena(); }
 
 		const QgsFields& attributeFields() const;
+		// 属性レコード(E8)の列のフィールド（attr_属性コード）
+		static QgsField attributeField(int code, DmAttributeColumn::Type type);
 
 		// リセットして最初から読み直す（イテレーターで使用）
 		void reset();
@@ -349,11 +267,24 @@ class QgsDmFile : public QObject
 		// 次の地物を取得（イテレーターで使用）
 		bool nextElement(DmElement& element);
 
-		QVariant fetchAttribute(const QString& fieldName, long recordid);
+		QVariant fetchAttribute(const QString& fieldName, qint64 recordid);
+
+		/**
+		 * attributeFields()の番号で属性を取得する
+		 * 属性レコード(E8)のフィールドは列から直接取得する
+		 */
+		QVariant fetchAttribute(int fieldIndex, qint64 recordid);
 
 		// 現在レコードID取得
-		long recordId() const { return mCurrentIndex + 1; }
-		bool setNextRecordId(long recordId);
+		qint64 recordId() const { return recordIdOfIndex(mCurrentIndex); }
+		// 現在の要素の番号（0～）
+		long currentIndex() const { return mCurrentIndex; }
+		bool setNextRecordId(qint64 recordId);
+
+		// 要素の番号（0～）とレコードID（1～、上位32ビットはディレクトリの番号）の変換
+		qint64 recordIdOfIndex(long index) const { return (static_cast<qint64>(mDirectoryIndex) << 32) + index + 1; }
+		// ディレクトリの異なるレコードIDは-1
+		long indexOfRecordId(qint64 recordId) const;
 
 		long recordCount() const;
 
@@ -362,37 +293,47 @@ class QgsDmFile : public QObject
 		/**
 		 * DMファイル読込
 		*/
-		bool readDmFilie(const QString& filePath);
+		bool readDmFilie(const QString& filePath, QgsFeedback* feedback = nullptr, const std::function<void()>& meshCompleted = std::function<void()>());
 
 		void clear();
 
+		void copyElements(const QgsDmFile& other);
+
 		void resetDefinition();
 
+		// データ種別の固定フィールドに属性レコード(E8)の属性コードごとのフィールドを加える
+		void updateAttributeFields();
+
 		QString mDirPath;
 		QString mSrid;
 		int mOverwritingTimes = -1;
 		QString mDataType;
+		QgsRectangle mFilterExtent;
+		bool mRecursive = false;
+		QString mManifestPath;
+		int mDirectoryIndex = 0;
+		bool mBuildLevelsOfDetail = false;
 
 		QString mGeomType;
 
 		bool mDefinitionValid = false;
-		//QByteArrayList mIndexes;
-		QList<DmMesh> mMeshes;
-		//QByteArrayList mHeaders;
-		QList<DmPolygon> mPolygons;
-		QList<DmLine> mLines;
-		QList<DmCircle> mCircles;
-		QList<DmArc> mArcs;
-		QList<DmPoint> mPoints;
-		QList<DmDirection> mDirections;
-		QList<DmNote> mNotes;
-		//QByteArrayList mAttributes;
-		//QByteArrayList mGrids;
-		//QByteArrayList mTins;
+		// 収集したデータ（座標列のアリーナは複製したQgsDmFileと共有する）
+		DmReader mReader;
+		// ディレクトリのカタログ（作成済みの場合mCatalogBuilt）
+		mutable DmCatalog mCatalog;
+		mutable bool mCatalogBuilt = false;
+		mutable QMutex mCatalogMutex;
 
 		QgsFields mFields;
 		QgsFields mFieldsForDeirection;
 		QgsFields mFieldsForNote;
+		// データ種別のフィールドと属性レコードのフィールド
+		QgsFields mAttributeFields;
+		// mAttributeFieldsのうち固定フィールドの数
+		int mBaseFieldCount = 0;
+		// グループヘッダレコードのフィールドの番号
+		int mLayerFieldIndex = -1;
+		int mGroupFieldIndex = -1;
 
 		long mCurrentIndex = -1;
 		bool mHoldCurrentRecord = false;
@@ -0,0 +1,92 @@
+/***************************************************************************
+    qgsdmloadtask.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmloadtask.h"
+#include "qgis.h"
+#include "qgslogger.h"
+
+#include <QCoreApplication>
+#include <QThread>
+
+// 途中経過を通知する間隔(ms)
+static const int BATCH_INTERVAL_MSECS = 1000;
+
+QgsDmLoadTask::QgsDmLoadTask( const QUrl &url )
+  : QgsTask( QObject::tr( "Loading DM directory %1" ).arg( url.toLocalFile() ) )
+  , mFile( qgis::make_unique< QgsDmFile >() )
+{
+  qRegisterMetaType< QSharedPointer<QgsDmFile> >();
+  mFile->setFromUrl( url );
+
+  // 読込中のファイルの進捗をタスクの進捗とする
+  connect( &mFeedback, &QgsFeedback::progressChanged, this, [ = ]( double progress )
+  {
+    setProgress( progress );
+  }, Qt::DirectConnection );
+}
+
+void QgsDmLoadTask::cancel()
+{
+  mFeedback.cancel();
+  QgsTask::cancel();
+}
+
+bool QgsDmLoadTask::run()
+{
+  const QStringList dmFiles = mFile->dmFilePaths();
+  if ( dmFiles.isEmpty() )
+    return false;
+
+  mBatchTimer.start();
+
+  // 一定間隔で読込済みの図郭を通知する（図郭の区切りで通知するので、大きなファイルも読込の途中で検索できる）
+  auto publish = [this]
+  {
+    if ( mBatchTimer.elapsed() >= BATCH_INTERVAL_MSECS )
+    {
+      emit elementsLoaded( snapshot() );
+      mBatchTimer.restart();
+    }
+  };
+
+  int fileIndex = 0;
+  for ( const QString &dmFile : dmFiles )
+  {
+    if ( isCanceled() )
+      return false;
+
+    // DMファイルを読み込みDMデータを収集する
+    if ( !mFile->readFile( dmFile, &mFeedback, publish ) )
+    {
+      if ( !mFeedback.isCanceled() )
+        QgsDebugMsg( QStringLiteral( "DM file %1 could not be read" ).arg( dmFile ) );
+      return false;
+    }
+
+    fileIndex++;
+
+    // ファイルの最後の図郭（最後のファイルは読込完了時に通知する）
+    if ( fileIndex < dmFiles.count() )
+      publish();
+  }
+
+  return true;
+}
+
+void QgsDmLoadTask::finished( bool result )
+{
+  emit loadFinished( result, isCanceled(), snapshot() );
+  mFile.reset();
+}
+
+QSharedPointer<QgsDmFile> QgsDmLoadTask::snapshot() const
+{
+  // 要素リストは暗黙共有なので複製は参照のコピーのみ
+  QSharedPointer<QgsDmFile> loaded( new QgsDmFile( mFile.get() ) );
+  // 受け取る側のスレッドに所属させる
+  loaded->moveToThread( thread() );
+  return loaded;
+}
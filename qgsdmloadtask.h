@@ -0,0 +1,67 @@
+/***************************************************************************
+    qgsdmloadtask.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMLOADTASK_H
+#define QGSDMLOADTASK_H
+
+#include <QSharedPointer>
+#include <QElapsedTimer>
+
+#include "qgstaskmanager.h"
+#include "qgsfeedback.h"
+#include "qgsdmfile.h"
+
+/**
+ * \class QgsDmLoadTask
+ * \brief Background task which reads the DM files of a directory.
+ *
+ * The task reads the files one at a time into its own QgsDmFile.  A snapshot
+ * of the data read so far is emitted through elementsLoaded() at mesh
+ * boundaries, at most once per batch interval, so that the provider can make
+ * the loaded meshes queryable before the whole directory (or a single large
+ * file) has been read.
+ */
+class QgsDmLoadTask : public QgsTask
+{
+    Q_OBJECT
+
+  public:
+
+    /**
+     * Constructor.
+     * \param url  the DM definition (directory, data type, overwriting times) to read
+     */
+    QgsDmLoadTask( const QUrl &url );
+
+    bool run() override;
+    void finished( bool result ) override;
+    void cancel() override;
+
+  signals:
+
+    /**
+     * Emitted from the worker thread with a snapshot of all the data read so far.
+     */
+    void elementsLoaded( QSharedPointer<QgsDmFile> loaded );
+
+    /**
+     * Emitted in the main thread when the task has finished or was canceled.
+     * \a canceled is TRUE if the task was canceled, in which case \a loaded
+     * only holds the meshes read before the cancellation.
+     */
+    void loadFinished( bool result, bool canceled, QSharedPointer<QgsDmFile> loaded );
+
+  private:
+
+    QSharedPointer<QgsDmFile> snapshot() const;
+
+    std::unique_ptr< QgsDmFile > mFile;
+    // 図郭単位のキャンセルと読込バイト数による進捗に使用する
+    QgsFeedback mFeedback;
+    QElapsedTimer mBatchTimer;
+};
+
+#endif // QGSDMLOADTASK_H
@@ -0,0 +1,247 @@
+/***************************************************************************
+  qgsdmmeshprovider.cpp -  Mesh data provider for DM TINs
+  -------------------
+          begin                : March 2021
+          copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#include "qgsdmmeshprovider.h"
+
+#include <QElapsedTimer>
+#include <QUrl>
+
+#include "qgslogger.h"
+#include "qgsmessagelog.h"
+
+const QString QgsDmMeshProvider::DM_MESH_PROVIDER_KEY = QStringLiteral( "dmtin" );
+const QString QgsDmMeshProvider::DM_MESH_PROVIDER_DESCRIPTION = QStringLiteral( "DM TIN data provider" );
+
+QgsDmMeshProvider::QgsDmMeshProvider( const QString &uri, const ProviderOptions &options )
+  : QgsMeshDataProvider( uri, options )
+{
+  QUrl url = QUrl::fromEncoded( uri.toLatin1() );
+  mDirPath = url.toLocalFile();
+
+  if ( url.hasQueryItem( QStringLiteral( "srid" ) ) )
+    mCrs.createFromString( QStringLiteral( "POSTGIS:%1" ).arg( url.queryItemValue( QStringLiteral( "srid" ) ) ) );
+  if ( url.hasQueryItem( QStringLiteral( "overwritingTimes" ) ) )
+    mOverwritingTimes = url.queryItemValue( QStringLiteral( "overwritingTimes" ) ).toInt();
+
+  mValid = load();
+}
+
+bool QgsDmMeshProvider::load()
+{
+  const QStringList filePaths = DmReader::dmFilePaths( mDirPath );
+  if ( filePaths.isEmpty() )
+  {
+    QgsMessageLog::logMessage( tr( "DM TIN %1: no DM files found" ).arg( mDirPath ), tr( "DM" ) );
+    return false;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+
+  // 不整三角網のみを1回の読込で頂点と三角形の配列に追加する
+  DmReader reader;
+  reader.setDataType( QStringLiteral( "dm_tin" ) );
+  reader.setOverwritingTimes( mOverwritingTimes );
+  for ( const QString &filePath : filePaths )
+  {
+    if ( !reader.readFile( filePath ) )
+      QgsMessageLog::logMessage( tr( "DM TIN: %1 cannot be read" ).arg( filePath ), tr( "DM" ) );
+  }
+  mTin = reader.tin();
+
+  QgsDebugMsg( QStringLiteral( "DM TIN %1: %2 surfaces, %3 vertices, %4 triangles, %5 ms" )
+               .arg( mDirPath ).arg( mTin.surfaceCount() ).arg( mTin.vertexCount() ).arg( mTin.triangleCount() ).arg( timer.elapsed() ) );
+
+  if ( mTin.triangleCount() == 0 )
+  {
+    QgsMessageLog::logMessage( tr( "DM TIN %1: no TIN records found" ).arg( mDirPath ), tr( "DM" ) );
+    return false;
+  }
+  return true;
+}
+
+QString QgsDmMeshProvider::name() const
+{
+  return DM_MESH_PROVIDER_KEY;
+}
+
+QString QgsDmMeshProvider::description() const
+{
+  return DM_MESH_PROVIDER_DESCRIPTION;
+}
+
+bool QgsDmMeshProvider::isValid() const
+{
+  return mValid;
+}
+
+QgsCoordinateReferenceSystem QgsDmMeshProvider::crs() const
+{
+  return mCrs;
+}
+
+QgsRectangle QgsDmMeshProvider::extent() const
+{
+  const DmRect &extent = mTin.extent();
+  if ( extent.isNull() )
+    return QgsRectangle();
+  return QgsRectangle( extent.xMinimum(), extent.yMinimum(), extent.xMaximum(), extent.yMaximum() );
+}
+
+int QgsDmMeshProvider::vertexCount() const
+{
+  return mTin.vertexCount();
+}
+
+int QgsDmMeshProvider::faceCount() const
+{
+  return mTin.triangleCount();
+}
+
+int QgsDmMeshProvider::edgeCount() const
+{
+  return 0;
+}
+
+void QgsDmMeshProvider::populateMesh( QgsMesh *mesh ) const
+{
+  if ( !mesh )
+    return;
+
+  // QgsMeshの形式に変換する（配列は事前に確保する）
+  const int vertexCount = mTin.vertexCount();
+  const double *vertices = mTin.vertices().constData();
+  mesh->vertices.resize( vertexCount );
+  for ( int i = 0; i < vertexCount; i++ )
+    mesh->vertices[i] = QgsMeshVertex( vertices[i * 3], vertices[i * 3 + 1], vertices[i * 3 + 2] );
+
+  const int triangleCount = mTin.triangleCount();
+  const qint32 *triangles = mTin.triangles().constData();
+  mesh->faces.resize( triangleCount );
+  for ( int i = 0; i < triangleCount; i++ )
+    mesh->faces[i] = QgsMeshFace( { triangles[i * 3], triangles[i * 3 + 1], triangles[i * 3 + 2] } );
+
+  mesh->edges.clear();
+}
+
+// 頂点の標高（Bed Elevation）以外のデータセットは持たない
+
+bool QgsDmMeshProvider::addDataset( const QString &uri )
+{
+  Q_UNUSED( uri )
+  return false;
+}
+
+QStringList QgsDmMeshProvider::extraDatasets() const
+{
+  return QStringList();
+}
+
+int QgsDmMeshProvider::datasetGroupCount() const
+{
+  return 0;
+}
+
+int QgsDmMeshProvider::datasetCount( int groupIndex ) const
+{
+  Q_UNUSED( groupIndex )
+  return 0;
+}
+
+QgsMeshDatasetGroupMetadata QgsDmMeshProvider::datasetGroupMetadata( int groupIndex ) const
+{
+  Q_UNUSED( groupIndex )
+  return QgsMeshDatasetGroupMetadata();
+}
+
+QgsMeshDatasetMetadata QgsDmMeshProvider::datasetMetadata( QgsMeshDatasetIndex index ) const
+{
+  Q_UNUSED( index )
+  return QgsMeshDatasetMetadata();
+}
+
+QgsMeshDatasetValue QgsDmMeshProvider::datasetValue( QgsMeshDatasetIndex index, int valueIndex ) const
+{
+  Q_UNUSED( index )
+  Q_UNUSED( valueIndex )
+  return QgsMeshDatasetValue();
+}
+
+QgsMeshDataBlock QgsDmMeshProvider::datasetValues( QgsMeshDatasetIndex index, int valueIndex, int count ) const
+{
+  Q_UNUSED( index )
+  Q_UNUSED( valueIndex )
+  Q_UNUSED( count )
+  return QgsMeshDataBlock();
+}
+
+QgsMesh3dDataBlock QgsDmMeshProvider::dataset3dValues( QgsMeshDatasetIndex index, int faceIndex, int count ) const
+{
+  Q_UNUSED( index )
+  Q_UNUSED( faceIndex )
+  Q_UNUSED( count )
+  return QgsMesh3dDataBlock();
+}
+
+bool QgsDmMeshProvider::isFaceActive( QgsMeshDatasetIndex index, int faceIndex ) const
+{
+  Q_UNUSED( index )
+  Q_UNUSED( faceIndex )
+  return true;
+}
+
+QgsMeshDataBlock QgsDmMeshProvider::areFacesActive( QgsMeshDatasetIndex index, int faceIndex, int count ) const
+{
+  Q_UNUSED( index )
+  Q_UNUSED( faceIndex )
+  QgsMeshDataBlock active( QgsMeshDataBlock::ActiveFlagInteger, count );
+  active.setValid( true );
+  return active;
+}
+
+bool QgsDmMeshProvider::persistDatasetGroup( const QString &outputFilePath, const QString &outputDriver, const QgsMeshDatasetGroupMetadata &meta, const QVector<QgsMeshDataBlock> &datasetValues, const QVector<QgsMeshDataBlock> &datasetActive, const QVector<double> &times )
+{
+  Q_UNUSED( outputFilePath )
+  Q_UNUSED( outputDriver )
+  Q_UNUSED( meta )
+  Q_UNUSED( datasetValues )
+  Q_UNUSED( datasetActive )
+  Q_UNUSED( times )
+  // 保存はできない（trueは失敗）
+  return true;
+}
+
+bool QgsDmMeshProvider::persistDatasetGroup( const QString &outputFilePath, const QString &outputDriver, QgsMeshDatasetSourceInterface *source, int datasetGroupIndex )
+{
+  Q_UNUSED( outputFilePath )
+  Q_UNUSED( outputDriver )
+  Q_UNUSED( source )
+  Q_UNUSED( datasetGroupIndex )
+  return true;
+}
+
+QVariantMap QgsDmMeshProviderMetadata::decodeUri( const QString &uri )
+{
+  QVariantMap components;
+  components.insert( QStringLiteral( "path" ), QUrl( uri ).toLocalFile() );
+  return components;
+}
+
+QgsDataProvider *QgsDmMeshProviderMetadata::createProvider( const QString &uri, const QgsDataProvider::ProviderOptions &options )
+{
+  return new QgsDmMeshProvider( uri, options );
+}
+
+QgsDmMeshProviderMetadata::QgsDmMeshProviderMetadata():
+  QgsProviderMetadata( QgsDmMeshProvider::DM_MESH_PROVIDER_KEY, QgsDmMeshProvider::DM_MESH_PROVIDER_DESCRIPTION )
+{
+}
+
+QGISEXTERN QgsProviderMetadata *providerMetadataFactory()
+{
+  return new QgsDmMeshProviderMetadata();
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+      qgsdmmeshprovider.h  -  Mesh data provider for DM TINs
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMMESHPROVIDER_H
+#define QGSDMMESHPROVIDER_H
+
+#include "qgsmeshdataprovider.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgsrectangle.h"
+#include "qgsprovidermetadata.h"
+
+#include "qgsdmparser.h"
+
+/**
+ * \class QgsDmMeshProvider
+ * \brief Mesh data provider for the TIN (T) records of a DM directory.
+ *
+ * All TIN records of the directory are read in a single pass into one
+ * vertex buffer and one triangle index buffer (DmTin).  The vertex elevation
+ * is exposed as the mesh Z value, so the layer gets the "Bed Elevation"
+ * dataset group; the provider has no datasets of its own.
+ *
+ * The uri is the directory as a file url with optional query items:
+ * - srid: as for the "dm" vector provider
+ * - overwritingTimes: as for the "dm" vector provider
+ */
+class QgsDmMeshProvider : public QgsMeshDataProvider
+{
+    Q_OBJECT
+
+  public:
+
+    static const QString DM_MESH_PROVIDER_KEY;
+    static const QString DM_MESH_PROVIDER_DESCRIPTION;
+
+    explicit QgsDmMeshProvider( const QString &uri, const QgsDataProvider::ProviderOptions &providerOptions );
+
+    QString name() const override;
+    QString description() const override;
+    bool isValid() const override;
+    QgsCoordinateReferenceSystem crs() const override;
+    QgsRectangle extent() const override;
+
+    int vertexCount() const override;
+    int faceCount() const override;
+    int edgeCount() const override;
+    void populateMesh( QgsMesh *mesh ) const override;
+
+    bool addDataset( const QString &uri ) override;
+    QStringList extraDatasets() const override;
+    int datasetGroupCount() const override;
+    int datasetCount( int groupIndex ) const override;
+    QgsMeshDatasetGroupMetadata datasetGroupMetadata( int groupIndex ) const override;
+    QgsMeshDatasetMetadata datasetMetadata( QgsMeshDatasetIndex index ) const override;
+    QgsMeshDatasetValue datasetValue( QgsMeshDatasetIndex index, int valueIndex ) const override;
+    QgsMeshDataBlock datasetValues( QgsMeshDatasetIndex index, int valueIndex, int count ) const override;
+    QgsMesh3dDataBlock dataset3dValues( QgsMeshDatasetIndex index, int faceIndex, int count ) const override;
+    bool isFaceActive( QgsMeshDatasetIndex index, int faceIndex ) const override;
+    QgsMeshDataBlock areFacesActive( QgsMeshDatasetIndex index, int faceIndex, int count ) const override;
+    bool persistDatasetGroup( const QString &outputFilePath,
+                              const QString &outputDriver,
+                              const QgsMeshDatasetGroupMetadata &meta,
+                              const QVector<QgsMeshDataBlock> &datasetValues,
+                              const QVector<QgsMeshDataBlock> &datasetActive,
+                              const QVector<double> &times ) override;
+    bool persistDatasetGroup( const QString &outputFilePath,
+                              const QString &outputDriver,
+                              QgsMeshDatasetSourceInterface *source,
+                              int datasetGroupIndex ) override;
+
+  private:
+
+    // ディレクトリの不整三角網を読み込む
+    bool load();
+
+    QString mDirPath;
+    int mOverwritingTimes = -1;
+
+    QgsCoordinateReferenceSystem mCrs;
+    // 頂点と三角形の配列
+    DmTin mTin;
+    bool mValid = false;
+};
+
+class QgsDmMeshProviderMetadata: public QgsProviderMetadata
+{
+  public:
+    QgsDmMeshProviderMetadata();
+    QgsDataProvider *createProvider( const QString &uri, const QgsDataProvider::ProviderOptions &options ) override;
+    QVariantMap decodeUri( const QString &uri ) override;
+};
+
+#endif
@@ -17,6 +17,14 @@
 #include <QRegExp>
 #include <QUrl>
 #include <QUrlQuery>
+#include <QThread>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 #include "qgsapplication.h"
 #include "qgsdataprovider.h"
@@ -24,6 +32,7 @@
 #include "qgsfeature.h"
 #include "qgsfields.h"
 #include "qgsgeometry.h"
+#include "qgspoint.h"
 #include "qgslogger.h"
 #include "qgsmessagelog.h"
 #include "qgsmessageoutput.h"
@@ -31,22 +40,28 @@
 #include "qgsspatialindex.h"
 #include "qgis.h"
 #include "qgsexpressioncontextutils.h"
+#include "qgsfeedback.h"
 #include "qgsproviderregistry.h"
+#include "qgstaskmanager.h"
 
+#include "qgsdmdirectorycache.h"
 #include "qgsdmfeatureiterator.h"
 #include "qgsdmfile.h"
+#include "qgsdmloadtask.h"
+#include "qgsdmqueryplanner.h"
+#include "qgsdmtransformcache.h"
 
 
 const QString QgsDmProvider::TEXT_PROVIDER_KEY = QStringLiteral( "dm" );
 const QString QgsDmProvider::TEXT_PROVIDER_DESCRIPTION = QStringLiteral( "DM data provider" );
 
-// If more than this fraction of records are not in a subset then use an index to
-// iterate over records rather than simple iterator and filter.
-
-static const int SUBSET_ID_THRESHOLD_FACTOR = 10;
+// Number of features scanned between checks for cancellation
+static const int CANCEL_CHECK_INTERVAL = 1000;
 
 QgsDmProvider::QgsDmProvider( const QString &uri, const ProviderOptions &options )
   : QgsVectorDataProvider( uri, options )
+  , mStatistics( std::make_shared< QgsDmLayerStatistics >() )
+  , mCounters( std::make_shared< QgsDmCounterStore >() )
 {
 	setEncoding("Shift-JIS");
 
@@ -109,11 +124,7 @@ QgsDmProvider::QgsDmProvider( const QString &uri, const ProviderOptions &options
 		QString mSrid = QString("POSTGIS:%1").arg(url.queryItemValue(QStringLiteral("srid")));
 		mCrs.createFromString(mSrid);
 	}
-	// プロバイダーがサブセットの効率を改善するためにインデックスを生成するかどうかを決定します。デフォルトはyesです
-  if ( url.hasQueryItem( QStringLiteral( "subsetIndex" ) ) )
-  {
-    mBuildSubsetIndex = ! url.queryItemValue( QStringLiteral( "subsetIndex" ) ).toLower().startsWith( 'n' );
-  }
+	// サブセットは常に選択ビット列で保持するため、subsetIndexの指定は不要（互換のため受け付けて無視する）
 	// プロバイダーが空間インデックスを生成するかどうかを決定します。デフォルトはnoです。
   if ( url.hasQueryItem( QStringLiteral( "spatialIndex" ) ) )
   {
@@ -126,6 +137,43 @@ QgsDmProvider::QgsDmProvider( const QString &uri, const ProviderOptions &options
     subset = QUrlQuery( url ).queryItemValue( QStringLiteral( "subset" ), QUrl::FullyDecoded );
     QgsDebugMsg( "subset is: " + subset );
   }
+	// 高速オープン：ヘッダレコードの地物数と図郭範囲でレイヤーを開き、要素の読込は最初の地物要求まで遅延します。デフォルトはnoです。
+	if (url.hasQueryItem(QStringLiteral("fastOpen")))
+	{
+		mFastOpen = !url.queryItemValue(QStringLiteral("fastOpen")).toLower().startsWith('n');
+	}
+	// バックグラウンド読込：ヘッダレコードでレイヤーを開き、要素はタスクマネージャーのタスクで読み込みます。デフォルトはnoです。
+	// GUIスレッド以外で作成された場合はイベントループがないため同期的に読み込みます。
+	if (url.hasQueryItem(QStringLiteral("backgroundLoad")))
+	{
+		mBackgroundLoad = !url.queryItemValue(QStringLiteral("backgroundLoad")).toLower().startsWith('n')
+			&& QThread::currentThread() == QCoreApplication::instance()->thread();
+	}
+	// プロファイル：地物ごとの処理時間（ジオメトリ作成・検証、インデックス、サブセット評価）を計測し、破棄時に累計をメッセージログに出力します。デフォルトはnoです。
+	if (url.hasQueryItem(QStringLiteral("profile")))
+	{
+		mLogCounters = !url.queryItemValue(QStringLiteral("profile")).toLower().startsWith('n');
+		mCounters->setTimingEnabled(mLogCounters);
+	}
+	// 実行計画の履歴：直近に閉じたイテレーターの実行計画を指定件数保持します。デフォルトは16、0で保持しません。
+	if (url.hasQueryItem(QStringLiteral("planHistory")))
+	{
+		mCounters->setPlanHistorySize(url.queryItemValue(QStringLiteral("planHistory")).toInt());
+	}
+	// 再帰モードで同時に読み込んでおくディレクトリの数：古いものから破棄します。デフォルトは16です。
+	mMaxDirectories = QgsDmDirectoryCache::DEFAULT_MAX_DIRECTORIES;
+	if (url.hasQueryItem(QStringLiteral("maxDirectories")))
+	{
+		mMaxDirectories = url.queryItemValue(QStringLiteral("maxDirectories")).toInt();
+	}
+	// 座標変換キャッシュ：レイヤと異なるCRSで描画する場合に変換した線・面の座標列を変換先CRSごとに保持し、次回の描画では変換しません。デフォルトはnoです。
+	// 再帰モードではディレクトリを破棄するので使用しません。
+	if (url.hasQueryItem(QStringLiteral("transformCache"))
+		&& !url.queryItemValue(QStringLiteral("transformCache")).toLower().startsWith('n')
+		&& !mFile->isRecursive())
+	{
+		mTransformCache = std::make_shared< QgsDmTransformCache >();
+	}
 	// クワイエットが含まれている場合、ファイルのロード中に発生したエラーはユーザーダイアログに報告されません（エラーは引き続き出力ログに表示されます）。
   if ( url.hasQueryItem( QStringLiteral( "quiet" ) ) ) mShowInvalidLines = false;
 
@@ -133,8 +181,27 @@ QgsDmProvider::QgsDmProvider( const QString &uri, const ProviderOptions &options
   // geometry type (for Wkt), extents, etc.  Parameter value subset.isEmpty()
   // avoid redundant building indexes if we will be building a subset string,
   // in which case indexes will be rebuilt.
+  // With fastOpen only the headers are read here, and the full scan is
+  // deferred until features are first requested.
 
-  scanFile( subset.isEmpty() );
+  // With backgroundLoad the files are read by a QgsDmLoadTask after the
+  // headers, and features become available as the task progresses.
+
+  // In recursive mode (recursive=yes) the layer covers a directory tree and is
+  // opened from the catalog.  Directories are read when an iterator needs
+  // them, so the subset and spatial indexes (which need every feature) are
+  // not built.
+
+  bool openFromHeaders = ( mFastOpen || mBackgroundLoad ) && subset.isEmpty();
+  if ( mFile->isRecursive() )
+  {
+    mBuildSpatialIndex = false;
+    scanCatalog();
+  }
+  else if ( !openFromHeaders || !scanHeaders() )
+    scanFile();
+  else if ( mBackgroundLoad )
+    startBackgroundLoad();
 
   if ( ! subset.isEmpty() )
   {
@@ -142,10 +209,95 @@ QgsDmProvider::QgsDmProvider( const QString &uri, const ProviderOptions &options
   }
 }
 
-QgsDmProvider::~QgsDmProvider() = default;
+QgsDmProvider::~QgsDmProvider()
+{
+  cancelBackgroundLoad();
+  if ( mLogCounters )
+  {
+    logCounters();
+    logRecentPlans();
+  }
+}
+
+void QgsDmProvider::cancelBackgroundLoad()
+{
+  if ( !mLoadTask )
+    return;
+
+  // タスクからの通知は受け取らない
+  disconnect( mLoadTask, nullptr, this, nullptr );
+  mLoadTask->cancel();
+  mLoadTask = nullptr;
+}
+
+void QgsDmProvider::startBackgroundLoad()
+{
+  // 要素はタスクで読み込むので遅延読込は行わない
+  mDeferredLoad = false;
+
+  mLoadTask = new QgsDmLoadTask( mFile->url() );
+  connect( mLoadTask, &QgsDmLoadTask::elementsLoaded, this, &QgsDmProvider::onElementsLoaded );
+  connect( mLoadTask, &QgsDmLoadTask::loadFinished, this, &QgsDmProvider::onLoadFinished );
+  QgsApplication::taskManager()->addTask( mLoadTask );
+}
+
+void QgsDmProvider::onElementsLoaded( QSharedPointer<QgsDmFile> loaded )
+{
+  if ( !mLoadTask )
+    return;
+
+  // 読込済みの図郭を検索できるようにする
+  // 地物数と範囲は読込完了までヘッダの値のままとする
+  mFile->setElements( *loaded );
+  QgsDebugMsg( QStringLiteral( "Dm: %1 elements of %2 loaded" ).arg( mFile->recordCount() ).arg( mFile->dirPath() ) );
+
+  clearMinMaxCache();
+  emit dataChanged();
+}
+
+void QgsDmProvider::onLoadFinished( bool result, bool canceled, QSharedPointer<QgsDmFile> loaded )
+{
+  mLoadTask = nullptr;
+
+  QgsDmCounters loadedCounters;
+  loadedCounters.add( QgsDmCounters::BytesRead, loaded->bytesRead() );
+  loadedCounters.add( QgsDmCounters::RecordsDecoded, loaded->elementsDecoded() );
+  mCounters->merge( loadedCounters );
+
+  if ( canceled )
+  {
+    // scanFile()のキャンセルと同じく、途中までのデータは残さずにレイヤーを無効とする
+    QgsDebugMsg( QStringLiteral( "DM background load canceled" ) );
+    mFile->clear();
+    setCanceled();
+    clearMinMaxCache();
+    emit fullExtentCalculated();
+    emit dataChanged();
+    return;
+  }
+
+  mFile->setElements( *loaded );
+  if ( !result )
+  {
+    QStringList messages;
+    messages.append( tr( "Loading of DM Files failed, only part of the data is available" ) );
+    reportErrors( messages );
+  }
+
+  // 読み込んだ要素から地物数・範囲・インデックスを確定する
+  // サブセットがある場合はサブセットの地物を選択する
+  scanElements();
+  if ( mSubsetExpression )
+    rescanFile();
+
+  clearMinMaxCache();
+  emit fullExtentCalculated();
+  emit dataChanged();
+}
 
 QgsAbstractFeatureSource *QgsDmProvider::featureSource() const
 {
+  loadDeferredFile();
   return new QgsDmFeatureSource( this );
 }
 
@@ -153,7 +305,6 @@ void QgsDmProvider::resetCachedSubset() const
 {
   mCachedSubsetString = QString();
   mCachedUseSubsetIndex = false;
-  mCachedUseSpatialIndex = false;
 }
 
 void QgsDmProvider::resetIndexes() const
@@ -162,16 +313,19 @@ void QgsDmProvider::resetIndexes() const
   mUseSubsetIndex = false;
   mUseSpatialIndex = false;
 
-  mSubsetIndex.clear();
+  mSubsetSelection.clear();
   if ( mBuildSpatialIndex)
     mSpatialIndex = qgis::make_unique< QgsSpatialIndex >();
 }
 
-// buildIndexes parameter of scanFile is set to false when we know we will be
-// immediately rescanning (when the file is loaded and then the subset expression is
-// set)
+void QgsDmProvider::resetSubsetSelection() const
+{
+  resetCachedSubset();
+  mUseSubsetIndex = false;
+  mSubsetSelection.clear();
+}
 
-void QgsDmProvider::scanFile( bool buildIndexes )
+void QgsDmProvider::scanFile( QgsFeedback *feedback )
 {
   QStringList messages;
 
@@ -185,12 +339,6 @@ void QgsDmProvider::scanFile( bool buildIndexes )
 
   // Initiallize indexes
   resetIndexes();
-  bool buildSpatialIndex = buildIndexes && nullptr != mSpatialIndex;
-
-  // No point building a subset index if there is no geometry, as all
-  // records will be included.
-
-  bool buildSubsetIndex = buildIndexes && mBuildSubsetIndex;
 
   if ( ! mFile->isValid() || mDataType.isEmpty() )
   {
@@ -208,171 +356,375 @@ void QgsDmProvider::scanFile( bool buildIndexes )
 	// 
 	// また、サブセットと空間インデックスを作成します。
 
-	if (mFile->read() == false) {
+	// 読み直した要素の座標は変換済みの座標列と対応しない
+	if (mTransformCache)
+		mTransformCache->clear();
+
+	bool readResult = false;
+	{
+		QgsDmScopedStage stage(*mCounters, QgsDmCounters::ReadTime, tr("Read DM files"));
+		readResult = mFile->read(feedback);
+		stage.counters().add(QgsDmCounters::BytesRead, mFile->bytesRead());
+		stage.counters().add(QgsDmCounters::RecordsDecoded, mFile->elementsDecoded());
+	}
+	if (readResult == false) {
+		if (feedback && feedback->isCanceled()) {
+			QgsDebugMsg(QStringLiteral("DM source read canceled"));
+			setCanceled();
+			return;
+		}
 		messages.append(tr("DM Files cannot be read"));
 		reportErrors(messages);
 		QgsDebugMsg(QStringLiteral("DM source invalid - files failed"));
 		return;
 	}
 
+	scanElements(feedback);
+}
+
+// 読込済みの要素から地物数・範囲を決定し、インデックスを作成する
+
+void QgsDmProvider::scanElements( QgsFeedback *feedback )
+{
+  // キャンセルは一定件数ごとに確認する
+  long scanned = 0;
+  auto scanCanceled = [feedback, &scanned]()
+  {
+    return feedback && ( ++scanned % CANCEL_CHECK_INTERVAL ) == 0 && feedback->isCanceled();
+  };
+
+  QgsDmScopedStage stage( *mCounters, QgsDmCounters::ScanTime, tr( "Scan DM features" ) );
+  QgsDmCounters &counters = stage.counters();
+
+  resetIndexes();
+  // 空間インデックスはサブセットによらず全ての要素で作成する
+  bool buildSpatialIndex = nullptr != mSpatialIndex;
+
+  // No point building a subset index if there is no geometry, as all
+  // records will be included.
+
 	attributeFields = mFile->attributeFields();
 
 	mNumberFeatures = 0;
 	mExtent = QgsRectangle();
+	mValidGeometries.clear();
 	bool foundFirstGeometry = false;
 
 
-	int fid = 1;
+	long index = 0;
 	if (mDataType == "dm_pg") {
-		const QList<DmPolygon>& dmpolygons = mFile->polygons();
+		const QVector<DmPolygon>& dmpolygons = mFile->polygons();
 
 		mNumberFeatures = dmpolygons.count();
+		mValidGeometries = QBitArray(dmpolygons.count());
 
 
-		QListIterator<DmPolygon> itr(dmpolygons);
+		QVectorIterator<DmPolygon> itr(dmpolygons);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmPolygon dmpolygon = itr.next();		
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmpolygon.points(), geom);
+			if (createGeometry(mGeometryType, dmpolygon.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_pl") {
-		const QList<DmLine>& dmlines = mFile->lines();
+		const QVector<DmLine>& dmlines = mFile->lines();
 
 		mNumberFeatures = dmlines.count();
+		mValidGeometries = QBitArray(dmlines.count());
 
-		QListIterator<DmLine> itr(dmlines);
+		QVectorIterator<DmLine> itr(dmlines);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmLine dmline = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmline.points(), geom);
+			if (createGeometry(mGeometryType, dmline.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_cir") {
-		const QList<DmCircle>& dmcircles = mFile->circles();
+		const QVector<DmCircle>& dmcircles = mFile->circles();
 
 		mNumberFeatures = dmcircles.count();
+		mValidGeometries = QBitArray(dmcircles.count());
 
-		QListIterator<DmCircle> itr(dmcircles);
+		QVectorIterator<DmCircle> itr(dmcircles);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmCircle dmcircle = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmcircle.points(), geom);
+			if (createGeometry(mGeometryType, dmcircle.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_arc") {
-		const QList<DmArc>& dmarcs = mFile->arcs();
+		const QVector<DmArc>& dmarcs = mFile->arcs();
 
 		mNumberFeatures = dmarcs.count();
+		mValidGeometries = QBitArray(dmarcs.count());
 
-		QListIterator<DmArc> itr(dmarcs);
+		QVectorIterator<DmArc> itr(dmarcs);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmArc dmarc = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmarc.points(), geom);
+			if (createGeometry(mGeometryType, dmarc.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_pt") {
-		const QList<DmPoint>& dmpoints = mFile->points();
+		const QVector<DmPoint>& dmpoints = mFile->points();
 
 		mNumberFeatures = dmpoints.count();
+		mValidGeometries = QBitArray(dmpoints.count());
 
-		QListIterator<DmPoint> itr(dmpoints);
+		QVectorIterator<DmPoint> itr(dmpoints);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmPoint dmpoint = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmpoint.points(), geom);
+			if (createGeometry(mGeometryType, dmpoint.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_dir") {
-		const QList<DmDirection>& dmdirs = mFile->directions();
+		const QVector<DmDirection>& dmdirs = mFile->directions();
 
 		mNumberFeatures = dmdirs.count();
+		mValidGeometries = QBitArray(dmdirs.count());
 
-		QListIterator<DmDirection> itr(dmdirs);
+		QVectorIterator<DmDirection> itr(dmdirs);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmDirection dmdir = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmdir.points(), geom);
+			if (createGeometry(mGeometryType, dmdir.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				addFeaturemToSpatialIndex(fid++, geom);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 	else if (mDataType == "dm_tx") {
-		const QList<DmNote>& dmnotes = mFile->notes();
+		const QVector<DmNote>& dmnotes = mFile->notes();
 
 		mNumberFeatures = dmnotes.count();
+		mValidGeometries = QBitArray(dmnotes.count());
 
-		QListIterator<DmNote> itr(dmnotes);
+		QVectorIterator<DmNote> itr(dmnotes);
 		while (itr.hasNext()) {
+			if (scanCanceled()) {
+				setCanceled();
+				return;
+			}
 			DmNote dmnote = itr.next();
 			QgsGeometry geom;
-			createGeometry(mGeometryType, dmnote.points(), geom);
+			if (createGeometry(mGeometryType, dmnote.points(), geom, &counters))
+				mValidGeometries.setBit(index);
 			appendExtent(geom, foundFirstGeometry);
 
 			if (buildSpatialIndex) {
-				QgsFeature f;
-				f.setId(fid++);
-				f.setGeometry(geom);
-				mSpatialIndex->addFeature(f);
+				addFeaturemToSpatialIndex(mFile->recordIdOfIndex(index), geom, counters);
 			}
+			index++;
 		}
 	}
 
-  // Decide whether to use subset ids to index records rather than simple iteration through all
-  // If more than 10% of records are being skipped, then use index.  (Not based on any experimentation,
-  // could do with some analysis?)
-
-  if ( buildSubsetIndex )
-  {
-    long recordCount = mNumberFeatures;
-    recordCount -= recordCount / SUBSET_ID_THRESHOLD_FACTOR;
-    mUseSubsetIndex = mSubsetIndex.size() < recordCount;
-    if ( ! mUseSubsetIndex )
-      mSubsetIndex = QList<quintptr>();
-  }
+  // サブセットの地物はrescanFile()で選択ビット列に記録する
+  // 地物の取得方法はイテレーターが統計から要求ごとに選ぶ
+  mStatistics = std::make_shared< QgsDmLayerStatistics >( *mFile );
+  mBaseFeatureCount = mNumberFeatures;
+  mBaseExtent = mExtent;
 
   mUseSpatialIndex = buildSpatialIndex;
   mLayerValid = true;
 }
 
+bool QgsDmProvider::scanHeaders()
+{
+	mLayerValid = false;
+	mValid = false;
+	attributeFields.clear();
+
+	if (!mFile->isValid() || mDataType.isEmpty())
+		return false;
+
+	// 図郭・グループヘッダレコードのみ読み込む
+	DmSurvey survey;
+	QgsDmScopedStage stage(*mCounters, QgsDmCounters::ReadTime, tr("Read DM headers"));
+	if (mFile->survey(survey) == false) {
+		QgsDebugMsg(QStringLiteral("DM source headers could not be surveyed"));
+		return false;
+	}
+
+	// 属性レコード(E8)の列は要素の読込後と同じ列・型となるよう調査した値から決める
+	attributeFields = mFile->attributeFields();
+	const QVector<DmSurvey::AttributeColumn>& columns = survey.attributeColumns(mDataType);
+	for (const DmSurvey::AttributeColumn& column : columns)
+		attributeFields.append(QgsDmFile::attributeField(column.code, column.type));
+
+	// 地物数はグループヘッダレコードの値、範囲は図郭の範囲とする
+	// 要素の読込後に実際の値で置き換える
+	mNumberFeatures = survey.featureCount(mDataType);
+	const DmRect& extent = survey.extent();
+	if (extent.isNull())
+		mExtent = QgsRectangle();
+	else
+		mExtent = QgsRectangle(extent.xMinimum(), extent.yMinimum(), extent.xMaximum(), extent.yMaximum());
+
+	mStatistics = std::make_shared< QgsDmLayerStatistics >(mNumberFeatures, mExtent);
+	mBaseFeatureCount = mNumberFeatures;
+	mBaseExtent = mExtent;
+
+	mDeferredLoad = true;
+	mLayerValid = true;
+	return true;
+}
+
+bool QgsDmProvider::scanCatalog()
+{
+	mLayerValid = false;
+	mValid = false;
+	attributeFields.clear();
+	resetIndexes();
+
+	if (!mFile->isValid() || mDataType.isEmpty()) {
+		reportErrors(QStringList() << tr("DM Files cannot be read or parameters are not valid"));
+		QgsDebugMsg(QStringLiteral("DM catalog invalid - directory or parameters"));
+		return false;
+	}
+
+	// インデックスレコードと図郭レコードのみ読み込む（変更のないファイルはマニフェストを使う）
+	QgsDmScopedStage stage(*mCounters, QgsDmCounters::ReadTime, tr("Read DM catalog"));
+	const DmCatalog& catalog = mFile->catalog();
+	mDirectoryCache = std::make_shared< QgsDmDirectoryCache >(*mFile, catalog, mFile->filterExtent(), mMaxDirectories);
+
+	// 属性レコード(E8)の列はディレクトリごとに異なるので、固定フィールドのみとする
+	attributeFields = mFile->attributeFields();
+
+	// 地物数はグループヘッダレコードの値、範囲は図郭の範囲とする
+	mNumberFeatures = 0;
+	mExtent = QgsRectangle();
+	const QList<int> directories = mDirectoryCache->directories();
+	for (int directory : directories) {
+		const QStringList filePaths = catalog.filePaths(directory);
+		for (const QString& filePath : filePaths) {
+			const DmCatalog::File* file = catalog.file(filePath);
+			mNumberFeatures += file->featureCounts.value(mDataType, 0);
+			if (file->extent.isNull())
+				continue;
+			QgsRectangle extent(file->extent.xMinimum(), file->extent.yMinimum(), file->extent.xMaximum(), file->extent.yMaximum());
+			if (mExtent.isNull())
+				mExtent = extent;
+			else
+				mExtent.combineExtentWith(extent);
+		}
+	}
+	QgsDebugMsg(QStringLiteral("Dm: catalog of %1 - %2 directories, %3 files").arg(mFile->dirPath()).arg(directories.count()).arg(catalog.fileCount()));
+	mStatistics = std::make_shared< QgsDmLayerStatistics >(mNumberFeatures, mExtent);
+	mBaseFeatureCount = mNumberFeatures;
+	mBaseExtent = mExtent;
+
+	mLayerValid = true;
+	return true;
+}
+
+bool QgsDmProvider::loadDeferredFile() const
+{
+	// 地物の要求は描画などのスレッドからも行われるので、読込は1つのスレッドのみで行い、
+	// 他のスレッドは読込の完了を待つ
+	QMutexLocker locker(&mDeferredLoadMutex);
+	if (!mDeferredLoad)
+		return false;
+
+	mDeferredLoad = false;
+	QgsDebugMsg(QStringLiteral("Dm: Loading deferred elements of %1").arg(mFile->dirPath()));
+	QgsDmProvider *provider = const_cast<QgsDmProvider *>(this);
+	provider->scanFile();
+
+	// 地物数と範囲がヘッダの値から変わったことを通知する（プロバイダのスレッドで行う）
+	QMetaObject::invokeMethod(provider, [provider]
+	{
+		provider->clearMinMaxCache();
+		emit provider->fullExtentCalculated();
+		emit provider->dataChanged();
+	}, Qt::QueuedConnection);
+	return true;
+}
+
 // rescanFile.  Called if something has changed file definition, such as
 // selecting a subset, the file has been changed by another program, etc
+//
+// The spatial index, element extents and geometry validity of the scan are
+// kept; only the subset selection and the feature count and extent derived
+// from it are rebuilt.
 
-void QgsDmProvider::rescanFile() const
+void QgsDmProvider::rescanFile( QgsFeedback *feedback ) const
 {
-  resetIndexes();
+  loadDeferredFile();
+  resetSubsetSelection();
 
-  bool buildSpatialIndex = nullptr != mSpatialIndex;
-  bool buildSubsetIndex = mBuildSubsetIndex && ( mSubsetExpression || !mDataType.isEmpty() );
+  // In recursive mode the feature count and extent stay those of the catalog,
+  // rather than reading every directory of the tree, and the subset is
+  // evaluated for each feature by the iterators.
+
+  if ( mDirectoryCache )
+  {
+    mValid = mLayerValid;
+    return;
+  }
 
   // In case file has been rewritten check that it is still valid
 
@@ -380,53 +732,146 @@ void QgsDmProvider::rescanFile() const
   if ( ! mValid )
     return;
 
-  // Open the file and get number of rows, etc. We assume that the
-  // file has a header row and process accordingly. Caller should make
-  // sure that the delimited file is properly formed.
+  std::shared_ptr< QgsDmLayerStatistics > statistics = std::make_shared< QgsDmLayerStatistics >( *mStatistics );
 
-  QStringList messages;
-
-
-  // Scan through the features in the file
+  // サブセットがなければ読込時の地物数と範囲に戻す
+  if ( !mSubsetExpression )
+  {
+    mNumberFeatures = mBaseFeatureCount;
+    mExtent = mBaseExtent;
+    statistics->setSubsetCount( -1 );
+    mStatistics = statistics;
+    return;
+  }
 
-  mSubsetIndex.clear();
-  mUseSubsetIndex = false;
-  QgsFeatureIterator fi = getFeatures( QgsFeatureRequest() );
-  mNumberFeatures = 0;
-  mExtent = QgsRectangle();
+  QgsDmScopedStage stage( *mCounters, QgsDmCounters::SubsetScanTime, tr( "Select DM subset" ) );
+
+  // サブセットの地物を選択ビット列に記録する
+  // 式が必要としなければジオメトリは作成せず（有効かどうかは読込時の結果を使う）、属性も式の分のみ取得する
+  // レイヤコード・地図分類コードのみの式はイテレーターが索引で処理する
+  QgsFeatureRequest request;
+  if ( !mSubsetExpression->needsGeometry() )
+    request.setFlags( QgsFeatureRequest::NoGeometry );
+  if ( !mSubsetExpression->referencedColumns().contains( QgsFeatureRequest::ALL_ATTRIBUTES ) )
+    request.setSubsetOfAttributes( mSubsetExpression->referencedAttributeIndexes( attributeFields ).toList() );
+
+  const long recordCount = mFile->recordCount();
+  QBitArray selection( static_cast<int>( recordCount ) );
+  long selected = 0;
+  long scanned = 0;
+  QgsFeatureIterator fi = getFeatures( request );
   QgsFeature f;
-  bool foundFirstGeometry = false;
   while ( fi.nextFeature( f ) )
   {
-    if ( mGeometryType != QgsWkbTypes::NullGeometry && f.hasGeometry() )
+    if ( feedback && ( ++scanned % CANCEL_CHECK_INTERVAL ) == 0 )
     {
-      if ( !foundFirstGeometry )
+      if ( feedback->isCanceled() )
       {
-        mExtent = f.geometry().boundingBox();
-        foundFirstGeometry = true;
+        setCanceled();
+        return;
       }
-      else
-      {
-        QgsRectangle bbox( f.geometry().boundingBox() );
-        mExtent.combineExtentWith( bbox );
-      }
-      if ( buildSpatialIndex )
-        mSpatialIndex->addFeature( f );
+      if ( recordCount > 0 )
+        feedback->setProgress( 100.0 * scanned / recordCount );
+    }
+    const long index = mFile->indexOfRecordId( f.id() );
+    if ( index >= 0 && index < recordCount )
+    {
+      selection.setBit( static_cast<int>( index ) );
+      selected++;
     }
-    if ( buildSubsetIndex )
-      mSubsetIndex.append( ( quintptr ) f.id() );
-    mNumberFeatures++;
   }
-  if ( buildSubsetIndex )
+
+  mSubsetSelection = selection;
+  mNumberFeatures = selected;
+  mExtent = selectionExtent();
+  // 選択ビット列を使うかどうかはイテレーターがサブセットの選択率から要求ごとに決める
+  mUseSubsetIndex = true;
+  statistics->setSubsetCount( mNumberFeatures );
+  mStatistics = statistics;
+}
+
+// 選択されている要素の範囲（読込時の要素ごとの範囲を合わせる）
+
+QgsRectangle QgsDmProvider::selectionExtent() const
+{
+  const bool point = mGeometryType == QgsWkbTypes::PointGeometry;
+  const DmPointCoords &points = mFile->pointCoords();
+  const DmElementExtents &extents = mFile->extents();
+  const int count = std::min( mSubsetSelection.size(), point ? points.count() : extents.count() );
+
+  double xMin = std::numeric_limits<double>::max();
+  double yMin = std::numeric_limits<double>::max();
+  double xMax = std::numeric_limits<double>::lowest();
+  double yMax = std::numeric_limits<double>::lowest();
+  bool found = false;
+  for ( int i = 0; i < count; i++ )
   {
-    long recordCount = mFile->recordCount();
-    recordCount -= recordCount / SUBSET_ID_THRESHOLD_FACTOR;
-    mUseSubsetIndex = recordCount < mSubsetIndex.size();
-    if ( ! mUseSubsetIndex )
-      mSubsetIndex.clear();
+    if ( !mSubsetSelection.testBit( i ) )
+      continue;
+    if ( point )
+    {
+      const double x = points.x( i );
+      const double y = points.y( i );
+      if ( std::isnan( x ) || std::isnan( y ) )
+        continue;
+      xMin = std::min( xMin, x );
+      yMin = std::min( yMin, y );
+      xMax = std::max( xMax, x );
+      yMax = std::max( yMax, y );
+    }
+    else
+    {
+      const DmRect extent = extents.extent( i );
+      if ( extent.isNull() )
+        continue;
+      xMin = std::min( xMin, extent.xMinimum() );
+      yMin = std::min( yMin, extent.yMinimum() );
+      xMax = std::max( xMax, extent.xMaximum() );
+      yMax = std::max( yMax, extent.yMaximum() );
+    }
+    found = true;
   }
+  return found ? QgsRectangle( xMin, yMin, xMax, yMax ) : QgsRectangle();
+}
 
-  mUseSpatialIndex = buildSpatialIndex;
+// setCanceled.  Called when a scan is canceled through a feedback, leaves the
+// provider invalid with no features, extent or indexes rather than partially scanned
+
+void QgsDmProvider::setCanceled() const
+{
+  resetIndexes();
+  mNumberFeatures = 0;
+  mExtent = QgsRectangle();
+  mBaseFeatureCount = 0;
+  mBaseExtent = QgsRectangle();
+  mValidGeometries.clear();
+  mStatistics = std::make_shared< QgsDmLayerStatistics >();
+  mLayerValid = false;
+  mValid = false;
+}
+
+bool QgsDmProvider::reload( QgsFeedback *feedback )
+{
+  cancelBackgroundLoad();
+  mDeferredLoad = false;
+
+  if ( mFile->isRecursive() )
+  {
+    // カタログを作り直し、読込済みのディレクトリを破棄する
+    mFile->setDirPath( mFile->dirPath() );
+    scanCatalog();
+    clearMinMaxCache();
+    emit dataChanged();
+    return mLayerValid;
+  }
+
+  scanFile( feedback );
+  if ( mLayerValid && mSubsetExpression )
+    rescanFile( feedback );
+
+  clearMinMaxCache();
+  emit dataChanged();
+  return mLayerValid;
 }
 
 QString QgsDmProvider::storageType() const
@@ -436,6 +881,7 @@ QString QgsDmProvider::storageType() const
 
 QgsFeatureIterator QgsDmProvider::getFeatures( const QgsFeatureRequest &request ) const
 {
+  loadDeferredFile();
   return QgsFeatureIterator( new QgsDmFeatureIterator( new QgsDmFeatureSource( this ), true, request ) );
 }
 
@@ -580,14 +1026,13 @@ bool QgsDmProvider::setSubsetString( const QString &subset, bool updateFeatureCo
       if ( ! mCachedSubsetString.isNull() && mSubsetString == mCachedSubsetString )
       {
         QgsDebugMsg( QStringLiteral( "Dm: Resetting cached subset string %1" ).arg( mSubsetString ) );
-        mUseSpatialIndex = mCachedUseSpatialIndex;
         mUseSubsetIndex = mCachedUseSubsetIndex;
         resetCachedSubset();
       }
       else
       {
         QgsDebugMsg( QStringLiteral( "Dm: Setting new subset string %1" ).arg( mSubsetString ) );
-        // Reset the subset index
+        // Reselect the subset, keeping the spatial index and element extents
         rescanFile();
         // Encode the subset string into the data source URI.
         setUriParameter( QStringLiteral( "subset" ), nonNullSubset );
@@ -601,11 +1046,10 @@ bool QgsDmProvider::setSubsetString( const QString &subset, bool updateFeatureCo
       {
         QgsDebugMsg( QStringLiteral( "Dm: Caching previous subset %1" ).arg( previousSubset ) );
         mCachedSubsetString = previousSubset;
-        mCachedUseSpatialIndex = mUseSpatialIndex;
         mCachedUseSubsetIndex = mUseSubsetIndex;
       }
+      // 選択ビット列は元のサブセットのものなので使わない（空間インデックスは全ての要素なので使える）
       mUseSubsetIndex = false;
-      mUseSpatialIndex = false;
     }
   }
 
@@ -624,14 +1068,38 @@ void QgsDmProvider::setUriParameter( const QString &parameter, const QString &va
   setDataSourceUri( QString::fromLatin1( url.toEncoded() ) );
 }
 
-QgsPolylineXY QgsDmProvider::createPolyline(const QList<Point2d>& vertexes, bool forPolygon)
+QgsPolylineXY QgsDmProvider::createPolyline(const DmCoords& vertexes, bool forPolygon, double tolerance)
 {
 	QgsPolylineXY polyline;
-	QListIterator<Point2d> itrPoint(vertexes);
-	while (itrPoint.hasNext())
-	{
-		Point2d vertex = itrPoint.next();
-		polyline.append(QgsPointXY(vertex.x(), vertex.y()));
+	polyline.reserve(vertexes.count() + (forPolygon ? 1 : 0));
+
+	// 直前に残した頂点から許容誤差未満の頂点を省く（線の終点は残し、面は3頂点以上とする）
+	const int lastIndex = vertexes.count() - 1;
+	if (tolerance > 0.0 && lastIndex >= (forPolygon ? 3 : 2)) {
+		const double tolerance2 = tolerance * tolerance;
+		double lastX = vertexes.first().x();
+		double lastY = vertexes.first().y();
+		polyline.append(QgsPointXY(lastX, lastY));
+		for (int i = 1; i < lastIndex; i++) {
+			const Point2d& vertex = vertexes.at(i);
+			const double dx = vertex.x() - lastX;
+			const double dy = vertex.y() - lastY;
+			if (dx * dx + dy * dy < tolerance2)
+				continue;
+			lastX = vertex.x();
+			lastY = vertex.y();
+			polyline.append(QgsPointXY(lastX, lastY));
+		}
+		polyline.append(QgsPointXY(vertexes.last().x(), vertexes.last().y()));
+		if (forPolygon && polyline.count() < 3)
+			polyline.clear();
+	}
+
+	if (polyline.isEmpty()) {
+		for (const Point2d& vertex : vertexes)
+		{
+			polyline.append(QgsPointXY(vertex.x(), vertex.y()));
+		}
 	}
 
 	if (forPolygon) {
@@ -652,26 +1120,48 @@ void QgsDmProvider::appendExtent(const QgsGeometry & geom, bool& foundFirstGeome
 	}
 }
 
-void QgsDmProvider::addFeaturemToSpatialIndex(int fid, const QgsGeometry& geom)
+void QgsDmProvider::addFeaturemToSpatialIndex(QgsFeatureId fid, const QgsGeometry& geom, QgsDmCounters& counters)
 {
+	QElapsedTimer timer;
+	if (counters.timing())
+		timer.start();
+
 	QgsFeature f;
 	f.setId(fid);
 	f.setGeometry(geom);
 	mSpatialIndex->addFeature(f);
+
+	if (counters.timing())
+		counters.add(QgsDmCounters::SpatialIndexTime, timer.nsecsElapsed());
 }
 
-bool QgsDmProvider::createGeometry(QgsWkbTypes::GeometryType type, const QList<Point2d>& points, QgsGeometry & geom)
+bool QgsDmProvider::createGeometry(QgsWkbTypes::GeometryType type, const DmCoords& points, QgsGeometry & geom, QgsDmCounters* counters, double tolerance)
 {
+	// 作成と検証の時間は別々に計測する
+	bool timing = counters && counters->timing();
+	QElapsedTimer timer;
+	if (timing)
+		timer.start();
+
 	if (type == QgsWkbTypes::PointGeometry) {
-		QgsPointXY point(points.first().x(), points.first().y());
-		geom = QgsGeometry::fromPointXY(point);
+		// 点は座標があれば常に有効なので検証しない
+		if (points.isEmpty())
+			return false;
+		geom = QgsGeometry(new QgsPoint(points.first().x(), points.first().y()));
+		if (counters) {
+			counters->add(QgsDmCounters::GeometriesBuilt);
+			counters->add(QgsDmCounters::VerticesBuilt);
+			if (timing)
+				counters->add(QgsDmCounters::GeometryBuildTime, timer.nsecsElapsed());
+		}
+		return true;
 	}
-	else if (type == QgsWkbTypes::LineGeometry) {
-		QgsPolylineXY polyline = createPolyline(points);
+	if (type == QgsWkbTypes::LineGeometry) {
+		QgsPolylineXY polyline = createPolyline(points, false, tolerance);
 		geom = QgsGeometry::fromPolylineXY(polyline);
 	}
 	else if (type == QgsWkbTypes::PolygonGeometry) {
-		QgsPolylineXY polyline = createPolyline(points, true);
+		QgsPolylineXY polyline = createPolyline(points, true, tolerance);
 		QgsPolygonXY polygon;
 		polygon.append(polyline);
 		geom = QgsGeometry::fromPolygonXY(polygon);
@@ -679,7 +1169,78 @@ bool QgsDmProvider::createGeometry(QgsWkbTypes::GeometryType type, const QList<P
 	else
 		return false;
 
-	return geom.isGeosValid();
+	if (!counters)
+		return geom.isGeosValid();
+
+	counters->add(QgsDmCounters::GeometriesBuilt);
+	counters->add(QgsDmCounters::VerticesBuilt, geom.constGet() ? geom.constGet()->nCoordinates() : 0);
+	if (timing) {
+		counters->add(QgsDmCounters::GeometryBuildTime, timer.nsecsElapsed());
+		timer.restart();
+	}
+	bool valid = geom.isGeosValid();
+	if (timing)
+		counters->add(QgsDmCounters::GeometryValidationTime, timer.nsecsElapsed());
+	if (!valid)
+		counters->add(QgsDmCounters::InvalidGeometries);
+	return valid;
+}
+
+QgsDmCounters QgsDmProvider::counters() const
+{
+  return mCounters->snapshot();
+}
+
+QVariantMap QgsDmProvider::counterValues() const
+{
+  const QgsDmCounters snapshot = mCounters->snapshot();
+  QVariantMap values;
+  for ( int i = 0; i < QgsDmCounters::CounterCount; i++ )
+  {
+    QgsDmCounters::Counter counter = static_cast<QgsDmCounters::Counter>( i );
+    values.insert( QgsDmCounters::key( counter ), snapshot.value( counter ) );
+  }
+  return values;
+}
+
+void QgsDmProvider::resetCounters()
+{
+  mCounters->reset();
+}
+
+void QgsDmProvider::logCounters() const
+{
+  const QgsDmCounters snapshot = mCounters->snapshot();
+  QString tag( QStringLiteral( "Dm" ) );
+  QgsMessageLog::logMessage( tr( "Counters of DM Directory %1" ).arg( mFile->dirPath() ), tag, Qgis::Info );
+  for ( int i = 0; i < QgsDmCounters::CounterCount; i++ )
+  {
+    QgsDmCounters::Counter counter = static_cast<QgsDmCounters::Counter>( i );
+    QgsMessageLog::logMessage( QStringLiteral( "%1: %2" ).arg( QgsDmCounters::name( counter ), snapshot.formattedValue( counter ) ), tag, Qgis::Info );
+  }
+}
+
+QList< QgsDmQueryPlan > QgsDmProvider::recentPlans() const
+{
+  return mCounters->plans();
+}
+
+QStringList QgsDmProvider::recentPlanDescriptions() const
+{
+  QStringList descriptions;
+  const QList< QgsDmQueryPlan > plans = mCounters->plans();
+  for ( const QgsDmQueryPlan &plan : plans )
+    descriptions.append( plan.toString() );
+  return descriptions;
+}
+
+void QgsDmProvider::logRecentPlans() const
+{
+  const QStringList descriptions = recentPlanDescriptions();
+  QString tag( QStringLiteral( "Dm" ) );
+  QgsMessageLog::logMessage( tr( "Recent feature requests of DM Directory %1" ).arg( mFile->dirPath() ), tag, Qgis::Info );
+  for ( const QString &description : descriptions )
+    QgsMessageLog::logMessage( description, tag, Qgis::Info );
 }
 
 QgsRectangle QgsDmProvider::extent() const
@@ -709,17 +1270,29 @@ bool QgsDmProvider::isValid() const
 
 QgsVectorDataProvider::Capabilities QgsDmProvider::capabilities() const
 {
-  return SelectAtId | CreateSpatialIndex | CircularGeometries;
+  // 描画用の簡略化（OptimizeForRendering）は地物の作成時に行う
+  // 再帰モードでは全ての地物を読み込まないので空間インデックスは作成しない
+  if ( mDirectoryCache )
+    return SelectAtId | CircularGeometries | SimplifyGeometries;
+  return SelectAtId | CreateSpatialIndex | CircularGeometries | SimplifyGeometries;
 }
 
 bool QgsDmProvider::createSpatialIndex()
 {
+	if (mDirectoryCache)
+		return false;
+
 	if (mBuildSpatialIndex)
 		return true; // Already built
 
 	mBuildSpatialIndex = true;
 	setUriParameter(QStringLiteral("spatialIndex"), QStringLiteral("yes"));
-	rescanFile();
+	// 空間インデックスは全ての要素で作成し、サブセットは選択し直す
+	// 遅延読込を行った場合は読込時のscanElements()で作成済み
+	if (!loadDeferredFile())
+		scanElements();
+	if (mSubsetExpression)
+		rescanFile();
 	return true;
 }
 
@@ -8,11 +8,16 @@
 #ifndef QGSDMPROVIDER_H
 #define QGSDMPROVIDER_H
 
+#include <QBitArray>
+#include <QMutex>
 #include <QStringList>
+#include <QPointer>
+#include <QSharedPointer>
 
 #include "qgsvectordataprovider.h"
 #include "qgscoordinatereferencesystem.h"
 #include "qgsdmfile.h"
+#include "qgsdmcounters.h"
 #include "qgsfields.h"
 
 #include "qgsprovidermetadata.h"
@@ -25,6 +30,11 @@ class QFile;
 class QTextStream;
 
 class QgsDmFeatureIterator;
+class QgsDmDirectoryCache;
+class QgsDmTransformCache;
+class QgsDmLayerStatistics;
+class QgsDmLoadTask;
+class QgsFeedback;
 class QgsExpression;
 class QgsSpatialIndex;
 
@@ -81,15 +91,81 @@ class QgsDmProvider : public QgsVectorDataProvider
 			return mSubsetString;
 		}
 
+		/**
+		 * Re-reads the DM directory and rebuilds the feature count, extent and indexes.
+		 * Progress is reported and cancellation is checked through \a feedback. If the
+		 * reload is canceled the provider is left invalid, with no features.
+		 * \returns true if the directory was read
+		 */
+		bool reload( QgsFeedback *feedback = nullptr );
+
+		/**
+		 * Returns a snapshot of the cumulative counters of this layer: bytes read,
+		 * records decoded, geometries built, features rejected at each filter stage
+		 * and the time spent in each stage.
+		 * Per-feature stage times are only measured if the uri has profile=yes.
+		 */
+		QgsDmCounters counters() const;
+
+		/**
+		 * Returns the counters keyed by QgsDmCounters::key() (e.g. "bytesRead"),
+		 * so that they can be read through QMetaObject::invokeMethod().
+		 */
+		Q_INVOKABLE QVariantMap counterValues() const;
+
+		//! Resets the counters of this layer.
+		Q_INVOKABLE void resetCounters();
+
+		//! Writes the counters of this layer to the message log.
+		Q_INVOKABLE void logCounters() const;
+
+		/**
+		 * Returns the plans of the most recently closed feature iterators, oldest
+		 * first: the mode chosen and why, the candidates from the index, the
+		 * features rejected at each stage and the time spent.
+		 * The number of plans kept is set with the planHistory uri parameter
+		 * (default 16, 0 disables the history).
+		 */
+		QList< QgsDmQueryPlan > recentPlans() const;
+
+		//! Returns recentPlans() as one line descriptions.
+		Q_INVOKABLE QStringList recentPlanDescriptions() const;
+
+		//! Writes recentPlans() to the message log.
+		Q_INVOKABLE void logRecentPlans() const;
+
+
+  private slots:
+
+    // バックグラウンド読込の途中経過を受け取る
+    void onElementsLoaded( QSharedPointer<QgsDmFile> loaded );
+    // バックグラウンド読込の完了を受け取る（キャンセルされた場合はレイヤーを無効とする）
+    void onLoadFinished( bool result, bool canceled, QSharedPointer<QgsDmFile> loaded );
 
   private:
 
-    void scanFile( bool buildIndexes );
+    void scanFile( QgsFeedback *feedback = nullptr );
+    void scanElements( QgsFeedback *feedback = nullptr );
+
+		// ヘッダレコードのみから地物数と範囲を決定する（要素の読込は遅延する）
+		bool scanHeaders();
+		// 再帰モード：カタログから地物数と範囲を決定する（要素はディレクトリごとに必要な時に読み込む）
+		bool scanCatalog();
+		// 遅延している要素の読込を行う（この呼出しで読み込んだ場合はtrueを返す）
+		bool loadDeferredFile() const;
+		// バックグラウンド読込を開始する
+		void startBackgroundLoad();
+		// バックグラウンド読込をキャンセルする
+		void cancelBackgroundLoad();
 
     //some of these methods const, as they need to be called from const methods such as extent()
-    void rescanFile() const;
+    void rescanFile( QgsFeedback *feedback = nullptr ) const;
+    void setCanceled() const;
     void resetCachedSubset() const;
     void resetIndexes() const;
+    void resetSubsetSelection() const;
+    // サブセットの選択ビット列の要素の範囲
+    QgsRectangle selectionExtent() const;
     void clearInvalidLines() const;
     void recordInvalidLine( const QString &message );
     void reportErrors( const QStringList &messages = QStringList(), bool showDialog = false ) const;
@@ -97,16 +173,37 @@ class QgsDmProvider : public QgsVectorDataProvider
     void setUriParameter( const QString &parameter, const QString &value );
 
 		void appendExtent(const QgsGeometry& geom, bool& foundFirstGeometry);
-		void addFeaturemToSpatialIndex(int fid, const QgsGeometry& geom);
+		void addFeaturemToSpatialIndex(QgsFeatureId fid, const QgsGeometry& geom, QgsDmCounters& counters);
 
     // mLayerValid defines whether the layer has been loaded as a valid layer
-    bool mLayerValid = false;
+    mutable bool mLayerValid = false;
     // mValid defines whether the layer is currently valid (may differ from
     // mLayerValid if the file has been rewritten)
     mutable bool mValid = false;
 
-		static bool createGeometry(QgsWkbTypes::GeometryType type, const QList<Point2d>& points, QgsGeometry& geom);
-		static QgsPolylineXY createPolyline(const QList<Point2d>& vertexes, bool forPolygon = false);
+		// ヘッダのみで開き、要素の読込を最初の地物要求まで遅延する
+		bool mFastOpen = false;
+		// 要素の読込が遅延中
+		mutable bool mDeferredLoad = false;
+		// 遅延している要素の読込を1回のみ行う
+		mutable QMutex mDeferredLoadMutex;
+		// ヘッダのみで開き、要素はバックグラウンドのタスクで読み込む
+		bool mBackgroundLoad = false;
+		// 実行中のバックグラウンド読込タスク（タスクマネージャーが所有）
+		QPointer< QgsDmLoadTask > mLoadTask;
+
+		// 再帰モードで同時に読み込んでおくディレクトリの数
+		int mMaxDirectories = 0;
+		// 再帰モードの読込済みディレクトリ（地物ソースと共有する）
+		std::shared_ptr< QgsDmDirectoryCache > mDirectoryCache;
+		// 変換先CRSごとの変換済み座標列（地物ソースと共有する。transformCache=yesの場合のみ）
+		std::shared_ptr< QgsDmTransformCache > mTransformCache;
+		// 地物の取得方法を選ぶための統計（地物ソースと共有する。変更時は新しく作成する）
+		mutable std::shared_ptr< const QgsDmLayerStatistics > mStatistics;
+
+		// toleranceが正の場合は直前に残した頂点から許容誤差未満の頂点を省いて作成する
+		static bool createGeometry(QgsWkbTypes::GeometryType type, const DmCoords& points, QgsGeometry& geom, QgsDmCounters* counters = nullptr, double tolerance = 0.0);
+		static QgsPolylineXY createPolyline(const DmCoords& vertexes, bool forPolygon = false, double tolerance = 0.0);
 
     //! Text file
     std::unique_ptr< QgsDmFile > mFile;
@@ -118,12 +215,17 @@ class QgsDmProvider : public QgsVectorDataProvider
     //! Layer extent
     mutable QgsRectangle mExtent;
 		mutable long mNumberFeatures;
+		// サブセットのない地物数と範囲（読込時の値）
+		mutable long mBaseFeatureCount = 0;
+		mutable QgsRectangle mBaseExtent;
+		// 要素のジオメトリが有効かどうか（読込時に判定する。要素の添字）
+		mutable QBitArray mValidGeometries;
 
     QString mSubsetString;
     mutable QString mCachedSubsetString;
     std::unique_ptr< QgsExpression > mSubsetExpression;
-    bool mBuildSubsetIndex = false;
-    mutable QList<quintptr> mSubsetIndex;
+    // サブセットの地物の選択ビット列（要素の添字）。空間インデックス・要素の範囲は全ての要素のまま保持する
+    mutable QBitArray mSubsetSelection;
     mutable bool mUseSubsetIndex = false;
     mutable bool mCachedUseSubsetIndex;
 
@@ -144,11 +246,16 @@ class QgsDmProvider : public QgsVectorDataProvider
     // Spatial index
     bool mBuildSpatialIndex = false;
     mutable bool mUseSpatialIndex;
-    mutable bool mCachedUseSpatialIndex;
     mutable std::unique_ptr< QgsSpatialIndex > mSpatialIndex;
 
+		// 処理量と時間の累計（地物ソースと共有する）
+		std::shared_ptr< QgsDmCounterStore > mCounters;
+		// 破棄時に累計と直近の実行計画をメッセージログに出力する
+		bool mLogCounters = false;
+
     friend class QgsDmFeatureIterator;
     friend class QgsDmFeatureSource;
+    friend class BenchDmParser;
 };
 
 class QgsDmProviderMetadata: public QgsProviderMetadata
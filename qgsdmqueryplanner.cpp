@@ -0,0 +1,262 @@
+/***************************************************************************
+    qgsdmqueryplanner.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmqueryplanner.h"
+#include "qgsdmfile.h"
+
+#include <algorithm>
+#include <cmath>
+
+QgsDmLayerStatistics::QgsDmLayerStatistics( long featureCount, const QgsRectangle &extent )
+  : mFeatureCount( featureCount )
+  , mExtent( extent )
+{
+}
+
+QgsDmLayerStatistics::QgsDmLayerStatistics( const QgsDmFile &file )
+  : mFeatureCount( file.recordCount() )
+{
+  const DmPointCoords &points = file.pointCoords();
+  const DmElementExtents &extents = file.extents();
+  const bool point = points.count() > 0;
+  const int count = point ? points.count() : extents.count();
+
+  auto extentOf = [&]( int index )
+  {
+    if ( point )
+    {
+      const double x = points.x( index );
+      const double y = points.y( index );
+      return std::isnan( x ) || std::isnan( y ) ? QgsRectangle() : QgsRectangle( x, y, x, y );
+    }
+    const DmRect extent = extents.extent( index );
+    return extent.isNull() ? QgsRectangle() : QgsRectangle( extent.xMinimum(), extent.yMinimum(), extent.xMaximum(), extent.yMaximum() );
+  };
+
+  // 範囲を求めてから要素の範囲の中心が含まれる格子に数える
+  for ( int i = 0; i < count; i++ )
+  {
+    const QgsRectangle extent = extentOf( i );
+    if ( extent.isNull() )
+      continue;
+    if ( mExtent.isNull() )
+      mExtent = extent;
+    else
+      mExtent.combineExtentWith( extent );
+  }
+
+  if ( !mExtent.isNull() )
+  {
+    mCells.resize( GRID_SIZE * GRID_SIZE );
+    const double cellWidth = std::max( mExtent.width(), 1e-9 ) / GRID_SIZE;
+    const double cellHeight = std::max( mExtent.height(), 1e-9 ) / GRID_SIZE;
+    for ( int i = 0; i < count; i++ )
+    {
+      const QgsRectangle extent = extentOf( i );
+      if ( extent.isNull() )
+        continue;
+      const int column = std::min( GRID_SIZE - 1, static_cast<int>( ( extent.center().x() - mExtent.xMinimum() ) / cellWidth ) );
+      const int row = std::min( GRID_SIZE - 1, static_cast<int>( ( extent.center().y() - mExtent.yMinimum() ) / cellHeight ) );
+      Cell &cell = mCells[row * GRID_SIZE + column];
+      if ( cell.count++ == 0 )
+        cell.extent = extent;
+      else
+        cell.extent.combineExtentWith( extent );
+    }
+  }
+
+  const DmElementCodes &codes = file.codes();
+  const QList<int> dmcodes = codes.dmcodes();
+  for ( int dmcode : dmcodes )
+    mDmcodeFrequencies.insert( dmcode, codes.frequency( dmcode ) );
+}
+
+double QgsDmLayerStatistics::subsetSelectivity() const
+{
+  if ( mSubsetCount < 0 || mFeatureCount <= 0 )
+    return 1.0;
+  return std::min( 1.0, static_cast<double>( mSubsetCount ) / mFeatureCount );
+}
+
+double QgsDmLayerStatistics::overlapFraction( const QgsRectangle &extent, const QgsRectangle &rect )
+{
+  if ( extent.xMinimum() > rect.xMaximum() || rect.xMinimum() > extent.xMaximum()
+       || extent.yMinimum() > rect.yMaximum() || rect.yMinimum() > extent.yMaximum() )
+    return 0.0;
+  double fraction = 1.0;
+  if ( extent.width() > 0.0 )
+    fraction *= ( std::min( extent.xMaximum(), rect.xMaximum() ) - std::max( extent.xMinimum(), rect.xMinimum() ) ) / extent.width();
+  if ( extent.height() > 0.0 )
+    fraction *= ( std::min( extent.yMaximum(), rect.yMaximum() ) - std::max( extent.yMinimum(), rect.yMinimum() ) ) / extent.height();
+  return fraction;
+}
+
+double QgsDmLayerStatistics::estimateIntersecting( const QgsRectangle &rect ) const
+{
+  if ( rect.isNull() )
+    return mFeatureCount;
+  if ( mExtent.isNull() )
+    return 0.0;
+
+  // 格子がない（再帰モード）場合はレイヤの範囲との重なりの割合とする
+  if ( mCells.isEmpty() )
+    return mFeatureCount * overlapFraction( mExtent, rect );
+
+  double estimate = 0.0;
+  for ( const Cell &cell : mCells )
+  {
+    if ( cell.count > 0 )
+      estimate += cell.count * overlapFraction( cell.extent, rect );
+  }
+  return estimate;
+}
+
+long QgsDmLayerStatistics::dmcodeFrequency( const QSet<int> &dmcodes ) const
+{
+  long frequency = 0;
+  for ( int dmcode : dmcodes )
+    frequency += mDmcodeFrequencies.value( dmcode, 0 );
+  return frequency;
+}
+
+QString QgsDmQueryPlanner::attributePathName( AttributePath path )
+{
+  switch ( path )
+  {
+    case Scan:
+      return QStringLiteral( "scan" );
+    case SubsetIndex:
+      return QStringLiteral( "subset selection" );
+    case LayerIndex:
+      return QStringLiteral( "layer index" );
+    case DmcodeIndex:
+      return QStringLiteral( "dmcode index" );
+  }
+  return QString();
+}
+
+QString QgsDmQueryPlanner::rectPathName( RectPath path )
+{
+  switch ( path )
+  {
+    case RectTest:
+      return QStringLiteral( "extent test" );
+    case ExtentFilter:
+      return QStringLiteral( "element extents" );
+    case SpatialIndex:
+      return QStringLiteral( "spatial index" );
+  }
+  return QString();
+}
+
+QString QgsDmQueryPlanner::Plan::description() const
+{
+  QString text = attributePathName( restriction.path );
+  if ( rectPath != RectTest )
+    text = restriction.path == Scan ? rectPathName( rectPath ) : text + QStringLiteral( " + " ) + rectPathName( rectPath );
+  return text + QStringLiteral( ", est. %1 features %2 ms" ).arg( features, 0, 'f', 0 ).arg( cost / 1e6, 0, 'f', 2 );
+}
+
+QgsDmQueryPlanner::QgsDmQueryPlanner( const QgsDmLayerStatistics &statistics )
+  : mStatistics( statistics )
+{
+}
+
+QgsDmQueryPlanner::Plan QgsDmQueryPlanner::estimate( const Request &request, const Restriction &restriction, RectPath rectPath ) const
+{
+  const double featureCount = std::max( 1L, mStatistics.featureCount() );
+  const double subsetSelectivity = request.hasSubset ? mStatistics.subsetSelectivity() : 1.0;
+  // 矩形と交差する割合
+  const double rectSelectivity = request.rect.isNull() ? 1.0 : std::min( 1.0, mStatistics.estimateIntersecting( request.rect ) / featureCount );
+  const bool scan = restriction.path == Scan;
+  const double candidates = scan ? featureCount : restriction.candidates;
+
+  Plan plan;
+  plan.restriction = restriction;
+  plan.rectPath = rectPath;
+
+  // 候補を列挙し、矩形と交差する候補を選ぶ
+  double cost = 0.0;
+  double selected = candidates * rectSelectivity;
+  switch ( rectPath )
+  {
+    case RectTest:
+      cost += candidates * ( scan ? SCAN_ELEMENT_COST : CANDIDATE_COST );
+      break;
+    case ExtentFilter:
+      cost += candidates * EXTENT_FILTER_COST + selected * ( ID_COST + CANDIDATE_COST );
+      break;
+    case SpatialIndex:
+    {
+      // 空間インデックスは全ての要素を持つ
+      const double results = featureCount * rectSelectivity;
+      cost += SPATIAL_INDEX_QUERY_COST + results * ( SPATIAL_INDEX_RESULT_COST + ID_COST );
+      if ( scan )
+      {
+        selected = results;
+      }
+      else
+      {
+        cost += candidates * ID_COST;
+        selected = std::min( results, selected );
+      }
+      cost += selected * CANDIDATE_COST;
+      break;
+    }
+  }
+
+  // インデックスで処理していないサブセットは、選択ビット列があれば地物の作成前に、なければ作成後に式で判定する
+  double built = selected;
+  double returned = selected;
+  if ( request.hasSubset && !restriction.coversSubset )
+  {
+    returned *= subsetSelectivity;
+    if ( request.subsetSelection )
+      built = returned;
+    else
+      cost += selected * EXPRESSION_COST;
+  }
+  // 地物を作成し、インデックスで処理していないフィルタ式を評価する
+  cost += built * FEATURE_COST;
+  if ( request.hasFilterExpression && !restriction.coversFilter )
+    cost += returned * EXPRESSION_COST;
+
+  plan.cost = cost;
+  plan.features = built;
+  return plan;
+}
+
+QgsDmQueryPlanner::Plan QgsDmQueryPlanner::plan( const Request &request ) const
+{
+  QVector<Restriction> restrictions;
+  restrictions << Restriction();
+  restrictions += request.restrictions;
+
+  QVector<RectPath> rectPaths;
+  rectPaths << RectTest;
+  if ( !request.rect.isNull() && request.extentFilter )
+    rectPaths << ExtentFilter;
+  if ( !request.rect.isNull() && request.spatialIndex )
+    rectPaths << SpatialIndex;
+
+  Plan best;
+  bool found = false;
+  for ( const Restriction &restriction : qAsConst( restrictions ) )
+  {
+    for ( RectPath rectPath : qAsConst( rectPaths ) )
+    {
+      if ( restriction.path != Scan && rectPath != RectTest && !request.combineIndexes )
+        continue;
+      const Plan candidate = estimate( request, restriction, rectPath );
+      if ( !found || candidate.cost < best.cost )
+      {
+        best = candidate;
+        found = true;
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,189 @@
+/***************************************************************************
+    qgsdmqueryplanner.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMQUERYPLANNER_H
+#define QGSDMQUERYPLANNER_H
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include "qgsrectangle.h"
+
+class QgsDmFile;
+
+/**
+ * \class QgsDmLayerStatistics
+ * \brief Statistics of the elements of a DM layer, used to estimate the number of candidates of each access path.
+ *
+ * Built by the provider when the elements are scanned: the number of
+ * features, a histogram of the element bounding boxes and the frequency of
+ * each dmcode.  The histogram counts the elements by the cell of a
+ * GRID_SIZE x GRID_SIZE grid over the layer extent containing the center of
+ * their bounding box, and keeps the combined bounding box of each cell, so
+ * estimates stay close for elements spanning several cells.  The subset
+ * selectivity is updated when the subset string changes.
+ *
+ * In recursive mode only the feature count and extent of the catalog are
+ * known and the rectangle estimate is proportional to the area.
+ */
+class QgsDmLayerStatistics
+{
+  public:
+
+    static const int GRID_SIZE = 32;
+
+    //! Creates statistics with only a feature count and extent.
+    QgsDmLayerStatistics( long featureCount = 0, const QgsRectangle &extent = QgsRectangle() );
+
+    //! Builds the statistics of the elements of \a file.
+    explicit QgsDmLayerStatistics( const QgsDmFile &file );
+
+    long featureCount() const { return mFeatureCount; }
+
+    //! Returns the fraction of the features in the subset (1 without a subset).
+    double subsetSelectivity() const;
+    //! Sets the number of features in the subset, -1 for no subset.
+    void setSubsetCount( long count ) { mSubsetCount = count; }
+
+    //! Returns the estimated number of features whose bounding box intersects \a rect.
+    double estimateIntersecting( const QgsRectangle &rect ) const;
+
+    //! Returns the number of features with one of \a dmcodes.
+    long dmcodeFrequency( const QSet<int> &dmcodes ) const;
+
+  private:
+
+    struct Cell
+    {
+      long count = 0;
+      QgsRectangle extent;
+    };
+
+    // 矩形と範囲の重なりの割合（幅・高さが0の範囲は交差すれば1）
+    static double overlapFraction( const QgsRectangle &extent, const QgsRectangle &rect );
+
+    long mFeatureCount = 0;
+    long mSubsetCount = -1;
+    QgsRectangle mExtent;
+    QVector<Cell> mCells;
+    QHash<int, long> mDmcodeFrequencies;
+};
+
+/**
+ * \class QgsDmQueryPlanner
+ * \brief Chooses how a feature iterator reaches the features of a request by estimated cost.
+ *
+ * A request is answered by combining one attribute access path (a scan of
+ * every element, the subset selection, the layer code ranges or the dmcode
+ * index) with one rectangle access path (a test of each element's extent,
+ * the element extent arrays or the spatial index).  Combining two indexes
+ * intersects their candidates.  The cost of every available combination is
+ * estimated from QgsDmLayerStatistics and the per-element costs below, and
+ * the cheapest is chosen.
+ *
+ * The costs are rough nanosecond figures.  benchdmprovider's planner
+ * benchmark runs the same requests against providers with and without
+ * each index, so changes to the costs can be checked against the measured
+ * times.
+ */
+class QgsDmQueryPlanner
+{
+  public:
+
+    // 要素・地物1件あたりの処理時間の目安(ns)
+    //! Visiting one element of a sequential scan (including the extent test).
+    static constexpr double SCAN_ELEMENT_COST = 40.0;
+    //! Visiting one id of a candidate list (including the extent test).
+    static constexpr double CANDIDATE_COST = 60.0;
+    //! Testing one element in the extent arrays.
+    static constexpr double EXTENT_FILTER_COST = 2.0;
+    //! Adding, sorting or intersecting one id.
+    static constexpr double ID_COST = 10.0;
+    //! One spatial index query.
+    static constexpr double SPATIAL_INDEX_QUERY_COST = 20000.0;
+    //! One result of a spatial index query.
+    static constexpr double SPATIAL_INDEX_RESULT_COST = 150.0;
+    //! Building the geometry and attributes of one feature.
+    static constexpr double FEATURE_COST = 1500.0;
+    //! Evaluating the subset or filter expression for one feature.
+    static constexpr double EXPRESSION_COST = 2000.0;
+
+    enum AttributePath
+    {
+      Scan,
+      SubsetIndex,
+      LayerIndex,
+      DmcodeIndex
+    };
+
+    enum RectPath
+    {
+      RectTest,
+      ExtentFilter,
+      SpatialIndex
+    };
+
+    //! An index restricting the features by attribute.
+    struct Restriction
+    {
+      AttributePath path = Scan;
+      //! Number of candidates of the index.
+      long candidates = 0;
+      //! The index returns exactly the features of the subset.
+      bool coversSubset = false;
+      //! The index returns exactly the features of the request's filter expression.
+      bool coversFilter = false;
+    };
+
+    //! What is known about a request before choosing its access paths.
+    struct Request
+    {
+      //! Filter rectangle in the layer CRS, null for none.
+      QgsRectangle rect;
+      bool hasSubset = false;
+      bool hasFilterExpression = false;
+      //! The spatial index can be used (it holds every feature, not only the subset).
+      bool spatialIndex = false;
+      //! The extent arrays can be used (not in recursive mode).
+      bool extentFilter = false;
+      //! An attribute index can be intersected with the extent arrays or the spatial index (not in recursive mode).
+      bool combineIndexes = true;
+      //! The subset can be tested with the subset selection bitmap instead of evaluating the expression.
+      bool subsetSelection = false;
+      QVector<Restriction> restrictions;
+    };
+
+    struct Plan
+    {
+      Restriction restriction;
+      RectPath rectPath = RectTest;
+      //! Estimated cost in ns.
+      double cost = 0.0;
+      //! Estimated number of features built.
+      double features = 0.0;
+
+      //! Returns a short description, e.g. "dmcode index + element extents".
+      QString description() const;
+    };
+
+    static QString attributePathName( AttributePath path );
+    static QString rectPathName( RectPath path );
+
+    explicit QgsDmQueryPlanner( const QgsDmLayerStatistics &statistics );
+
+    //! Returns the cheapest plan for \a request.
+    Plan plan( const Request &request ) const;
+
+    //! Returns the estimated cost of answering \a request with \a restriction and \a rectPath.
+    Plan estimate( const Request &request, const Restriction &restriction, RectPath rectPath ) const;
+
+  private:
+    const QgsDmLayerStatistics &mStatistics;
+};
+
+#endif // QGSDMQUERYPLANNER_H
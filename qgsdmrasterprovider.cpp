@@ -0,0 +1,331 @@
+/***************************************************************************
+  qgsdmrasterprovider.cpp -  Raster data provider for DM grids
+  -------------------
+          begin                : March 2021
+          copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#include "qgsdmrasterprovider.h"
+
+#include <QElapsedTimer>
+#include <QUrl>
+#include <QtMath>
+
+#include "qgslogger.h"
+#include "qgsmessagelog.h"
+#include "qgsrasterblock.h"
+
+#include "qgsdmparser.h"
+
+#include <algorithm>
+#include <cmath>
+
+const QString QgsDmRasterProvider::DM_RASTER_PROVIDER_KEY = QStringLiteral( "dmgrid" );
+const QString QgsDmRasterProvider::DM_RASTER_PROVIDER_DESCRIPTION = QStringLiteral( "DM grid data provider" );
+
+QgsDmRasterProvider::QgsDmRasterProvider( const QString &uri, const ProviderOptions &options )
+  : QgsRasterDataProvider( uri, options )
+{
+  QUrl url = QUrl::fromEncoded( uri.toLatin1() );
+  mDirPath = url.toLocalFile();
+
+  if ( url.hasQueryItem( QStringLiteral( "srid" ) ) )
+    mCrs.createFromString( QStringLiteral( "POSTGIS:%1" ).arg( url.queryItemValue( QStringLiteral( "srid" ) ) ) );
+  // 分類コード：読み込むグリッドの分類コードを指定します。デフォルトは最初のグリッドの分類コードです。
+  if ( url.hasQueryItem( QStringLiteral( "code" ) ) )
+    mCode = url.queryItemValue( QStringLiteral( "code" ) ).toInt();
+  if ( url.hasQueryItem( QStringLiteral( "overwritingTimes" ) ) )
+    mOverwritingTimes = url.queryItemValue( QStringLiteral( "overwritingTimes" ) ).toInt();
+
+  mValid = load();
+  if ( !mValid )
+  {
+    QgsMessageLog::logMessage( tr( "DM grid %1: %2" ).arg( mDirPath, mError ), tr( "DM" ) );
+    return;
+  }
+
+  mSrcNoDataValue.append( mRaster->noDataValue() );
+  mSrcHasNoDataValue.append( true );
+  mUseSrcNoDataValue.append( true );
+}
+
+QgsDmRasterProvider::QgsDmRasterProvider( const QgsDmRasterProvider &other )
+  : QgsRasterDataProvider( other.dataSourceUri(), ProviderOptions() )
+  , mDirPath( other.mDirPath )
+  , mCode( other.mCode )
+  , mOverwritingTimes( other.mOverwritingTimes )
+  , mCrs( other.mCrs )
+  , mExtent( other.mExtent )
+  , mSpacing( other.mSpacing )
+  , mGridCount( other.mGridCount )
+  , mValid( other.mValid )
+  , mError( other.mError )
+  , mRaster( other.mRaster )
+{
+  mSrcNoDataValue = other.mSrcNoDataValue;
+  mSrcHasNoDataValue = other.mSrcHasNoDataValue;
+  mUseSrcNoDataValue = other.mUseSrcNoDataValue;
+}
+
+QgsDmRasterProvider *QgsDmRasterProvider::clone() const
+{
+  QgsDmRasterProvider *provider = new QgsDmRasterProvider( *this );
+  provider->copyBaseSettings( *this );
+  return provider;
+}
+
+bool QgsDmRasterProvider::load()
+{
+  const QStringList filePaths = DmReader::dmFilePaths( mDirPath );
+  if ( filePaths.isEmpty() )
+  {
+    mError = tr( "No DM files found" );
+    return false;
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+
+  // ヘッダレコードのみでグリッドの範囲を決定する
+  DmReader reader;
+  reader.setOverwritingTimes( mOverwritingTimes );
+  DmSurvey survey;
+  for ( const QString &filePath : filePaths )
+    reader.surveyFile( filePath, survey );
+
+  DmRect extent;
+  for ( const DmGrid &grid : survey.grids() )
+  {
+    if ( mCode < 0 )
+      mCode = grid.code();
+    if ( grid.code() != mCode )
+      continue;
+    if ( mSpacing <= 0 )
+      mSpacing = grid.spacing();
+    if ( !qgsDoubleNear( grid.spacing(), mSpacing ) )
+    {
+      QgsDebugMsg( QStringLiteral( "DM grid with spacing %1 skipped (expected %2)" ).arg( grid.spacing() ).arg( mSpacing ) );
+      continue;
+    }
+    extent.combine( grid.extent() );
+    mGridCount++;
+  }
+  if ( mGridCount == 0 || extent.isNull() )
+  {
+    mError = tr( "No grid records found" );
+    return false;
+  }
+
+  mExtent = QgsRectangle( extent.xMinimum(), extent.yMinimum(), extent.xMaximum(), extent.yMaximum() );
+  const int width = static_cast<int>( std::round( mExtent.width() / mSpacing ) );
+  const int height = static_cast<int>( std::round( mExtent.height() / mSpacing ) );
+
+  mRaster = std::make_shared< QgsDmTiledRaster >();
+  if ( !mRaster->create( width, height, DmGrid::NoData ) )
+  {
+    mError = tr( "Cannot create the tile file for %1 x %2 cells" ).arg( width ).arg( height );
+    return false;
+  }
+
+  // グリッドの値はファイル単位で読み込んでタイルに書き込み、読込後に破棄する
+  reader.setDataType( QStringLiteral( "dm_grid" ) );
+  for ( const QString &filePath : filePaths )
+  {
+    reader.clear();
+    if ( !reader.readFile( filePath ) )
+      continue;
+
+    for ( const DmGrid &grid : reader.grids() )
+    {
+      if ( grid.code() != mCode || !qgsDoubleNear( grid.spacing(), mSpacing ) )
+        continue;
+      const DmRect gridExtent = grid.extent();
+      const int column = static_cast<int>( std::round( ( gridExtent.xMinimum() - mExtent.xMinimum() ) / mSpacing ) );
+      const int row = static_cast<int>( std::round( ( mExtent.yMaximum() - gridExtent.yMaximum() ) / mSpacing ) );
+      mRaster->writeGrid( grid, column, row );
+    }
+  }
+  reader.clear();
+
+  mRaster->buildOverviews();
+
+  QgsDebugMsg( QStringLiteral( "DM grid %1: %2 grids, %3 x %4 cells, %5 levels, %6 ms" )
+               .arg( mDirPath ).arg( mGridCount ).arg( width ).arg( height ).arg( mRaster->levelCount() ).arg( timer.elapsed() ) );
+  return true;
+}
+
+int QgsDmRasterProvider::levelForResolution( double resolution ) const
+{
+  // 要求された解像度より細かい範囲で最も粗いレベル
+  int level = 0;
+  double cellSize = mSpacing * 2;
+  while ( level + 1 < mRaster->levelCount() && cellSize <= resolution )
+  {
+    level++;
+    cellSize *= 2;
+  }
+  return level;
+}
+
+bool QgsDmRasterProvider::readBlock( int bandNo, int xBlock, int yBlock, void *data )
+{
+  Q_UNUSED( bandNo )
+  if ( !mValid )
+    return false;
+
+  QVector<int> columns( QgsDmTiledRaster::TILE_SIZE );
+  QVector<int> rows( QgsDmTiledRaster::TILE_SIZE );
+  for ( int i = 0; i < QgsDmTiledRaster::TILE_SIZE; i++ )
+  {
+    int column = xBlock * QgsDmTiledRaster::TILE_SIZE + i;
+    int row = yBlock * QgsDmTiledRaster::TILE_SIZE + i;
+    columns[i] = column < mRaster->width() ? column : -1;
+    rows[i] = row < mRaster->height() ? row : -1;
+  }
+  mRaster->sample( 0, columns, rows, static_cast<float *>( data ) );
+  return true;
+}
+
+bool QgsDmRasterProvider::readBlock( int bandNo, const QgsRectangle &viewExtent, int width, int height, void *data, QgsRasterBlockFeedback *feedback )
+{
+  Q_UNUSED( bandNo )
+  Q_UNUSED( feedback )
+  if ( !mValid || width <= 0 || height <= 0 )
+    return false;
+
+  const double xRes = viewExtent.width() / width;
+  const double yRes = viewExtent.height() / height;
+  const int level = levelForResolution( std::min( xRes, yRes ) );
+  const double cellSize = mSpacing * ( 1 << level );
+  const int levelWidth = mRaster->width( level );
+  const int levelHeight = mRaster->height( level );
+
+  // 出力セルの中心に最も近いセル（最近傍）
+  QVector<int> columns( width );
+  for ( int i = 0; i < width; i++ )
+  {
+    double x = viewExtent.xMinimum() + ( i + 0.5 ) * xRes;
+    int column = static_cast<int>( std::floor( ( x - mExtent.xMinimum() ) / cellSize ) );
+    columns[i] = ( column >= 0 && column < levelWidth ) ? column : -1;
+  }
+  QVector<int> rows( height );
+  for ( int j = 0; j < height; j++ )
+  {
+    double y = viewExtent.yMaximum() - ( j + 0.5 ) * yRes;
+    int row = static_cast<int>( std::floor( ( mExtent.yMaximum() - y ) / cellSize ) );
+    rows[j] = ( row >= 0 && row < levelHeight ) ? row : -1;
+  }
+
+  mRaster->sample( level, columns, rows, static_cast<float *>( data ) );
+  return true;
+}
+
+QString QgsDmRasterProvider::name() const
+{
+  return DM_RASTER_PROVIDER_KEY;
+}
+
+QString QgsDmRasterProvider::description() const
+{
+  return DM_RASTER_PROVIDER_DESCRIPTION;
+}
+
+bool QgsDmRasterProvider::isValid() const
+{
+  return mValid;
+}
+
+QgsCoordinateReferenceSystem QgsDmRasterProvider::crs() const
+{
+  return mCrs;
+}
+
+QgsRectangle QgsDmRasterProvider::extent() const
+{
+  return mExtent;
+}
+
+int QgsDmRasterProvider::capabilities() const
+{
+  return QgsRasterDataProvider::Size | QgsRasterDataProvider::Identify | QgsRasterDataProvider::IdentifyValue;
+}
+
+Qgis::DataType QgsDmRasterProvider::dataType( int bandNo ) const
+{
+  return sourceDataType( bandNo );
+}
+
+Qgis::DataType QgsDmRasterProvider::sourceDataType( int bandNo ) const
+{
+  Q_UNUSED( bandNo )
+  return Qgis::Float32;
+}
+
+int QgsDmRasterProvider::bandCount() const
+{
+  return 1;
+}
+
+int QgsDmRasterProvider::xSize() const
+{
+  return mValid ? mRaster->width() : 0;
+}
+
+int QgsDmRasterProvider::ySize() const
+{
+  return mValid ? mRaster->height() : 0;
+}
+
+int QgsDmRasterProvider::xBlockSize() const
+{
+  return QgsDmTiledRaster::TILE_SIZE;
+}
+
+int QgsDmRasterProvider::yBlockSize() const
+{
+  return QgsDmTiledRaster::TILE_SIZE;
+}
+
+QString QgsDmRasterProvider::htmlMetadata()
+{
+  if ( !mValid )
+    return QString();
+
+  return QStringLiteral( "<tr><td class=\"highlight\">" ) + tr( "Classification code" ) + QStringLiteral( "</td><td>%1</td></tr>" ).arg( mCode )
+         + QStringLiteral( "<tr><td class=\"highlight\">" ) + tr( "Grids" ) + QStringLiteral( "</td><td>%1</td></tr>" ).arg( mGridCount )
+         + QStringLiteral( "<tr><td class=\"highlight\">" ) + tr( "Grid spacing" ) + QStringLiteral( "</td><td>%1</td></tr>" ).arg( mSpacing )
+         + QStringLiteral( "<tr><td class=\"highlight\">" ) + tr( "Overview levels" ) + QStringLiteral( "</td><td>%1</td></tr>" ).arg( mRaster->levelCount() - 1 )
+         + QStringLiteral( "<tr><td class=\"highlight\">" ) + tr( "Tile file" ) + QStringLiteral( "</td><td>%1 MiB</td></tr>" ).arg( mRaster->byteSize() / ( 1024.0 * 1024.0 ), 0, 'f', 1 );
+}
+
+QString QgsDmRasterProvider::lastErrorTitle()
+{
+  return tr( "DM grid" );
+}
+
+QString QgsDmRasterProvider::lastError()
+{
+  return mError;
+}
+
+QVariantMap QgsDmRasterProviderMetadata::decodeUri( const QString &uri )
+{
+  QVariantMap components;
+  components.insert( QStringLiteral( "path" ), QUrl( uri ).toLocalFile() );
+  return components;
+}
+
+QgsDataProvider *QgsDmRasterProviderMetadata::createProvider( const QString &uri, const QgsDataProvider::ProviderOptions &options )
+{
+  return new QgsDmRasterProvider( uri, options );
+}
+
+QgsDmRasterProviderMetadata::QgsDmRasterProviderMetadata():
+  QgsProviderMetadata( QgsDmRasterProvider::DM_RASTER_PROVIDER_KEY, QgsDmRasterProvider::DM_RASTER_PROVIDER_DESCRIPTION )
+{
+}
+
+QGISEXTERN QgsProviderMetadata *providerMetadataFactory()
+{
+  return new QgsDmRasterProviderMetadata();
+}
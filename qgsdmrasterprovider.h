@@ -0,0 +1,106 @@
+/***************************************************************************
+      qgsdmrasterprovider.h  -  Raster data provider for DM grids
+                             -------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+#ifndef QGSDMRASTERPROVIDER_H
+#define QGSDMRASTERPROVIDER_H
+
+#include <memory>
+
+#include "qgsrasterdataprovider.h"
+#include "qgscoordinatereferencesystem.h"
+#include "qgsrectangle.h"
+#include "qgsprovidermetadata.h"
+
+#include "qgsdmtiledraster.h"
+
+/**
+ * \class QgsDmRasterProvider
+ * \brief Raster data provider for the grid (G) records of a DM directory.
+ *
+ * The grids of all DM files in the directory are decoded once into a tiled,
+ * memory mapped float raster with overviews (QgsDmTiledRaster).  Block
+ * requests pick the overview matching the requested resolution and read only
+ * the tiles they intersect.
+ *
+ * The uri is the directory as a file url with optional query items:
+ * - srid: as for the "dm" vector provider
+ * - code: classification code of the grids to load (default: the code of the first grid)
+ * - overwritingTimes: as for the "dm" vector provider
+ *
+ * Grids with a different spacing from the first loaded grid are skipped.
+ */
+class QgsDmRasterProvider : public QgsRasterDataProvider
+{
+    Q_OBJECT
+
+  public:
+
+    static const QString DM_RASTER_PROVIDER_KEY;
+    static const QString DM_RASTER_PROVIDER_DESCRIPTION;
+
+    explicit QgsDmRasterProvider( const QString &uri, const QgsDataProvider::ProviderOptions &providerOptions );
+
+    QgsDmRasterProvider *clone() const override;
+    QString name() const override;
+    QString description() const override;
+    bool isValid() const override;
+    QgsCoordinateReferenceSystem crs() const override;
+    QgsRectangle extent() const override;
+
+    int capabilities() const override;
+    Qgis::DataType dataType( int bandNo ) const override;
+    Qgis::DataType sourceDataType( int bandNo ) const override;
+    int bandCount() const override;
+    int xSize() const override;
+    int ySize() const override;
+    int xBlockSize() const override;
+    int yBlockSize() const override;
+
+    QString htmlMetadata() override;
+    QString lastErrorTitle() override;
+    QString lastError() override;
+
+  protected:
+
+    bool readBlock( int bandNo, int xBlock, int yBlock, void *data ) override;
+    bool readBlock( int bandNo, const QgsRectangle &viewExtent, int width, int height, void *data, QgsRasterBlockFeedback *feedback = nullptr ) override;
+
+  private:
+
+    // 複製用（タイルを共有する）
+    QgsDmRasterProvider( const QgsDmRasterProvider &other );
+
+    // ディレクトリのグリッドを読み込みタイルを作成する
+    bool load();
+
+    // 要求された解像度（セルの大きさ）に対応するレベル
+    int levelForResolution( double resolution ) const;
+
+    QString mDirPath;
+    int mCode = -1;
+    int mOverwritingTimes = -1;
+
+    QgsCoordinateReferenceSystem mCrs;
+    QgsRectangle mExtent;
+    double mSpacing = 0;
+    int mGridCount = 0;
+    bool mValid = false;
+    QString mError;
+
+    // 複製したプロバイダと共有する（読込後は変更しない）
+    std::shared_ptr< QgsDmTiledRaster > mRaster;
+};
+
+class QgsDmRasterProviderMetadata: public QgsProviderMetadata
+{
+  public:
+    QgsDmRasterProviderMetadata();
+    QgsDataProvider *createProvider( const QString &uri, const QgsDataProvider::ProviderOptions &options ) override;
+    QVariantMap decodeUri( const QString &uri ) override;
+};
+
+#endif
@@ -91,7 +91,16 @@ void QgsDmSourceSelect::addButtonClicked()
   {
     url.addQueryItem( QStringLiteral( "overwritingTimes" ), QString::number(mOverwritingTimes->value()));
   }
-	url.addQueryItem(QStringLiteral("spatialIndex"), cbxSpatialIndex->isChecked() ? QStringLiteral("yes") : QStringLiteral("no"));
+	if (mFile->isRecursive()) {
+		// ディレクトリツリー全体を1つのレイヤーとし、表示範囲のディレクトリのみ読み込む
+		url.addQueryItem(QStringLiteral("recursive"), QStringLiteral("yes"));
+	}
+	else {
+		url.addQueryItem(QStringLiteral("spatialIndex"), cbxSpatialIndex->isChecked() ? QStringLiteral("yes") : QStringLiteral("no"));
+		// 要素はバックグラウンドで読み込み、読み込んだ図郭から表示する
+		url.addQueryItem(QStringLiteral("fastOpen"), QStringLiteral("yes"));
+		url.addQueryItem(QStringLiteral("backgroundLoad"), QStringLiteral("yes"));
+	}
 
 	// グループを作成する
 	QgsLayerTree *root = QgsProject::instance()->layerTreeRoot();
@@ -142,6 +151,9 @@ void QgsDmSourceSelect::addButtonClicked()
 bool QgsDmSourceSelect::loadDmFilesDefinition()
 {
   mFile->setDirPath( mDirectoryWidget->filePath());
+	// 直下にDMファイルがなくサブディレクトリにある場合は再帰モード（都市全体のアーカイブ等）とする
+	const QString dirPath = mDirectoryWidget->filePath();
+	mFile->setRecursive(!dirPath.isEmpty() && DmReader::dmFilePaths(dirPath).isEmpty() && !DmReader::dmDirectories(dirPath).isEmpty());
 	if (chkForceOverwriting->isChecked()) {
 		mFile->setOverwritingTimes(mOverwritingTimes->value());
 	}
@@ -197,7 +209,7 @@ bool QgsDmSourceSelect::validate()
 			return false;
 		}
 
-		if (dir.entryList(QStringList() << "*.dm", QDir::Files).count() == 0) {
+		if (dir.entryList(QStringList() << "*.dm", QDir::Files).count() == 0 && !mFile->isRecursive()) {
 			message = tr("DMファイルが存在しません");
 			return false;
 		}
@@ -0,0 +1,219 @@
+/***************************************************************************
+    qgsdmtiledraster.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmtiledraster.h"
+#include "qgsdmparser.h"
+
+#include <QDir>
+
+#include <algorithm>
+
+namespace
+{
+  const qint64 TILE_VALUES = static_cast<qint64>( QgsDmTiledRaster::TILE_SIZE ) * QgsDmTiledRaster::TILE_SIZE;
+}
+
+QgsDmTiledRaster::~QgsDmTiledRaster()
+{
+  if ( mData )
+    mFile.unmap( reinterpret_cast<uchar *>( mData ) );
+}
+
+bool QgsDmTiledRaster::create( int width, int height, float noDataValue )
+{
+  if ( width <= 0 || height <= 0 )
+    return false;
+
+  mNoDataValue = noDataValue;
+
+  // 1タイルに収まるまで解像度を半分にしたレベルを作る
+  qint64 values = 0;
+  int levelWidth = width;
+  int levelHeight = height;
+  for ( ;; )
+  {
+    Level level;
+    level.width = levelWidth;
+    level.height = levelHeight;
+    level.tilesX = ( levelWidth + TILE_SIZE - 1 ) / TILE_SIZE;
+    level.tilesY = ( levelHeight + TILE_SIZE - 1 ) / TILE_SIZE;
+    level.offset = values;
+    level.written = QBitArray( level.tilesX * level.tilesY );
+    values += TILE_VALUES * level.tilesX * level.tilesY;
+    mLevels.append( level );
+
+    if ( level.tilesX == 1 && level.tilesY == 1 )
+      break;
+    levelWidth = ( levelWidth + 1 ) / 2;
+    levelHeight = ( levelHeight + 1 ) / 2;
+  }
+
+  // 書き込んだタイルのみ領域が確保されるように、サイズを設定するだけで初期化しない
+  mFile.setFileTemplate( QDir::temp().filePath( QStringLiteral( "dmgrid_XXXXXX.raw" ) ) );
+  if ( !mFile.open() || !mFile.resize( values * static_cast<qint64>( sizeof( float ) ) ) )
+  {
+    mLevels.clear();
+    return false;
+  }
+
+  mData = reinterpret_cast<float *>( mFile.map( 0, mFile.size() ) );
+  if ( !mData )
+  {
+    mLevels.clear();
+    return false;
+  }
+  return true;
+}
+
+const float *QgsDmTiledRaster::tile( int level, int tileX, int tileY ) const
+{
+  const Level &l = mLevels.at( level );
+  int index = tileY * l.tilesX + tileX;
+  if ( !l.written.testBit( index ) )
+    return nullptr;
+  return mData + l.offset + TILE_VALUES * index;
+}
+
+float *QgsDmTiledRaster::writableTile( int level, int tileX, int tileY )
+{
+  Level &l = mLevels[level];
+  int index = tileY * l.tilesX + tileX;
+  float *data = mData + l.offset + TILE_VALUES * index;
+  if ( !l.written.testBit( index ) )
+  {
+    std::fill( data, data + TILE_VALUES, mNoDataValue );
+    l.written.setBit( index );
+  }
+  return data;
+}
+
+void QgsDmTiledRaster::writeGrid( const DmGrid &grid, int column, int row )
+{
+  if ( !mData || grid.values().isEmpty() )
+    return;
+
+  const Level &level = mLevels.at( 0 );
+  const float gridNoData = DmGrid::NoData;
+  for ( int r = 0; r < grid.rowCount(); r++ )
+  {
+    int y = row + r;
+    if ( y < 0 || y >= level.height )
+      continue;
+
+    for ( int c = 0; c < grid.columnCount(); c++ )
+    {
+      int x = column + c;
+      if ( x < 0 || x >= level.width )
+        continue;
+
+      float value = grid.value( c, r );
+      if ( value == gridNoData )
+        continue;
+
+      float *data = writableTile( 0, x / TILE_SIZE, y / TILE_SIZE );
+      data[( y % TILE_SIZE ) * TILE_SIZE + x % TILE_SIZE] = value;
+    }
+  }
+}
+
+void QgsDmTiledRaster::buildOverviews()
+{
+  for ( int level = 1; level < mLevels.count(); level++ )
+  {
+    const Level &source = mLevels.at( level - 1 );
+    const Level &target = mLevels.at( level );
+
+    // 書き込み済みのタイルから縮小する（値のない領域は処理しない）
+    for ( int tileY = 0; tileY < target.tilesY; tileY++ )
+    {
+      for ( int tileX = 0; tileX < target.tilesX; tileX++ )
+      {
+        bool hasSource = false;
+        for ( int sy = tileY * 2; sy < std::min( tileY * 2 + 2, source.tilesY ) && !hasSource; sy++ )
+        {
+          for ( int sx = tileX * 2; sx < std::min( tileX * 2 + 2, source.tilesX ) && !hasSource; sx++ )
+            hasSource = source.written.testBit( sy * source.tilesX + sx );
+        }
+        if ( !hasSource )
+          continue;
+
+        float *data = writableTile( level, tileX, tileY );
+        int yEnd = std::min( TILE_SIZE, target.height - tileY * TILE_SIZE );
+        int xEnd = std::min( TILE_SIZE, target.width - tileX * TILE_SIZE );
+        for ( int y = 0; y < yEnd; y++ )
+        {
+          for ( int x = 0; x < xEnd; x++ )
+          {
+            int column = ( tileX * TILE_SIZE + x ) * 2;
+            int row = ( tileY * TILE_SIZE + y ) * 2;
+            double sum = 0;
+            int count = 0;
+            for ( int dy = 0; dy < 2; dy++ )
+            {
+              for ( int dx = 0; dx < 2; dx++ )
+              {
+                if ( column + dx >= source.width || row + dy >= source.height )
+                  continue;
+                float v = value( level - 1, column + dx, row + dy );
+                if ( v == mNoDataValue )
+                  continue;
+                sum += v;
+                count++;
+              }
+            }
+            if ( count > 0 )
+              data[y * TILE_SIZE + x] = static_cast<float>( sum / count );
+          }
+        }
+      }
+    }
+  }
+}
+
+float QgsDmTiledRaster::value( int level, int column, int row ) const
+{
+  const float *data = tile( level, column / TILE_SIZE, row / TILE_SIZE );
+  if ( !data )
+    return mNoDataValue;
+  return data[( row % TILE_SIZE ) * TILE_SIZE + column % TILE_SIZE];
+}
+
+void QgsDmTiledRaster::sample( int level, const QVector<int> &columns, const QVector<int> &rows, float *out ) const
+{
+  const int width = columns.count();
+  for ( int j = 0; j < rows.count(); j++ )
+  {
+    float *outRow = out + static_cast<qint64>( j ) * width;
+    const int row = rows.at( j );
+    if ( row < 0 )
+    {
+      std::fill( outRow, outRow + width, mNoDataValue );
+      continue;
+    }
+
+    // 同じタイルが続く間はタイルの検索を繰り返さない
+    const int tileY = row / TILE_SIZE;
+    const int rowOffset = ( row % TILE_SIZE ) * TILE_SIZE;
+    int currentTileX = -1;
+    const float *data = nullptr;
+    for ( int i = 0; i < width; i++ )
+    {
+      const int column = columns.at( i );
+      if ( column < 0 )
+      {
+        outRow[i] = mNoDataValue;
+        continue;
+      }
+      const int tileX = column / TILE_SIZE;
+      if ( tileX != currentTileX )
+      {
+        currentTileX = tileX;
+        data = tile( level, tileX, tileY );
+      }
+      outRow[i] = data ? data[rowOffset + column % TILE_SIZE] : mNoDataValue;
+    }
+  }
+}
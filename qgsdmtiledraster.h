@@ -0,0 +1,99 @@
+/***************************************************************************
+    qgsdmtiledraster.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMTILEDRASTER_H
+#define QGSDMTILEDRASTER_H
+
+#include <QBitArray>
+#include <QTemporaryFile>
+#include <QVector>
+
+class DmGrid;
+
+/**
+ * \class QgsDmTiledRaster
+ * \brief A single band float raster stored in square tiles of a memory mapped file.
+ *
+ * Level 0 holds the full resolution grid and each following level (overview)
+ * halves the resolution of the previous one, down to a single tile.  All
+ * levels live in one temporary file which is mapped into memory, so reading
+ * a region only touches the pages of the tiles it intersects.  Tiles that
+ * were never written are not stored and read as the no data value.
+ */
+class QgsDmTiledRaster
+{
+  public:
+
+    static const int TILE_SIZE = 256;
+
+    QgsDmTiledRaster() = default;
+    ~QgsDmTiledRaster();
+
+    QgsDmTiledRaster( const QgsDmTiledRaster &other ) = delete;
+    QgsDmTiledRaster &operator=( const QgsDmTiledRaster &other ) = delete;
+
+    /**
+     * Creates an empty raster of \a width x \a height cells with overviews
+     * in a temporary file.  Returns false if the file cannot be created or mapped.
+     */
+    bool create( int width, int height, float noDataValue );
+
+    bool isValid() const { return mData; }
+
+    int levelCount() const { return mLevels.count(); }
+    int width( int level = 0 ) const { return mLevels.at( level ).width; }
+    int height( int level = 0 ) const { return mLevels.at( level ).height; }
+    float noDataValue() const { return mNoDataValue; }
+
+    //! Returns the size of the mapped file in bytes.
+    qint64 byteSize() const { return mFile.size(); }
+
+    /**
+     * Writes the values of \a grid with its north west cell at \a column, \a row
+     * of level 0.  Cells outside the raster and no data values are skipped.
+     */
+    void writeGrid( const DmGrid &grid, int column, int row );
+
+    //! Computes all overview levels from level 0 (mean of the valid cells).
+    void buildOverviews();
+
+    /**
+     * Returns the value of cell \a column, \a row of \a level
+     * (no data if the tile was never written).
+     */
+    float value( int level, int column, int row ) const;
+
+    /**
+     * Samples \a level at the given cells: output cell (i, j) receives the value
+     * of cell (columns[i], rows[j]).  Negative indexes give no data.  \a out must
+     * hold columns.count() * rows.count() values.
+     */
+    void sample( int level, const QVector<int> &columns, const QVector<int> &rows, float *out ) const;
+
+  private:
+
+    struct Level
+    {
+      int width = 0;
+      int height = 0;
+      int tilesX = 0;
+      int tilesY = 0;
+      // ファイル内の最初のタイルの位置（値の数）
+      qint64 offset = 0;
+      // 書き込み済みのタイル
+      QBitArray written;
+    };
+
+    const float *tile( int level, int tileX, int tileY ) const;
+    float *writableTile( int level, int tileX, int tileY );
+
+    QTemporaryFile mFile;
+    float *mData = nullptr;
+    QVector<Level> mLevels;
+    float mNoDataValue = 0;
+};
+
+#endif // QGSDMTILEDRASTER_H
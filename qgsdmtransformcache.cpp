@@ -0,0 +1,100 @@
+/***************************************************************************
+    qgsdmtransformcache.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#include "qgsdmtransformcache.h"
+#include "qgslogger.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+
+QgsDmTransformCache::Entry::Entry( int elementCount )
+  : mCoords( std::max( 0, elementCount ) )
+{
+}
+
+DmCoords QgsDmTransformCache::Entry::coords( int index ) const
+{
+  QMutexLocker locker( &mMutex );
+  if ( index < 0 || index >= mCoords.count() )
+    return DmCoords();
+  return mCoords.at( index );
+}
+
+DmCoords QgsDmTransformCache::Entry::insert( int index, const Point2d *points, int count )
+{
+  QMutexLocker locker( &mMutex );
+  if ( index < 0 || index >= mCoords.count() )
+    return DmCoords( points, count );
+
+  // 同時に変換された場合は先に登録されたものを使う
+  if ( !mCoords.at( index ).isEmpty() )
+    return mCoords.at( index );
+
+  Point2d *stored = mArena.allocateArray<Point2d>( count );
+  std::copy( points, points + count, stored );
+  mCoords[index] = DmCoords( stored, count );
+  return mCoords.at( index );
+}
+
+qint64 QgsDmTransformCache::Entry::bytesAllocated() const
+{
+  QMutexLocker locker( &mMutex );
+  return static_cast<qint64>( mArena.bytesAllocated() );
+}
+
+QgsDmTransformCache::QgsDmTransformCache( int maxEntries )
+  : mMaxEntries( std::max( 1, maxEntries ) )
+{
+}
+
+std::shared_ptr< QgsDmTransformCache::Entry > QgsDmTransformCache::entry( const QgsCoordinateTransform &transform, int level, int elementCount )
+{
+  // 認証IDのないCRSはWKTで区別する
+  auto crsKey = []( const QgsCoordinateReferenceSystem & crs )
+  {
+    return crs.authid().isEmpty() ? crs.toWkt() : crs.authid();
+  };
+  // 同じCRSの組でも変換のコンテキストで選んだ座標操作が異なれば座標が異なる
+  const QString key = QStringLiteral( "%1|%2|%3|%4" )
+                      .arg( crsKey( transform.sourceCrs() ), crsKey( transform.destinationCrs() ), transform.coordinateOperation() )
+                      .arg( level );
+
+  QMutexLocker locker( &mMutex );
+  for ( int i = 0; i < mEntries.count(); i++ )
+  {
+    if ( mEntries.at( i ).first != key )
+      continue;
+    QPair< QString, std::shared_ptr< Entry > > found = mEntries.takeAt( i );
+    // 要素数が変わった場合（読み直し等）は作り直す
+    if ( found.second->elementCount() != elementCount )
+      break;
+    mEntries.prepend( found );
+    return found.second;
+  }
+
+  std::shared_ptr< Entry > created = std::make_shared< Entry >( elementCount );
+  mEntries.prepend( qMakePair( key, created ) );
+  // 最近使用していないものから破棄する
+  while ( mEntries.count() > mMaxEntries )
+  {
+    QgsDebugMsgLevel( QStringLiteral( "DM transform cache %1 evicted (%2 bytes)" ).arg( mEntries.last().first ).arg( mEntries.last().second->bytesAllocated() ), 2 );
+    mEntries.removeLast();
+  }
+  return created;
+}
+
+int QgsDmTransformCache::entryCount() const
+{
+  QMutexLocker locker( &mMutex );
+  return mEntries.count();
+}
+
+void QgsDmTransformCache::clear()
+{
+  QMutexLocker locker( &mMutex );
+  mEntries.clear();
+}
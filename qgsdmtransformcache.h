@@ -0,0 +1,96 @@
+/***************************************************************************
+    qgsdmtransformcache.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef QGSDMTRANSFORMCACHE_H
+#define QGSDMTRANSFORMCACHE_H
+
+#include <QList>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <QVector>
+#include <memory>
+
+#include "qgscoordinatereferencesystem.h"
+#include "qgscoordinatetransform.h"
+#include "qgsdmparser.h"
+
+/**
+ * \class QgsDmTransformCache
+ * \brief Keeps the line and polygon coordinates transformed to the destination CRS of recent requests.
+ *
+ * A DM layer shown in another CRS (e.g. JGD2011 plane rectangular data on a
+ * Web Mercator map) transforms the same coordinates again on every refresh.
+ * With transformCache=yes the feature iterator stores the coordinates it has
+ * transformed in an entry per coordinate transform (source and destination
+ * CRS and the coordinate operation chosen by the transform context) and
+ * level of detail, and later iterators take them from there.  Entries are
+ * filled as features are fetched; once more than maxEntries exist the least
+ * recently used one is dropped.  Iterators hold a shared pointer to their entry, so an entry
+ * dropped while in use stays valid until the iterator is destroyed.
+ *
+ * The cache is shared by the provider and its feature sources and is thread safe.
+ */
+class QgsDmTransformCache
+{
+  public:
+
+    static const int DEFAULT_MAX_ENTRIES = 4;
+
+    /**
+     * Transformed coordinates of every element for one destination CRS and level of detail.
+     */
+    class Entry
+    {
+      public:
+        explicit Entry( int elementCount );
+
+        Entry( const Entry & ) = delete;
+        Entry &operator=( const Entry & ) = delete;
+
+        //! Returns the number of elements of the layer when the entry was created.
+        int elementCount() const { return mCoords.count(); }
+
+        //! Returns the transformed coordinates of element \a index, empty if they are not stored yet.
+        DmCoords coords( int index ) const;
+
+        //! Stores \a count transformed \a points of element \a index and returns the stored copy.
+        DmCoords insert( int index, const Point2d *points, int count );
+
+        //! Returns the number of bytes used by the stored coordinates.
+        qint64 bytesAllocated() const;
+
+      private:
+        mutable QMutex mMutex;
+        QVector< DmCoords > mCoords;
+        DmArena mArena;
+    };
+
+    explicit QgsDmTransformCache( int maxEntries = DEFAULT_MAX_ENTRIES );
+
+    /**
+     * Returns the entry for the source and destination CRS and coordinate operation of
+     * \a transform and level of detail \a level, creating it if needed.
+     * An entry created for a different number of elements is replaced.
+     */
+    std::shared_ptr< Entry > entry( const QgsCoordinateTransform &transform, int level, int elementCount );
+
+    //! Returns the number of entries.
+    int entryCount() const;
+
+    //! Drops all entries (the elements have been read again).
+    void clear();
+
+  private:
+
+    int mMaxEntries = DEFAULT_MAX_ENTRIES;
+
+    mutable QMutex mMutex;
+    // 座標変換と詳細度のキーと座標列（先頭が最新）
+    QList< QPair< QString, std::shared_ptr< Entry > > > mEntries;
+};
+
+#endif // QGSDMTRANSFORMCACHE_H
@@ -0,0 +1,80 @@
+/***************************************************************************
+    dmtestutils.h
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+#ifndef DMTESTUTILS_H
+#define DMTESTUTILS_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+namespace DmTest
+{
+  //! Returns \a value right-aligned in a field of \a width columns.
+  inline QByteArray number( qint64 value, int width )
+  {
+    return QByteArray::number( value ).rightJustified( width, ' ' );
+  }
+
+  //! Returns a fixed-length record of \a recordType with the (column, text) \a fields set.
+  inline QByteArray record( const char *recordType, const QList< QPair< int, QByteArray > > &fields = QList< QPair< int, QByteArray > >() )
+  {
+    QByteArray line( 84, ' ' );
+    line.replace( 0, 2, recordType );
+    for ( const QPair< int, QByteArray > &field : fields )
+      line.replace( field.first, field.second.size(), field.second );
+    return line;
+  }
+
+  /**
+   * Returns the index, mesh and group header records of one level 500 mesh.
+   * The mesh origin is (0, 0), its size is 400 m x 300 m and the element
+   * coordinates are in millimeters. \a elementCounts holds the E1 to E7
+   * element counts of the group header record.
+   */
+  inline QList<QByteArray> meshRecords( const QList<int> &elementCounts )
+  {
+    QList<QByteArray> records;
+    // インデックスレコード
+    records << record( "I ", { { 37, number( 1, 2 ) } } )
+            << record( "  ", { { 0, number( 0, 8 ) } } );
+    // 図郭レコード(a)～(e)
+    records << record( "M ", { { 2, number( 0, 8 ) }, { 30, number( 500, 5 ) }, { 65, number( 0, 2 ) } } )
+            << record( "  ", { { 0, number( 0, 7 ) }, { 7, number( 0, 7 ) }, { 14, number( 300, 7 ) }, { 21, number( 400, 7 ) }, { 44, number( 1, 3 ) } } )
+            << record( "  " )
+            << record( "  ", { { 0, number( 0, 2 ) }, { 9, number( 0, 1 ) } } )
+            << record( "  ", { { 40, number( 0, 4 ) }, { 44, number( 0, 4 ) }, { 48, number( 0, 4 ) }, { 52, number( 0, 4 ) } } );
+    // グループヘッダレコード
+    int total = 0;
+    QList< QPair< int, QByteArray > > fields;
+    for ( int i = 0; i < elementCounts.count(); i++ )
+    {
+      total += elementCounts.at( i );
+      fields << qMakePair( 28 + i * 5, number( elementCounts.at( i ), 5 ) );
+    }
+    fields << qMakePair( 16, number( 0, 2 ) ) << qMakePair( 18, number( total, 5 ) ) << qMakePair( 23, number( 0, 5 ) );
+    records << record( "H ", fields );
+    return records;
+  }
+
+  //! Writes \a records to \a filePath, one CRLF terminated line each.
+  inline bool writeFile( const QString &filePath, const QList<QByteArray> &records )
+  {
+    QFile file( filePath );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+      return false;
+    for ( const QByteArray &line : records )
+    {
+      if ( file.write( line + "\r\n" ) != line.size() + 2 )
+        return false;
+    }
+    return true;
+  }
+}
+
+#endif // DMTESTUTILS_H
@@ -0,0 +1,79 @@
+/***************************************************************************
+    testqgsdmparser.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// DM解析ライブラリ（dmparser）のテスト
+
+#include "dmtestutils.h"
+
+#include "qgsdmparser.h"
+
+#include <QTemporaryDir>
+#include <QtTest/QtTest>
+
+class TestQgsDmParser : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void coords3d_data();
+    void coords3d();
+};
+
+void TestQgsDmParser::coords3d_data()
+{
+  QTest::addColumn<int>( "pointCount" );
+
+  // 3次元の座標は1レコードに4点
+  QTest::newRow( "one record" ) << 4;
+  QTest::newRow( "two records" ) << 6;
+  QTest::newRow( "three records" ) << 9;
+}
+
+void TestQgsDmParser::coords3d()
+{
+  QFETCH( int, pointCount );
+
+  QTemporaryDir tempDir;
+  QVERIFY( tempDir.isValid() );
+
+  // 線1件（3次元）。i番目の頂点は(i+1, 2(i+1))m、標高は(i+1)m
+  const int recordCount = ( pointCount + 3 ) / 4;
+  QList<QByteArray> records = DmTest::meshRecords( { 0, 1, 0, 0, 0, 0, 0 } );
+  records << DmTest::record( "E2", { { 2, "2101" }, { 18, DmTest::number( 1, 2 ) }, { 20, "3" }, { 24, DmTest::number( 0, 2 ) }, { 26, "0" },
+    { 27, DmTest::number( pointCount, 4 ) }, { 31, DmTest::number( recordCount, 4 ) } } );
+  QList< QPair< int, QByteArray > > fields;
+  for ( int i = 0; i < pointCount; i++ )
+  {
+    const int start = ( i % 4 ) * 21;
+    fields << qMakePair( start, DmTest::number( 2000 * ( i + 1 ), 7 ) )
+           << qMakePair( start + 7, DmTest::number( 1000 * ( i + 1 ), 7 ) )
+           << qMakePair( start + 14, DmTest::number( 1000 * ( i + 1 ), 7 ) );
+    if ( i % 4 == 3 || i == pointCount - 1 )
+    {
+      records << DmTest::record( "  ", fields );
+      fields.clear();
+    }
+  }
+  const QString filePath = tempDir.filePath( QStringLiteral( "0000.dm" ) );
+  QVERIFY( DmTest::writeFile( filePath, records ) );
+
+  DmReader reader;
+  reader.setDataType( QStringLiteral( "dm_pl" ) );
+  QVERIFY( reader.readFile( filePath ) );
+  QCOMPARE( reader.lines().count(), 1 );
+
+  const DmCoords points = reader.lines().at( 0 ).points();
+  QCOMPARE( points.count(), pointCount );
+  for ( int i = 0; i < pointCount; i++ )
+  {
+    QCOMPARE( points.at( i ).x(), 1.0 * ( i + 1 ) );
+    QCOMPARE( points.at( i ).y(), 2.0 * ( i + 1 ) );
+  }
+}
+
+QTEST_GUILESS_MAIN( TestQgsDmParser )
+#include "testqgsdmparser.moc"
@@ -0,0 +1,178 @@
+/***************************************************************************
+    testqgsdmprovider.cpp
+    ---------------------
+    begin                : March 2021
+    copyright            : orbitalnet.imc
+ ***************************************************************************/
+
+// DMプロバイダのテスト
+//
+// テストデータは小さなDMファイルをテストごとに一時ディレクトリに作成する。
+
+#include "dmtestutils.h"
+
+#include "qgsapplication.h"
+#include "qgsdmprovider.h"
+#include "qgsfeatureiterator.h"
+#include "qgsfeaturerequest.h"
+
+#include <QTemporaryDir>
+#include <QUrlQuery>
+#include <QtTest/QtTest>
+
+class TestQgsDmProvider : public QObject
+{
+    Q_OBJECT
+
+  private slots:
+    void initTestCase();
+
+    void noteTextFilter_data();
+    void noteTextFilter();
+    void attributeFields_data();
+    void attributeFields();
+
+  private:
+    QString uri( const QString &dataType, const QString &options = QString() ) const;
+    static QByteArray noteHeader( int length, int x, int y );
+    static QList<QByteArray> attributeRecords( int code, const QByteArray &value );
+
+    QTemporaryDir mTempDir;
+};
+
+void TestQgsDmProvider::initTestCase()
+{
+  QVERIFY( mTempDir.isValid() );
+
+  QList<QByteArray> records = DmTest::meshRecords( { 0, 0, 0, 0, 2, 0, 4 } );
+
+  // 属性レコード付きの点2件（属性コード1は整数と実数、2は文字列）
+  const QByteArray pointHeader = DmTest::record( "E5", { { 2, "5101" }, { 18, DmTest::number( 1, 2 ) }, { 20, "2" }, { 24, DmTest::number( 0, 2 ) }, { 26, "0" },
+    { 27, DmTest::number( 0, 4 ) }, { 31, DmTest::number( 0, 4 ) }, { 35, DmTest::number( 10000, 7 ) }, { 42, DmTest::number( 10000, 7 ) } } );
+  records << pointHeader << attributeRecords( 1, "12" ) << attributeRecords( 2, "abc" )
+          << pointHeader << attributeRecords( 1, "1.5" );
+
+  // 注記3件と、縦横区分が数値でないため取込に失敗する注記1件
+  const QByteArray texts[] = { "ABC", "ABC", "DEF" };
+  int x = 10000;
+  for ( const QByteArray &text : texts )
+  {
+    records << noteHeader( text.size(), x, 10000 )
+            << DmTest::record( "  ", { { 0, "0" }, { 1, DmTest::number( 0, 7 ) }, { 8, DmTest::number( 30, 5 ) }, { 20, text } } );
+    x += 10000;
+  }
+  records << noteHeader( 3, x, 10000 )
+          << DmTest::record( "  ", { { 0, "X" }, { 1, DmTest::number( 0, 7 ) }, { 8, DmTest::number( 30, 5 ) }, { 20, "GHI" } } );
+
+  QVERIFY( DmTest::writeFile( mTempDir.filePath( QStringLiteral( "0000.dm" ) ), records ) );
+}
+
+QString TestQgsDmProvider::uri( const QString &dataType, const QString &options ) const
+{
+  QUrl url = QUrl::fromLocalFile( mTempDir.path() );
+  QUrlQuery query;
+  query.addQueryItem( QStringLiteral( "dataType" ), dataType );
+  query.addQueryItem( QStringLiteral( "quiet" ), QStringLiteral( "yes" ) );
+  if ( !options.isEmpty() )
+    query.addQueryItem( options.section( '=', 0, 0 ), options.section( '=', 1 ) );
+  url.setQuery( query );
+  return QString::fromLatin1( url.toEncoded() );
+}
+
+QByteArray TestQgsDmProvider::noteHeader( int length, int x, int y )
+{
+  // 半角の注記、1レコード
+  return DmTest::record( "E7", { { 2, "7101" }, { 18, DmTest::number( 1, 2 ) }, { 20, "2" }, { 23, "2" }, { 24, DmTest::number( 0, 2 ) },
+    { 27, DmTest::number( length, 4 ) }, { 31, DmTest::number( 1, 4 ) }, { 35, DmTest::number( y, 7 ) }, { 42, DmTest::number( x, 7 ) } } );
+}
+
+QList<QByteArray> TestQgsDmProvider::attributeRecords( int code, const QByteArray &value )
+{
+  return QList<QByteArray>()
+         << DmTest::record( "E8", { { 2, DmTest::number( code, 4 ) }, { 27, DmTest::number( value.size(), 4 ) }, { 31, DmTest::number( 1, 4 ) } } )
+         << DmTest::record( "  ", { { 20, value } } );
+}
+
+void TestQgsDmProvider::noteTextFilter_data()
+{
+  QTest::addColumn<QString>( "expression" );
+  QTest::addColumn<int>( "count" );
+
+  QTest::newRow( "repeated text" ) << QStringLiteral( "\"vtext\" = 'ABC'" ) << 2;
+  QTest::newRow( "single text" ) << QStringLiteral( "\"vtext\" = 'DEF'" ) << 1;
+  // 取込に失敗した注記の文字列は文字列プールにない
+  QTest::newRow( "text of malformed note" ) << QStringLiteral( "\"vtext\" = 'GHI'" ) << 0;
+  QTest::newRow( "unknown text" ) << QStringLiteral( "\"vtext\" = 'XYZ'" ) << 0;
+  QTest::newRow( "empty text" ) << QStringLiteral( "\"vtext\" = ''" ) << 0;
+  // 式として評価される条件
+  QTest::newRow( "malformed note" ) << QStringLiteral( "\"vtext\" IS NULL" ) << 1;
+}
+
+void TestQgsDmProvider::noteTextFilter()
+{
+  QFETCH( QString, expression );
+  QFETCH( int, count );
+
+  QgsDmProvider provider( uri( QStringLiteral( "dm_tx" ) ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+  QCOMPARE( provider.featureCount(), 4L );
+
+  QgsFeatureIterator it = provider.getFeatures( QgsFeatureRequest().setFilterExpression( expression ) );
+  QgsFeature feature;
+  int features = 0;
+  while ( it.nextFeature( feature ) )
+    features++;
+  QCOMPARE( features, count );
+}
+
+void TestQgsDmProvider::attributeFields_data()
+{
+  QTest::addColumn<QString>( "options" );
+
+  QTest::newRow( "read on open" ) << QString();
+  // ヘッダのみ読み込んだ時点で要素の読込後と同じフィールドとなる
+  QTest::newRow( "fast open" ) << QStringLiteral( "fastOpen=yes" );
+}
+
+void TestQgsDmProvider::attributeFields()
+{
+  QFETCH( QString, options );
+
+  QgsDmProvider provider( uri( QStringLiteral( "dm_pt" ), options ), QgsDataProvider::ProviderOptions() );
+  QVERIFY( provider.isValid() );
+
+  const QgsFields fields = provider.fields();
+  const int integerOrDouble = fields.indexFromName( QStringLiteral( "attr_0001" ) );
+  const int string = fields.indexFromName( QStringLiteral( "attr_0002" ) );
+  QVERIFY( integerOrDouble >= 0 );
+  QVERIFY( string >= 0 );
+  QCOMPARE( fields.at( integerOrDouble ).type(), QVariant::Double );
+  QCOMPARE( fields.at( string ).type(), QVariant::String );
+
+  QgsFeatureIterator it = provider.getFeatures( QgsFeatureRequest() );
+  QgsFeature feature;
+  QVERIFY( it.nextFeature( feature ) );
+  QCOMPARE( feature.attribute( integerOrDouble ).toDouble(), 12.0 );
+  QCOMPARE( feature.attribute( string ).toString(), QStringLiteral( "abc" ) );
+  QVERIFY( it.nextFeature( feature ) );
+  QCOMPARE( feature.attribute( integerOrDouble ).toDouble(), 1.5 );
+  QVERIFY( feature.attribute( string ).isNull() );
+
+  // 要素の読込後もフィールドは変わらない
+  QCOMPARE( provider.fields(), fields );
+}
+
+int main( int argc, char *argv[] )
+{
+  QgsApplication app( argc, argv, false );
+  QgsApplication::init();
+  QgsApplication::initQgis();
+
+  TestQgsDmProvider test;
+  int result = QTest::qExec( &test, argc, argv );
+
+  QgsApplication::exitQgis();
+  return result;
+}
+
+#include "testqgsdmprovider.moc"